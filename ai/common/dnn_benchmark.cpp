@@ -0,0 +1,166 @@
+#include "dnn_benchmark.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <glog/logging.h>
+#include <sstream>
+
+using namespace std;
+using namespace cv;
+using namespace cv::dnn;
+
+bool setBackendMode(Net& net, const string& mode)
+{
+    if (mode == "cpu") {
+        LOG(INFO) << "use CPU backend";
+        net.setPreferableBackend(DNN_BACKEND_DEFAULT);
+        net.setPreferableTarget(DNN_TARGET_CPU);
+    } else if (mode == "gpu") {
+        LOG(INFO) << "use GPU backend";
+        net.setPreferableBackend(DNN_BACKEND_CUDA);
+        net.setPreferableTarget(DNN_TARGET_CUDA);
+    } else if (mode == "cpuie") {
+        LOG(INFO) << "use CPUIE backend";
+        net.setPreferableBackend(DNN_BACKEND_INFERENCE_ENGINE);
+        net.setPreferableTarget(DNN_TARGET_CPU);
+    } else {
+        LOG(ERROR) << "Unknown mode " << mode;
+        return false;
+    }
+    return true;
+}
+
+vector<BackendTarget> availableBackendTargets()
+{
+    struct Candidate {
+        const char* name;
+        Backend backend;
+        Target target;
+    };
+    const Candidate candidates[] = {
+        { "opencv/cpu", DNN_BACKEND_OPENCV, DNN_TARGET_CPU },
+        { "opencv/opencl_fp16", DNN_BACKEND_OPENCV, DNN_TARGET_OPENCL_FP16 },
+        { "ie/cpu", DNN_BACKEND_INFERENCE_ENGINE, DNN_TARGET_CPU },
+        { "ie/opencl_fp16", DNN_BACKEND_INFERENCE_ENGINE, DNN_TARGET_OPENCL_FP16 },
+        { "ie/myriad", DNN_BACKEND_INFERENCE_ENGINE, DNN_TARGET_MYRIAD },
+    };
+    vector<BackendTarget> configs;
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+        vector<Target> targets = getAvailableTargets(candidates[i].backend);
+        if (find(targets.begin(), targets.end(), candidates[i].target) != targets.end())
+            configs.push_back(BackendTarget{ candidates[i].name, candidates[i].backend, candidates[i].target });
+    }
+    return configs;
+}
+
+static string jsonString(const string& s)
+{
+    string out = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+        char c = s[i];
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if ((unsigned char)c < 0x20)
+            out += format("\\u%04x", c);
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+static double percentileOf(vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    size_t k = min(values.size() - 1, (size_t)(p * values.size()));
+    nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+// One configuration as a JSON object
+static string benchmarkConfig(Net& net, const BackendTarget& config, const vector<Mat>& frames,
+    const function<void(Net&, const Mat&)>& infer, const BenchmarkOptions& options)
+{
+    ostringstream json;
+    json << "{\"name\": " << jsonString(config.name) << ", \"backend\": " << config.backend
+         << ", \"target\": " << config.target;
+    try {
+        net.setPreferableBackend(config.backend);
+        net.setPreferableTarget(config.target);
+        for (int i = 0; i < options.warmup; ++i)
+            infer(net, frames[i % frames.size()]);
+
+        vector<String> names = net.getLayerNames();
+        vector<double> layerTicks(names.size(), 0);
+        vector<double> latencies;
+        vector<double> timings;
+        double forwardTicks = 0;
+        double total = 0;
+        for (int i = 0; i < options.frames; ++i) {
+            double t = (double)getTickCount();
+            infer(net, frames[i % frames.size()]);
+            t = ((double)getTickCount() - t) / getTickFrequency();
+            total += t;
+            latencies.push_back(t);
+            forwardTicks += (double)net.getPerfProfile(timings);
+            for (size_t l = 0; l < timings.size() && l < layerTicks.size(); ++l)
+                layerTicks[l] += timings[l];
+        }
+
+        double sum = 0;
+        for (size_t i = 0; i < latencies.size(); ++i)
+            sum += latencies[i];
+        double toMs = 1000.0 / getTickFrequency() / max(1, options.frames);
+        json << ", \"frames\": " << options.frames << ", \"fps\": " << options.frames / max(total, 1e-9)
+             << ", \"latency_ms\": {\"mean\": " << sum / max<size_t>(1, latencies.size()) * 1000
+             << ", \"p50\": " << percentileOf(latencies, 0.5) * 1000
+             << ", \"p99\": " << percentileOf(latencies, 0.99) * 1000 << "}"
+             << ", \"forward_ms\": " << forwardTicks * toMs << ", \"layers\": [";
+
+        vector<size_t> order;
+        for (size_t l = 0; l < layerTicks.size(); ++l)
+            order.push_back(l);
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return layerTicks[a] > layerTicks[b]; });
+        for (size_t i = 0; i < order.size(); ++i) {
+            int id = net.getLayerId(names[order[i]]);
+            json << (i ? ", " : "") << "{\"name\": " << jsonString(names[order[i]]) << ", \"type\": "
+                 << jsonString(net.getLayer(id)->type) << ", \"ms\": " << layerTicks[order[i]] * toMs << "}";
+        }
+        json << "]";
+        LOG(INFO) << config.name << ": " << options.frames / max(total, 1e-9) << " fps, p99 "
+                  << percentileOf(latencies, 0.99) * 1000 << " ms";
+    } catch (const cv::Exception& e) {
+        LOG(WARNING) << config.name << ": " << e.what();
+        json << ", \"error\": " << jsonString(e.what());
+    }
+    json << "}";
+    return json.str();
+}
+
+string benchmarkNet(const string& model, Net& net, const vector<Mat>& frames,
+    const function<void(Net&, const Mat&)>& infer, const BenchmarkOptions& options)
+{
+    CV_Assert(!frames.empty() && options.frames > 0);
+    ostringstream json;
+    json << "{\"model\": " << jsonString(model) << ", \"warmup\": " << options.warmup << ", \"configs\": [";
+    for (size_t i = 0; i < options.configs.size(); ++i)
+        json << (i ? ",\n  " : "\n  ") << benchmarkConfig(net, options.configs[i], frames, infer, options);
+    json << "\n]}\n";
+    return json.str();
+}
+
+bool writeBenchmark(const string& json, const string& path)
+{
+    if (path.empty()) {
+        cout << json;
+        return true;
+    }
+    ofstream out(path.c_str());
+    out << json;
+    if (!out) {
+        LOG(ERROR) << "Unable to write " << path;
+        return false;
+    }
+    LOG(INFO) << "benchmark written to " << path;
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef DNN_BENCHMARK_H
+#define DNN_BENCHMARK_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+
+struct BackendTarget {
+    std::string name;
+    int backend;
+    int target;
+};
+
+// --mode of the samples: cpu (OpenCV), cpuie (Inference Engine on the CPU)
+// or gpu (CUDA). False for anything else.
+bool setBackendMode(cv::dnn::Net& net, const std::string& mode);
+
+// The OpenCV and Inference Engine backends on the CPU, plus their FP16
+// targets (OpenCL FP16, MYRIAD) where this build and machine have them:
+// OpenCV has no FP16 CPU target.
+std::vector<BackendTarget> availableBackendTargets();
+
+struct BenchmarkOptions {
+    int warmup = 5; // frames run before timing
+    int frames = 100; // frames timed, the inputs are reused in turn
+    std::vector<BackendTarget> configs;
+};
+
+// Runs infer (preprocessing and forward, what one frame costs) over the
+// frames with every backend/target of options, and returns the results as
+// JSON: per configuration fps, latency mean/p50/p99, forward time and the
+// mean time of each layer from getPerfProfile, slowest first. A
+// configuration that fails to run gets an "error" instead.
+std::string benchmarkNet(const std::string& model, cv::dnn::Net& net, const std::vector<cv::Mat>& frames,
+    const std::function<void(cv::dnn::Net&, const cv::Mat&)>& infer, const BenchmarkOptions& options);
+
+// To path, or stdout if it is empty
+bool writeBenchmark(const std::string& json, const std::string& path);
+
+#endif
@@ -0,0 +1,115 @@
+#include "detection_tracker.h"
+#include <algorithm>
+#include <glog/logging.h>
+
+using namespace std;
+using namespace cv;
+
+double overlap(const Rect2d& a, const Rect2d& b)
+{
+    double inter = (a & b).area();
+    double uni = a.area() + b.area() - inter;
+    return uni > 0 ? inter / uni : 0;
+}
+
+DetectionTracker::DetectionTracker(const string& type, double matchIou)
+    : type_(type)
+    , matchIou_(matchIou)
+{
+    CV_Assert(!createTracker().empty());
+}
+
+Ptr<Tracker> DetectionTracker::createTracker() const
+{
+    // The same types as the tracking sample
+    if (type_ == "KCF")
+        return TrackerKCF::create();
+    if (type_ == "MOSSE")
+        return TrackerMOSSE::create();
+    if (type_ == "CSRT")
+        return TrackerCSRT::create();
+    if (type_ == "MEDIANFLOW")
+        return TrackerMedianFlow::create();
+    if (type_ == "MIL")
+        return TrackerMIL::create();
+    if (type_ == "BOOSTING")
+        return TrackerBoosting::create();
+    LOG(ERROR) << "Unknown tracker type " << type_;
+    return Ptr<Tracker>();
+}
+
+// A tracker can only be initialized once, so a new one per detection
+void DetectionTracker::start(Track& track, const Mat& frame, const Detection& detection)
+{
+    track.classId = detection.classId;
+    track.score = detection.score;
+    track.box = Rect2d(detection.box);
+    track.framesTracked = 0;
+    track.tracker = createTracker();
+    track.tracker->init(frame, track.box);
+}
+
+void DetectionTracker::update(const Mat& frame, const vector<Detection>& detections)
+{
+    struct Match {
+        double iou;
+        size_t track;
+        size_t detection;
+    };
+    vector<Match> candidates;
+    for (size_t t = 0; t < tracks_.size(); ++t) {
+        for (size_t d = 0; d < detections.size(); ++d) {
+            if (tracks_[t].classId != detections[d].classId)
+                continue;
+            double iou = overlap(tracks_[t].box, Rect2d(detections[d].box));
+            if (iou >= matchIou_)
+                candidates.push_back(Match{ iou, t, d });
+        }
+    }
+    sort(candidates.begin(), candidates.end(), [](const Match& a, const Match& b) { return a.iou > b.iou; });
+
+    vector<int> trackOf(detections.size(), -1);
+    vector<bool> matched(tracks_.size(), false);
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        const Match& m = candidates[i];
+        if (matched[m.track] || trackOf[m.detection] != -1)
+            continue;
+        matched[m.track] = true;
+        trackOf[m.detection] = (int)m.track;
+    }
+
+    vector<Track> next;
+    next.reserve(detections.size());
+    for (size_t d = 0; d < detections.size(); ++d) {
+        Track track;
+        track.id = trackOf[d] != -1 ? tracks_[trackOf[d]].id : nextId_++;
+        start(track, frame, detections[d]);
+        next.push_back(track);
+    }
+    tracks_.swap(next);
+}
+
+void DetectionTracker::track(const Mat& frame)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < tracks_.size(); ++i) {
+        Track& track = tracks_[i];
+        if (!track.tracker->update(frame, track.box))
+            continue;
+        track.framesTracked++;
+        if (n != i)
+            tracks_[n] = track;
+        n++;
+    }
+    tracks_.resize(n);
+}
+
+vector<Detection> DetectionTracker::detections() const
+{
+    vector<Detection> result;
+    for (size_t i = 0; i < tracks_.size(); ++i) {
+        const Track& track = tracks_[i];
+        result.push_back(Detection{ track.classId, track.score, Rect(track.box) });
+    }
+    return result;
+}
@@ -0,0 +1,53 @@
+#ifndef DETECTION_TRACKER_H
+#define DETECTION_TRACKER_H
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/tracking.hpp>
+
+struct Detection {
+    int classId;
+    float score;
+    cv::Rect box;
+};
+
+struct Track {
+    int id;
+    int classId;
+    float score; // of the detection the track was last matched to
+    cv::Rect2d box;
+    int framesTracked; // since that detection
+    cv::Ptr<cv::Tracker> tracker;
+};
+
+// Carries detections over the frames between two detection passes with a
+// single object tracker per box. A detection pass re-associates: each
+// detection takes over the track of the same class it overlaps most (greedy,
+// best overlap first, at least matchIou), unmatched detections start new
+// tracks and tracks left without a detection end.
+class DetectionTracker {
+public:
+    // type: KCF or MOSSE (or any other tracker the tracking module has)
+    explicit DetectionTracker(const std::string& type, double matchIou = 0.3);
+
+    void update(const cv::Mat& frame, const std::vector<Detection>& detections);
+    // Moves every track to this frame, drops those the tracker lost
+    void track(const cv::Mat& frame);
+
+    const std::vector<Track>& tracks() const { return tracks_; }
+    std::vector<Detection> detections() const;
+
+private:
+    cv::Ptr<cv::Tracker> createTracker() const;
+    void start(Track& track, const cv::Mat& frame, const Detection& detection);
+
+    std::string type_;
+    double matchIou_;
+    int nextId_ = 0;
+    std::vector<Track> tracks_;
+};
+
+double overlap(const cv::Rect2d& a, const cv::Rect2d& b);
+
+#endif
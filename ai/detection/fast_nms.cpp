@@ -0,0 +1,236 @@
+#include "fast_nms.h"
+#include <algorithm>
+#include <cmath>
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Float overlaps further than this from the threshold decide on their own
+static const float kOverlapMargin = 1e-4f;
+
+// The overlap of two boxes as NMSBoxes computes it
+static float rectOverlap(const YoloBoxes& boxes, int i, int j)
+{
+    Rect a(boxes.left[i], boxes.top[i], boxes.width[i], boxes.height[i]);
+    Rect b(boxes.left[j], boxes.top[j], boxes.width[j], boxes.height[j]);
+    return 1.f - static_cast<float>(jaccardDistance(a, b));
+}
+
+// Best score first, lower index first on ties: the order stable_sort gives
+// NMSBoxes
+static bool betterCandidate(const pair<float, int>& a, const pair<float, int>& b)
+{
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+void FastNMS::Candidates::reserve(size_t n)
+{
+    if (index.size() >= n)
+        return;
+    x1.resize(n);
+    y1.resize(n);
+    x2.resize(n);
+    y2.resize(n);
+    area.resize(n);
+    score.resize(n);
+    index.resize(n);
+}
+
+void FastNMS::Candidates::assign(size_t i, const YoloBoxes& boxes, int idx, float s)
+{
+    x1[i] = (float)boxes.left[idx];
+    y1[i] = (float)boxes.top[idx];
+    x2[i] = (float)boxes.left[idx] + boxes.width[idx];
+    y2[i] = (float)boxes.top[idx] + boxes.height[idx];
+    area[i] = (float)boxes.width[idx] * boxes.height[idx];
+    score[i] = s;
+    index[i] = idx;
+}
+
+void FastNMS::run(const YoloBoxes& boxes, const NmsParams& params, vector<int>& indices, vector<float>* scores)
+{
+    indices.clear();
+    if (scores)
+        scores->clear();
+    if (!boxes.count)
+        return;
+    kept_.reserve(boxes.count);
+    remaining_.reserve(boxes.count);
+
+    if (!params.classAware) {
+        byClass_.resize(boxes.count);
+        for (size_t i = 0; i < boxes.count; ++i)
+            byClass_[i] = (int)i;
+        select(boxes, byClass_.data(), boxes.count, params);
+        if (params.softSigma > 0)
+            softNMS(boxes, params, indices, scores);
+        else
+            hardNMS(boxes, params, indices, scores);
+        return;
+    }
+
+    // Counting sort by class, indices stay in increasing order within a class
+    int classes = 1 + *max_element(boxes.classId.begin(), boxes.classId.begin() + boxes.count);
+    classStart_.assign(classes + 1, 0);
+    for (size_t i = 0; i < boxes.count; ++i)
+        classStart_[boxes.classId[i] + 1]++;
+    for (int c = 0; c < classes; ++c)
+        classStart_[c + 1] += classStart_[c];
+    byClass_.resize(boxes.count);
+    for (size_t i = 0; i < boxes.count; ++i)
+        byClass_[classStart_[boxes.classId[i]]++] = (int)i;
+    for (int c = classes; c > 0; --c)
+        classStart_[c] = classStart_[c - 1];
+    classStart_[0] = 0;
+
+    for (int c = 0; c < classes; ++c) {
+        size_t n = classStart_[c + 1] - classStart_[c];
+        if (!n)
+            continue;
+        select(boxes, byClass_.data() + classStart_[c], n, params);
+        if (params.softSigma > 0)
+            softNMS(boxes, params, indices, scores);
+        else
+            hardNMS(boxes, params, indices, scores);
+    }
+}
+
+// The candidates above the score threshold, best first, topK of them
+void FastNMS::select(const YoloBoxes& boxes, const int* ids, size_t n, const NmsParams& params)
+{
+    order_.clear();
+    for (size_t i = 0; i < n; ++i) {
+        float score = boxes.score[ids[i]];
+        if (score > params.scoreThreshold)
+            order_.push_back(make_pair(score, ids[i]));
+    }
+    if (params.topK > 0 && params.topK < (int)order_.size()) {
+        nth_element(order_.begin(), order_.begin() + params.topK, order_.end(), betterCandidate);
+        order_.resize(params.topK);
+    }
+    sort(order_.begin(), order_.end(), betterCandidate);
+}
+
+bool FastNMS::overlapsKept(const YoloBoxes& boxes, int index, float threshold) const
+{
+    const Candidates& k = kept_;
+    float x1 = (float)boxes.left[index];
+    float y1 = (float)boxes.top[index];
+    float x2 = x1 + boxes.width[index];
+    float y2 = y1 + boxes.height[index];
+    float area = (float)boxes.width[index] * boxes.height[index];
+    size_t i = 0;
+#if CV_SIMD
+    const int lanes = v_float32::nlanes;
+    const int allLanes = (1 << lanes) - 1;
+    v_float32 vx1 = vx_setall_f32(x1), vy1 = vx_setall_f32(y1);
+    v_float32 vx2 = vx_setall_f32(x2), vy2 = vx_setall_f32(y2);
+    v_float32 varea = vx_setall_f32(area), zero = vx_setzero_f32();
+    v_float32 above = vx_setall_f32(threshold + kOverlapMargin);
+    v_float32 below = vx_setall_f32(threshold - kOverlapMargin);
+    for (; i + lanes <= k.count; i += lanes) {
+        v_float32 w = v_max(v_min(vx2, vx_load(&k.x2[i])) - v_max(vx1, vx_load(&k.x1[i])), zero);
+        v_float32 h = v_max(v_min(vy2, vx_load(&k.y2[i])) - v_max(vy1, vx_load(&k.y1[i])), zero);
+        v_float32 inter = w * h;
+        v_float32 overlap = inter / (varea + vx_load(&k.area[i]) - inter);
+        if (v_check_any(overlap > above))
+            return true;
+        // Close to the threshold, or no area at all
+        int unsure = allLanes & ~v_signmask(overlap < below);
+        for (int lane = 0; unsure; ++lane, unsure >>= 1)
+            if ((unsure & 1) && rectOverlap(boxes, index, k.index[i + lane]) > threshold)
+                return true;
+    }
+#endif
+    for (; i < k.count; ++i)
+        if (rectOverlap(boxes, index, k.index[i]) > threshold)
+            return true;
+    return false;
+}
+
+void FastNMS::hardNMS(const YoloBoxes& boxes, const NmsParams& params, vector<int>& indices, vector<float>* scores)
+{
+    float threshold = params.nmsThreshold;
+    kept_.count = 0;
+    for (size_t i = 0; i < order_.size(); ++i) {
+        int idx = order_[i].second;
+        if (overlapsKept(boxes, idx, threshold))
+            continue;
+        kept_.assign(kept_.count++, boxes, idx, order_[i].first);
+        indices.push_back(idx);
+        if (scores)
+            scores->push_back(order_[i].first);
+        if (params.eta < 1 && threshold > 0.5f)
+            threshold *= params.eta;
+    }
+}
+
+// Picks the best remaining box, decays the scores of the others by their
+// overlap with it and drops those no longer above the threshold
+void FastNMS::softNMS(const YoloBoxes& boxes, const NmsParams& params, vector<int>& indices, vector<float>* scores)
+{
+    Candidates& r = remaining_;
+    r.count = order_.size();
+    for (size_t i = 0; i < r.count; ++i)
+        r.assign(i, boxes, order_[i].second, order_[i].first);
+    overlaps_.resize(r.count);
+
+    while (r.count) {
+        size_t best = 0;
+        for (size_t i = 1; i < r.count; ++i)
+            if (betterCandidate(make_pair(r.score[i], r.index[i]), make_pair(r.score[best], r.index[best])))
+                best = i;
+        indices.push_back(r.index[best]);
+        if (scores)
+            scores->push_back(r.score[best]);
+        float x1 = r.x1[best], y1 = r.y1[best], x2 = r.x2[best], y2 = r.y2[best], area = r.area[best];
+
+        size_t last = --r.count;
+        r.x1[best] = r.x1[last];
+        r.y1[best] = r.y1[last];
+        r.x2[best] = r.x2[last];
+        r.y2[best] = r.y2[last];
+        r.area[best] = r.area[last];
+        r.score[best] = r.score[last];
+        r.index[best] = r.index[last];
+
+        size_t i = 0;
+#if CV_SIMD
+        const int lanes = v_float32::nlanes;
+        v_float32 vx1 = vx_setall_f32(x1), vy1 = vx_setall_f32(y1);
+        v_float32 vx2 = vx_setall_f32(x2), vy2 = vx_setall_f32(y2);
+        v_float32 varea = vx_setall_f32(area), zero = vx_setzero_f32();
+        for (; i + lanes <= r.count; i += lanes) {
+            v_float32 w = v_max(v_min(vx2, vx_load(&r.x2[i])) - v_max(vx1, vx_load(&r.x1[i])), zero);
+            v_float32 h = v_max(v_min(vy2, vx_load(&r.y2[i])) - v_max(vy1, vx_load(&r.y1[i])), zero);
+            v_float32 inter = w * h;
+            v_store(&overlaps_[i], inter / (varea + vx_load(&r.area[i]) - inter));
+        }
+#endif
+        for (; i < r.count; ++i) {
+            float w = max(min(x2, r.x2[i]) - max(x1, r.x1[i]), 0.f);
+            float h = max(min(y2, r.y2[i]) - max(y1, r.y1[i]), 0.f);
+            float inter = w * h;
+            overlaps_[i] = inter / (area + r.area[i] - inter);
+        }
+
+        size_t n = 0;
+        for (i = 0; i < r.count; ++i) {
+            float overlap = overlaps_[i];
+            // Boxes without area overlap nothing
+            float score = overlap > 0 ? r.score[i] * exp(-overlap * overlap / params.softSigma) : r.score[i];
+            if (!(score > params.scoreThreshold))
+                continue;
+            r.x1[n] = r.x1[i];
+            r.y1[n] = r.y1[i];
+            r.x2[n] = r.x2[i];
+            r.y2[n] = r.y2[i];
+            r.area[n] = r.area[i];
+            r.score[n] = score;
+            r.index[n] = r.index[i];
+            n++;
+        }
+        r.count = n;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef FAST_NMS_H
+#define FAST_NMS_H
+
+#include <utility>
+#include <vector>
+#include "yolo_decode.h"
+
+struct NmsParams {
+    float scoreThreshold = 0.5f;
+    float nmsThreshold = 0.4f;
+    float eta = 1.f; // adaptive threshold, as NMSBoxes
+    int topK = 0; // best candidates considered (per class with classAware), 0: all
+    bool classAware = false; // boxes only suppress boxes of their own class
+    float softSigma = 0; // > 0: Gaussian Soft-NMS, overlapping scores decay by exp(-iou^2 / softSigma)
+};
+
+// Non maximum suppression over the SoA boxes of decodeYolo().
+//
+// By default it keeps exactly what cv::dnn::NMSBoxes keeps, in the same
+// order: candidates above scoreThreshold best first (ties by index), the
+// topK of them picked with nth_element instead of a full sort, each one kept
+// unless its overlap with a kept box is above the threshold. The overlaps
+// with the kept boxes are computed with SIMD in float; the few that land
+// close to the threshold are computed again the way NMSBoxes does.
+//
+// classAware runs that per class, the classes in increasing order. Soft-NMS
+// keeps every box but decays the score of those overlapping a better one,
+// dropping them once they are not above scoreThreshold.
+//
+// Buffers are kept between calls, so one instance per thread.
+class FastNMS {
+public:
+    // indices into boxes; scores, if given, gets the score of each one
+    // (decayed with Soft-NMS)
+    void run(const YoloBoxes& boxes, const NmsParams& params, std::vector<int>& indices, std::vector<float>* scores = 0);
+
+private:
+    struct Candidates {
+        std::vector<float> x1, y1, x2, y2, area, score;
+        std::vector<int> index;
+        size_t count = 0;
+        void reserve(size_t n);
+        void assign(size_t i, const YoloBoxes& boxes, int index, float score);
+    };
+
+    void select(const YoloBoxes& boxes, const int* ids, size_t n, const NmsParams& params);
+    void hardNMS(const YoloBoxes& boxes, const NmsParams& params, std::vector<int>& indices, std::vector<float>* scores);
+    void softNMS(const YoloBoxes& boxes, const NmsParams& params, std::vector<int>& indices, std::vector<float>* scores);
+    bool overlapsKept(const YoloBoxes& boxes, int index, float threshold) const;
+
+    std::vector<std::pair<float, int>> order_;
+    std::vector<int> byClass_;
+    std::vector<int> classStart_;
+    Candidates kept_;
+    Candidates remaining_;
+    std::vector<float> overlaps_;
+};
+
+#endif
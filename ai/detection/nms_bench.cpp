@@ -0,0 +1,224 @@
+// Checks FastNMS against cv::dnn::NMSBoxes (all classes at once, per class,
+// with topK and eta) and Soft-NMS against a plain implementation, then times
+// them on crowded synthetic scenes: boxes jittered around a few objects.
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <sstream>
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/dnn.hpp>
+#include "fast_nms.h"
+
+using namespace std;
+using namespace cv;
+using namespace cv::dnn;
+
+DEFINE_string(counts, "1000,10000,50000", "numbers of boxes");
+DEFINE_int32(boxes_per_object, 20, "candidate boxes around each object");
+DEFINE_int32(classes, 80, "number of classes");
+DEFINE_double(confThreshold, 0.5, "Confidence threshold");
+DEFINE_double(nmsThreshold, 0.4, "nms threshold");
+DEFINE_double(soft_sigma, 0.5, "Soft-NMS sigma");
+DEFINE_int32(soft_boxes, 10000, "time Soft-NMS up to this many boxes, it is quadratic");
+
+void makeBoxes(int count, RNG& rng, YoloBoxes& boxes)
+{
+    Size frameSize(1920, 1080);
+    boxes.count = 0;
+    boxes.reserve(count);
+    int objects = max(1, count / FLAGS_boxes_per_object);
+    for (int o = 0; o < objects; ++o) {
+        int width = rng.uniform(16, 400);
+        int height = rng.uniform(16, 400);
+        int left = rng.uniform(-width / 4, frameSize.width - width / 2);
+        int top = rng.uniform(-height / 4, frameSize.height - height / 2);
+        int classId = rng.uniform(0, FLAGS_classes);
+        for (int b = o; b < count; b += objects) {
+            size_t n = boxes.count++;
+            boxes.left[n] = left + rng.uniform(-width / 8, width / 8 + 1);
+            boxes.top[n] = top + rng.uniform(-height / 8, height / 8 + 1);
+            boxes.width[n] = max(0, width + rng.uniform(-width / 8, width / 8 + 1));
+            boxes.height[n] = max(0, height + rng.uniform(-height / 8, height / 8 + 1));
+            // A few near duplicates with the same score, a few boxes of the
+            // neighbouring class
+            boxes.score[n] = b % 17 == 0 && n ? boxes.score[n - 1] : rng.uniform(0.f, 1.f);
+            boxes.classId[n] = b % 5 == 0 ? (classId + 1) % FLAGS_classes : classId;
+        }
+    }
+}
+
+void toRects(const YoloBoxes& boxes, vector<Rect>& rects, vector<float>& scores)
+{
+    rects.resize(boxes.count);
+    scores.assign(boxes.score.begin(), boxes.score.begin() + boxes.count);
+    for (size_t i = 0; i < boxes.count; ++i)
+        rects[i] = Rect(boxes.left[i], boxes.top[i], boxes.width[i], boxes.height[i]);
+}
+
+// NMSBoxes class by class, the classes in increasing order
+void nmsBoxesPerClass(const YoloBoxes& boxes, const NmsParams& params, vector<int>& indices)
+{
+    indices.clear();
+    int classes = 1 + *max_element(boxes.classId.begin(), boxes.classId.begin() + boxes.count);
+    vector<Rect> rects;
+    vector<float> scores;
+    vector<int> ids, kept;
+    for (int c = 0; c < classes; ++c) {
+        rects.clear();
+        scores.clear();
+        ids.clear();
+        for (size_t i = 0; i < boxes.count; ++i) {
+            if (boxes.classId[i] != c)
+                continue;
+            rects.push_back(Rect(boxes.left[i], boxes.top[i], boxes.width[i], boxes.height[i]));
+            scores.push_back(boxes.score[i]);
+            ids.push_back((int)i);
+        }
+        if (ids.empty())
+            continue;
+        NMSBoxes(rects, scores, params.scoreThreshold, params.nmsThreshold, kept, params.eta, params.topK);
+        for (size_t i = 0; i < kept.size(); ++i)
+            indices.push_back(ids[kept[i]]);
+    }
+}
+
+float floatOverlap(const YoloBoxes& boxes, int i, int j)
+{
+    float w = max(min((float)boxes.left[i] + boxes.width[i], (float)boxes.left[j] + boxes.width[j])
+            - max((float)boxes.left[i], (float)boxes.left[j]), 0.f);
+    float h = max(min((float)boxes.top[i] + boxes.height[i], (float)boxes.top[j] + boxes.height[j])
+            - max((float)boxes.top[i], (float)boxes.top[j]), 0.f);
+    float inter = w * h;
+    return inter / ((float)boxes.width[i] * boxes.height[i] + (float)boxes.width[j] * boxes.height[j] - inter);
+}
+
+// Gaussian Soft-NMS over all classes, written plainly
+void referenceSoftNMS(const YoloBoxes& boxes, const NmsParams& params, vector<int>& indices, vector<float>& scores)
+{
+    indices.clear();
+    scores.clear();
+    vector<pair<float, int>> remaining;
+    for (size_t i = 0; i < boxes.count; ++i)
+        if (boxes.score[i] > params.scoreThreshold)
+            remaining.push_back(make_pair(boxes.score[i], (int)i));
+    while (!remaining.empty()) {
+        size_t best = 0;
+        for (size_t i = 1; i < remaining.size(); ++i)
+            if (remaining[i].first > remaining[best].first
+                || (remaining[i].first == remaining[best].first && remaining[i].second < remaining[best].second))
+                best = i;
+        pair<float, int> picked = remaining[best];
+        remaining.erase(remaining.begin() + best);
+        indices.push_back(picked.second);
+        scores.push_back(picked.first);
+        vector<pair<float, int>> next;
+        for (size_t i = 0; i < remaining.size(); ++i) {
+            float overlap = floatOverlap(boxes, picked.second, remaining[i].second);
+            float score = overlap > 0 ? remaining[i].first * exp(-overlap * overlap / params.softSigma) : remaining[i].first;
+            if (score > params.scoreThreshold)
+                next.push_back(make_pair(score, remaining[i].second));
+        }
+        remaining.swap(next);
+    }
+}
+
+// Seconds per call, repeated for at least a quarter of a second
+double timeIt(const function<void()>& work)
+{
+    int calls = 0;
+    double start = (double)getTickCount();
+    double elapsed = 0;
+    do {
+        work();
+        calls++;
+        elapsed = ((double)getTickCount() - start) / getTickFrequency();
+    } while (elapsed < 0.25);
+    return elapsed / calls;
+}
+
+bool check(const char* what, int count, const vector<int>& expected, const vector<int>& actual)
+{
+    if (expected == actual)
+        return true;
+    LOG(ERROR) << what << " with " << count << " boxes: FastNMS kept " << actual.size()
+               << " boxes, expected " << expected.size();
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_logtostderr = 1;
+
+    NmsParams params;
+    params.scoreThreshold = (float)FLAGS_confThreshold;
+    params.nmsThreshold = (float)FLAGS_nmsThreshold;
+    RNG rng(0x4e4d53);
+    FastNMS nms;
+    YoloBoxes boxes;
+    vector<Rect> rects;
+    vector<float> scores, fastScores, expectedScores;
+    vector<int> expected, indices;
+    bool ok = true;
+
+    stringstream ss(FLAGS_counts);
+    string item;
+    while (getline(ss, item, ',')) {
+        int count = atoi(item.c_str());
+        if (count < 1)
+            continue;
+        makeBoxes(count, rng, boxes);
+        toRects(boxes, rects, scores);
+
+        NMSBoxes(rects, scores, params.scoreThreshold, params.nmsThreshold, expected);
+        nms.run(boxes, params, indices);
+        ok = check("default", count, expected, indices) && ok;
+        size_t kept = indices.size();
+
+        NmsParams limited = params;
+        limited.topK = count / 10;
+        limited.eta = 0.9f;
+        limited.nmsThreshold = 0.7f;
+        NMSBoxes(rects, scores, limited.scoreThreshold, limited.nmsThreshold, expected, limited.eta, limited.topK);
+        nms.run(boxes, limited, indices);
+        ok = check("topK and eta", count, expected, indices) && ok;
+
+        NmsParams perClass = params;
+        perClass.classAware = true;
+        nmsBoxesPerClass(boxes, perClass, expected);
+        nms.run(boxes, perClass, indices);
+        ok = check("per class", count, expected, indices) && ok;
+        size_t keptPerClass = indices.size();
+
+        double reference = timeIt([&] { NMSBoxes(rects, scores, params.scoreThreshold, params.nmsThreshold, expected); });
+        double fast = timeIt([&] { nms.run(boxes, params, indices); });
+        double referencePerClass = timeIt([&] { nmsBoxesPerClass(boxes, perClass, expected); });
+        double fastPerClass = timeIt([&] { nms.run(boxes, perClass, indices); });
+        LOG(INFO) << count << " boxes: NMSBoxes " << reference * 1000 << " ms, FastNMS " << fast * 1000
+                  << " ms (" << reference / max(fast, 1e-9) << "x), " << kept << " kept; per class "
+                  << referencePerClass * 1000 << " ms, FastNMS " << fastPerClass * 1000 << " ms ("
+                  << referencePerClass / max(fastPerClass, 1e-9) << "x), " << keptPerClass << " kept";
+
+        if (count > FLAGS_soft_boxes)
+            continue;
+        NmsParams soft = params;
+        soft.softSigma = (float)FLAGS_soft_sigma;
+        referenceSoftNMS(boxes, soft, expected, expectedScores);
+        nms.run(boxes, soft, indices, &fastScores);
+        bool sameScores = expectedScores.size() == fastScores.size();
+        for (size_t i = 0; sameScores && i < fastScores.size(); ++i)
+            sameScores = fabs(expectedScores[i] - fastScores[i]) <= 1e-5f;
+        ok = check("Soft-NMS", count, expected, indices) && sameScores && ok;
+        double fastSoft = timeIt([&] { nms.run(boxes, soft, indices); });
+        LOG(INFO) << count << " boxes: Soft-NMS " << fastSoft * 1000 << " ms, " << indices.size() << " kept"
+                  << (sameScores ? "" : ", SCORES DIFFER");
+    }
+
+    LOG(INFO) << (ok ? "all checks passed" : "CHECKS FAILED");
+    gflags::ShutDownCommandLineFlags();
+    return ok ? 0 : 1;
+}
@@ -2,7 +2,29 @@
 # video file input
 # You can download the test video clip from https://github.com/spmallick/learnopencv/tree/master/OpenPose
 # You need also download the pose network
+# Every mode stops after --num_frames frames, 10 by default; --num_frames=0 runs until the inputs end or a key is pressed.
+# --batch, --batch_sizes, --pipeline, --detect_every/--scene_change, --track_intervals and --benchmark are exclusive.
 ./build/yolo3detection --input=./sample_video.mp4 --num_frames=10 --show=true 
 #./build/yolo3detection --input=./run.mp4 --num_frames=10 --show=true 
+# batched inference over two inputs, 8 frames per forward pass
+#./build/yolo3detection --input=./sample_video.mp4,./run.mp4 --batch=8
+# throughput and latency per batch size over 256 frames
+#./build/yolo3detection --input=./sample_video.mp4 --num_frames=256 --batch_sizes=1,2,4,8,16,32
+# capture, preprocess, inference and postprocess on their own threads
+#./build/yolo3detection --input=./sample_video.mp4 --pipeline=true --queue_size=2
+# camera input, stale frames are dropped when the pipeline falls behind
+#./build/yolo3detection --cameraid=0 --pipeline=true --show=true
 # camera input & show 
 #./build/OpenPoseVideo --mode=gpu --cameraid=0 --num_frames=1000 --show=true --width=656 --height=368
+# region layer decoding, decodeYolo against the former minMaxLoc loop
+#./build/yolo_decode_bench --sizes=416,608
+# FastNMS against NMSBoxes at 1k, 10k and 50k boxes
+#./build/nms_bench --counts=1000,10000,50000
+# suppression within each class only, or Gaussian Soft-NMS
+#./build/yolo3detection --input=./sample_video.mp4 --nms_per_class=true --soft_nms_sigma=0.5
+# detect every 5th frame (and on scene changes), KCF trackers in between
+#./build/yolo3detection --input=./sample_video.mp4 --detect_every=5 --scene_change=25 --tracker=KCF --show=true
+# fps and recall against detecting every frame, over 200 frames
+#./build/yolo3detection --input=./sample_video.mp4 --num_frames=200 --track_intervals=2,5,10 --tracker=MOSSE
+# every available backend/target, 5 warmup and 100 timed frames, results as JSON
+#./build/yolo3detection --input=./sample_video.mp4 --benchmark=true --warmup=5 --num_frames=100 --json=yolov3.json
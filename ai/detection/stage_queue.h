@@ -0,0 +1,83 @@
+#ifndef STAGE_QUEUE_H
+#define STAGE_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Bounded FIFO between two pipeline stages. close() ends the stream: the
+// consumer drains what is left, producers give up.
+template <typename T>
+class StageQueue {
+public:
+    explicit StageQueue(size_t capacity)
+        : capacity_(capacity)
+    {
+    }
+
+    // Waits while the queue is full, false if it was closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] { return queue_.size() < capacity_ || closed_; });
+        if (closed_)
+            return false;
+        queue_.push_back(std::move(item));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    // For live sources: never waits, makes room by dropping the oldest
+    // items instead. Returns how many were dropped.
+    size_t pushDropOldest(T item)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_)
+            return 0;
+        size_t dropped = 0;
+        while (queue_.size() >= capacity_) {
+            queue_.pop_front();
+            dropped++;
+        }
+        queue_.push_back(std::move(item));
+        notEmpty_.notify_one();
+        return dropped;
+    }
+
+    // False once the queue is closed and drained
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+        if (queue_.empty())
+            return false;
+        item = std::move(queue_.front());
+        queue_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    std::deque<T> queue_;
+    size_t capacity_;
+    bool closed_ = false;
+};
+
+#endif
@@ -1,25 +1,48 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <functional>
 #include <sstream>
 #include <iostream>
+#include <thread>
 #include <opencv2/dnn.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
+#include "../common/dnn_benchmark.h"
+#include "detection_tracker.h"
+#include "fast_nms.h"
+#include "stage_queue.h"
+#include "yolo_decode.h"
 
 using namespace std;
 using namespace cv;
 using namespace cv::dnn;
 
 DEFINE_string(mode, "cpu", "dnn backend(cpu,cpuie,gpu)");
-DEFINE_string(input, "./sample_video.mp4", "input video");
+DEFINE_string(input, "./sample_video.mp4", "input video, or several separated by commas");
 DEFINE_int32(cameraid, -1, "camera id");
-DEFINE_int32(num_frames, 10, "number of frames to test");
+DEFINE_int32(num_frames, 10, "number of frames to test (0: until the inputs end)");
 DEFINE_bool(show, false, "whether to show or not the result");
 DEFINE_int32(width, 416, "net input width");
 DEFINE_int32(height, 416, "net input height");
 DEFINE_double(confThreshold, 0.5, "Confidence threshold");
 DEFINE_double(nmsThreshold, 0.4, "nms threshold");
+DEFINE_bool(nms_per_class, false, "suppress overlapping boxes only within a class");
+DEFINE_double(soft_nms_sigma, 0, "> 0: Gaussian Soft-NMS with this sigma instead of dropping overlapping boxes");
+DEFINE_int32(batch, 1, "frames per forward pass, taken from the inputs in turn");
+DEFINE_string(batch_sizes, "", "benchmark these batch sizes (e.g. 1,2,4,8,16,32) over num_frames frames, at least the largest size, and exit");
+DEFINE_bool(pipeline, false, "run capture, preprocess, inference and postprocess on their own threads (one frame per forward pass)");
+DEFINE_int32(queue_size, 2, "frames queued between two pipeline stages");
+DEFINE_int32(detect_every, 1, "run the detector on every Nth frame only and track its boxes in between");
+DEFINE_double(scene_change, 0, "also detect when the mean grey level difference to the last detected frame is above this (0: off)");
+DEFINE_string(tracker, "KCF", "tracker between detections: KCF, MOSSE, CSRT, MEDIANFLOW, MIL, BOOSTING");
+DEFINE_string(track_intervals, "", "compare detecting every N of these frame counts (e.g. 2,5,10) with detecting every frame over num_frames frames and exit");
+DEFINE_bool(benchmark, false, "time the network on every available backend/target over num_frames frames and exit");
+DEFINE_int32(warmup, 5, "frames run on each backend/target before timing");
+DEFINE_string(json, "", "write the benchmark results to this file instead of stdout");
+DEFINE_bool(live, false, "drop the oldest queued frame instead of waiting when the pipeline falls behind (always on for cameras)");
 
 float confThreshold = 0;
 float nmsThreshold = 0;
@@ -43,6 +66,17 @@ vector<String> getOutputsNames(const Net& net)
     return names;
 }
 
+vector<string> splitList(const string& list)
+{
+    vector<string> items;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
 void drawPred(int classId, float conf, int left, int top, int right, int bottom, Mat& frame)
 {
     // Draw a rectangle displaying the bounding box
@@ -63,46 +97,383 @@ void drawPred(int classId, float conf, int left, int top, int right, int bottom,
     putText(frame, label, Point(left, top), FONT_HERSHEY_SIMPLEX, 0.75, Scalar(0, 0, 0), 1);
 }
 
+// Decoded boxes left after non maximum suppression
+vector<Detection> findDetections(const Mat& frame, const vector<Mat>& outs)
+{
+    static thread_local YoloBoxes decoded;
+    static thread_local FastNMS nms;
+    decodeYolo(outs, frame.size(), confThreshold, decoded);
+
+    NmsParams params;
+    params.scoreThreshold = confThreshold;
+    params.nmsThreshold = nmsThreshold;
+    params.classAware = FLAGS_nms_per_class;
+    params.softSigma = (float)FLAGS_soft_nms_sigma;
+    vector<int> indices;
+    vector<float> scores;
+    nms.run(decoded, params, indices, &scores);
+
+    vector<Detection> detections;
+    for (size_t i = 0; i < indices.size(); ++i) {
+        int idx = indices[i];
+        detections.push_back(Detection{ decoded.classId[idx], scores[i],
+            Rect(decoded.left[idx], decoded.top[idx], decoded.width[idx], decoded.height[idx]) });
+    }
+    return detections;
+}
+
+void drawDetections(Mat& frame, const vector<Detection>& detections)
+{
+    for (size_t i = 0; i < detections.size(); ++i) {
+        const Rect& box = detections[i].box;
+        drawPred(detections[i].classId, detections[i].score, box.x, box.y, box.x + box.width, box.y + box.height, frame);
+    }
+}
+
 void postprocess(Mat& frame, const vector<Mat>& outs)
 {
-    vector<int> classIds;
-    vector<float> confidences;
-    vector<Rect> boxes;
+    drawDetections(frame, findDetections(frame, outs));
+}
 
+// Cuts the outputs of a forward pass over a batch into the outputs of each
+// frame. The region layers give [batch, rows, cols] for batch > 1; older
+// OpenCV versions stack the frames along the rows of a 2D blob instead.
+vector<vector<Mat>> splitBatchOutputs(const vector<Mat>& outs, int batch)
+{
+    vector<vector<Mat>> perFrame(batch);
     for (size_t i = 0; i < outs.size(); i++) {
-        float* data = (float*)outs[i].data;
-        for (int j = 0; j < outs[i].rows; ++j, data += outs[i].cols) {
-            Mat scores = outs[i].row(j).colRange(5, outs[i].cols);
-            Point classIdPoint;
-            double confidence;
-            minMaxLoc(scores, 0, &confidence, &classIdPoint);
-            if (confidence > confThreshold) {
-                int centerX = (int)(data[0] * frame.cols);
-                int centerY = (int)(data[1] * frame.rows);
-                int width = (int)(data[2] * frame.cols);
-                int height = (int)(data[3] * frame.rows);
-                int left = centerX - width / 2;
-                int top = centerY - height / 2;
-
-                classIds.push_back(classIdPoint.x);
-                confidences.push_back((float)confidence);
-                boxes.push_back(Rect(left, top, width, height));
+        const Mat& out = outs[i];
+        if (out.dims == 3) {
+            CV_Assert(out.size[0] == batch);
+            for (int b = 0; b < batch; ++b)
+                perFrame[b].push_back(Mat(out.size[1], out.size[2], CV_32F, (void*)out.ptr<float>(b)));
+        } else {
+            CV_Assert(out.rows % batch == 0);
+            int rows = out.rows / batch;
+            for (int b = 0; b < batch; ++b)
+                perFrame[b].push_back(out.rowRange(b * rows, (b + 1) * rows));
+        }
+    }
+    return perFrame;
+}
+
+// One blob and one forward pass for all frames, then postprocess per frame
+void detectBatch(Net& net, vector<Mat>& frames, Size inputSize)
+{
+    Mat inpBlob = blobFromImages(frames, 1.0 / 255, inputSize, Scalar(0, 0, 0), false, false);
+    net.setInput(inpBlob);
+    vector<Mat> outputs;
+    net.forward(outputs, getOutputsNames(net));
+    vector<vector<Mat>> perFrame = splitBatchOutputs(outputs, (int)frames.size());
+    for (size_t i = 0; i < frames.size(); ++i)
+        postprocess(frames[i], perFrame[i]);
+}
+
+double percentile(vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    size_t k = min(values.size() - 1, (size_t)(p * values.size()));
+    nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+// Runs the frames through the network in batches of each size. A frame is
+// done when its batch is, and waits for the frames after it in the batch to
+// arrive at sourceFps first, so latency = fill wait + batch time.
+void benchmarkBatchSizes(Net& net, const vector<Mat>& frames, Size inputSize, const vector<int>& sizes, double sourceFps)
+{
+    for (size_t s = 0; s < sizes.size(); ++s) {
+        int batch = sizes[s];
+        int batches = batch < 1 ? 0 : (int)frames.size() / batch;
+        if (batches == 0) {
+            LOG(WARNING) << "batch " << batch << ": skipped, needs at least that many frames and the inputs gave "
+                         << frames.size();
+            continue;
+        }
+
+        vector<Mat> inputs;
+        for (int i = 0; i < batch; ++i)
+            inputs.push_back(frames[i].clone());
+        detectBatch(net, inputs, inputSize); // warm up
+
+        vector<double> latencies;
+        double total = 0;
+        for (int b = 0; b < batches; ++b) {
+            inputs.clear();
+            for (int i = 0; i < batch; ++i)
+                inputs.push_back(frames[b * batch + i].clone());
+            double t = (double)getTickCount();
+            detectBatch(net, inputs, inputSize);
+            t = ((double)getTickCount() - t) / getTickFrequency();
+            total += t;
+            for (int i = 0; i < batch; ++i)
+                latencies.push_back(t + (batch - 1 - i) / sourceFps);
+        }
+
+        double sum = 0;
+        for (size_t i = 0; i < latencies.size(); ++i)
+            sum += latencies[i];
+        LOG(INFO) << "batch " << batch << ": " << batches * batch / total << " fps, "
+                  << total / batches * 1000 << " ms per forward+postprocess, latency at "
+                  << sourceFps << " fps input: mean " << sum / latencies.size() * 1000
+                  << " ms, p99 " << percentile(latencies, 0.99) * 1000 << " ms";
+    }
+}
+
+vector<Detection> detectFrame(Net& net, const Mat& frame, Size inputSize)
+{
+    Mat inpBlob = blobFromImage(frame, 1.0 / 255, inputSize, Scalar(0, 0, 0), false, false);
+    net.setInput(inpBlob);
+    vector<Mat> outputs;
+    net.forward(outputs, getOutputsNames(net));
+    return findDetections(frame, outputs);
+}
+
+// Detects every detectEvery frames, on a scene change in between, and
+// tracks the detected boxes over the other frames
+class HybridDetector {
+public:
+    HybridDetector(Net& net, Size inputSize, int detectEvery, double sceneChange)
+        : net_(net)
+        , inputSize_(inputSize)
+        , detectEvery_(max(1, detectEvery))
+        , sceneChange_(sceneChange)
+        , tracker_(FLAGS_tracker)
+    {
+    }
+
+    vector<Detection> process(const Mat& frame)
+    {
+        bool detect = frames_++ % detectEvery_ == 0;
+        Mat small;
+        if (sceneChange_ > 0) {
+            // Mean absolute difference of small grey versions of the frames
+            Mat grey;
+            cvtColor(frame, grey, COLOR_BGR2GRAY);
+            resize(grey, small, Size(64, 36), 0, 0, INTER_AREA);
+            Mat diff;
+            if (!reference_.empty())
+                absdiff(small, reference_, diff);
+            if (!detect && (reference_.empty() || mean(diff)[0] > sceneChange_)) {
+                detect = true;
+                sceneChanges_++;
+                frames_ = 1; // the next detection N frames from this one
             }
         }
+        if (detect) {
+            tracker_.update(frame, detectFrame(net_, frame, inputSize_));
+            reference_ = small;
+            detections_++;
+        } else {
+            tracker_.track(frame);
+        }
+        return tracker_.detections();
     }
 
-    vector<int> indices;
-    NMSBoxes(boxes, confidences, confThreshold, nmsThreshold, indices);
-    for (size_t i = 0; i < indices.size(); ++i) {
-        int idx = indices[i];
-        Rect box = boxes[idx];
-        drawPred(classIds[idx], confidences[idx], box.x, box.y, box.x + box.width, box.y + box.height, frame);
+    long long detections() const { return detections_; }
+    long long sceneChanges() const { return sceneChanges_; }
+
+private:
+    Net& net_;
+    Size inputSize_;
+    int detectEvery_;
+    double sceneChange_;
+    DetectionTracker tracker_;
+    Mat reference_;
+    long long frames_ = 0;
+    long long detections_ = 0;
+    long long sceneChanges_ = 0;
+};
+
+// Detections of the baseline with a box of the same class at IoU >= 0.5
+// in found, each box matched once
+int matchedDetections(const vector<Detection>& baseline, const vector<Detection>& found)
+{
+    vector<bool> used(found.size(), false);
+    int matched = 0;
+    for (size_t i = 0; i < baseline.size(); ++i) {
+        int best = -1;
+        double bestIou = 0.5;
+        for (size_t j = 0; j < found.size(); ++j) {
+            if (used[j] || found[j].classId != baseline[i].classId)
+                continue;
+            double iou = overlap(Rect2d(baseline[i].box), Rect2d(found[j].box));
+            if (iou >= bestIou) {
+                bestIou = iou;
+                best = (int)j;
+            }
+        }
+        if (best >= 0) {
+            used[best] = true;
+            matched++;
+        }
+    }
+    return matched;
+}
+
+// Detects on every frame as the baseline, then runs HybridDetector with each
+// interval: fps, and the share of the baseline detections it still finds
+void evaluateTracking(Net& net, const vector<Mat>& frames, Size inputSize, const vector<int>& intervals)
+{
+    vector<vector<Detection>> baseline;
+    size_t total = 0;
+    double t = (double)getTickCount();
+    for (size_t i = 0; i < frames.size(); ++i) {
+        baseline.push_back(detectFrame(net, frames[i], inputSize));
+        total += baseline.back().size();
+    }
+    t = ((double)getTickCount() - t) / getTickFrequency();
+    LOG(INFO) << "every frame: " << frames.size() / t << " fps, " << total << " detections";
+
+    for (size_t k = 0; k < intervals.size(); ++k) {
+        HybridDetector hybrid(net, inputSize, intervals[k], FLAGS_scene_change);
+        size_t matched = 0;
+        t = (double)getTickCount();
+        for (size_t i = 0; i < frames.size(); ++i)
+            matched += matchedDetections(baseline[i], hybrid.process(frames[i]));
+        t = ((double)getTickCount() - t) / getTickFrequency();
+        LOG(INFO) << "detect every " << intervals[k] << " (" << FLAGS_tracker << "): " << frames.size() / t
+                  << " fps, recall " << (total ? (double)matched / total : 1.0) << ", " << hybrid.detections()
+                  << " detection passes, " << hybrid.sceneChanges() << " on scene changes";
+    }
+}
+
+struct PipelineFrame {
+    long long seq = 0;
+    int source = 0;
+    int64 captured = 0; // tick count
+    Mat frame;
+    Mat blob;
+    vector<Mat> outputs;
+};
+
+struct StageStats {
+    const char* name;
+    long long items = 0;
+    double busy = 0; // seconds
+    double depthSum = 0; // input queue depth seen by each item
+    size_t maxDepth = 0;
+};
+
+// Pops frames from in, runs work on them and passes them on. Single thread
+// per stage, so the frames stay in capture order.
+void runStage(StageQueue<PipelineFrame>& in, StageQueue<PipelineFrame>& out, StageStats& stats,
+    const function<void(PipelineFrame&)>& work)
+{
+    PipelineFrame item;
+    while (in.pop(item)) {
+        size_t depth = in.size();
+        stats.depthSum += depth;
+        stats.maxDepth = max(stats.maxDepth, depth);
+        double t = (double)getTickCount();
+        work(item);
+        stats.busy += ((double)getTickCount() - t) / getTickFrequency();
+        stats.items++;
+        out.push(std::move(item));
+    }
+    out.close();
+}
+
+// capture -> preprocess -> inference -> postprocess -> display (this
+// thread, imshow has to run here), each stage on its own thread and bounded
+// queues in between, so the rate is that of the slowest stage rather than
+// of their sum. A file source waits when the pipeline is full; a live source
+// drops its oldest queued frame instead, so what gets detected stays fresh.
+void runPipeline(Net& net, Size inputSize, const function<bool(Mat&, int&)>& readFrame, bool live, bool multipleSources)
+{
+    size_t capacity = max(1, FLAGS_queue_size);
+    StageQueue<PipelineFrame> captured(capacity), preprocessed(capacity), inferred(capacity), done(capacity);
+    StageStats captureStats, preprocessStats, inferStats, postprocessStats;
+    captureStats.name = "capture";
+    preprocessStats.name = "preprocess";
+    inferStats.name = "inference";
+    postprocessStats.name = "postprocess";
+    atomic<bool> stop(false);
+    atomic<long long> dropped(0);
+    vector<String> outNames = getOutputsNames(net);
+
+    int64 start = getTickCount();
+    thread captureThread([&] {
+        long long seq = 0;
+        PipelineFrame item;
+        while (!stop) {
+            double t = (double)getTickCount();
+            if (!readFrame(item.frame, item.source))
+                break;
+            captureStats.busy += ((double)getTickCount() - t) / getTickFrequency();
+            captureStats.items++;
+            item.seq = seq++;
+            item.captured = getTickCount();
+            if (live)
+                dropped += captured.pushDropOldest(std::move(item));
+            else if (!captured.push(std::move(item)))
+                break;
+            item = PipelineFrame();
+        }
+        captured.close();
+    });
+    thread preprocessThread([&] {
+        runStage(captured, preprocessed, preprocessStats, [&](PipelineFrame& item) {
+            item.blob = blobFromImage(item.frame, 1.0 / 255, inputSize, Scalar(0, 0, 0), false, false);
+        });
+    });
+    thread inferThread([&] {
+        runStage(preprocessed, inferred, inferStats, [&](PipelineFrame& item) {
+            net.setInput(item.blob);
+            net.forward(item.outputs, outNames);
+            item.blob.release();
+        });
+    });
+    thread postprocessThread([&] {
+        runStage(inferred, done, postprocessStats, [&](PipelineFrame& item) {
+            postprocess(item.frame, item.outputs);
+            item.outputs.clear();
+        });
+    });
+
+    vector<double> latencies;
+    long long lastSeq = -1;
+    long long outOfOrder = 0;
+    PipelineFrame item;
+    while (done.pop(item)) {
+        latencies.push_back(((double)getTickCount() - item.captured) / getTickFrequency());
+        if (item.seq <= lastSeq)
+            outOfOrder++;
+        lastSeq = item.seq;
+        if (FLAGS_show) {
+            imshow(multipleSources ? format("Yolov3 Detection %d", item.source) : String("Yolov3 Detection"), item.frame);
+            if (waitKey(1) >= 0)
+                stop = true;
+        }
+    }
+    captureThread.join();
+    preprocessThread.join();
+    inferThread.join();
+    postprocessThread.join();
+    double seconds = ((double)getTickCount() - start) / getTickFrequency();
+
+    StageStats* stages[] = { &captureStats, &preprocessStats, &inferStats, &postprocessStats };
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i) {
+        const StageStats& stage = *stages[i];
+        double items = max(1LL, stage.items);
+        LOG(INFO) << stage.name << ": " << stage.items << " frames, " << stage.busy / items * 1000
+                  << " ms per frame (" << items / max(stage.busy, 1e-9) << " fps alone)"
+                  << (i == 0 ? "" : format(", input queue depth avg %.2f max %d", stage.depthSum / items, (int)stage.maxDepth));
     }
+    double sum = 0;
+    for (size_t i = 0; i < latencies.size(); ++i)
+        sum += latencies[i];
+    LOG(INFO) << "pipeline: " << latencies.size() / seconds << " fps, latency mean "
+              << (latencies.empty() ? 0 : sum / latencies.size() * 1000) << " ms, p99 "
+              << percentile(latencies, 0.99) * 1000 << " ms, " << dropped << " stale frames dropped"
+              << (outOfOrder ? format(", %lld OUT OF ORDER", outOfOrder) : String());
 }
 
 int main(int argc, char** argv)
 {
-    LOG(INFO) << "USAGE : ./yolo3detection --mode=[cpu|gpu|cpuie] --input=<videofile> ";
+    LOG(INFO) << "USAGE : ./yolo3detection --mode=[cpu|gpu|cpuie] --input=<videofile>[,<videofile>...] [--num_frames=N] [--batch=N | --batch_sizes=1,2,4,8,16,32 | --pipeline | --detect_every=N | --track_intervals=2,5,10 | --benchmark]";
+    LOG(INFO) << "stops after --num_frames frames (default 10), --num_frames=0 runs until the inputs end or a key is pressed";
     FLAGS_logtostderr = 1;
     google::InitGoogleLogging("YOLO3Detection");
     gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -112,48 +483,200 @@ int main(int argc, char** argv)
     string line;
     while (getline(ifs, line)) classes.push_back(line);
 
-    int inWidth = FLAGS_width;
-    int inHeight = FLAGS_height;
+    Size inputSize(FLAGS_width, FLAGS_height);
     confThreshold = FLAGS_confThreshold;
     nmsThreshold = FLAGS_nmsThreshold;
 
-    cv::VideoCapture cap(FLAGS_input);
+    vector<VideoCapture> caps;
     if (FLAGS_cameraid != -1) {
-        cap.release();
-        cap = cv::VideoCapture(FLAGS_cameraid);
+        caps.push_back(VideoCapture(FLAGS_cameraid));
         LOG(INFO) << "Use camera " << FLAGS_cameraid << " as input!";
+    } else {
+        vector<string> inputs = splitList(FLAGS_input);
+        for (size_t i = 0; i < inputs.size(); ++i)
+            caps.push_back(VideoCapture(inputs[i]));
     }
 
-    if (!cap.isOpened()) {
-        LOG(ERROR) << "Unable to open the video capture";
+    for (size_t i = 0; i < caps.size(); ++i) {
+        if (!caps[i].isOpened()) {
+            LOG(ERROR) << "Unable to open the video capture";
+            return 1;
+        }
+    }
+    if (caps.empty() || FLAGS_batch < 1) {
+        LOG(ERROR) << "Need at least one input and --batch >= 1";
+        return 1;
+    }
+
+    // Each of these picks its own way to run, so only one of them at a time
+    vector<string> modes;
+    if (FLAGS_benchmark)
+        modes.push_back("--benchmark");
+    if (FLAGS_pipeline)
+        modes.push_back("--pipeline");
+    if (!FLAGS_track_intervals.empty())
+        modes.push_back("--track_intervals");
+    if (FLAGS_detect_every > 1 || FLAGS_scene_change > 0)
+        modes.push_back("--detect_every/--scene_change");
+    if (!FLAGS_batch_sizes.empty())
+        modes.push_back("--batch_sizes");
+    if (FLAGS_batch > 1)
+        modes.push_back("--batch");
+    if (modes.size() > 1) {
+        string list = modes[0];
+        for (size_t i = 1; i < modes.size(); ++i)
+            list += ", " + modes[i];
+        LOG(ERROR) << "Conflicting modes " << list << ", use one of them";
         return 1;
     }
 
-    Mat frame, frameCopy;
-    int frameWidth = cap.get(CAP_PROP_FRAME_WIDTH);
-    int frameHeight = cap.get(CAP_PROP_FRAME_HEIGHT);
+    vector<int> batchSizes;
+    vector<string> batchItems = splitList(FLAGS_batch_sizes);
+    for (size_t i = 0; i < batchItems.size(); ++i)
+        batchSizes.push_back(atoi(batchItems[i].c_str()));
 
     String modelConfig = "yolov3.cfg";
     String modelWeights = "yolov3.weights";
 
     Net net = readNetFromDarknet(modelConfig, modelWeights);
-    net.setPreferableBackend(DNN_BACKEND_DEFAULT);
-    net.setPreferableTarget(DNN_TARGET_CPU);
+    if (!setBackendMode(net, FLAGS_mode))
+        return 1;
+
+    // Frames are taken from the inputs in turn until all of them have ended,
+    // num_frames of them at most. The batch benchmark reads at least as many
+    // as its largest batch, so no size is skipped for the default num_frames.
+    long long frameLimit = FLAGS_num_frames;
+    for (size_t i = 0; i < batchSizes.size() && frameLimit > 0; ++i)
+        frameLimit = std::max<long long>(frameLimit, batchSizes[i]);
+    vector<bool> ended(caps.size(), false);
+    size_t next = 0;
+    size_t alive = caps.size();
+    long long framesRead = 0;
+    auto readFrame = [&](Mat& frame, int& source) {
+        while (alive > 0 && (frameLimit <= 0 || framesRead < frameLimit)) {
+            source = (int)(next++ % caps.size());
+            if (ended[source])
+                continue;
+            caps[source] >> frame;
+            if (!frame.empty()) {
+                framesRead++;
+                return true;
+            }
+            ended[source] = true;
+            alive--;
+        }
+        return false;
+    };
+
+    if (FLAGS_benchmark) {
+        // Up to 50 distinct frames, the benchmark cycles through them
+        vector<Mat> frames;
+        Mat frame;
+        int source;
+        while (frames.size() < 50 && readFrame(frame, source))
+            frames.push_back(frame.clone());
+        if (frames.empty()) {
+            LOG(ERROR) << "No frame to benchmark with";
+            return 1;
+        }
+        BenchmarkOptions options;
+        options.warmup = FLAGS_warmup;
+        options.frames = FLAGS_num_frames > 0 ? FLAGS_num_frames : 100;
+        options.configs = availableBackendTargets();
+        vector<String> outNames = getOutputsNames(net);
+        string json = benchmarkNet("yolov3", net, frames, [&](Net& n, const Mat& f) {
+            n.setInput(blobFromImage(f, 1.0 / 255, inputSize, Scalar(0, 0, 0), false, false));
+            vector<Mat> outputs;
+            n.forward(outputs, outNames);
+        }, options);
+        gflags::ShutDownCommandLineFlags();
+        return writeBenchmark(json, FLAGS_json) ? 0 : 1;
+    }
 
+    if (FLAGS_pipeline) {
+        runPipeline(net, inputSize, readFrame, FLAGS_live || FLAGS_cameraid != -1, caps.size() > 1);
+        gflags::ShutDownCommandLineFlags();
+        return 0;
+    }
+
+    if (!FLAGS_track_intervals.empty()) {
+        vector<int> intervals;
+        vector<string> items = splitList(FLAGS_track_intervals);
+        for (size_t i = 0; i < items.size(); ++i)
+            intervals.push_back(atoi(items[i].c_str()));
+        vector<Mat> frames;
+        Mat frame;
+        int source;
+        while (readFrame(frame, source))
+            frames.push_back(frame.clone());
+        evaluateTracking(net, frames, inputSize, intervals);
+        gflags::ShutDownCommandLineFlags();
+        return 0;
+    }
+
+    if (FLAGS_detect_every > 1 || FLAGS_scene_change > 0) {
+        // One detector per input, a tracker only follows one scene
+        vector<Ptr<HybridDetector>> hybrids;
+        for (size_t i = 0; i < caps.size(); ++i)
+            hybrids.push_back(makePtr<HybridDetector>(net, inputSize, FLAGS_detect_every, FLAGS_scene_change));
+        Mat frame;
+        int source;
+        long long frames = 0;
+        double t = (double)getTickCount();
+        while (waitKey(1) < 0 && readFrame(frame, source)) {
+            vector<Detection> detections = hybrids[source]->process(frame);
+            frames++;
+            if (FLAGS_show) {
+                drawDetections(frame, detections);
+                imshow(caps.size() == 1 ? String("Yolov3 Detection") : format("Yolov3 Detection %d", source), frame);
+            }
+        }
+        t = ((double)getTickCount() - t) / getTickFrequency();
+        LOG(INFO) << frames << " frames, " << frames / t << " fps";
+        gflags::ShutDownCommandLineFlags();
+        return 0;
+    }
+
+    if (!batchSizes.empty()) {
+        vector<Mat> frames;
+        Mat frame;
+        int source;
+        while (readFrame(frame, source))
+            frames.push_back(frame.clone());
+        double sourceFps = caps[0].get(CAP_PROP_FPS);
+        if (sourceFps <= 0)
+            sourceFps = 25;
+        LOG(INFO) << "benchmarking " << frames.size() << " frames from " << caps.size() << " input(s)";
+        benchmarkBatchSizes(net, frames, inputSize, batchSizes, sourceFps * caps.size());
+        gflags::ShutDownCommandLineFlags();
+        return 0;
+    }
+
+    vector<Mat> batch;
+    vector<int> sources;
     while (waitKey(1) < 0) {
-        cap >> frame;
-        Mat inpBlob = blobFromImage(frame, 1.0 / 255, Size(inWidth, inHeight), Scalar(0, 0, 0), false, false);
-        net.setInput(inpBlob);
-        vector<Mat> outputs;
-        net.forward(outputs, getOutputsNames(net));
-        postprocess(frame, outputs);
+        batch.clear();
+        sources.clear();
+        Mat frame;
+        int source;
+        while ((int)batch.size() < FLAGS_batch && readFrame(frame, source)) {
+            batch.push_back(frame);
+            sources.push_back(source);
+            frame = Mat(); // the next read must not reuse the buffer in the batch
+        }
+        if (batch.empty())
+            break;
+
+        detectBatch(net, batch, inputSize);
         if (FLAGS_show) {
-            imshow("Yolov3 Detection", frame);
+            for (size_t i = 0; i < batch.size(); ++i)
+                imshow(caps.size() == 1 ? String("Yolov3 Detection") : format("Yolov3 Detection %d", sources[i]), batch[i]);
         }
     }
 
     // When everything done, release the video capture and write object
-    cap.release();
+    for (size_t i = 0; i < caps.size(); ++i)
+        caps[i].release();
     gflags::ShutDownCommandLineFlags();
 
     return 0;
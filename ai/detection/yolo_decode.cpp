@@ -0,0 +1,95 @@
+#include "yolo_decode.h"
+#include <cfloat>
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace std;
+using namespace cv;
+
+void YoloBoxes::reserve(size_t n)
+{
+    if (left.size() >= n)
+        return;
+    left.resize(n);
+    top.resize(n);
+    width.resize(n);
+    height.resize(n);
+    score.resize(n);
+    classId.resize(n);
+}
+
+// First index of the largest value, as minMaxLoc() gives it
+static int argmax(const float* scores, int n, float& best)
+{
+    int i = 0;
+    float maxVal = -FLT_MAX;
+#if CV_SIMD
+    const int lanes = v_float32::nlanes;
+    if (n >= lanes) {
+        v_float32 vmax = vx_load(scores);
+        for (i = lanes; i <= n - lanes; i += lanes)
+            vmax = v_max(vmax, vx_load(scores + i));
+        maxVal = v_reduce_max(vmax);
+    }
+#endif
+    for (; i < n; ++i)
+        maxVal = max(maxVal, scores[i]);
+
+    best = maxVal;
+    i = 0;
+#if CV_SIMD
+    v_float32 vbest = vx_setall_f32(maxVal);
+    for (; i <= n - lanes; i += lanes) {
+        int mask = v_signmask(vx_load(scores + i) == vbest);
+        if (mask) {
+            while (!(mask & 1)) {
+                mask >>= 1;
+                i++;
+            }
+            return i;
+        }
+    }
+#endif
+    for (; i < n; ++i)
+        if (scores[i] == maxVal)
+            return i;
+    return 0;
+}
+
+void decodeYoloRows(const float* data, int rows, int cols, Size frameSize, float threshold, YoloBoxes& boxes)
+{
+    boxes.reserve(boxes.count + rows);
+    size_t n = boxes.count;
+    for (int j = 0; j < rows; ++j, data += cols) {
+        if (!(data[4] > threshold))
+            continue;
+        float confidence;
+        int classId = argmax(data + 5, cols - 5, confidence);
+        if (!(confidence > threshold))
+            continue;
+        int centerX = (int)(data[0] * frameSize.width);
+        int centerY = (int)(data[1] * frameSize.height);
+        int width = (int)(data[2] * frameSize.width);
+        int height = (int)(data[3] * frameSize.height);
+        boxes.left[n] = centerX - width / 2;
+        boxes.top[n] = centerY - height / 2;
+        boxes.width[n] = width;
+        boxes.height[n] = height;
+        boxes.score[n] = confidence;
+        boxes.classId[n] = classId;
+        n++;
+    }
+    boxes.count = n;
+}
+
+void decodeYolo(const vector<Mat>& outs, Size frameSize, float threshold, YoloBoxes& boxes)
+{
+    size_t rows = 0;
+    for (size_t i = 0; i < outs.size(); i++)
+        rows += outs[i].rows;
+    boxes.count = 0;
+    boxes.reserve(rows);
+    for (size_t i = 0; i < outs.size(); i++) {
+        CV_Assert(outs[i].type() == CV_32F && outs[i].isContinuous() && outs[i].cols > 5);
+        decodeYoloRows((const float*)outs[i].data, outs[i].rows, outs[i].cols, frameSize, threshold, boxes);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef YOLO_DECODE_H
+#define YOLO_DECODE_H
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Boxes decoded from the region layer outputs, one array per field. The
+// arrays only grow, so decoding frame after frame does not allocate.
+struct YoloBoxes {
+    std::vector<int> left, top, width, height;
+    std::vector<float> score;
+    std::vector<int> classId;
+    size_t count = 0;
+
+    void reserve(size_t n);
+};
+
+// Walks the rows of the region layer outputs once: [cx, cy, w, h,
+// objectness, class scores...], scores already multiplied by objectness.
+// A class score can't exceed objectness, so a row whose objectness is not
+// above threshold is skipped without looking at its scores; for the others
+// the best class is found with SIMD. Keeps the rows postprocess() kept
+// before, in the same order and with the same values.
+void decodeYolo(const std::vector<cv::Mat>& outs, cv::Size frameSize, float threshold, YoloBoxes& boxes);
+
+// Appends the boxes of one output, rows of cols floats
+void decodeYoloRows(const float* data, int rows, int cols, cv::Size frameSize, float threshold, YoloBoxes& boxes);
+
+#endif
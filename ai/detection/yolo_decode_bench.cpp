@@ -0,0 +1,141 @@
+// Times decodeYolo() against the decoding loop postprocess() used before
+// (a minMaxLoc over the class scores of every row) on synthetic region layer
+// outputs shaped like YOLOv3's at the given input sizes, and checks both
+// keep the same boxes. Needs no network or video.
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <cstdlib>
+#include <sstream>
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include "yolo_decode.h"
+
+using namespace std;
+using namespace cv;
+
+DEFINE_string(sizes, "416,608", "net input sizes");
+DEFINE_int32(iterations, 200, "decodes per size and method");
+DEFINE_int32(classes, 80, "number of classes");
+DEFINE_double(objects, 0.01, "fraction of rows with a high objectness");
+DEFINE_double(confThreshold, 0.5, "Confidence threshold");
+
+// The three YOLOv3 outputs for a square input: 3 anchors per cell on the
+// strides 32, 16 and 8. Scores as the region layer gives them: class
+// probability times objectness, zero when not above its threshold of 0.2.
+vector<Mat> makeOutputs(int inputSize, RNG& rng)
+{
+    vector<Mat> outs;
+    for (int stride = 32; stride >= 8; stride /= 2) {
+        int cells = inputSize / stride;
+        Mat out(cells * cells * 3, 5 + FLAGS_classes, CV_32F);
+        for (int j = 0; j < out.rows; ++j) {
+            float* data = out.ptr<float>(j);
+            data[0] = rng.uniform(0.f, 1.f);
+            data[1] = rng.uniform(0.f, 1.f);
+            data[2] = rng.uniform(0.01f, 0.5f);
+            data[3] = rng.uniform(0.01f, 0.5f);
+            bool object = rng.uniform(0.0, 1.0) < FLAGS_objects;
+            float objectness = object ? rng.uniform(0.3f, 1.f) : rng.uniform(0.f, 0.05f);
+            data[4] = objectness;
+            int best = rng.uniform(0, FLAGS_classes);
+            for (int c = 0; c < FLAGS_classes; ++c) {
+                float probability = c == best ? rng.uniform(0.5f, 1.f) : rng.uniform(0.f, 0.1f);
+                float score = probability * objectness;
+                data[5 + c] = score > 0.2f ? score : 0;
+            }
+        }
+        outs.push_back(out);
+    }
+    return outs;
+}
+
+// The loop postprocess() ran before decodeYolo(), with the class taken from
+// the location of the maximum (it was passed as minLoc)
+void referenceDecode(const vector<Mat>& outs, Size frameSize, float threshold,
+    vector<int>& classIds, vector<float>& confidences, vector<Rect>& boxes)
+{
+    classIds.clear();
+    confidences.clear();
+    boxes.clear();
+    for (size_t i = 0; i < outs.size(); i++) {
+        float* data = (float*)outs[i].data;
+        for (int j = 0; j < outs[i].rows; ++j, data += outs[i].cols) {
+            Mat scores = outs[i].row(j).colRange(5, outs[i].cols);
+            Point classIdPoint;
+            double confidence;
+            minMaxLoc(scores, 0, &confidence, 0, &classIdPoint);
+            if (confidence > threshold) {
+                int centerX = (int)(data[0] * frameSize.width);
+                int centerY = (int)(data[1] * frameSize.height);
+                int width = (int)(data[2] * frameSize.width);
+                int height = (int)(data[3] * frameSize.height);
+                int left = centerX - width / 2;
+                int top = centerY - height / 2;
+
+                classIds.push_back(classIdPoint.x);
+                confidences.push_back((float)confidence);
+                boxes.push_back(Rect(left, top, width, height));
+            }
+        }
+    }
+}
+
+bool sameBoxes(const vector<int>& classIds, const vector<float>& confidences, const vector<Rect>& boxes, const YoloBoxes& decoded)
+{
+    if (decoded.count != boxes.size())
+        return false;
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        if (decoded.classId[i] != classIds[i] || decoded.score[i] != confidences[i]
+            || Rect(decoded.left[i], decoded.top[i], decoded.width[i], decoded.height[i]) != boxes[i])
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_logtostderr = 1;
+
+    Size frameSize(1280, 720);
+    float threshold = (float)FLAGS_confThreshold;
+    RNG rng(0x12345);
+    bool ok = true;
+
+    stringstream ss(FLAGS_sizes);
+    string item;
+    while (getline(ss, item, ',')) {
+        int inputSize = atoi(item.c_str());
+        if (inputSize < 32)
+            continue;
+        vector<Mat> outs = makeOutputs(inputSize, rng);
+        int rows = 0;
+        for (size_t i = 0; i < outs.size(); i++)
+            rows += outs[i].rows;
+
+        vector<int> classIds;
+        vector<float> confidences;
+        vector<Rect> boxes;
+        YoloBoxes decoded;
+
+        double t = (double)getTickCount();
+        for (int n = 0; n < FLAGS_iterations; ++n)
+            referenceDecode(outs, frameSize, threshold, classIds, confidences, boxes);
+        double reference = ((double)getTickCount() - t) / getTickFrequency() / FLAGS_iterations;
+
+        t = (double)getTickCount();
+        for (int n = 0; n < FLAGS_iterations; ++n)
+            decodeYolo(outs, frameSize, threshold, decoded);
+        double vectorized = ((double)getTickCount() - t) / getTickFrequency() / FLAGS_iterations;
+
+        bool same = sameBoxes(classIds, confidences, boxes, decoded);
+        ok = ok && same;
+        LOG(INFO) << inputSize << "x" << inputSize << ": " << rows << " rows, " << boxes.size() << " boxes, minMaxLoc "
+                  << reference * 1000 << " ms, decodeYolo " << vectorized * 1000 << " ms ("
+                  << reference / max(vectorized, 1e-9) << "x)" << (same ? "" : ", BOXES DIFFER");
+    }
+
+    gflags::ShutDownCommandLineFlags();
+    return ok ? 0 : 1;
+}
@@ -4,6 +4,7 @@
 #include <opencv2/dnn.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
+#include "../common/dnn_benchmark.h"
 
 using namespace std;
 using namespace cv;
@@ -17,6 +18,9 @@ DEFINE_bool(show, false, "whether to show or not the result");
 DEFINE_int32(width, 656, "net input width");
 DEFINE_int32(height, 368, "net input height");
 DEFINE_double(thresh, 0.05, "net thresh");
+DEFINE_bool(benchmark, false, "time the network on every available backend/target over num_frames frames and exit");
+DEFINE_int32(warmup, 5, "frames run on each backend/target before timing");
+DEFINE_string(json, "", "write the benchmark results to this file instead of stdout");
 
 #define COCO
 
@@ -45,7 +49,7 @@ int nPoints = 18;
 
 int main(int argc, char** argv)
 {
-    LOG(INFO) << "USAGE : ./openpose --mode=[cpu|gpu|cpuie] --input=<videofile> ";
+    LOG(INFO) << "USAGE : ./openpose --mode=[cpu|gpu|cpuie] --input=<videofile> [--benchmark]";
     FLAGS_logtostderr = 1;
     google::InitGoogleLogging("OPENPOSE");
     gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -76,18 +80,29 @@ int main(int argc, char** argv)
 
     Net net = readNetFromCaffe(protoFile, weightsFile);
 
-    if (FLAGS_mode == "cpu") {
-        LOG(INFO) << "use CPU backend";
-        net.setPreferableBackend(DNN_BACKEND_DEFAULT);
-        net.setPreferableTarget(DNN_TARGET_CPU);
-    } else if (FLAGS_mode == "gpu") {
-        LOG(INFO) << "use GPU backend";
-        net.setPreferableBackend(DNN_BACKEND_CUDA);
-        net.setPreferableTarget(DNN_TARGET_CUDA);
-    } else if (FLAGS_mode == "cpuie") {
-        LOG(INFO) << "use CPUIE backend";
-        net.setPreferableBackend(DNN_BACKEND_INFERENCE_ENGINE);
-        net.setPreferableTarget(DNN_TARGET_CPU);
+    if (!setBackendMode(net, FLAGS_mode))
+        return 1;
+
+    if (FLAGS_benchmark) {
+        // Up to 50 distinct frames, the benchmark cycles through them
+        vector<Mat> frames;
+        while (frames.size() < 50 && (int)frames.size() < max(1, FLAGS_num_frames) && cap.read(frame))
+            frames.push_back(frame.clone());
+        if (frames.empty()) {
+            LOG(ERROR) << "No frame to benchmark with";
+            return 1;
+        }
+        BenchmarkOptions options;
+        options.warmup = FLAGS_warmup;
+        options.frames = FLAGS_num_frames > 0 ? FLAGS_num_frames : 100;
+        options.configs = availableBackendTargets();
+        string json = benchmarkNet("openpose", net, frames, [&](Net& n, const Mat& f) {
+            n.setInput(blobFromImage(f, 1.0 / 255, Size(inWidth, inHeight), Scalar(0, 0, 0), false, false));
+            n.forward();
+        }, options);
+        cap.release();
+        gflags::ShutDownCommandLineFlags();
+        return writeBenchmark(json, FLAGS_json) ? 0 : 1;
     }
 
     long long frame_num = 0;
@@ -116,12 +131,6 @@ int main(int argc, char** argv)
             if (frame_num == FLAGS_num_frames)
                 break;
         }
-        // vector<double> layersTimings;
-        // double tick_freq = getTickFrequency();
-        // double time_ms = net.getPerfProfile(layersTimings) / tick_freq * 1000;
-        // for (auto i : layersTimings) {
-        // std::cout << i << " " << std::endl;
-        //}
 
         int H = output.size[2];
         int W = output.size[3];
@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define __STDC_CONSTANT_MACROS
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+};
+
+#include "sample_convert.h"
+
+// A/V pipeline: the video and the audio encoder each run on their own thread
+// and push packets into a bounded per-stream queue, a muxer thread pulls them
+// in DTS order and writes one MP4 (or fragmented MP4) with
+// av_interleaved_write_frame(). The report gives the queue occupancy, the
+// time the encoders were blocked on a full queue and the time the muxer
+// stalled waiting for the other stream, which is what sizes the buffers for
+// live use.
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_CHANNELS 2
+#define DEFAULT_QUEUE_PACKETS 64
+
+static double now_s()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct queued_packet {
+    AVPacket* pkt;
+    double enqueue_time;
+};
+
+// Bounded packet queue of one stream, with the statistics the report needs
+class PacketQueue {
+public:
+    explicit PacketQueue(size_t capacity)
+        : capacity_(capacity)
+    {
+    }
+
+    ~PacketQueue()
+    {
+        for (size_t i = 0; i < queue_.size(); ++i)
+            av_packet_free(&queue_[i].pkt);
+    }
+
+    // Blocks while the queue is full, the blocked time is the backpressure
+    // the encoder sees from the muxer. False if the queue was closed, the
+    // packet then stays with the caller.
+    bool push(AVPacket* pkt)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.size() >= capacity_ && !closed_) {
+            double t = now_s();
+            not_full_.wait(lock, [this] { return queue_.size() < capacity_ || closed_; });
+            blocked_ += now_s() - t;
+            full_events_++;
+        }
+        if (closed_)
+            return false;
+        queued_packet item = { pkt, now_s() };
+        queue_.push_back(item);
+        pushes_++;
+        depth_sum_ += queue_.size();
+        max_depth_ = std::max(max_depth_, queue_.size());
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Waits for a head packet, false once the queue is closed and drained.
+    // Time spent waiting is added to *waited.
+    bool peek(queued_packet* item, double* waited)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.empty() && !closed_) {
+            double t = now_s();
+            not_empty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+            *waited += now_s() - t;
+        }
+        if (queue_.empty())
+            return false;
+        *item = queue_.front();
+        return true;
+    }
+
+    void pop()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.pop_front();
+        not_full_.notify_one();
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    void report(const char* name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        printf("%s queue: capacity %zu, packets %lld, max depth %zu, mean depth %.1f, full %lld times, encoder blocked %.3f s\n",
+            name, capacity_, (long long)pushes_, max_depth_, pushes_ ? (double)depth_sum_ / pushes_ : 0.0,
+            (long long)full_events_, blocked_);
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<queued_packet> queue_;
+    size_t capacity_;
+    bool closed_ = false;
+    int64_t pushes_ = 0;
+    int64_t depth_sum_ = 0;
+    size_t max_depth_ = 0;
+    int64_t full_events_ = 0;
+    double blocked_ = 0;
+};
+
+struct output_stream {
+    AVStream* st;
+    AVCodecContext* enc;
+    PacketQueue* queue;
+    const char* name;
+    int ok;
+};
+
+// Drain the encoder into the stream queue, timestamps in the stream time base.
+// AVERROR_EXIT once the muxer has closed the queue.
+static int drain_encoder(output_stream* os)
+{
+    int ret;
+    for (;;) {
+        AVPacket* pkt = av_packet_alloc();
+        ret = avcodec_receive_packet(os->enc, pkt);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            break;
+        }
+        pkt->stream_index = os->st->index;
+        av_packet_rescale_ts(pkt, os->enc->time_base, os->st->time_base);
+        if (!os->queue->push(pkt)) {
+            av_packet_free(&pkt);
+            return AVERROR_EXIT;
+        }
+    }
+    return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+static int send_frame(output_stream* os, AVFrame* frame)
+{
+    int ret = avcodec_send_frame(os->enc, frame);
+    if (ret < 0)
+        return ret;
+    return drain_encoder(os);
+}
+
+// In live mode the producers wait for the wall clock to reach the media time
+// of their next frame, like a capture device would deliver it
+static void pace(int live, double start, int64_t pts, AVRational time_base)
+{
+    if (!live)
+        return;
+    double due = start + pts * av_q2d(time_base);
+    double wait = due - now_s();
+    if (wait > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+}
+
+static void video_thread(output_stream* os, FILE* in_file, int live, double start)
+{
+    AVCodecContext* enc = os->enc;
+    AVFrame* frame = av_frame_alloc();
+    int ret = 0;
+    frame->format = enc->pix_fmt;
+    frame->width = enc->width;
+    frame->height = enc->height;
+    os->ok = av_frame_get_buffer(frame, 0) >= 0;
+
+    for (int64_t pts = 0; os->ok; ++pts) {
+        if (av_frame_make_writable(frame) < 0) {
+            os->ok = 0;
+            break;
+        }
+        // yuv420p, one row at a time to honor the frame linesize
+        int eof = 0;
+        for (int plane = 0; plane < 3 && !eof; ++plane) {
+            int w = plane ? enc->width / 2 : enc->width;
+            int h = plane ? enc->height / 2 : enc->height;
+            for (int y = 0; y < h && !eof; ++y)
+                eof = fread(frame->data[plane] + y * frame->linesize[plane], 1, w, in_file) != (size_t)w;
+        }
+        if (eof)
+            break;
+
+        pace(live, start, pts, enc->time_base);
+        frame->pts = pts;
+        ret = send_frame(os, frame);
+        if (ret == AVERROR_EXIT)
+            break;
+        if (ret < 0) {
+            printf("Failed to encode video frame %lld\n", (long long)pts);
+            os->ok = 0;
+        }
+    }
+    if (ret != AVERROR_EXIT && send_frame(os, NULL) < 0)
+        os->ok = 0;
+    os->queue->close();
+    av_frame_free(&frame);
+}
+
+static void audio_thread(output_stream* os, FILE* in_file, int live, double start)
+{
+    AVCodecContext* enc = os->enc;
+    const int frame_size = enc->frame_size > 0 ? enc->frame_size : 1024;
+    AVFrame* frame = av_frame_alloc();
+    int ret = 0;
+    frame->format = enc->sample_fmt;
+    frame->channel_layout = enc->channel_layout;
+    frame->channels = enc->channels;
+    frame->nb_samples = frame_size;
+    os->ok = av_frame_get_buffer(frame, 0) >= 0;
+
+    std::vector<int16_t> pcm((size_t)frame_size * enc->channels);
+    for (int64_t pts = 0; os->ok; pts += frame_size) {
+        int n = (int)(fread(&pcm[0], 2 * enc->channels, frame_size, in_file));
+        if (n <= 0)
+            break;
+        if (av_frame_make_writable(frame) < 0) {
+            os->ok = 0;
+            break;
+        }
+        const uint8_t* src = (const uint8_t*)&pcm[0];
+        sample_convert(frame->extended_data, enc->sample_fmt, &src, AV_SAMPLE_FMT_S16, enc->channels, n);
+        if (n < frame_size)
+            av_samples_set_silence(frame->extended_data, n, frame_size - n, enc->channels, enc->sample_fmt);
+
+        pace(live, start, pts, enc->time_base);
+        frame->pts = pts;
+        ret = send_frame(os, frame);
+        if (ret == AVERROR_EXIT)
+            break;
+        if (ret < 0) {
+            printf("Failed to encode audio frame at %lld\n", (long long)pts);
+            os->ok = 0;
+        }
+    }
+    if (ret != AVERROR_EXIT && send_frame(os, NULL) < 0)
+        os->ok = 0;
+    os->queue->close();
+    av_frame_free(&frame);
+}
+
+struct mux_stats {
+    int64_t packets;
+    double stall_seconds[2]; // waiting for a packet of stream i
+    int64_t stalls[2];
+    std::vector<double> residency; // enqueue to written, seconds
+};
+
+// Always write the queued packet with the lowest DTS, which needs a head
+// packet from every stream still running: when one stream is late the muxer
+// stalls on it while the other queue fills up.
+static int mux_thread(AVFormatContext* fmt_ctx, output_stream* streams, int nb_streams, mux_stats* stats)
+{
+    for (;;) {
+        int best = -1;
+        queued_packet best_item = { NULL, 0 };
+        for (int i = 0; i < nb_streams; ++i) {
+            queued_packet item;
+            double waited = 0;
+            int have = streams[i].queue->peek(&item, &waited);
+            if (waited > 0) {
+                stats->stall_seconds[i] += waited;
+                stats->stalls[i]++;
+            }
+            if (!have)
+                continue;
+            if (best < 0
+                || av_compare_ts(item.pkt->dts, streams[i].st->time_base,
+                       best_item.pkt->dts, streams[best].st->time_base)
+                    < 0) {
+                best = i;
+                best_item = item;
+            }
+        }
+        if (best < 0)
+            return 0;
+
+        streams[best].queue->pop();
+        int ret = av_interleaved_write_frame(fmt_ctx, best_item.pkt);
+        av_packet_free(&best_item.pkt);
+        if (ret < 0) {
+            // Nobody drains the queues any more: closing them stops the
+            // encoder threads instead of leaving them blocked on a full one
+            printf("Failed to write packet\n");
+            for (int i = 0; i < nb_streams; ++i)
+                streams[i].queue->close();
+            return ret;
+        }
+        stats->packets++;
+        stats->residency.push_back(now_s() - best_item.enqueue_time);
+    }
+}
+
+static AVCodecContext* open_video_encoder(AVFormatContext* fmt_ctx, int width, int height, int fps)
+{
+    AVCodec* codec = avcodec_find_encoder(fmt_ctx->oformat->video_codec);
+    if (!codec)
+        return NULL;
+    AVCodecContext* enc = avcodec_alloc_context3(codec);
+    enc->width = width;
+    enc->height = height;
+    enc->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc->time_base = av_make_q(1, fps);
+    enc->framerate = av_make_q(fps, 1);
+    enc->bit_rate = 400000;
+    enc->gop_size = fps * 2; // a keyframe, and so a fragment, every 2 s
+    enc->max_b_frames = 0;
+    if (fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+        enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    AVDictionary* param = NULL;
+    if (enc->codec_id == AV_CODEC_ID_H264) {
+        av_dict_set(&param, "preset", "veryfast", 0);
+        av_dict_set(&param, "tune", "zerolatency", 0);
+    }
+    int ret = avcodec_open2(enc, codec, &param);
+    av_dict_free(&param);
+    if (ret < 0)
+        avcodec_free_context(&enc);
+    return enc;
+}
+
+static AVCodecContext* open_audio_encoder(AVFormatContext* fmt_ctx)
+{
+    AVCodec* codec = avcodec_find_encoder(fmt_ctx->oformat->audio_codec);
+    if (!codec)
+        return NULL;
+    AVCodecContext* enc = avcodec_alloc_context3(codec);
+    enc->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+    enc->sample_rate = AUDIO_SAMPLE_RATE;
+    enc->channels = AUDIO_CHANNELS;
+    enc->channel_layout = av_get_default_channel_layout(AUDIO_CHANNELS);
+    enc->bit_rate = 64000 * AUDIO_CHANNELS;
+    enc->time_base = av_make_q(1, AUDIO_SAMPLE_RATE);
+    if (fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+        enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if (!sample_convert_supported(enc->sample_fmt, AV_SAMPLE_FMT_S16) || avcodec_open2(enc, codec, NULL) < 0)
+        avcodec_free_context(&enc);
+    return enc;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 7) {
+        printf("Usage: %s <in.yuv> <width> <height> <fps> <in.pcm> <out.mp4> [--fmp4] [--live] [--queue packets]\n", argv[0]);
+        printf("  in.yuv is yuv420p, in.pcm is s16le %d Hz %d channels\n", AUDIO_SAMPLE_RATE, AUDIO_CHANNELS);
+        return -1;
+    }
+    const char* out_file = argv[6];
+    int width = atoi(argv[2]);
+    int height = atoi(argv[3]);
+    int fps = atoi(argv[4]);
+    int fragmented = 0, live = 0;
+    int queue_packets = DEFAULT_QUEUE_PACKETS;
+    for (int i = 7; i < argc; ++i) {
+        if (!strcmp(argv[i], "--fmp4"))
+            fragmented = 1;
+        else if (!strcmp(argv[i], "--live"))
+            live = 1;
+        else if (!strcmp(argv[i], "--queue") && i + 1 < argc)
+            queue_packets = atoi(argv[++i]);
+    }
+
+    FILE* video_in = fopen(argv[1], "rb");
+    FILE* audio_in = fopen(argv[5], "rb");
+    if (video_in == NULL || audio_in == NULL || width <= 0 || height <= 0 || fps <= 0 || queue_packets <= 0) {
+        printf("Error open file\n");
+        return -1;
+    }
+
+    av_register_all();
+
+    AVFormatContext* fmt_ctx = NULL;
+    avformat_alloc_output_context2(&fmt_ctx, NULL, "mp4", out_file);
+    if (!fmt_ctx) {
+        printf("Failed to allocate the mp4 muxer\n");
+        return -1;
+    }
+
+    AVCodecContext* video_enc = open_video_encoder(fmt_ctx, width, height, fps);
+    AVCodecContext* audio_enc = open_audio_encoder(fmt_ctx);
+    if (!video_enc || !audio_enc) {
+        printf("Failed to open encoders\n");
+        return -1;
+    }
+
+    PacketQueue video_queue(queue_packets);
+    PacketQueue audio_queue(queue_packets);
+    output_stream streams[2] = {
+        { avformat_new_stream(fmt_ctx, NULL), video_enc, &video_queue, "video", 1 },
+        { avformat_new_stream(fmt_ctx, NULL), audio_enc, &audio_queue, "audio", 1 },
+    };
+    for (int i = 0; i < 2; ++i) {
+        avcodec_parameters_from_context(streams[i].st->codecpar, streams[i].enc);
+        streams[i].st->time_base = streams[i].enc->time_base;
+    }
+    av_dump_format(fmt_ctx, 0, out_file, 1);
+
+    if (avio_open(&fmt_ctx->pb, out_file, AVIO_FLAG_WRITE) < 0) {
+        printf("Failed to open output file %s\n", out_file);
+        return -1;
+    }
+
+    // fragmented: a moof/mdat pair per video keyframe, playable while written
+    AVDictionary* opts = NULL;
+    if (fragmented)
+        av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    int ret = avformat_write_header(fmt_ctx, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        printf("Failed to write header\n");
+        return -1;
+    }
+
+    mux_stats stats = {};
+    double start = now_s();
+    std::thread video(video_thread, &streams[0], video_in, live, start);
+    std::thread audio(audio_thread, &streams[1], audio_in, live, start);
+    std::thread muxer([&] { ret = mux_thread(fmt_ctx, streams, 2, &stats); });
+    video.join();
+    audio.join();
+    muxer.join();
+    double wall = now_s() - start;
+
+    av_write_trailer(fmt_ctx);
+
+    std::sort(stats.residency.begin(), stats.residency.end());
+    size_t n = stats.residency.size();
+    printf("--------------- Mux report ----------------\n");
+    printf("%s: %s, %lld packets, %.2f s wall\n", out_file, fragmented ? "fragmented mp4" : "mp4",
+        (long long)stats.packets, wall);
+    video_queue.report("video");
+    audio_queue.report("audio");
+    for (int i = 0; i < 2; ++i) {
+        printf("muxer stalled on %s: %lld times, %.3f s\n", streams[i].name, (long long)stats.stalls[i],
+            stats.stall_seconds[i]);
+    }
+    if (n) {
+        printf("queue residency: p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", stats.residency[n / 2] * 1000,
+            stats.residency[std::min(n - 1, n * 99 / 100)] * 1000, stats.residency[n - 1] * 1000);
+    }
+    printf("-------------------------------------------\n");
+
+    avcodec_free_context(&video_enc);
+    avcodec_free_context(&audio_enc);
+    avio_closep(&fmt_ctx->pb);
+    avformat_free_context(fmt_ctx);
+    fclose(video_in);
+    fclose(audio_in);
+    return (ret < 0 || !streams[0].ok || !streams[1].ok) ? -1 : 0;
+}
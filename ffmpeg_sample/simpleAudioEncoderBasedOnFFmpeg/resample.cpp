@@ -0,0 +1,278 @@
+#include "resample.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+// Stopband attenuation the Kaiser window is designed for, in dB
+#define STOPBAND_DB 90.0
+
+// Per channel filter loop: one dot product per output sample, starting at
+// window pos with coefficient phase, until max_out samples are written or the
+// window would run past size. Returns the number of samples written.
+typedef int (*filter_func)(const resampler* r, const float* buf, int size, float* dst, int max_out, int* pos, int* phase);
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+template <typename Dot>
+static ALWAYS_INLINE int filter_loop(const resampler* r, const float* buf, int size, float* dst, int max_out, int* pos, int* phase, Dot dot)
+{
+    const int taps = r->taps;
+    const int phases = r->phases;
+    const int step_int = r->step / phases;
+    const int step_frac = r->step % phases;
+    const float* coeffs = &r->coeffs[0];
+    int p = *pos, ph = *phase, n = 0;
+    while (n < max_out && p + taps <= size) {
+        dst[n++] = dot(coeffs + (size_t)ph * taps, buf + p, taps);
+        p += step_int;
+        ph += step_frac;
+        if (ph >= phases) {
+            ph -= phases;
+            p++;
+        }
+    }
+    *pos = p;
+    *phase = ph;
+    return n;
+}
+
+static ALWAYS_INLINE float dot_c(const float* a, const float* b, int n)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static int filter_c(const resampler* r, const float* buf, int size, float* dst, int max_out, int* pos, int* phase)
+{
+    return filter_loop(r, buf, size, dst, max_out, pos, phase, dot_c);
+}
+
+#if HAVE_X86
+#define AVX2 __attribute__((target("avx2,fma")))
+
+// n is a multiple of 8
+AVX2 static ALWAYS_INLINE float dot_avx2(const float* a, const float* b, int n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    if (i < n)
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+AVX2 static int filter_avx2(const resampler* r, const float* buf, int size, float* dst, int max_out, int* pos, int* phase)
+{
+    return filter_loop(r, buf, size, dst, max_out, pos, phase, dot_avx2);
+}
+#endif
+
+#if HAVE_NEON
+static ALWAYS_INLINE float dot_neon(const float* a, const float* b, int n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    for (int i = 0; i < n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1));
+}
+
+static int filter_neon(const resampler* r, const float* buf, int size, float* dst, int max_out, int* pos, int* phase)
+{
+    return filter_loop(r, buf, size, dst, max_out, pos, phase, dot_neon);
+}
+#endif
+
+static int force_c = 0;
+
+static filter_func select_filter(const char** name)
+{
+    *name = "c";
+    if (force_c)
+        return filter_c;
+#if HAVE_X86
+    static const int has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (has_avx2) {
+        *name = "avx2";
+        return filter_avx2;
+    }
+#elif HAVE_NEON
+    *name = "neon";
+    return filter_neon;
+#endif
+    return filter_c;
+}
+
+const char* resampler_impl()
+{
+    const char* name;
+    select_filter(&name);
+    return name;
+}
+
+void resampler_force_c(int force)
+{
+    force_c = force;
+}
+
+static int gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function of the first kind
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k = 1; k < 64 && term > sum * 1e-12; ++k) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+int resampler_init(resampler* r, int in_rate, int out_rate, int channels, int taps)
+{
+    if (in_rate <= 0 || out_rate <= 0 || channels <= 0)
+        return -1;
+    int g = gcd(in_rate, out_rate);
+    int phases = out_rate / g;
+    int step = in_rate / g;
+    if (phases > RESAMPLER_MAX_PHASES)
+        return -1;
+    if (taps <= 0)
+        taps = RESAMPLER_DEFAULT_TAPS;
+    taps = (taps + 7) & ~7;
+
+    r->in_rate = in_rate;
+    r->out_rate = out_rate;
+    r->channels = channels;
+    r->phases = phases;
+    r->step = step;
+    r->taps = taps;
+
+    // Kaiser design: the transition band the window allows for this length,
+    // placed just below the lower of the two Nyquist frequencies. Frequencies
+    // are relative to the input Nyquist frequency.
+    double beta = 0.1102 * (STOPBAND_DB - 8.7);
+    double transition = (STOPBAND_DB - 8) / (2.285 * taps * M_PI);
+    double nyquist = phases < step ? (double)phases / step : 1.0;
+    double cutoff = nyquist - transition / 2;
+    if (cutoff < nyquist / 2)
+        cutoff = nyquist / 2;
+
+    // Prototype filter at the upsampled rate, centered on (taps / 2) * L so the
+    // delay is exactly taps / 2 input samples
+    int length = taps * phases;
+    double center = (double)(taps / 2) * phases;
+    std::vector<double> proto(length);
+    double i0_beta = bessel_i0(beta);
+    for (int j = 0; j < length; ++j) {
+        double x = (j - center) / phases;
+        double ratio = x / (taps / 2);
+        double window = fabs(ratio) < 1 ? bessel_i0(beta * sqrt(1 - ratio * ratio)) / i0_beta : 0;
+        double sinc = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+        proto[j] = cutoff * sinc * window;
+    }
+
+    // Split into phases, reversed so the inner loop walks the input forward,
+    // and normalize each phase to unity DC gain
+    r->coeffs.assign((size_t)phases * taps, 0.0f);
+    for (int p = 0; p < phases; ++p) {
+        double sum = 0;
+        for (int k = 0; k < taps; ++k)
+            sum += proto[p + k * phases];
+        float* c = &r->coeffs[(size_t)p * taps];
+        for (int k = 0; k < taps; ++k)
+            c[taps - 1 - k] = (float)(proto[p + k * phases] / sum);
+    }
+
+    // taps / 2 - 1 samples of silence in front align output 0 with input 0
+    r->history.assign(channels, std::vector<float>(taps / 2 - 1, 0.0f));
+    r->pos = 0;
+    r->phase = 0;
+    r->in_count = 0;
+    r->out_count = 0;
+    return 0;
+}
+
+int resampler_max_output(const resampler* r, int nb_in)
+{
+    int64_t avail = (int64_t)r->history[0].size() - r->pos + nb_in;
+    return (int)(avail * r->phases / r->step + 1);
+}
+
+// Run the filter over the pending history, at most max_out and at most
+// limit - out_count samples per channel, then drop the consumed input
+static int run_filter(resampler* r, float* const* out, int max_out, int64_t limit)
+{
+    const char* name;
+    filter_func filter = select_filter(&name);
+    if (limit - r->out_count < max_out)
+        max_out = (int)(limit - r->out_count);
+
+    // every channel starts from the same state and ends in the same state
+    int produced = 0;
+    int pos = r->pos;
+    int phase = r->phase;
+    for (int c = 0; c < r->channels; ++c) {
+        pos = r->pos;
+        phase = r->phase;
+        produced = filter(r, r->history[c].data(), (int)r->history[c].size(), out[c], max_out, &pos, &phase);
+    }
+
+    // with strong downsampling the next window may start past the buffer end
+    int size = (int)r->history[0].size();
+    int drop = pos < size ? pos : size;
+    for (int c = 0; c < r->channels; ++c)
+        r->history[c].erase(r->history[c].begin(), r->history[c].begin() + drop);
+    r->pos = pos - drop;
+    r->phase = phase;
+    r->out_count += produced;
+    return produced;
+}
+
+int resampler_process(resampler* r, float* const* out, int max_out, const float* const* in, int nb_in)
+{
+    for (int c = 0; c < r->channels; ++c)
+        r->history[c].insert(r->history[c].end(), in[c], in[c] + nb_in);
+    r->in_count += nb_in;
+    return run_filter(r, out, max_out, INT64_MAX);
+}
+
+int resampler_flush(resampler* r, float* const* out, int max_out)
+{
+    // enough silence behind the last input sample to fill the last window
+    for (int c = 0; c < r->channels; ++c)
+        r->history[c].resize(r->history[c].size() + r->taps, 0.0f);
+    int64_t total = (r->in_count * r->phases + r->step - 1) / r->step;
+    return run_filter(r, out, max_out, total);
+}
@@ -0,0 +1,61 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+
+#include <vector>
+
+// Rational polyphase FIR resampler on planar float audio (FLTP), used to
+// bring 44.1 kHz and 48 kHz sources to the encoder rate without
+// libswresample.
+//
+// The rate ratio is reduced to L/M, and a Kaiser windowed sinc with taps * L
+// coefficients is split into L phases of taps coefficients each. Output
+// sample n is one dot product of the phase (n * M) % L with the taps input
+// samples ending at (n * M) / L, with AVX2+FMA (picked at runtime) or NEON
+// inner loops. The history and phase are kept between calls, so the input
+// can be fed in chunks of any size, and the output is aligned with the input
+// (no group delay to trim).
+
+#define RESAMPLER_MAX_PHASES 4096
+#define RESAMPLER_DEFAULT_TAPS 64
+
+struct resampler {
+    int in_rate;
+    int out_rate;
+    int channels;
+    int phases; // L
+    int step; // M
+    int taps; // per phase, a multiple of 8
+    std::vector<float> coeffs; // phases * taps, each phase stored reversed
+    std::vector<std::vector<float> > history; // per channel, pending input
+    int pos; // start of the next dot product in history
+    int phase;
+    int64_t in_count;
+    int64_t out_count;
+};
+
+// Returns 0 on success, -1 for unsupported rates or channel counts.
+// taps is rounded up to a multiple of 8, more taps give a narrower transition
+// band, 0 selects RESAMPLER_DEFAULT_TAPS.
+int resampler_init(resampler* r, int in_rate, int out_rate, int channels, int taps);
+
+// Upper bound of the output produced by feeding nb_in more samples
+int resampler_max_output(const resampler* r, int nb_in);
+
+// Feed nb_in samples per channel and write up to max_out resampled samples
+// per channel to out. Returns the number of samples written; input that
+// could not be turned into output yet stays in the history.
+int resampler_process(resampler* r, float* const* out, int max_out, const float* const* in, int nb_in);
+
+// Drain the filter at the end of the stream, so that the total output is
+// in_count * out_rate / in_rate samples. Returns the number of samples written.
+int resampler_flush(resampler* r, float* const* out, int max_out);
+
+// Name of the kernel in use: "avx2", "neon" or "c"
+const char* resampler_impl();
+
+// Force the portable C kernel, for benchmarking and cross-checking
+void resampler_force_c(int force);
+
+#endif
@@ -0,0 +1,140 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "resample.h"
+
+// Benchmark and quality check of the polyphase resampler:
+//  - throughput in channel-seconds of input per wall second, SIMD and C
+//  - THD+N of resampled sine tones against the exact sine at the output rate
+//  - chunked (streaming) output must match one-shot output bit for bit
+
+#define BENCH_CHANNELS 2
+#define BENCH_SECONDS 60
+#define BENCH_CHUNK 1024
+#define TONE_AMPLITUDE 0.5
+
+static double now_s()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::vector<float> make_tone(double freq, int rate, int64_t count)
+{
+    std::vector<float> tone(count);
+    for (int64_t i = 0; i < count; ++i)
+        tone[i] = (float)(TONE_AMPLITUDE * sin(2 * M_PI * freq * i / rate));
+    return tone;
+}
+
+// Resample a mono signal, chunk sizes cycle through chunks[]
+static std::vector<float> resample_mono(const std::vector<float>& in, int in_rate, int out_rate,
+    int taps, const int* chunks, int nb_chunks)
+{
+    resampler r;
+    std::vector<float> out;
+    if (resampler_init(&r, in_rate, out_rate, 1, taps) < 0)
+        return out;
+
+    std::vector<float> buf;
+    size_t pos = 0;
+    for (int k = 0; pos < in.size(); ++k) {
+        int n = chunks[k % nb_chunks];
+        if (n > (int)(in.size() - pos))
+            n = (int)(in.size() - pos);
+        buf.resize(resampler_max_output(&r, n));
+        const float* src = &in[pos];
+        float* dst = &buf[0];
+        int got = resampler_process(&r, &dst, (int)buf.size(), &src, n);
+        out.insert(out.end(), buf.begin(), buf.begin() + got);
+        pos += n;
+    }
+    buf.resize(resampler_max_output(&r, r.taps));
+    float* dst = &buf[0];
+    int got = resampler_flush(&r, &dst, (int)buf.size());
+    out.insert(out.end(), buf.begin(), buf.begin() + got);
+    return out;
+}
+
+static double throughput(int in_rate, int out_rate, int taps)
+{
+    resampler r;
+    if (resampler_init(&r, in_rate, out_rate, BENCH_CHANNELS, taps) < 0)
+        return 0;
+
+    std::vector<float> tone = make_tone(1000, in_rate, BENCH_CHUNK);
+    std::vector<std::vector<float> > out(BENCH_CHANNELS, std::vector<float>(resampler_max_output(&r, BENCH_CHUNK) + r.taps));
+    const float* in[BENCH_CHANNELS];
+    float* dst[BENCH_CHANNELS];
+    for (int c = 0; c < BENCH_CHANNELS; ++c) {
+        in[c] = &tone[0];
+        dst[c] = &out[c][0];
+    }
+
+    int64_t total = (int64_t)in_rate * BENCH_SECONDS;
+    double t = now_s();
+    for (int64_t done = 0; done < total; done += BENCH_CHUNK)
+        resampler_process(&r, dst, (int)out[0].size(), in, BENCH_CHUNK);
+    double elapsed = now_s() - t;
+    return (double)BENCH_SECONDS * BENCH_CHANNELS / elapsed;
+}
+
+// THD+N in dB of a resampled tone against the exact tone at the output rate.
+// The filter edges at the start and end of the signal are left out.
+static double thd_n(const std::vector<float>& out, double freq, int out_rate, int skip)
+{
+    double signal = 0, noise = 0;
+    for (size_t i = skip; i + skip < out.size(); ++i) {
+        double ref = TONE_AMPLITUDE * sin(2 * M_PI * freq * i / out_rate);
+        signal += ref * ref;
+        noise += (out[i] - ref) * (out[i] - ref);
+    }
+    return 10 * log10(noise / signal);
+}
+
+int main(int argc, char* argv[])
+{
+    // Usage: resampleBench [taps]
+    int taps = argc > 1 ? atoi(argv[1]) : RESAMPLER_DEFAULT_TAPS;
+    static const int rates[][2] = { { 44100, 48000 }, { 48000, 44100 } };
+    static const double tones[] = { 1000, 10000, 16000 };
+    static const int one_shot[] = { 1 << 30 };
+    static const int chunks[] = { 1, 7, 480, 1024, 4096, 333 };
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i) {
+        int in_rate = rates[i][0];
+        int out_rate = rates[i][1];
+
+        resampler_force_c(1);
+        double c_speed = throughput(in_rate, out_rate, taps);
+        resampler_force_c(0);
+        double simd_speed = throughput(in_rate, out_rate, taps);
+        printf("%d -> %d, %d taps: %s %.0f, c %.0f channel-seconds/s\n",
+            in_rate, out_rate, (taps + 7) & ~7, resampler_impl(), simd_speed, c_speed);
+
+        for (size_t k = 0; k < sizeof(tones) / sizeof(tones[0]); ++k) {
+            std::vector<float> tone = make_tone(tones[k], in_rate, in_rate * 2);
+            std::vector<float> whole = resample_mono(tone, in_rate, out_rate, taps, one_shot, 1);
+            std::vector<float> chunked = resample_mono(tone, in_rate, out_rate, taps, chunks, sizeof(chunks) / sizeof(chunks[0]));
+
+            resampler_force_c(1);
+            std::vector<float> reference = resample_mono(tone, in_rate, out_rate, taps, one_shot, 1);
+            resampler_force_c(0);
+            double max_diff = 0;
+            for (size_t n = 0; n < whole.size() && n < reference.size(); ++n)
+                max_diff = fmax(max_diff, fabs(whole[n] - reference[n]));
+
+            int64_t expected = ((int64_t)tone.size() * out_rate + in_rate - 1) / in_rate;
+            int ok = whole == chunked && (int64_t)whole.size() == expected;
+            printf("  %5.0f Hz: THD+N %7.1f dB, %zu samples, chunked %s, max diff vs c %.2g\n",
+                tones[k], thd_n(whole, tones[k], out_rate, taps), whole.size(), ok ? "identical" : "MISMATCH", max_diff);
+            if (!ok)
+                failed++;
+        }
+    }
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,166 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+};
+
+#include "sample_convert.h"
+
+// Microbenchmark of sample_convert() against libswresample doing the same
+// format-only conversion (no resampling, no remixing). Every case is also
+// cross-checked against the portable C kernels, which must match bit for
+// bit, and against swr, where the largest difference is reported.
+
+#define BENCH_RATE 48000
+#define BENCH_FRAMES 1024 // one typical encoder frame per call
+
+struct bench_case {
+    enum AVSampleFormat src_fmt;
+    enum AVSampleFormat dst_fmt;
+};
+
+static const bench_case cases[] = {
+    { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_FLTP },
+    { AV_SAMPLE_FMT_S32, AV_SAMPLE_FMT_FLTP },
+    { AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP },
+    { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S16P },
+    { AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16 },
+    { AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT },
+    { AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S32 },
+    { AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S16 },
+    { AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_S16 },
+    { AV_SAMPLE_FMT_S32, AV_SAMPLE_FMT_S16 },
+    { AV_SAMPLE_FMT_S32, AV_SAMPLE_FMT_FLT },
+    { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_FLT },
+    { AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_S32 },
+    { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S32 },
+};
+
+static double now_s()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One buffer per plane (a single one for interleaved formats), AVFrame style
+struct sample_buffer {
+    std::vector<std::vector<uint8_t> > planes;
+    std::vector<uint8_t*> ptrs;
+
+    sample_buffer(enum AVSampleFormat fmt, int channels, int frames)
+    {
+        int planar = av_sample_fmt_is_planar(fmt);
+        int count = planar ? channels : 1;
+        size_t bytes = (size_t)frames * av_get_bytes_per_sample(fmt) * (planar ? 1 : channels);
+        planes.resize(count, std::vector<uint8_t>(bytes));
+        for (int i = 0; i < count; ++i)
+            ptrs.push_back(&planes[i][0]);
+    }
+};
+
+static void fill_random(sample_buffer* buf, enum AVSampleFormat fmt)
+{
+    for (size_t p = 0; p < buf->planes.size(); ++p) {
+        std::vector<uint8_t>& plane = buf->planes[p];
+        if (av_get_packed_sample_fmt(fmt) == AV_SAMPLE_FMT_FLT) {
+            // a little beyond full scale so the clipping paths get exercised
+            float* f = (float*)&plane[0];
+            for (size_t i = 0; i < plane.size() / 4; ++i)
+                f[i] = (rand() / (float)RAND_MAX) * 2.2f - 1.1f;
+        } else {
+            for (size_t i = 0; i < plane.size(); ++i)
+                plane[i] = rand();
+        }
+    }
+}
+
+// Largest difference between two buffers, in units of the format
+static double max_diff(const sample_buffer& a, const sample_buffer& b, enum AVSampleFormat fmt)
+{
+    double diff = 0;
+    enum AVSampleFormat packed = av_get_packed_sample_fmt(fmt);
+    for (size_t p = 0; p < a.planes.size(); ++p) {
+        const uint8_t* x = &a.planes[p][0];
+        const uint8_t* y = &b.planes[p][0];
+        size_t count = a.planes[p].size() / av_get_bytes_per_sample(fmt);
+        for (size_t i = 0; i < count; ++i) {
+            double d;
+            if (packed == AV_SAMPLE_FMT_S16)
+                d = fabs((double)((const int16_t*)x)[i] - ((const int16_t*)y)[i]);
+            else if (packed == AV_SAMPLE_FMT_S32)
+                d = fabs((double)((const int32_t*)x)[i] - ((const int32_t*)y)[i]);
+            else
+                d = fabs((double)((const float*)x)[i] - ((const float*)y)[i]);
+            if (d > diff)
+                diff = d;
+        }
+    }
+    return diff;
+}
+
+static int run_case(const bench_case& c, int channels, int iterations)
+{
+    sample_buffer src(c.src_fmt, channels, BENCH_FRAMES);
+    sample_buffer out_simd(c.dst_fmt, channels, BENCH_FRAMES);
+    sample_buffer out_c(c.dst_fmt, channels, BENCH_FRAMES);
+    sample_buffer out_swr(c.dst_fmt, channels, BENCH_FRAMES);
+    fill_random(&src, c.src_fmt);
+
+    int64_t layout = av_get_default_channel_layout(channels);
+    SwrContext* swr = swr_alloc_set_opts(NULL, layout, c.dst_fmt, BENCH_RATE, layout, c.src_fmt, BENCH_RATE, 0, NULL);
+    if (!swr || swr_init(swr) < 0) {
+        printf("Failed to initialize libswresample\n");
+        swr_free(&swr);
+        return -1;
+    }
+
+    const uint8_t* const* in = (const uint8_t* const*)&src.ptrs[0];
+    double samples = (double)BENCH_FRAMES * channels * iterations;
+
+    sample_convert_force_c(1);
+    double t = now_s();
+    for (int i = 0; i < iterations; ++i)
+        sample_convert(&out_c.ptrs[0], c.dst_fmt, in, c.src_fmt, channels, BENCH_FRAMES);
+    double c_sec = now_s() - t;
+
+    sample_convert_force_c(0);
+    t = now_s();
+    for (int i = 0; i < iterations; ++i)
+        sample_convert(&out_simd.ptrs[0], c.dst_fmt, in, c.src_fmt, channels, BENCH_FRAMES);
+    double simd_sec = now_s() - t;
+
+    t = now_s();
+    for (int i = 0; i < iterations; ++i)
+        swr_convert(swr, &out_swr.ptrs[0], BENCH_FRAMES, (const uint8_t**)&src.ptrs[0], BENCH_FRAMES);
+    double swr_sec = now_s() - t;
+    swr_free(&swr);
+
+    int exact = out_simd.planes == out_c.planes;
+    printf("%d ch %-5s -> %-5s  %-5s %8.1f  c %8.1f  swr %8.1f Msamples/s  %5.2fx vs swr  %s  swr max diff %g\n",
+        channels, av_get_sample_fmt_name(c.src_fmt), av_get_sample_fmt_name(c.dst_fmt), sample_convert_impl(),
+        samples / simd_sec / 1e6, samples / c_sec / 1e6, samples / swr_sec / 1e6, swr_sec / simd_sec,
+        exact ? "exact" : "MISMATCH", max_diff(out_simd, out_swr, c.dst_fmt));
+    return exact ? 0 : -1;
+}
+
+int main(int argc, char* argv[])
+{
+    // Usage: sampleConvertBench [iterations]
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    static const int channel_counts[] = { 2, 6, 8 };
+
+    int failed = 0;
+    for (size_t ch = 0; ch < sizeof(channel_counts) / sizeof(channel_counts[0]); ++ch) {
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+            if (run_case(cases[i], channel_counts[ch], iterations) < 0)
+                failed++;
+        }
+    }
+    return failed ? -1 : 0;
+}
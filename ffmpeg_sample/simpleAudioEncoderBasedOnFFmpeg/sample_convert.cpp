@@ -0,0 +1,747 @@
+#include "sample_convert.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+extern "C" {
+#include <libavutil/error.h>
+};
+
+// frames per chunk, the scratch buffer stays in L1 even at 16 channels
+#define CHUNK_FRAMES 256
+
+struct convert_kernels {
+    const char* name;
+    void (*s16_to_flt)(float* dst, const int16_t* src, int n);
+    void (*s32_to_flt)(float* dst, const int32_t* src, int n);
+    void (*flt_to_s16)(int16_t* dst, const float* src, int n);
+    void (*flt_to_s32)(int32_t* dst, const float* src, int n);
+    void (*s32_to_s16)(int16_t* dst, const int32_t* src, int n);
+    void (*s16_to_s32)(int32_t* dst, const int16_t* src, int n);
+    void (*deinterleave_32)(float* const* dst, const float* src, int channels, int n);
+    void (*interleave_32)(float* dst, const float* const* src, int channels, int n);
+    void (*deinterleave_16)(int16_t* const* dst, const int16_t* src, int channels, int n);
+    void (*interleave_16)(int16_t* dst, const int16_t* const* src, int channels, int n);
+};
+
+// ---------------------------------------------------------------------------
+// C kernels, also the tail handling of the SIMD ones
+
+static inline int16_t flt_to_s16_1(float x)
+{
+    float v = x * 32768.0f;
+    if (v >= 32767.0f)
+        return 32767;
+    if (v <= -32768.0f)
+        return -32768;
+    return (int16_t)lrintf(v);
+}
+
+static inline int32_t flt_to_s32_1(float x)
+{
+    // x * 2^31 is exact in float, only the clipping needs care
+    float v = x * 2147483648.0f;
+    if (v >= 2147483648.0f)
+        return 2147483647;
+    if (v <= -2147483648.0f)
+        return -2147483647 - 1;
+    return (int32_t)lrintf(v);
+}
+
+static void s16_to_flt_c(float* dst, const int16_t* src, int n)
+{
+    for (int i = 0; i < n; ++i)
+        dst[i] = src[i] * (1.0f / 32768.0f);
+}
+
+static void s32_to_flt_c(float* dst, const int32_t* src, int n)
+{
+    for (int i = 0; i < n; ++i)
+        dst[i] = src[i] * (1.0f / 2147483648.0f);
+}
+
+static void flt_to_s16_c(int16_t* dst, const float* src, int n)
+{
+    for (int i = 0; i < n; ++i)
+        dst[i] = flt_to_s16_1(src[i]);
+}
+
+static void flt_to_s32_c(int32_t* dst, const float* src, int n)
+{
+    for (int i = 0; i < n; ++i)
+        dst[i] = flt_to_s32_1(src[i]);
+}
+
+static void s32_to_s16_c(int16_t* dst, const int32_t* src, int n)
+{
+    for (int i = 0; i < n; ++i)
+        dst[i] = src[i] >> 16;
+}
+
+static void s16_to_s32_c(int32_t* dst, const int16_t* src, int n)
+{
+    for (int i = 0; i < n; ++i)
+        dst[i] = (int32_t)((uint32_t)src[i] << 16);
+}
+
+template <typename T>
+static void deinterleave_c(T* const* dst, const T* src, int channels, int n)
+{
+    for (int i = 0; i < n; ++i, src += channels)
+        for (int c = 0; c < channels; ++c)
+            dst[c][i] = src[c];
+}
+
+template <typename T>
+static void interleave_c(T* dst, const T* const* src, int channels, int n)
+{
+    for (int i = 0; i < n; ++i, dst += channels)
+        for (int c = 0; c < channels; ++c)
+            dst[c] = src[c][i];
+}
+
+static void deinterleave_32_c(float* const* dst, const float* src, int channels, int n)
+{
+    deinterleave_c(dst, src, channels, n);
+}
+
+static void interleave_32_c(float* dst, const float* const* src, int channels, int n)
+{
+    interleave_c(dst, src, channels, n);
+}
+
+static void deinterleave_16_c(int16_t* const* dst, const int16_t* src, int channels, int n)
+{
+    deinterleave_c(dst, src, channels, n);
+}
+
+static void interleave_16_c(int16_t* dst, const int16_t* const* src, int channels, int n)
+{
+    interleave_c(dst, src, channels, n);
+}
+
+static const convert_kernels kernels_c = {
+    "c",
+    s16_to_flt_c,
+    s32_to_flt_c,
+    flt_to_s16_c,
+    flt_to_s32_c,
+    s32_to_s16_c,
+    s16_to_s32_c,
+    deinterleave_32_c,
+    interleave_32_c,
+    deinterleave_16_c,
+    interleave_16_c,
+};
+
+// ---------------------------------------------------------------------------
+// AVX2 kernels, compiled with a target attribute so the rest of the sample
+// does not need -mavx2 and still runs on older CPUs.
+
+#if HAVE_X86
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void s16_to_flt_avx2(float* dst, const int16_t* src, int n)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+    }
+    s16_to_flt_c(dst + i, src + i, n - i);
+}
+
+AVX2 static void s32_to_flt_avx2(float* dst, const int32_t* src, int n)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    s32_to_flt_c(dst + i, src + i, n - i);
+}
+
+AVX2 static void flt_to_s16_avx2(int16_t* dst, const float* src, int n)
+{
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    const __m256 vmax = _mm256_set1_ps(32767.0f);
+    const __m256 vmin = _mm256_set1_ps(-32768.0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale);
+        a = _mm256_max_ps(_mm256_min_ps(a, vmax), vmin);
+        b = _mm256_max_ps(_mm256_min_ps(b, vmax), vmin);
+        // packs works per 128 bit lane, the permute restores sample order
+        __m256i v = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(v, 0xD8));
+    }
+    flt_to_s16_c(dst + i, src + i, n - i);
+}
+
+AVX2 static void flt_to_s32_avx2(int32_t* dst, const float* src, int n)
+{
+    const __m256 scale = _mm256_set1_ps(2147483648.0f);
+    const __m256i vmax = _mm256_set1_epi32(2147483647);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+        // cvtps returns INT32_MIN on overflow, which is right for negative
+        // values only, positive overflow is patched to INT32_MAX
+        __m256i r = _mm256_cvtps_epi32(v);
+        __m256 over = _mm256_cmp_ps(v, scale, _CMP_GE_OQ);
+        r = _mm256_blendv_epi8(r, vmax, _mm256_castps_si256(over));
+        _mm256_storeu_si256((__m256i*)(dst + i), r);
+    }
+    flt_to_s32_c(dst + i, src + i, n - i);
+}
+
+AVX2 static void s32_to_s16_avx2(int16_t* dst, const int32_t* src, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(src + i)), 16);
+        __m256i b = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(src + i + 8)), 16);
+        __m256i v = _mm256_packs_epi32(a, b);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(v, 0xD8));
+    }
+    s32_to_s16_c(dst + i, src + i, n - i);
+}
+
+AVX2 static void s16_to_s32_avx2(int32_t* dst, const int16_t* src, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_slli_epi32(v, 16));
+    }
+    s16_to_s32_c(dst + i, src + i, n - i);
+}
+
+AVX2 static inline void transpose8_ps(__m256* r)
+{
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+    __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+    __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+    __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+AVX2 static void deinterleave_32_avx2(float* const* dst, const float* src, int channels, int n)
+{
+    int i = 0;
+    if (channels == 2) {
+        const __m256i idx = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+        for (; i + 8 <= n; i += 8, src += 16) {
+            __m256 a = _mm256_permutevar8x32_ps(_mm256_loadu_ps(src), idx);
+            __m256 b = _mm256_permutevar8x32_ps(_mm256_loadu_ps(src + 8), idx);
+            _mm256_storeu_ps(dst[0] + i, _mm256_permute2f128_ps(a, b, 0x20));
+            _mm256_storeu_ps(dst[1] + i, _mm256_permute2f128_ps(a, b, 0x31));
+        }
+    } else if (channels == 8) {
+        __m256 r[8];
+        for (; i + 8 <= n; i += 8, src += 64) {
+            for (int k = 0; k < 8; ++k)
+                r[k] = _mm256_loadu_ps(src + 8 * k);
+            transpose8_ps(r);
+            for (int c = 0; c < 8; ++c)
+                _mm256_storeu_ps(dst[c] + i, r[c]);
+        }
+    } else if (channels > 2) {
+        const __m256i idx = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(channels));
+        for (; i + 8 <= n; i += 8, src += 8 * channels) {
+            for (int c = 0; c < channels; ++c)
+                _mm256_storeu_ps(dst[c] + i, _mm256_i32gather_ps(src + c, idx, 4));
+        }
+    }
+
+    float* tail[SAMPLE_CONVERT_MAX_CHANNELS];
+    for (int c = 0; c < channels; ++c)
+        tail[c] = dst[c] + i;
+    deinterleave_32_c(tail, src, channels, n - i);
+}
+
+AVX2 static void interleave_32_avx2(float* dst, const float* const* src, int channels, int n)
+{
+    int i = 0;
+    if (channels == 2) {
+        for (; i + 8 <= n; i += 8, dst += 16) {
+            __m256 l = _mm256_loadu_ps(src[0] + i);
+            __m256 r = _mm256_loadu_ps(src[1] + i);
+            __m256 lo = _mm256_unpacklo_ps(l, r);
+            __m256 hi = _mm256_unpackhi_ps(l, r);
+            _mm256_storeu_ps(dst, _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+    } else if (channels == 8) {
+        __m256 r[8];
+        for (; i + 8 <= n; i += 8, dst += 64) {
+            for (int c = 0; c < 8; ++c)
+                r[c] = _mm256_loadu_ps(src[c] + i);
+            transpose8_ps(r);
+            for (int k = 0; k < 8; ++k)
+                _mm256_storeu_ps(dst + 8 * k, r[k]);
+        }
+    }
+
+    const float* tail[SAMPLE_CONVERT_MAX_CHANNELS];
+    for (int c = 0; c < channels; ++c)
+        tail[c] = src[c] + i;
+    interleave_32_c(dst, tail, channels, n - i);
+}
+
+AVX2 static void deinterleave_16_avx2(int16_t* const* dst, const int16_t* src, int channels, int n)
+{
+    int i = 0;
+    if (channels == 2) {
+        // even samples to the low half of each lane, odd ones to the high half
+        const __m256i shuf = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15,
+            0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15);
+        for (; i + 8 <= n; i += 8, src += 16) {
+            __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)src), shuf);
+            v = _mm256_permute4x64_epi64(v, 0xD8);
+            _mm_storeu_si128((__m128i*)(dst[0] + i), _mm256_castsi256_si128(v));
+            _mm_storeu_si128((__m128i*)(dst[1] + i), _mm256_extracti128_si256(v, 1));
+        }
+    }
+
+    int16_t* tail[SAMPLE_CONVERT_MAX_CHANNELS];
+    for (int c = 0; c < channels; ++c)
+        tail[c] = dst[c] + i;
+    deinterleave_16_c(tail, src, channels, n - i);
+}
+
+AVX2 static void interleave_16_avx2(int16_t* dst, const int16_t* const* src, int channels, int n)
+{
+    int i = 0;
+    if (channels == 2) {
+        for (; i + 8 <= n; i += 8, dst += 16) {
+            __m128i l = _mm_loadu_si128((const __m128i*)(src[0] + i));
+            __m128i r = _mm_loadu_si128((const __m128i*)(src[1] + i));
+            _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(l, r));
+            _mm_storeu_si128((__m128i*)(dst + 8), _mm_unpackhi_epi16(l, r));
+        }
+    }
+
+    const int16_t* tail[SAMPLE_CONVERT_MAX_CHANNELS];
+    for (int c = 0; c < channels; ++c)
+        tail[c] = src[c] + i;
+    interleave_16_c(dst, tail, channels, n - i);
+}
+
+static const convert_kernels kernels_avx2 = {
+    "avx2",
+    s16_to_flt_avx2,
+    s32_to_flt_avx2,
+    flt_to_s16_avx2,
+    flt_to_s32_avx2,
+    s32_to_s16_avx2,
+    s16_to_s32_avx2,
+    deinterleave_32_avx2,
+    interleave_32_avx2,
+    deinterleave_16_avx2,
+    interleave_16_avx2,
+};
+#endif
+
+// ---------------------------------------------------------------------------
+// NEON kernels (AArch64, where NEON is always present)
+
+#if HAVE_NEON
+static void s16_to_flt_neon(float* dst, const int16_t* src, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), 1.0f / 32768.0f));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), 1.0f / 32768.0f));
+    }
+    s16_to_flt_c(dst + i, src + i, n - i);
+}
+
+static void s32_to_flt_neon(float* dst, const int32_t* src, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)), 1.0f / 2147483648.0f));
+    s32_to_flt_c(dst + i, src + i, n - i);
+}
+
+static void flt_to_s16_neon(int16_t* dst, const float* src, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        // round to nearest, then the saturating narrow does the clipping
+        int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 32768.0f));
+        int32x4_t b = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i + 4), 32768.0f));
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+    flt_to_s16_c(dst + i, src + i, n - i);
+}
+
+static void flt_to_s32_neon(int32_t* dst, const float* src, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        vst1q_s32(dst + i, vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 2147483648.0f)));
+    flt_to_s32_c(dst + i, src + i, n - i);
+}
+
+static void s32_to_s16_neon(int16_t* dst, const int32_t* src, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        vst1q_s16(dst + i, vcombine_s16(vshrn_n_s32(vld1q_s32(src + i), 16), vshrn_n_s32(vld1q_s32(src + i + 4), 16)));
+    s32_to_s16_c(dst + i, src + i, n - i);
+}
+
+static void s16_to_s32_neon(int32_t* dst, const int16_t* src, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        vst1q_s32(dst + i, vshll_n_s16(vget_low_s16(v), 16));
+        vst1q_s32(dst + i + 4, vshll_n_s16(vget_high_s16(v), 16));
+    }
+    s16_to_s32_c(dst + i, src + i, n - i);
+}
+
+static void deinterleave_32_neon(float* const* dst, const float* src, int channels, int n)
+{
+    int i = 0;
+    if (channels == 2) {
+        for (; i + 4 <= n; i += 4, src += 8) {
+            float32x4x2_t v = vld2q_f32(src);
+            vst1q_f32(dst[0] + i, v.val[0]);
+            vst1q_f32(dst[1] + i, v.val[1]);
+        }
+    } else if (channels == 4 || channels == 8) {
+        // 8 channels as two interleaved groups of 4 with a stride of 8
+        for (; i + 4 <= n; i += 4, src += 4 * channels) {
+            for (int g = 0; g < channels; g += 4) {
+                float32x4_t f[4];
+                for (int k = 0; k < 4; ++k)
+                    f[k] = vld1q_f32(src + k * channels + g);
+                float32x4x2_t t01 = vtrnq_f32(f[0], f[1]);
+                float32x4x2_t t23 = vtrnq_f32(f[2], f[3]);
+                vst1q_f32(dst[g + 0] + i, vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0])));
+                vst1q_f32(dst[g + 1] + i, vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1])));
+                vst1q_f32(dst[g + 2] + i, vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0])));
+                vst1q_f32(dst[g + 3] + i, vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1])));
+            }
+        }
+    }
+
+    float* tail[SAMPLE_CONVERT_MAX_CHANNELS];
+    for (int c = 0; c < channels; ++c)
+        tail[c] = dst[c] + i;
+    deinterleave_32_c(tail, src, channels, n - i);
+}
+
+static void interleave_32_neon(float* dst, const float* const* src, int channels, int n)
+{
+    int i = 0;
+    if (channels == 2) {
+        for (; i + 4 <= n; i += 4, dst += 8) {
+            float32x4x2_t v = { { vld1q_f32(src[0] + i), vld1q_f32(src[1] + i) } };
+            vst2q_f32(dst, v);
+        }
+    } else if (channels == 4) {
+        for (; i + 4 <= n; i += 4, dst += 16) {
+            float32x4x4_t v = { { vld1q_f32(src[0] + i), vld1q_f32(src[1] + i), vld1q_f32(src[2] + i), vld1q_f32(src[3] + i) } };
+            vst4q_f32(dst, v);
+        }
+    }
+
+    const float* tail[SAMPLE_CONVERT_MAX_CHANNELS];
+    for (int c = 0; c < channels; ++c)
+        tail[c] = src[c] + i;
+    interleave_32_c(dst, tail, channels, n - i);
+}
+
+static void deinterleave_16_neon(int16_t* const* dst, const int16_t* src, int channels, int n)
+{
+    int i = 0;
+    if (channels == 2) {
+        for (; i + 8 <= n; i += 8, src += 16) {
+            int16x8x2_t v = vld2q_s16(src);
+            vst1q_s16(dst[0] + i, v.val[0]);
+            vst1q_s16(dst[1] + i, v.val[1]);
+        }
+    } else if (channels == 4) {
+        for (; i + 8 <= n; i += 8, src += 32) {
+            int16x8x4_t v = vld4q_s16(src);
+            for (int c = 0; c < 4; ++c)
+                vst1q_s16(dst[c] + i, v.val[c]);
+        }
+    }
+
+    int16_t* tail[SAMPLE_CONVERT_MAX_CHANNELS];
+    for (int c = 0; c < channels; ++c)
+        tail[c] = dst[c] + i;
+    deinterleave_16_c(tail, src, channels, n - i);
+}
+
+static void interleave_16_neon(int16_t* dst, const int16_t* const* src, int channels, int n)
+{
+    int i = 0;
+    if (channels == 2) {
+        for (; i + 8 <= n; i += 8, dst += 16) {
+            int16x8x2_t v = { { vld1q_s16(src[0] + i), vld1q_s16(src[1] + i) } };
+            vst2q_s16(dst, v);
+        }
+    } else if (channels == 4) {
+        for (; i + 8 <= n; i += 8, dst += 32) {
+            int16x8x4_t v = { { vld1q_s16(src[0] + i), vld1q_s16(src[1] + i), vld1q_s16(src[2] + i), vld1q_s16(src[3] + i) } };
+            vst4q_s16(dst, v);
+        }
+    }
+
+    const int16_t* tail[SAMPLE_CONVERT_MAX_CHANNELS];
+    for (int c = 0; c < channels; ++c)
+        tail[c] = src[c] + i;
+    interleave_16_c(dst, tail, channels, n - i);
+}
+
+static const convert_kernels kernels_neon = {
+    "neon",
+    s16_to_flt_neon,
+    s32_to_flt_neon,
+    flt_to_s16_neon,
+    flt_to_s32_neon,
+    s32_to_s16_neon,
+    s16_to_s32_neon,
+    deinterleave_32_neon,
+    interleave_32_neon,
+    deinterleave_16_neon,
+    interleave_16_neon,
+};
+#endif
+
+// ---------------------------------------------------------------------------
+
+static int force_c = 0;
+
+static const convert_kernels* select_kernels()
+{
+    if (force_c)
+        return &kernels_c;
+#if HAVE_X86
+    static const int has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2)
+        return &kernels_avx2;
+#elif HAVE_NEON
+    return &kernels_neon;
+#endif
+    return &kernels_c;
+}
+
+const char* sample_convert_impl()
+{
+    return select_kernels()->name;
+}
+
+void sample_convert_force_c(int force)
+{
+    force_c = force;
+}
+
+// interleaved -> planar
+static int convert_to_planar(uint8_t* const* dst, enum AVSampleFormat dst_fmt,
+    const uint8_t* src, enum AVSampleFormat src_fmt, int channels, int nb_samples)
+{
+    const convert_kernels* k = select_kernels();
+    alignas(32) float scratch[CHUNK_FRAMES * SAMPLE_CONVERT_MAX_CHANNELS];
+    int src_bps = av_get_bytes_per_sample(src_fmt);
+
+    for (int done = 0; done < nb_samples; done += CHUNK_FRAMES) {
+        int n = nb_samples - done < CHUNK_FRAMES ? nb_samples - done : CHUNK_FRAMES;
+        int count = n * channels;
+        const uint8_t* in = src + (size_t)done * channels * src_bps;
+
+        if (dst_fmt == AV_SAMPLE_FMT_FLTP) {
+            float* planes[SAMPLE_CONVERT_MAX_CHANNELS];
+            for (int c = 0; c < channels; ++c)
+                planes[c] = (float*)dst[c] + done;
+
+            const float* flt = (const float*)in;
+            if (src_fmt == AV_SAMPLE_FMT_S16) {
+                k->s16_to_flt(scratch, (const int16_t*)in, count);
+                flt = scratch;
+            } else if (src_fmt == AV_SAMPLE_FMT_S32) {
+                k->s32_to_flt(scratch, (const int32_t*)in, count);
+                flt = scratch;
+            }
+            k->deinterleave_32(planes, flt, channels, n);
+        } else {
+            int16_t* planes[SAMPLE_CONVERT_MAX_CHANNELS];
+            for (int c = 0; c < channels; ++c)
+                planes[c] = (int16_t*)dst[c] + done;
+
+            const int16_t* s16 = (const int16_t*)in;
+            int16_t* tmp = (int16_t*)scratch;
+            if (src_fmt == AV_SAMPLE_FMT_S32) {
+                k->s32_to_s16(tmp, (const int32_t*)in, count);
+                s16 = tmp;
+            } else if (src_fmt == AV_SAMPLE_FMT_FLT) {
+                k->flt_to_s16(tmp, (const float*)in, count);
+                s16 = tmp;
+            }
+            k->deinterleave_16(planes, s16, channels, n);
+        }
+    }
+    return 0;
+}
+
+// planar -> interleaved
+static int convert_to_interleaved(uint8_t* dst, enum AVSampleFormat dst_fmt,
+    const uint8_t* const* src, enum AVSampleFormat src_fmt, int channels, int nb_samples)
+{
+    const convert_kernels* k = select_kernels();
+    alignas(32) float scratch[CHUNK_FRAMES * SAMPLE_CONVERT_MAX_CHANNELS];
+    int dst_bps = av_get_bytes_per_sample(dst_fmt);
+
+    for (int done = 0; done < nb_samples; done += CHUNK_FRAMES) {
+        int n = nb_samples - done < CHUNK_FRAMES ? nb_samples - done : CHUNK_FRAMES;
+        int count = n * channels;
+        uint8_t* out = dst + (size_t)done * channels * dst_bps;
+
+        if (src_fmt == AV_SAMPLE_FMT_FLTP) {
+            const float* planes[SAMPLE_CONVERT_MAX_CHANNELS];
+            for (int c = 0; c < channels; ++c)
+                planes[c] = (const float*)src[c] + done;
+
+            if (dst_fmt == AV_SAMPLE_FMT_FLT) {
+                k->interleave_32((float*)out, planes, channels, n);
+            } else {
+                k->interleave_32(scratch, planes, channels, n);
+                if (dst_fmt == AV_SAMPLE_FMT_S16)
+                    k->flt_to_s16((int16_t*)out, scratch, count);
+                else
+                    k->flt_to_s32((int32_t*)out, scratch, count);
+            }
+        } else {
+            const int16_t* planes[SAMPLE_CONVERT_MAX_CHANNELS];
+            for (int c = 0; c < channels; ++c)
+                planes[c] = (const int16_t*)src[c] + done;
+
+            if (dst_fmt == AV_SAMPLE_FMT_S16) {
+                k->interleave_16((int16_t*)out, planes, channels, n);
+            } else {
+                int16_t* tmp = (int16_t*)scratch;
+                k->interleave_16(tmp, planes, channels, n);
+                if (dst_fmt == AV_SAMPLE_FMT_S32)
+                    k->s16_to_s32((int32_t*)out, tmp, count);
+                else
+                    k->s16_to_flt((float*)out, tmp, count);
+            }
+        }
+    }
+    return 0;
+}
+
+// interleaved -> interleaved, one kernel per pair, no scratch needed
+static int convert_interleaved(uint8_t* dst, enum AVSampleFormat dst_fmt,
+    const uint8_t* src, enum AVSampleFormat src_fmt, int channels, int nb_samples)
+{
+    const convert_kernels* k = select_kernels();
+    int count = nb_samples * channels;
+
+    if (dst_fmt == AV_SAMPLE_FMT_FLT) {
+        if (src_fmt == AV_SAMPLE_FMT_S16)
+            k->s16_to_flt((float*)dst, (const int16_t*)src, count);
+        else
+            k->s32_to_flt((float*)dst, (const int32_t*)src, count);
+    } else if (dst_fmt == AV_SAMPLE_FMT_S16) {
+        if (src_fmt == AV_SAMPLE_FMT_FLT)
+            k->flt_to_s16((int16_t*)dst, (const float*)src, count);
+        else
+            k->s32_to_s16((int16_t*)dst, (const int32_t*)src, count);
+    } else {
+        if (src_fmt == AV_SAMPLE_FMT_FLT)
+            k->flt_to_s32((int32_t*)dst, (const float*)src, count);
+        else
+            k->s16_to_s32((int32_t*)dst, (const int16_t*)src, count);
+    }
+    return 0;
+}
+
+static int is_interleaved_fmt(enum AVSampleFormat fmt)
+{
+    return fmt == AV_SAMPLE_FMT_S16 || fmt == AV_SAMPLE_FMT_S32 || fmt == AV_SAMPLE_FMT_FLT;
+}
+
+static int is_planar_fmt(enum AVSampleFormat fmt)
+{
+    return fmt == AV_SAMPLE_FMT_FLTP || fmt == AV_SAMPLE_FMT_S16P;
+}
+
+int sample_convert_supported(enum AVSampleFormat dst_fmt, enum AVSampleFormat src_fmt)
+{
+    if (dst_fmt == src_fmt)
+        return is_interleaved_fmt(dst_fmt) || is_planar_fmt(dst_fmt);
+    // everything except planar -> planar
+    return (is_interleaved_fmt(src_fmt) && (is_interleaved_fmt(dst_fmt) || is_planar_fmt(dst_fmt)))
+        || (is_planar_fmt(src_fmt) && is_interleaved_fmt(dst_fmt));
+}
+
+int sample_convert(uint8_t* const* dst, enum AVSampleFormat dst_fmt,
+    const uint8_t* const* src, enum AVSampleFormat src_fmt,
+    int channels, int nb_samples)
+{
+    if (channels < 1 || channels > SAMPLE_CONVERT_MAX_CHANNELS || nb_samples < 0)
+        return AVERROR(EINVAL);
+
+    if (dst_fmt == src_fmt) {
+        int bps = av_get_bytes_per_sample(dst_fmt);
+        if (is_interleaved_fmt(dst_fmt)) {
+            memcpy(dst[0], src[0], (size_t)nb_samples * channels * bps);
+            return 0;
+        }
+        if (is_planar_fmt(dst_fmt)) {
+            for (int c = 0; c < channels; ++c)
+                memcpy(dst[c], src[c], (size_t)nb_samples * bps);
+            return 0;
+        }
+    }
+
+    if (!sample_convert_supported(dst_fmt, src_fmt))
+        return AVERROR(ENOSYS);
+    if (is_interleaved_fmt(dst_fmt) && is_interleaved_fmt(src_fmt))
+        return convert_interleaved(dst[0], dst_fmt, src[0], src_fmt, channels, nb_samples);
+    if (is_planar_fmt(dst_fmt))
+        return convert_to_planar(dst, dst_fmt, src[0], src_fmt, channels, nb_samples);
+    return convert_to_interleaved(dst[0], dst_fmt, src, src_fmt, channels, nb_samples);
+}
@@ -0,0 +1,37 @@
+#ifndef SAMPLE_CONVERT_H
+#define SAMPLE_CONVERT_H
+
+#include <stdint.h>
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+};
+
+#define SAMPLE_CONVERT_MAX_CHANNELS 16
+
+// Sample format conversion between the interleaved formats we read from disk
+// (S16, S32, FLT) and the planar formats encoders want (FLTP, S16P), in both
+// directions, and among the interleaved formats themselves. Planar to planar
+// is not handled. dst and src follow the AVFrame data[] layout: one pointer for
+// interleaved formats, one pointer per channel for planar ones, so the
+// output can be written straight into the encoder's frame.
+//
+// The conversion runs in small chunks through an L1 sized scratch buffer,
+// with AVX2 (picked at runtime) or NEON kernels for the scaling and the
+// (de)interleaving. Rounding and clipping match libswresample.
+//
+// Returns 0 on success, a negative AVERROR for unsupported conversions.
+int sample_convert(uint8_t* const* dst, enum AVSampleFormat dst_fmt,
+    const uint8_t* const* src, enum AVSampleFormat src_fmt,
+    int channels, int nb_samples);
+
+// Whether sample_convert() handles src_fmt -> dst_fmt
+int sample_convert_supported(enum AVSampleFormat dst_fmt, enum AVSampleFormat src_fmt);
+
+// Name of the kernel set in use: "avx2", "neon" or "c"
+const char* sample_convert_impl();
+
+// Force the portable C kernels, for benchmarking and cross-checking
+void sample_convert_force_c(int force);
+
+#endif
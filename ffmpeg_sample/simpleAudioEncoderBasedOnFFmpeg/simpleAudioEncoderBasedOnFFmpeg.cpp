@@ -1,4 +1,15 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define __STDC_CONSTANT_MACROS
 
@@ -7,135 +18,555 @@ extern "C" {
 #include <libavformat/avformat.h>
 };
 
-int flush_encoder(AVFormatContext* fmt_ctx, unsigned int stream_index) {
-    int ret;
-    int got_frame;
-    AVPacket enc_pkt;
-    if (!(fmt_ctx->streams[stream_index]->codec->codec->capabilities & CODEC_CAP_DELAY))
+#include "resample.h"
+#include "sample_convert.h"
+
+// Raw input defaults, WAV inputs carry their own format in the header
+#define DEFAULT_SAMPLE_RATE 44100
+#define DEFAULT_CHANNELS 2
+#define DEFAULT_ENCODER "libfdk_aac"
+
+// used when the encoder takes any frame size (frame_size == 0)
+#define DEFAULT_FRAME_SIZE 1024
+
+// input samples per channel fed to the resampler at a time
+#define RESAMPLE_CHUNK 4096
+
+struct audio_input {
+    std::string in_path;
+    std::string out_path;
+    std::vector<uint8_t> pcm; // interleaved, S16, S32 or FLT
+    enum AVSampleFormat sample_fmt;
+    int sample_rate;
+    int channels;
+};
+
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity_(capacity)
+    {
+    }
+
+    // Blocks while the queue is full
+    void push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return queue_.size() < capacity_; });
+        queue_.push_back(std::move(item));
+        not_empty_.notify_one();
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+        if (queue_.empty())
+            return false;
+        item = std::move(queue_.front());
+        queue_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<T> queue_;
+    size_t capacity_;
+    bool closed_ = false;
+};
+
+static uint32_t get_le32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get_le16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+// Strip a canonical RIFF/WAVE header in place, supports 16/32 bit integer
+// PCM and 32 bit float, plain or WAVE_FORMAT_EXTENSIBLE
+static int parse_wav(audio_input* input)
+{
+    std::vector<uint8_t>& buf = input->pcm;
+    if (buf.size() < 12 || memcmp(&buf[0], "RIFF", 4) || memcmp(&buf[8], "WAVE", 4))
         return 0;
 
-    while(1) {
-        enc_pkt.data = NULL;
-        enc_pkt.size = 0;
-        av_init_packet(&enc_pkt);
-        ret = avcodec_encode_audio2(fmt_ctx->streams[stream_index]->codec, &enc_pkt, NULL, &got_frame);
-        av_frame_free(NULL);
-        if (ret < 0)
-            break;
-        if (!got_frame) {
-            ret = 0;
-            break;
+    size_t pos = 12;
+    int have_fmt = 0;
+    while (pos + 8 <= buf.size()) {
+        uint32_t chunk_size = get_le32(&buf[pos + 4]);
+        const uint8_t* chunk = &buf[pos + 8];
+        if (!memcmp(&buf[pos], "fmt ", 4) && chunk_size >= 16) {
+            int tag = get_le16(chunk);
+            int bits = get_le16(chunk + 14);
+            if (tag == 0xFFFE && chunk_size >= 40)
+                tag = get_le16(chunk + 24); // sub format GUID starts with the tag
+            if (tag == 1 && bits == 16) {
+                input->sample_fmt = AV_SAMPLE_FMT_S16;
+            } else if (tag == 1 && bits == 32) {
+                input->sample_fmt = AV_SAMPLE_FMT_S32;
+            } else if (tag == 3 && bits == 32) {
+                input->sample_fmt = AV_SAMPLE_FMT_FLT;
+            } else {
+                printf("%s: unsupported WAV format %d, %d bits\n", input->in_path.c_str(), tag, bits);
+                return -1;
+            }
+            input->channels = get_le16(chunk + 2);
+            input->sample_rate = get_le32(chunk + 4);
+            if (input->channels < 1 || input->channels > SAMPLE_CONVERT_MAX_CHANNELS || input->sample_rate <= 0) {
+                printf("%s: invalid WAV header, %d channels at %d Hz\n", input->in_path.c_str(), input->channels, input->sample_rate);
+                return -1;
+            }
+            have_fmt = 1;
+        } else if (!memcmp(&buf[pos], "data", 4) && have_fmt) {
+            size_t size = std::min<size_t>(chunk_size, buf.size() - pos - 8);
+            buf.erase(buf.begin(), buf.begin() + pos + 8);
+            buf.resize(size);
+            return 0;
         }
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+    printf("%s: malformed WAV file\n", input->in_path.c_str());
+    return -1;
+}
 
-        printf("Flush Encoder: Succeed to encode 1 frame!\tsize:%5d\n", enc_pkt.size);
-        //mux encoded frame
-        ret = av_write_frame(fmt_ctx, &enc_pkt);
-        if (ret < 0)
-            break;
+static int load_audio_input(audio_input* input)
+{
+    FILE* in_file = fopen(input->in_path.c_str(), "rb");
+    if (in_file == NULL) {
+        printf("Failed to open input file %s\n", input->in_path.c_str());
+        return -1;
     }
-    return ret;
+
+    fseek(in_file, 0, SEEK_END);
+    long size = ftell(in_file);
+    fseek(in_file, 0, SEEK_SET);
+
+    input->pcm.resize(size > 0 ? size : 0);
+    input->sample_rate = DEFAULT_SAMPLE_RATE;
+    input->channels = DEFAULT_CHANNELS;
+    input->sample_fmt = AV_SAMPLE_FMT_S16;
+    size_t got = input->pcm.empty() ? 0 : fread(&input->pcm[0], 1, input->pcm.size(), in_file);
+    fclose(in_file);
+    if (got != input->pcm.size()) {
+        printf("Failed to read raw data!\n");
+        return -1;
+    }
+    return parse_wav(input);
 }
 
-int main()
+static int encode_write_frame(AVFormatContext* fmt_ctx, AVCodecContext* enc_ctx, AVStream* st, AVFrame* frame, int verbose)
 {
-    const char* out_file = "tdjm.aac";
-    FILE* in_file = fopen("tdjm.pcm", "rb");
+    int ret = avcodec_send_frame(enc_ctx, frame);
+    if (ret < 0)
+        return ret;
 
-    av_register_all();
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    while ((ret = avcodec_receive_packet(enc_ctx, &pkt)) >= 0) {
+        if (verbose)
+            printf("%s to encode 1 frame! \tsize:%5d\n", frame ? "Succeed" : "Flush Encoder: Succeed", pkt.size);
+        pkt.stream_index = st->index;
+        av_packet_rescale_ts(&pkt, enc_ctx->time_base, st->time_base);
+        ret = av_write_frame(fmt_ctx, &pkt);
+        av_packet_unref(&pkt);
+        if (ret < 0)
+            return ret;
+    }
+    return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
 
-    AVFormatContext* pFormatCtx = avformat_alloc_context();
-    AVOutputFormat* fmt = av_guess_format(NULL, out_file, NULL);
-    pFormatCtx->oformat = fmt;
+// Pick the encoder sample format: the input format when the encoder takes it
+// as is, otherwise the first of the preferred formats sample_convert() can
+// produce from the input.
+static enum AVSampleFormat choose_sample_fmt(const AVCodec* codec, enum AVSampleFormat in_fmt)
+{
+    const enum AVSampleFormat preferred[] = { in_fmt, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16P,
+        AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S32 };
+    if (!codec->sample_fmts)
+        return in_fmt;
+    for (size_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); ++i) {
+        for (const enum AVSampleFormat* p = codec->sample_fmts; *p != AV_SAMPLE_FMT_NONE; ++p) {
+            if (*p == preferred[i] && sample_convert_supported(*p, in_fmt))
+                return *p;
+        }
+    }
+    return AV_SAMPLE_FMT_NONE;
+}
 
-    if (avio_open(&pFormatCtx->pb, out_file, AVIO_FLAG_READ_WRITE) < 0) {
-        printf("Failed to open output file\n");
-        return -1;
+// Pick the encoder sample rate: the requested one, else the input rate when
+// the encoder supports it, else the closest supported rate above it (or the
+// highest one).
+static int choose_sample_rate(const AVCodec* codec, int in_rate, int requested)
+{
+    if (requested > 0)
+        return requested;
+    if (!codec->supported_samplerates)
+        return in_rate;
+    int above = 0, highest = 0;
+    for (const int* p = codec->supported_samplerates; *p; ++p) {
+        if (*p == in_rate)
+            return in_rate;
+        if (*p > in_rate && (above == 0 || *p < above))
+            above = *p;
+        if (*p > highest)
+            highest = *p;
     }
+    return above ? above : (highest ? highest : in_rate);
+}
 
-    AVStream* audio_st = avformat_new_stream(pFormatCtx, 0);
-    if (audio_st == NULL) {
+// Stream the input through the resampler in chunks, converting each chunk to
+// planar float first, the output is planar float at out_rate
+static int resample_input(const audio_input* input, int out_rate, int verbose, std::vector<std::vector<float> >* planes)
+{
+    resampler r;
+    if (resampler_init(&r, input->sample_rate, out_rate, input->channels, 0) < 0) {
+        printf("Can not resample %d Hz to %d Hz\n", input->sample_rate, out_rate);
         return -1;
     }
 
-    AVCodecContext* pCodecCtx;
-    pCodecCtx = audio_st->codec;
-    pCodecCtx->codec_id = fmt->audio_codec;
-    pCodecCtx->codec_type = AVMEDIA_TYPE_AUDIO;
-    pCodecCtx->sample_fmt = AV_SAMPLE_FMT_S16;
-    pCodecCtx->sample_rate = 44100;
-    pCodecCtx->channel_layout = AV_CH_LAYOUT_STEREO;
-    pCodecCtx->channels = av_get_channel_layout_nb_channels(pCodecCtx->channel_layout);
-    pCodecCtx->bit_rate = 64000;
+    const int channels = input->channels;
+    const size_t sample_bytes = (size_t)av_get_bytes_per_sample(input->sample_fmt) * channels;
+    const size_t total = input->pcm.size() / sample_bytes;
+    std::vector<std::vector<float> > chunk(channels, std::vector<float>(RESAMPLE_CHUNK));
+    std::vector<std::vector<float> > out(channels);
+    uint8_t* chunk_planes[SAMPLE_CONVERT_MAX_CHANNELS];
+    const float* in_planes[SAMPLE_CONVERT_MAX_CHANNELS];
+    float* out_planes[SAMPLE_CONVERT_MAX_CHANNELS];
+    for (int c = 0; c < channels; ++c) {
+        chunk_planes[c] = (uint8_t*)&chunk[c][0];
+        in_planes[c] = &chunk[c][0];
+    }
 
-    av_dump_format(pFormatCtx, 0, out_file, 1);
+    planes->assign(channels, std::vector<float>());
+    auto start = std::chrono::steady_clock::now();
+    size_t pos = 0;
+    for (;;) {
+        int n = (int)std::min<size_t>(RESAMPLE_CHUNK, total - pos);
+        int max_out = resampler_max_output(&r, n > 0 ? n : r.taps);
+        for (int c = 0; c < channels; ++c) {
+            out[c].resize(max_out);
+            out_planes[c] = &out[c][0];
+        }
 
-    //pCodec = avcodec_find_encoder(pCodecCtx->codec_id);
-    AVCodec* pCodec = avcodec_find_encoder_by_name("libfdk_aac");
+        // the empty chunk at the end drains the filter
+        int got;
+        if (n > 0) {
+            const uint8_t* src = &input->pcm[pos * sample_bytes];
+            sample_convert(chunk_planes, AV_SAMPLE_FMT_FLTP, &src, input->sample_fmt, channels, n);
+            got = resampler_process(&r, out_planes, max_out, in_planes, n);
+        } else {
+            got = resampler_flush(&r, out_planes, max_out);
+        }
+        for (int c = 0; c < channels; ++c)
+            (*planes)[c].insert((*planes)[c].end(), out[c].begin(), out[c].begin() + got);
+        if (n == 0)
+            break;
+        pos += n;
+    }
+
+    if (verbose) {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("resampled %d Hz -> %d Hz (%s, %d taps): %.0f channel-seconds/s\n", input->sample_rate, out_rate,
+            resampler_impl(), r.taps, (double)total * channels / input->sample_rate / elapsed);
+    }
+    return 0;
+}
+
+// Encode one interleaved buffer into out_file. Every call owns its own
+// format and codec context, so it can run concurrently on several threads.
+static int encode_audio(const audio_input* input, const char* codec_name, int out_rate, int threads, int verbose)
+{
+    const char* out_file = input->out_path.c_str();
+
+    AVFormatContext* pFormatCtx = NULL;
+    avformat_alloc_output_context2(&pFormatCtx, NULL, NULL, out_file);
+    if (!pFormatCtx) {
+        printf("Failed to guess output format for %s\n", out_file);
+        return -1;
+    }
+
+    AVCodec* pCodec = avcodec_find_encoder_by_name(codec_name);
     if (!pCodec) {
-        printf("Can not find encoder!\n");
+        printf("Can not find encoder %s!\n", codec_name);
+        avformat_free_context(pFormatCtx);
+        return -1;
+    }
+
+    // A rate change goes through the resampler, which produces planar float
+    out_rate = choose_sample_rate(pCodec, input->sample_rate, out_rate);
+    std::vector<std::vector<float> > resampled;
+    enum AVSampleFormat src_fmt = input->sample_fmt;
+    if (out_rate != input->sample_rate)
+        src_fmt = AV_SAMPLE_FMT_FLTP;
+
+    enum AVSampleFormat sample_fmt = choose_sample_fmt(pCodec, src_fmt);
+    if (sample_fmt == AV_SAMPLE_FMT_NONE || input->channels > SAMPLE_CONVERT_MAX_CHANNELS) {
+        printf("%s: no usable sample format for %d channel %s input\n", codec_name,
+            input->channels, av_get_sample_fmt_name(src_fmt));
+        avformat_free_context(pFormatCtx);
+        return -1;
+    }
+    if (src_fmt == AV_SAMPLE_FMT_FLTP && resample_input(input, out_rate, verbose, &resampled) < 0) {
+        avformat_free_context(pFormatCtx);
         return -1;
     }
 
+    AVStream* audio_st = avformat_new_stream(pFormatCtx, NULL);
+    AVCodecContext* pCodecCtx = avcodec_alloc_context3(pCodec);
+    pCodecCtx->sample_fmt = sample_fmt;
+    pCodecCtx->sample_rate = out_rate;
+    pCodecCtx->channels = input->channels;
+    pCodecCtx->channel_layout = av_get_default_channel_layout(input->channels);
+    pCodecCtx->bit_rate = 32000 * input->channels;
+    pCodecCtx->time_base = av_make_q(1, out_rate);
+    pCodecCtx->thread_count = threads;
+    if (pFormatCtx->oformat->flags & AVFMT_GLOBALHEADER)
+        pCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    int ret = -1;
+    AVFrame* pFrame = NULL;
     if (avcodec_open2(pCodecCtx, pCodec, NULL) < 0) {
         printf("Failed to open encoder!\n");
-        return -1;
+        goto end;
     }
 
-    AVFrame* pFrame = av_frame_alloc();
-    pFrame->nb_samples = pCodecCtx->frame_size;
-    pFrame->format = pCodecCtx->sample_fmt;
+    avcodec_parameters_from_context(audio_st->codecpar, pCodecCtx);
+    audio_st->time_base = pCodecCtx->time_base;
+    if (verbose) {
+        av_dump_format(pFormatCtx, 0, out_file, 1);
+        printf("%s -> %s, conversion kernels: %s\n", av_get_sample_fmt_name(src_fmt),
+            av_get_sample_fmt_name(sample_fmt), sample_convert_impl());
+    }
 
-    int size = av_samples_get_buffer_size(NULL, pCodecCtx->channels, pCodecCtx->frame_size, pCodecCtx->sample_fmt, 1);
-    uint8_t* frame_buf = (uint8_t*)av_malloc(size);
-    avcodec_fill_audio_frame(pFrame, pCodecCtx->channels, pCodecCtx->sample_fmt, (const uint8_t*)frame_buf, size, 1);
+    if (avio_open(&pFormatCtx->pb, out_file, AVIO_FLAG_WRITE) < 0) {
+        printf("Failed to open output file %s\n", out_file);
+        goto end;
+    }
 
-    avformat_write_header(pFormatCtx, NULL);
+    if (avformat_write_header(pFormatCtx, NULL) < 0) {
+        printf("Failed to write header\n");
+        goto end;
+    }
 
-    AVPacket pkt;
-    av_new_packet(&pkt, size);
-
-    int got_frame = 0;
-    int ret = 0;
-    int framenum = 1000;
-    for (int i = 0; i < framenum; ++i) {
-        if (fread(frame_buf, 1, size, in_file) <= 0) {
-            printf("Failed to read raw data!\n");
-            return -1;
-        } else if (feof(in_file)) {
-            break;
-        }
-        pFrame->data[0] = frame_buf;
-        pFrame->pts = i * 100;
-        got_frame = 0;
-
-        ret = avcodec_encode_audio2(pCodecCtx, &pkt, pFrame, &got_frame);
-        if (ret < 0) {
-            printf("Failed to encoder!\n");
-            return -1;
+    pFrame = av_frame_alloc();
+    pFrame->nb_samples = pCodecCtx->frame_size > 0 ? pCodecCtx->frame_size : DEFAULT_FRAME_SIZE;
+    pFrame->format = pCodecCtx->sample_fmt;
+    pFrame->channel_layout = pCodecCtx->channel_layout;
+    pFrame->channels = pCodecCtx->channels;
+    if (av_frame_get_buffer(pFrame, 0) < 0) {
+        printf("Failed to allocate frame\n");
+        goto end;
+    }
+
+    {
+        // the source (the input, or its resampled planes) is converted
+        // straight into the frame planes, no staging copy
+        const int frame_size = pFrame->nb_samples;
+        const uint8_t* base[SAMPLE_CONVERT_MAX_CHANNELS];
+        size_t stride, total;
+        if (resampled.empty()) {
+            base[0] = input->pcm.empty() ? NULL : &input->pcm[0];
+            stride = (size_t)av_get_bytes_per_sample(input->sample_fmt) * input->channels;
+            total = input->pcm.size() / stride;
+        } else {
+            for (int c = 0; c < input->channels; ++c)
+                base[c] = (const uint8_t*)resampled[c].data();
+            stride = sizeof(float);
+            total = resampled[0].size();
         }
+        const int nb_planes = resampled.empty() ? 1 : input->channels;
 
-        if (got_frame == 1) {
-            printf("Succeed to encode 1 frame! \tsize:%5d\n", pkt.size);
-            pkt.stream_index = audio_st->index;
-            ret = av_write_frame(pFormatCtx, &pkt);
-            av_free_packet(&pkt);
+        int64_t pts = 0;
+        for (size_t pos = 0; pos < total; pos += frame_size) {
+            if (av_frame_make_writable(pFrame) < 0)
+                goto end;
+            // the last partial frame is padded with silence
+            int n = (int)std::min<size_t>(frame_size, total - pos);
+            const uint8_t* src[SAMPLE_CONVERT_MAX_CHANNELS];
+            for (int c = 0; c < nb_planes; ++c)
+                src[c] = base[c] + pos * stride;
+            if (sample_convert(pFrame->extended_data, sample_fmt, src, src_fmt, input->channels, n) < 0) {
+                printf("Unsupported sample conversion\n");
+                goto end;
+            }
+            if (n < frame_size)
+                av_samples_set_silence(pFrame->extended_data, n, frame_size - n, input->channels, sample_fmt);
+            pFrame->pts = pts;
+            pts += frame_size;
+
+            if (encode_write_frame(pFormatCtx, pCodecCtx, audio_st, pFrame, verbose) < 0) {
+                printf("Failed to encoder!\n");
+                goto end;
+            }
         }
     }
 
-    ret = flush_encoder(pFormatCtx, 0);
-    if (ret < 0) {
+    if (encode_write_frame(pFormatCtx, pCodecCtx, audio_st, NULL, verbose) < 0) {
         printf("Flushing encoder failed\n");
-        return -1;
+        goto end;
     }
 
     av_write_trailer(pFormatCtx);
+    ret = 0;
 
-    if (audio_st) {
-        avcodec_close(audio_st->codec);
-        av_free(pFrame);
-        av_free(frame_buf);
+end:
+    av_frame_free(&pFrame);
+    avcodec_free_context(&pCodecCtx);
+    if (pFormatCtx->pb)
+        avio_closep(&pFormatCtx->pb);
+    avformat_free_context(pFormatCtx);
+    return ret;
+}
+
+static double input_seconds(const audio_input* input)
+{
+    return (double)input->pcm.size() / (av_get_bytes_per_sample(input->sample_fmt) * input->channels) / input->sample_rate;
+}
+
+static const char* output_extension(const char* codec_name)
+{
+    if (!strcmp(codec_name, "libopus") || !strcmp(codec_name, "opus"))
+        return ".opus";
+    if (!strcmp(codec_name, "libmp3lame"))
+        return ".mp3";
+    return ".aac";
+}
+
+static std::string default_output_path(const std::string& in_path, const char* codec_name)
+{
+    size_t dot = in_path.find_last_of('.');
+    size_t slash = in_path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return in_path + output_extension(codec_name);
+    return in_path.substr(0, dot) + output_extension(codec_name);
+}
+
+// Batch mode: one reader thread loads the manifest entries ahead of the
+// encoders, a fixed set of workers each runs an independent encoder context
+// with a single codec thread, so throughput scales with the worker count.
+static int encode_batch(const char* manifest, const char* codec_name, int out_rate, int num_workers)
+{
+    std::vector<audio_input> inputs;
+    FILE* fp = fopen(manifest, "r");
+    if (fp == NULL) {
+        printf("Failed to open manifest %s\n", manifest);
+        return -1;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        char in_path[2048], out_path[2048];
+        int n = sscanf(line, "%2047s %2047s", in_path, out_path);
+        if (n < 1 || in_path[0] == '#')
+            continue;
+        audio_input input;
+        input.in_path = in_path;
+        input.out_path = n > 1 ? out_path : default_output_path(in_path, codec_name);
+        inputs.push_back(std::move(input));
     }
+    fclose(fp);
 
-    avio_close(pFormatCtx->pb);
-    fclose(in_file);
+    printf("Encoding %zu files with %d workers\n", inputs.size(), num_workers);
+
+    // read-ahead window of two files per worker bounds the memory use
+    BoundedQueue<audio_input> queue(2 * num_workers);
+    std::mutex stats_mutex;
+    double audio_seconds = 0;
+    int failed = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread reader([&] {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            audio_input input = std::move(inputs[i]);
+            if (load_audio_input(&input) < 0) {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                failed++;
+                continue;
+            }
+            queue.push(std::move(input));
+        }
+        queue.close();
+    });
+
+    std::vector<std::thread> workers;
+    for (int w = 0; w < num_workers; ++w) {
+        workers.emplace_back([&] {
+            audio_input input;
+            while (queue.pop(input)) {
+                auto t = std::chrono::steady_clock::now();
+                int ret = encode_audio(&input, codec_name, out_rate, 1, 0);
+                double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+                double seconds = input_seconds(&input);
+
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                if (ret < 0) {
+                    failed++;
+                    printf("FAILED %s\n", input.in_path.c_str());
+                } else {
+                    audio_seconds += seconds;
+                    printf("%s -> %s: %.2f s audio, %.1fx realtime\n", input.in_path.c_str(), input.out_path.c_str(), seconds, seconds / elapsed);
+                }
+            }
+        });
+    }
+
+    reader.join();
+    for (size_t w = 0; w < workers.size(); ++w)
+        workers[w].join();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("--------------- Batch report ----------------\n");
+    printf("files: %zu, failed: %d, workers: %d\n", inputs.size(), failed, num_workers);
+    printf("audio: %.2f s, wall: %.2f s\n", audio_seconds, wall);
+    printf("aggregate realtime factor: %.1fx (%.1fx per worker)\n", audio_seconds / wall, audio_seconds / wall / num_workers);
+    printf("---------------------------------------------\n");
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    av_register_all();
+
+    // Usage: simpleAudioEncoderBasedOnFFmpeg [-c encoder] [-r rate] [--batch manifest.txt [workers]]
+    const char* codec_name = DEFAULT_ENCODER;
+    int out_rate = 0; // keep the input rate when the encoder supports it
+    int arg = 1;
+    for (; arg + 1 < argc; arg += 2) {
+        if (!strcmp(argv[arg], "-c"))
+            codec_name = argv[arg + 1];
+        else if (!strcmp(argv[arg], "-r"))
+            out_rate = atoi(argv[arg + 1]);
+        else
+            break;
+    }
+
+    if (arg + 1 < argc && !strcmp(argv[arg], "--batch")) {
+        int workers = arg + 2 < argc ? atoi(argv[arg + 2]) : (int)std::thread::hardware_concurrency();
+        return encode_batch(argv[arg + 1], codec_name, out_rate, workers > 0 ? workers : 1);
+    }
+
+    audio_input input;
+    input.in_path = "tdjm.pcm";
+    input.out_path = default_output_path(input.in_path, codec_name);
+    if (load_audio_input(&input) < 0)
+        return -1;
+
+    return encode_audio(&input, codec_name, out_rate, 0, 1);
 }
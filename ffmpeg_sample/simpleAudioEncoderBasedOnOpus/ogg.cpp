@@ -0,0 +1,158 @@
+#include "ogg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+
+#include "opus/opus.h"
+
+#define OGG_FLAG_BOS 0x02
+#define OGG_FLAG_EOS 0x04
+#define OGG_MAX_SEGMENTS 255
+
+static uint32_t crc_table[256];
+
+// Ogg CRC: polynomial 0x04c11db7, not reflected, zero init, no final xor
+static void init_crc_table()
+{
+    if (crc_table[1])
+        return;
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t r = i << 24;
+        for (int k = 0; k < 8; ++k)
+            r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : r << 1;
+        crc_table[i] = r;
+    }
+}
+
+static uint32_t ogg_crc(uint32_t crc, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+        crc = (crc << 8) ^ crc_table[((crc >> 24) ^ data[i]) & 0xff];
+    return crc;
+}
+
+static void put_le16(uint8_t* p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t* p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(uint8_t* p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static int flush_page(ogg_opus_writer* w, int flags, int64_t granule)
+{
+    uint8_t header[27 + OGG_MAX_SEGMENTS];
+    int nsegs = (int)w->segments.size();
+    memcpy(header, "OggS", 4);
+    header[4] = 0; // version
+    header[5] = flags;
+    put_le64(header + 6, granule);
+    put_le32(header + 14, w->serial);
+    put_le32(header + 18, w->sequence++);
+    put_le32(header + 22, 0);
+    header[26] = nsegs;
+    if (nsegs)
+        memcpy(header + 27, &w->segments[0], nsegs);
+
+    // the CRC covers the header with a zero CRC field, then the body
+    uint32_t crc = ogg_crc(0, header, 27 + nsegs);
+    if (!w->body.empty())
+        crc = ogg_crc(crc, &w->body[0], w->body.size());
+    put_le32(header + 22, crc);
+
+    if (fwrite(header, 1, 27 + nsegs, w->file) != (size_t)(27 + nsegs))
+        return -1;
+    if (!w->body.empty() && fwrite(&w->body[0], 1, w->body.size(), w->file) != w->body.size())
+        return -1;
+    fflush(w->file); // a page is the unit a live reader can consume
+
+    w->pages++;
+    w->bytes += 27 + nsegs + w->body.size();
+    w->segments.clear();
+    w->body.clear();
+    w->page_samples = 0;
+    return 0;
+}
+
+static void add_packet(ogg_opus_writer* w, const uint8_t* data, int size)
+{
+    // lacing: runs of 255 then the remainder, a multiple of 255 ends with 0
+    int left = size;
+    while (left >= 255) {
+        w->segments.push_back(255);
+        left -= 255;
+    }
+    w->segments.push_back(left);
+    w->body.insert(w->body.end(), data, data + size);
+}
+
+int ogg_opus_writer_open(ogg_opus_writer* w, FILE* file, int channels, int input_rate, int pre_skip, int max_page_ms)
+{
+    init_crc_table();
+    w->file = file;
+    // Chained or multiplexed streams need distinct serials, so the serial
+    // comes from a real random source and differs from run to run
+    w->serial = std::random_device()();
+    w->sequence = 0;
+    w->max_page_samples = max_page_ms * 48;
+    w->page_samples = 0;
+    w->granule = 0;
+    w->segments.clear();
+    w->body.clear();
+    w->pages = 0;
+    w->bytes = 0;
+
+    // OpusHead, alone on the first page
+    uint8_t head[19];
+    memcpy(head, "OpusHead", 8);
+    head[8] = 1; // version
+    head[9] = channels;
+    put_le16(head + 10, pre_skip);
+    put_le32(head + 12, input_rate);
+    put_le16(head + 16, 0); // output gain
+    head[18] = 0; // mapping family: mono or stereo
+    add_packet(w, head, sizeof(head));
+    if (flush_page(w, OGG_FLAG_BOS, 0))
+        return -1;
+
+    // OpusTags with the vendor string only
+    const char* vendor = opus_get_version_string();
+    std::vector<uint8_t> tags(8 + 4 + strlen(vendor) + 4);
+    memcpy(&tags[0], "OpusTags", 8);
+    put_le32(&tags[8], strlen(vendor));
+    memcpy(&tags[12], vendor, strlen(vendor));
+    put_le32(&tags[12 + strlen(vendor)], 0);
+    add_packet(w, &tags[0], tags.size());
+    return flush_page(w, 0, 0);
+}
+
+int ogg_opus_writer_write_packet(ogg_opus_writer* w, const uint8_t* data, int size, int samples, int64_t granule)
+{
+    int nsegs = size / 255 + 1;
+    if ((int)w->segments.size() + nsegs > OGG_MAX_SEGMENTS && flush_page(w, 0, w->granule))
+        return -1;
+
+    add_packet(w, data, size);
+    w->granule = granule;
+    w->page_samples += samples;
+    if (w->page_samples >= w->max_page_samples)
+        return flush_page(w, 0, w->granule);
+    return 0;
+}
+
+int ogg_opus_writer_close(ogg_opus_writer* w)
+{
+    return flush_page(w, OGG_FLAG_EOS, w->granule);
+}
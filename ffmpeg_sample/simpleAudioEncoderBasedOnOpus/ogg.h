@@ -0,0 +1,37 @@
+#ifndef OGG_H
+#define OGG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+// Minimal Ogg Opus writer (RFC 3533 pages, RFC 7845 mapping), no libogg.
+// Packets are collected into a page until it holds max_page_ms of audio or
+// runs out of lacing values, so a small max_page_ms keeps the container from
+// adding latency on top of the codec when the output is streamed.
+
+struct ogg_opus_writer {
+    FILE* file;
+    uint32_t serial;
+    uint32_t sequence;
+    int max_page_samples; // 48 kHz samples per page before it is flushed
+    int page_samples;
+    int64_t granule; // end of the last packet added, 48 kHz incl. pre-skip
+    std::vector<uint8_t> segments; // lacing values of the pending page
+    std::vector<uint8_t> body;
+    int64_t pages;
+    int64_t bytes;
+};
+
+// Writes the OpusHead and OpusTags pages. pre_skip is in 48 kHz samples.
+int ogg_opus_writer_open(ogg_opus_writer* w, FILE* file, int channels, int input_rate, int pre_skip, int max_page_ms);
+
+// granule is the 48 kHz position (incl. pre-skip) at the end of this packet,
+// samples its duration in 48 kHz samples
+int ogg_opus_writer_write_packet(ogg_opus_writer* w, const uint8_t* data, int size, int samples, int64_t granule);
+
+// Flushes the last page with the end-of-stream flag
+int ogg_opus_writer_close(ogg_opus_writer* w);
+
+#endif
@@ -0,0 +1,340 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "ogg.h"
+#include "opus/opus.h"
+
+// Low latency voice encoder on top of libopus. The frame size, complexity,
+// in-band FEC and DTX are exposed on the command line; the output is Ogg Opus
+// or raw packets. Every opus_encode() call is timed to report the per-frame
+// cost, the algorithmic latency and how many realtime channels one core holds.
+
+#define MAX_PACKET_SIZE 4000 // recommended by libopus, enough for 60 ms frames
+
+struct encoder_options {
+    const char* in_path;
+    const char* out_path;
+    int sample_rate; // raw input only, WAV carries its own
+    int channels;
+    double frame_ms;
+    int complexity;
+    int bitrate;
+    int application;
+    int fec_loss; // expected packet loss in percent, 0 disables FEC
+    int dtx;
+    int raw; // raw packets instead of Ogg
+    int max_page_ms;
+};
+
+static void usage(const char* name)
+{
+    printf("Usage: %s <in.pcm|in.wav> <out.opus|out.bit> [options]\n", name);
+    printf("  -r rate        raw s16le input rate: 8000|12000|16000|24000|48000 (48000)\n");
+    printf("  -ch channels   raw input channels (1)\n");
+    printf("  -f ms          frame size: 2.5|5|10|20|40|60 (20)\n");
+    printf("  -c complexity  0..10 (10)\n");
+    printf("  -b bitrate     bits per second (opus default)\n");
+    printf("  -a app         voip|audio|lowdelay (voip)\n");
+    printf("  -fec loss      in-band FEC for the given packet loss percentage\n");
+    printf("  -dtx           discontinuous transmission\n");
+    printf("  -raw           raw packets (opus_demo format) instead of Ogg\n");
+    printf("  -page ms       max Ogg page duration (20)\n");
+}
+
+static int parse_options(int argc, char* argv[], encoder_options* opt)
+{
+    if (argc < 3)
+        return -1;
+    opt->in_path = argv[1];
+    opt->out_path = argv[2];
+    opt->sample_rate = 48000;
+    opt->channels = 1;
+    opt->frame_ms = 20;
+    opt->complexity = 10;
+    opt->bitrate = OPUS_AUTO;
+    opt->application = OPUS_APPLICATION_VOIP;
+    opt->fec_loss = 0;
+    opt->dtx = 0;
+    opt->raw = 0;
+    opt->max_page_ms = 20;
+
+    for (int i = 3; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "-dtx")) {
+            opt->dtx = 1;
+            continue;
+        }
+        if (!strcmp(arg, "-raw")) {
+            opt->raw = 1;
+            continue;
+        }
+        if (value == NULL)
+            return -1;
+        ++i;
+        if (!strcmp(arg, "-r")) {
+            opt->sample_rate = atoi(value);
+        } else if (!strcmp(arg, "-ch")) {
+            opt->channels = atoi(value);
+        } else if (!strcmp(arg, "-f")) {
+            opt->frame_ms = atof(value);
+        } else if (!strcmp(arg, "-c")) {
+            opt->complexity = atoi(value);
+        } else if (!strcmp(arg, "-b")) {
+            opt->bitrate = atoi(value);
+        } else if (!strcmp(arg, "-fec")) {
+            opt->fec_loss = atoi(value);
+        } else if (!strcmp(arg, "-page")) {
+            opt->max_page_ms = atoi(value);
+        } else if (!strcmp(arg, "-a")) {
+            if (!strcmp(value, "voip"))
+                opt->application = OPUS_APPLICATION_VOIP;
+            else if (!strcmp(value, "audio"))
+                opt->application = OPUS_APPLICATION_AUDIO;
+            else if (!strcmp(value, "lowdelay"))
+                opt->application = OPUS_APPLICATION_RESTRICTED_LOWDELAY;
+            else
+                return -1;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t get_le32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get_le16(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+// Load s16le samples, a 16 bit PCM WAV header overrides rate and channels
+static int load_input(encoder_options* opt, std::vector<int16_t>* pcm)
+{
+    FILE* fp = fopen(opt->in_path, "rb");
+    if (fp == NULL) {
+        printf("Failed to open input file %s\n", opt->in_path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    std::vector<uint8_t> buf(size > 0 ? size : 0);
+    size_t got = buf.empty() ? 0 : fread(&buf[0], 1, buf.size(), fp);
+    fclose(fp);
+    if (got != buf.size()) {
+        printf("Failed to read %s\n", opt->in_path);
+        return -1;
+    }
+
+    size_t data = 0, data_size = buf.size();
+    if (buf.size() >= 12 && !memcmp(&buf[0], "RIFF", 4) && !memcmp(&buf[8], "WAVE", 4)) {
+        size_t pos = 12;
+        data_size = 0;
+        while (pos + 8 <= buf.size()) {
+            uint32_t chunk_size = get_le32(&buf[pos + 4]);
+            const uint8_t* chunk = &buf[pos + 8];
+            if (!memcmp(&buf[pos], "fmt ", 4) && chunk_size >= 16) {
+                if (get_le16(chunk) != 1 || get_le16(chunk + 14) != 16) {
+                    printf("%s: only 16 bit PCM WAV is supported\n", opt->in_path);
+                    return -1;
+                }
+                opt->channels = get_le16(chunk + 2);
+                opt->sample_rate = get_le32(chunk + 4);
+            } else if (!memcmp(&buf[pos], "data", 4)) {
+                data = pos + 8;
+                data_size = std::min<size_t>(chunk_size, buf.size() - data);
+                break;
+            }
+            pos += 8 + chunk_size + (chunk_size & 1);
+        }
+    }
+
+    pcm->resize(data_size / 2);
+    for (size_t i = 0; i < pcm->size(); ++i)
+        (*pcm)[i] = (int16_t)get_le16(&buf[data + 2 * i]);
+    return 0;
+}
+
+static void put_be32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static double thread_cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char* bandwidth_name(int bandwidth)
+{
+    switch (bandwidth) {
+    case OPUS_BANDWIDTH_NARROWBAND:
+        return "NB";
+    case OPUS_BANDWIDTH_MEDIUMBAND:
+        return "MB";
+    case OPUS_BANDWIDTH_WIDEBAND:
+        return "WB";
+    case OPUS_BANDWIDTH_SUPERWIDEBAND:
+        return "SWB";
+    case OPUS_BANDWIDTH_FULLBAND:
+        return "FB";
+    default:
+        return "?";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    encoder_options opt;
+    if (parse_options(argc, argv, &opt) < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    std::vector<int16_t> pcm;
+    if (load_input(&opt, &pcm) < 0)
+        return -1;
+
+    // opus takes 2.5 ms multiples up to 60 ms
+    int frame_size = (int)(opt.sample_rate * opt.frame_ms / 1000 + 0.5);
+    int frame_units = (int)(opt.frame_ms * 2 + 0.5);
+    if (frame_units != 5 && frame_units != 10 && frame_units != 20 && frame_units != 40
+        && frame_units != 80 && frame_units != 120) {
+        printf("Invalid frame size %.1f ms\n", opt.frame_ms);
+        return -1;
+    }
+
+    int err;
+    OpusEncoder* enc = opus_encoder_create(opt.sample_rate, opt.channels, opt.application, &err);
+    if (err != OPUS_OK) {
+        printf("Failed to create encoder: %s\n", opus_strerror(err));
+        return -1;
+    }
+    opus_encoder_ctl(enc, OPUS_SET_COMPLEXITY(opt.complexity));
+    opus_encoder_ctl(enc, OPUS_SET_BITRATE(opt.bitrate));
+    opus_encoder_ctl(enc, OPUS_SET_DTX(opt.dtx));
+    opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(opt.fec_loss > 0));
+    opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(opt.fec_loss));
+    if (opt.application == OPUS_APPLICATION_VOIP)
+        opus_encoder_ctl(enc, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+
+    opus_int32 lookahead = 0;
+    opus_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(&lookahead));
+    const int to_48k = 48000 / opt.sample_rate;
+    const int pre_skip = lookahead * to_48k;
+
+    FILE* outfile = fopen(opt.out_path, "wb");
+    if (outfile == NULL) {
+        printf("Failed to open output file %s\n", opt.out_path);
+        return -1;
+    }
+    ogg_opus_writer ogg;
+    if (!opt.raw && ogg_opus_writer_open(&ogg, outfile, opt.channels, opt.sample_rate, pre_skip, opt.max_page_ms) < 0) {
+        printf("Failed to write Ogg headers\n");
+        return -1;
+    }
+
+    // Encode enough frames to push the last input sample through the
+    // lookahead, the final granule position trims the padding again
+    const int64_t in_samples = pcm.size() / opt.channels;
+    const int64_t frames = (in_samples + lookahead + frame_size - 1) / frame_size;
+    pcm.resize((size_t)frames * frame_size * opt.channels, 0);
+
+    std::vector<double> cost_us;
+    cost_us.reserve(frames);
+    int64_t total_bytes = 0;
+    int dtx_frames = 0;
+    uint8_t packet[8 + MAX_PACKET_SIZE];
+    double cpu_start = thread_cpu_seconds();
+
+    for (int64_t i = 0; i < frames; ++i) {
+        const int16_t* in = &pcm[(size_t)i * frame_size * opt.channels];
+        auto t = std::chrono::steady_clock::now();
+        int len = opus_encode(enc, in, frame_size, packet + 8, MAX_PACKET_SIZE);
+        cost_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count());
+        if (len < 0) {
+            printf("Failed to encode frame %lld: %s\n", (long long)i, opus_strerror(len));
+            return -1;
+        }
+        // with DTX a packet of 2 bytes or less carries no audio
+        if (len <= 2)
+            dtx_frames++;
+        total_bytes += len;
+
+        int ret;
+        if (opt.raw) {
+            // opus_demo bitstream: BE32 length, BE32 encoder final range, payload
+            opus_uint32 range;
+            opus_encoder_ctl(enc, OPUS_GET_FINAL_RANGE(&range));
+            put_be32(packet, len);
+            put_be32(packet + 4, range);
+            ret = fwrite(packet, 1, len + 8, outfile) == (size_t)(len + 8) ? 0 : -1;
+        } else {
+            int64_t end = std::min<int64_t>((i + 1) * frame_size, in_samples + lookahead);
+            ret = ogg_opus_writer_write_packet(&ogg, packet + 8, len, frame_size * to_48k, end * to_48k);
+        }
+        if (ret < 0) {
+            printf("Failed to write frame %lld\n", (long long)i);
+            return -1;
+        }
+    }
+    double cpu_seconds = thread_cpu_seconds() - cpu_start;
+
+    if (!opt.raw)
+        ogg_opus_writer_close(&ogg);
+    fclose(outfile);
+
+    opus_int32 bandwidth = 0;
+    opus_encoder_ctl(enc, OPUS_GET_BANDWIDTH(&bandwidth));
+    opus_encoder_destroy(enc);
+
+    double frame_duration_us = 1e6 * frame_size / opt.sample_rate;
+    double audio_seconds = (double)in_samples / opt.sample_rate;
+    std::vector<double> sorted = cost_us;
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0;
+    for (size_t i = 0; i < cost_us.size(); ++i)
+        mean += cost_us[i];
+    mean = cost_us.empty() ? 0 : mean / cost_us.size();
+    double p50 = sorted.empty() ? 0 : sorted[sorted.size() / 2];
+    double p99 = sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+    double worst = sorted.empty() ? 0 : sorted.back();
+
+    printf("--------------- Opus report ----------------\n");
+    printf("%s: %d Hz, %d ch, %.2f s -> %s (%s)\n", opt.in_path, opt.sample_rate, opt.channels, audio_seconds,
+        opt.out_path, opt.raw ? "raw packets" : "Ogg Opus");
+    printf("frame %.1f ms, complexity %d, fec %s, dtx %s, bandwidth %s\n", opt.frame_ms, opt.complexity,
+        opt.fec_loss > 0 ? "on" : "off", opt.dtx ? "on" : "off", bandwidth_name(bandwidth));
+    printf("frames: %lld, dtx frames: %d, bitrate: %.1f kbps\n", (long long)frames, dtx_frames,
+        audio_seconds > 0 ? total_bytes * 8 / audio_seconds / 1000 : 0);
+    if (!opt.raw)
+        printf("ogg: %lld pages, %lld bytes container overhead\n", (long long)ogg.pages, (long long)(ogg.bytes - total_bytes));
+    printf("per-frame encode cost: mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n", mean, p50, p99, worst);
+    // the decoder adds no delay of its own beyond the encoder lookahead
+    printf("algorithmic latency: %.1f ms (frame %.1f ms + lookahead %.1f ms)\n",
+        opt.frame_ms + 1000.0 * lookahead / opt.sample_rate, opt.frame_ms, 1000.0 * lookahead / opt.sample_rate);
+    if (cpu_seconds > 0 && mean > 0) {
+        double streams = audio_seconds / cpu_seconds;
+        printf("realtime capacity per core: %.0f streams (%.0f channels) by CPU time, %.0f streams by mean frame cost\n",
+            streams, streams * opt.channels, frame_duration_us / mean);
+    }
+    printf("--------------------------------------------\n");
+    return 0;
+}
@@ -0,0 +1,298 @@
+#include "ivf.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+static void mem_put_le16(uint8_t* mem, unsigned int val)
+{
+    mem[0] = val;
+    mem[1] = val >> 8;
+}
+
+static void mem_put_le32(uint8_t* mem, uint32_t val)
+{
+    mem[0] = val;
+    mem[1] = val >> 8;
+    mem[2] = val >> 16;
+    mem[3] = val >> 24;
+}
+
+static void mem_put_le64(uint8_t* mem, uint64_t val)
+{
+    mem_put_le32(mem, val & 0xFFFFFFFF);
+    mem_put_le32(mem + 4, val >> 32);
+}
+
+static uint16_t mem_get_le16(const uint8_t* mem)
+{
+    return mem[0] | (mem[1] << 8);
+}
+
+static uint32_t mem_get_le32(const uint8_t* mem)
+{
+    return (uint32_t)mem[0] | ((uint32_t)mem[1] << 8) | ((uint32_t)mem[2] << 16) | ((uint32_t)mem[3] << 24);
+}
+
+static uint64_t mem_get_le64(const uint8_t* mem)
+{
+    return mem_get_le32(mem) | ((uint64_t)mem_get_le32(mem + 4) << 32);
+}
+
+static int write_all(ivf_writer* writer, const void* data, size_t size)
+{
+    if (fwrite(data, 1, size, writer->file) != size)
+        return -1;
+    writer->pos += size;
+    return 0;
+}
+
+int ivf_writer_open(ivf_writer* writer, FILE* file, const ivf_file_header* header, FILE* index_file)
+{
+    uint8_t buf[IVF_FILE_HDR_SZ];
+
+    writer->file = file;
+    writer->header = *header;
+    writer->pos = 0;
+    writer->index_file = index_file;
+    writer->frame_cnt = 0;
+    writer->index.clear();
+
+    memcpy(buf, "DKIF", 4);
+    mem_put_le16(buf + 4, 0);  // version
+    mem_put_le16(buf + 6, IVF_FILE_HDR_SZ); // headersize
+    mem_put_le32(buf + 8, header->fourcc);
+    mem_put_le16(buf + 12, header->width);
+    mem_put_le16(buf + 14, header->height);
+    mem_put_le32(buf + 16, header->rate);
+    mem_put_le32(buf + 20, header->scale);
+    mem_put_le32(buf + 24, header->frame_cnt);
+    mem_put_le32(buf + 28, 0);
+
+    return write_all(writer, buf, IVF_FILE_HDR_SZ);
+}
+
+int ivf_writer_write_frame(ivf_writer* writer, const void* data, uint32_t size, uint64_t pts, int is_key)
+{
+    uint8_t buf[IVF_FRAME_HDR_SZ];
+    mem_put_le32(buf, size);
+    mem_put_le64(buf + 4, pts);
+
+    if (write_all(writer, buf, IVF_FRAME_HDR_SZ) || write_all(writer, data, size))
+        return -1;
+    writer->frame_cnt++;
+    if (!writer->index_file)
+        return 0;
+
+    ivf_index_entry entry;
+    entry.offset = writer->pos - size;
+    entry.pts = pts;
+    entry.size = size;
+    entry.flags = is_key ? IVF_FRAME_FLAG_KEY : 0;
+    writer->index.push_back(entry);
+    return 0;
+}
+
+int ivf_writer_close(ivf_writer* writer)
+{
+    uint32_t count = writer->frame_cnt;
+    int ret = 0;
+
+    if (writer->index_file) {
+        uint8_t buf[IVF_INDEX_ENTRY_SZ];
+        memcpy(buf, IVF_INDEX_MAGIC, 4);
+        mem_put_le32(buf + 4, count);
+        mem_put_le64(buf + 8, writer->pos);
+        if (fwrite(buf, 1, IVF_INDEX_HDR_SZ, writer->index_file) != IVF_INDEX_HDR_SZ)
+            ret = -1;
+        for (size_t i = 0; i < writer->index.size() && !ret; ++i) {
+            const ivf_index_entry& entry = writer->index[i];
+            mem_put_le64(buf, entry.offset);
+            mem_put_le64(buf + 8, entry.pts);
+            mem_put_le32(buf + 16, entry.size);
+            mem_put_le32(buf + 20, entry.flags);
+            if (fwrite(buf, 1, IVF_INDEX_ENTRY_SZ, writer->index_file) != IVF_INDEX_ENTRY_SZ)
+                ret = -1;
+        }
+        if (fflush(writer->index_file))
+            ret = -1;
+    }
+
+    // Only patch the frame count when the output really is a file,
+    // fseek on a pipe fails or, worse, silently succeeds on some systems.
+    struct stat st;
+    if (fstat(fileno(writer->file), &st) == 0 && S_ISREG(st.st_mode)) {
+        uint8_t buf[4];
+        mem_put_le32(buf, count);
+        fflush(writer->file);
+        if (!fseek(writer->file, 24, SEEK_SET)) {
+            fwrite(buf, 1, 4, writer->file);
+            fseek(writer->file, 0, SEEK_END);
+        }
+    }
+
+    writer->index.clear();
+    return fflush(writer->file) || ret ? -1 : 0;
+}
+
+static int load_index_file(ivf_reader* reader, const char* path, uint32_t hdr_size)
+{
+    std::string index_path = std::string(path) + IVF_INDEX_SUFFIX;
+    FILE* file = fopen(index_path.c_str(), "rb");
+    if (!file)
+        return -1;
+
+    uint8_t buf[IVF_INDEX_ENTRY_SZ];
+    int ret = -1;
+    if (fread(buf, 1, IVF_INDEX_HDR_SZ, file) == IVF_INDEX_HDR_SZ && !memcmp(buf, IVF_INDEX_MAGIC, 4)
+        && mem_get_le64(buf + 8) == reader->size) {
+        uint32_t count = mem_get_le32(buf + 4);
+        reader->index.resize(count);
+        ret = 0;
+        for (uint32_t i = 0; i < count && !ret; ++i) {
+            ivf_index_entry& entry = reader->index[i];
+            if (fread(buf, 1, IVF_INDEX_ENTRY_SZ, file) != IVF_INDEX_ENTRY_SZ) {
+                ret = -1;
+                break;
+            }
+            entry.offset = mem_get_le64(buf);
+            entry.pts = mem_get_le64(buf + 8);
+            entry.size = mem_get_le32(buf + 16);
+            entry.flags = mem_get_le32(buf + 20);
+            if (entry.offset < hdr_size + IVF_FRAME_HDR_SZ || entry.offset + entry.size > reader->size)
+                ret = -1;
+        }
+        if (ret)
+            reader->index.clear();
+    }
+    fclose(file);
+    return ret;
+}
+
+static void scan_index(ivf_reader* reader, uint32_t hdr_size)
+{
+    uint64_t pos = hdr_size;
+    reader->index.clear();
+    if (reader->header.frame_cnt)
+        reader->index.reserve(reader->header.frame_cnt);
+
+    while (pos + IVF_FRAME_HDR_SZ <= reader->size) {
+        const uint8_t* p = reader->data + pos;
+        uint32_t size = mem_get_le32(p);
+        if (pos + IVF_FRAME_HDR_SZ + size > reader->size)
+            break;
+
+        ivf_index_entry entry;
+        entry.offset = pos + IVF_FRAME_HDR_SZ;
+        entry.pts = mem_get_le64(p + 4);
+        entry.size = size;
+        entry.flags = ivf_is_keyframe(reader->header.fourcc, p + IVF_FRAME_HDR_SZ, size) ? IVF_FRAME_FLAG_KEY : 0;
+        reader->index.push_back(entry);
+
+        pos += IVF_FRAME_HDR_SZ + size;
+    }
+}
+
+int ivf_reader_open(ivf_reader* reader, const char* path)
+{
+    reader->data = NULL;
+    reader->size = 0;
+    reader->index.clear();
+
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(reader->fd, &st) || st.st_size < IVF_FILE_HDR_SZ) {
+        ivf_reader_close(reader);
+        return -1;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+    if (data == MAP_FAILED) {
+        ivf_reader_close(reader);
+        return -1;
+    }
+    reader->data = (const uint8_t*)data;
+    reader->size = st.st_size;
+
+    const uint8_t* p = reader->data;
+    uint32_t hdr_size = mem_get_le16(p + 6);
+    if (memcmp(p, "DKIF", 4) || hdr_size < IVF_FILE_HDR_SZ || hdr_size > reader->size) {
+        ivf_reader_close(reader);
+        return -1;
+    }
+    reader->header.fourcc = mem_get_le32(p + 8);
+    reader->header.width = mem_get_le16(p + 12);
+    reader->header.height = mem_get_le16(p + 14);
+    reader->header.rate = mem_get_le32(p + 16);
+    reader->header.scale = mem_get_le32(p + 20);
+    reader->header.frame_cnt = mem_get_le32(p + 24);
+
+    if (load_index_file(reader, path, hdr_size))
+        scan_index(reader, hdr_size);
+
+    // the header count is 0 for streamed files, trust the index instead
+    reader->header.frame_cnt = reader->index.size();
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+void ivf_reader_close(ivf_reader* reader)
+{
+    if (reader->data)
+        munmap((void*)reader->data, reader->size);
+    if (reader->fd >= 0)
+        close(reader->fd);
+    reader->data = NULL;
+    reader->size = 0;
+    reader->fd = -1;
+    reader->index.clear();
+}
+
+static bool pts_less(uint64_t pts, const ivf_index_entry& entry)
+{
+    return pts < entry.pts;
+}
+
+long ivf_reader_seek_keyframe(const ivf_reader* reader, uint64_t pts)
+{
+    std::vector<ivf_index_entry>::const_iterator it = std::upper_bound(reader->index.begin(), reader->index.end(), pts, pts_less);
+    long i = (long)(it - reader->index.begin()) - 1;
+    while (i >= 0 && !(reader->index[i].flags & IVF_FRAME_FLAG_KEY))
+        --i;
+    return i;
+}
+
+int ivf_is_keyframe(uint32_t fourcc, const uint8_t* data, uint32_t size)
+{
+    if (size < 1)
+        return 0;
+
+    if (fourcc == IVF_FOURCC_VP8) {
+        // frame tag bit 0 is the inverse key frame flag
+        return !(data[0] & 0x1);
+    }
+
+    if (fourcc == IVF_FOURCC_VP9) {
+        // frame_marker(2) profile_low(1) profile_high(1) [reserved(1)] show_existing_frame(1) frame_type(1)
+        int bit = 0;
+        if ((data[0] >> 6) != 0x2)
+            return 0;
+        int profile = ((data[0] >> 5) & 1) | (((data[0] >> 4) & 1) << 1);
+        bit = profile == 3 ? 5 : 4;
+        if ((data[0] >> (7 - bit)) & 1) // show_existing_frame
+            return 0;
+        ++bit;
+        return !((data[0] >> (7 - bit)) & 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#ifndef IVF_H
+#define IVF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#define IVF_FILE_HDR_SZ 32
+#define IVF_FRAME_HDR_SZ 12
+
+#define IVF_FOURCC_VP8 0x30385056
+#define IVF_FOURCC_VP9 0x30395056
+
+#define IVF_FRAME_FLAG_KEY 0x1
+
+// Optional seek index, written to a sidecar file (<file>.ivf.idx) so the
+// .ivf itself stays a standard IVF any demuxer reads:
+//   "IVFI", u32 count, u64 size of the .ivf it was written for
+//   count * { u64 offset, u64 pts, u32 size, u32 flags }  (offset of the frame payload)
+// A sidecar whose size does not match the .ivf is ignored.
+#define IVF_INDEX_HDR_SZ 16
+#define IVF_INDEX_ENTRY_SZ 24
+#define IVF_INDEX_MAGIC "IVFI"
+#define IVF_INDEX_SUFFIX ".idx"
+
+struct ivf_file_header {
+    uint32_t fourcc;
+    uint16_t width;
+    uint16_t height;
+    uint32_t rate;
+    uint32_t scale;
+    uint32_t frame_cnt;
+};
+
+struct ivf_index_entry {
+    uint64_t offset;
+    uint64_t pts;
+    uint32_t size;
+    uint32_t flags;
+};
+
+struct ivf_writer {
+    FILE* file;
+    ivf_file_header header;
+    uint64_t pos;
+    FILE* index_file;
+    uint32_t frame_cnt;
+    std::vector<ivf_index_entry> index; // only kept with an index_file
+};
+
+// Streaming writer, safe on pipes and sockets: it only seeks back to patch
+// the header frame count on close when the output is a regular file. With an
+// index_file the seek index is written to it on close.
+int ivf_writer_open(ivf_writer* writer, FILE* file, const ivf_file_header* header, FILE* index_file);
+int ivf_writer_write_frame(ivf_writer* writer, const void* data, uint32_t size, uint64_t pts, int is_key);
+int ivf_writer_close(ivf_writer* writer);
+
+struct ivf_reader {
+    const uint8_t* data;
+    uint64_t size;
+    int fd;
+    ivf_file_header header;
+    std::vector<ivf_index_entry> index;
+};
+
+// The reader maps the whole file and builds the frame index up front, either
+// from the sidecar index next to it or with one pass over the frame headers.
+// Frame payloads are handed out as pointers into the mapping.
+int ivf_reader_open(ivf_reader* reader, const char* path);
+void ivf_reader_close(ivf_reader* reader);
+
+static inline size_t ivf_reader_frame_count(const ivf_reader* reader)
+{
+    return reader->index.size();
+}
+
+static inline const uint8_t* ivf_reader_frame(const ivf_reader* reader, size_t i, uint32_t* size)
+{
+    *size = reader->index[i].size;
+    return reader->data + reader->index[i].offset;
+}
+
+// Index of the last keyframe at or before pts, -1 if there is none.
+long ivf_reader_seek_keyframe(const ivf_reader* reader, uint64_t pts);
+
+// Keyframe detection from the payload, for files without a .idx sidecar.
+int ivf_is_keyframe(uint32_t fourcc, const uint8_t* data, uint32_t size);
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ivf.h"
+
+// Drop the temporal layers above max_layer from an IVF file produced by
+// simpleEncoderBasedOnVPX in temporal layer mode, no re-encoding involved.
+// The layer id of each frame comes from the ".tl" sidecar written by the encoder.
+
+#define MAX_TS_LAYERS 3
+
+int main(int argc, char* argv[])
+{
+    if (argc != 5) {
+        printf("Usage: %s <in.ivf> <in.ivf.tl> <out.ivf|-> <max_layer>\n", argv[0]);
+        return -1;
+    }
+
+    ivf_reader reader;
+    if (ivf_reader_open(&reader, argv[1])) {
+        printf("Invalid IVF file: %s\n", argv[1]);
+        return -1;
+    }
+
+    FILE* layerfile = fopen(argv[2], "r");
+    FILE* outfile = strcmp(argv[3], "-") ? fopen(argv[3], "wb") : fdopen(dup(STDOUT_FILENO), "wb");
+    int max_layer = atoi(argv[4]);
+
+    if (layerfile == NULL || outfile == NULL) {
+        printf("Error open file\n");
+        return -1;
+    }
+    if (!strcmp(argv[3], "-"))
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    unsigned int ts_layers = 0, ts_periodicity = 0;
+    if (fscanf(layerfile, "# ts_number_layers %u ts_periodicity %u\n", &ts_layers, &ts_periodicity) != 2
+        || ts_layers < 1 || ts_layers > MAX_TS_LAYERS) {
+        printf("Invalid layer sidecar: %s\n", argv[2]);
+        return -1;
+    }
+
+    ivf_file_header header = reader.header;
+    header.frame_cnt = 0;
+    ivf_writer writer;
+    if (ivf_writer_open(&writer, outfile, &header, NULL)) {
+        printf("Failed to write IVF header\n");
+        return -1;
+    }
+
+    double framerate = (double)header.rate / header.scale;
+
+    int in_frames = ivf_reader_frame_count(&reader);
+    int out_frames = 0;
+    int layer_frames[MAX_TS_LAYERS] = { 0 };
+    long long layer_bytes[MAX_TS_LAYERS] = { 0 };
+
+    for (int i = 0; i < in_frames; ++i) {
+        uint32_t frame_size;
+        const uint8_t* frame = ivf_reader_frame(&reader, i, &frame_size);
+
+        long long index;
+        int layer_id;
+        unsigned int size;
+        if (fscanf(layerfile, "%lld %d %u\n", &index, &layer_id, &size) != 3 || size != frame_size
+            || layer_id < 0 || layer_id >= (int)ts_layers) {
+            printf("Layer sidecar does not match frame %d\n", i);
+            return -1;
+        }
+
+        if (layer_id > max_layer)
+            continue;
+
+        if (ivf_writer_write_frame(&writer, frame, frame_size, reader.index[i].pts, reader.index[i].flags & IVF_FRAME_FLAG_KEY)) {
+            printf("Failed to write frame %d\n", i);
+            return -1;
+        }
+        layer_frames[layer_id]++;
+        layer_bytes[layer_id] += frame_size;
+        ++out_frames;
+    }
+
+    ivf_writer_close(&writer);
+
+    // Cumulative like the encoder's layer report: each row is what a
+    // receiver subscribed up to that layer gets
+    double duration = in_frames / framerate;
+    printf("kept %d of %d frames (layers 0..%d)\n", out_frames, in_frames, max_layer);
+    if (duration > 0)
+        printf("%-10s %6s %7s %10s\n", "layers", "frames", "fps", "kbps");
+    int frames = 0;
+    long long bytes = 0;
+    for (int l = 0; l < (int)ts_layers && l <= max_layer && duration > 0; ++l) {
+        frames += layer_frames[l];
+        bytes += layer_bytes[l];
+        printf("TL0..TL%-3d %6d %7.2f %10.2f\n", l, frames, frames / duration, bytes * 8 / duration / 1000);
+    }
+
+    ivf_reader_close(&reader);
+    fclose(layerfile);
+    fclose(outfile);
+    return 0;
+}
@@ -1,75 +1,158 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "ivf.h"
 #include "vpx/vp8cx.h"
 #include "vpx/vpx_encoder.h"
 
 #define INTERFACE (&vpx_codec_vp8_cx_algo)
-#define fourcc 0x30385056
 
-static void mem_put_1e16(char* mem, unsigned int val)
-{
-    mem[0] = val;
-    mem[1] = val >> 8;
-}
+#define MAX_TS_LAYERS 3
+#define MAX_TS_PERIODICITY 4
 
-static void mem_put_1e32(char* mem, unsigned int val)
+// Configure VP8 temporal scalability, the layer patterns follow
+// vpx_temporal_svc_encoder.c in libvpx. LAST is owned by TL0, GOLDEN by TL1
+// and no layer ever references a frame from a higher layer, so a relay can
+// drop the upper layers without breaking the decoder.
+static int setup_temporal_layers(vpx_codec_enc_cfg_t* cfg, int layers, int* layer_flags)
 {
-    mem[0] = val;
-    mem[1] = val >> 8;
-    mem[2] = val >> 16;
-    mem[3] = val >> 24;
-}
+    switch (layers) {
+    case 2: {
+        // 2-layers, 2-frame period: 0 1 0 1 ...
+        cfg->ts_number_layers = 2;
+        cfg->ts_periodicity = 2;
+        cfg->ts_layer_id[0] = 0;
+        cfg->ts_layer_id[1] = 1;
+        cfg->ts_rate_decimator[0] = 2;
+        cfg->ts_rate_decimator[1] = 1;
+        cfg->ts_target_bitrate[0] = cfg->rc_target_bitrate * 60 / 100;
+        cfg->ts_target_bitrate[1] = cfg->rc_target_bitrate;
 
-static void write_ivf_file_header(FILE* outfile, const vpx_codec_enc_cfg_t* cfg, int frame_cnt)
-{
-    char header[32];
-    if (cfg->g_pass != VPX_RC_ONE_PASS && cfg->g_pass != VPX_RC_LAST_PASS)
-        return;
+        layer_flags[0] = VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF;
+        layer_flags[1] = VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF;
+        break;
+    }
+    case 3: {
+        // 3-layers, 4-frame period: 0 2 1 2 ...
+        cfg->ts_number_layers = 3;
+        cfg->ts_periodicity = 4;
+        cfg->ts_layer_id[0] = 0;
+        cfg->ts_layer_id[1] = 2;
+        cfg->ts_layer_id[2] = 1;
+        cfg->ts_layer_id[3] = 2;
+        cfg->ts_rate_decimator[0] = 4;
+        cfg->ts_rate_decimator[1] = 2;
+        cfg->ts_rate_decimator[2] = 1;
+        cfg->ts_target_bitrate[0] = cfg->rc_target_bitrate * 40 / 100;
+        cfg->ts_target_bitrate[1] = cfg->rc_target_bitrate * 60 / 100;
+        cfg->ts_target_bitrate[2] = cfg->rc_target_bitrate;
+
+        layer_flags[0] = VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF;
+        layer_flags[2] = VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF;
+        layer_flags[1] = VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF;
+        layer_flags[3] = layer_flags[1];
+        break;
+    }
+    default:
+        return -1;
+    }
 
-    header[0] = 'D';
-    header[1] = 'K';
-    header[2] = 'I';
-    header[3] = 'F';
-    mem_put_1e16(header + 4, 0);  // version
-    mem_put_1e16(header + 6, 32); // headersize
-    mem_put_1e32(header + 8, fourcc);
-    mem_put_1e16(header + 12, cfg->g_w);
-    mem_put_1e16(header + 14, cfg->g_h);
-    mem_put_1e32(header + 16, cfg->g_timebase.den);
-    mem_put_1e32(header + 20, cfg->g_timebase.num);
-    mem_put_1e32(header + 24, frame_cnt);
-    mem_put_1e32(header + 28, 0);
-
-    fwrite(header, 1, 32, outfile);
+    // Realtime conferencing settings, every layer is rate controlled on its own
+    cfg->rc_end_usage = VPX_CBR;
+    cfg->g_lag_in_frames = 0;
+    cfg->g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+    cfg->rc_dropframe_thresh = 0;
+    // The encoder would place its own keyframes on any phase, and a keyframe
+    // in an upper layer is dropped by ivfLayerFilter. They are forced on the
+    // first TL0 phase after kf_max_dist frames instead.
+    cfg->kf_mode = VPX_KF_DISABLED;
+    cfg->kf_max_dist = 3000;
+    return 0;
 }
 
-static void write_ivf_frame_header(FILE* outfile, const vpx_codec_cx_pkt_t* pkt) {
-    char header[12];
-    vpx_codec_pts_t pts;
-    
-    if (pkt->kind != VPX_CODEC_CX_FRAME_PKT)
+// Layer L is decodable from the packets of layers 0..L, so the report is
+// cumulative: what a receiver subscribed up to layer L gets. That is also how
+// ts_target_bitrate is given, and what ivfLayerFilter prints.
+static void print_layer_report(const vpx_codec_enc_cfg_t* cfg, const int* layer_frames, const long long* layer_bytes, int frame_cnt)
+{
+    double framerate = (double)cfg->g_timebase.den / cfg->g_timebase.num;
+    double duration = frame_cnt / framerate;
+    if (duration <= 0)
         return;
 
-    pts = pkt->data.frame.pts;
-    mem_put_1e32(header, pkt->data.frame.sz);
-    mem_put_1e32(header + 4, pts & 0xFFFFFFFF);
-    mem_put_1e32(header + 8, pts >> 32);
-
-    fwrite(header, 1, 12, outfile);
+    int frames = 0;
+    long long bytes = 0;
+    printf("--------------- Temporal layer report ----------------\n");
+    printf("%-10s %6s %7s %10s %12s\n", "layers", "frames", "fps", "kbps", "target kbps");
+    for (unsigned int l = 0; l < cfg->ts_number_layers; ++l) {
+        frames += layer_frames[l];
+        bytes += layer_bytes[l];
+        printf("TL0..TL%-3u %6d %7.2f %10.2f %12u\n",
+            l, frames, frames / duration, bytes * 8 / duration / 1000, cfg->ts_target_bitrate[l]);
+    }
+    printf("------------------------------------------------------\n");
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    // Usage: simpleEncoderBasedOnVPX [ts_layers(1|2|3)] [output.ivf|-] [index]
+    // "-" streams the IVF to stdout, "index" also writes the seek index to
+    // the sidecar output.ivf.idx.
+    int ts_layers = argc > 1 ? atoi(argv[1]) : 1;
+    const char* out_path = argc > 2 ? argv[2] : "./bbc_out.ivf";
+    int write_index = argc > 3 && !strcmp(argv[3], "index");
+    if (ts_layers < 1 || ts_layers > MAX_TS_LAYERS) {
+        printf("Unsupported number of temporal layers: %d\n", ts_layers);
+        return -1;
+    }
+
     // Open input file for this encoding pass
     FILE* infile = fopen("../clips/bbc_640x480_374.yuv", "rb");
-    FILE* outfile = fopen("./bbc_out.ivf", "wb");
+    FILE* outfile;
+    if (strcmp(out_path, "-")) {
+        outfile = fopen(out_path, "wb");
+    } else {
+        // keep the progress log off the IVF stream
+        outfile = fdopen(dup(STDOUT_FILENO), "wb");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        out_path = "./bbc_out.ivf";
+    }
 
     if (infile == NULL || outfile == NULL) {
         printf("Error open file\n");
         return -1;
     }
 
+    FILE* indexfile = NULL;
+    if (write_index) {
+        if (!strcmp(argv[2], "-")) {
+            printf("The seek index needs a file output\n");
+            return -1;
+        }
+        char index_path[1024];
+        snprintf(index_path, sizeof(index_path), "%s%s", out_path, IVF_INDEX_SUFFIX);
+        indexfile = fopen(index_path, "wb");
+        if (indexfile == NULL) {
+            printf("Error open file\n");
+            return -1;
+        }
+    }
+
+    // Sidecar with one "frame_index layer_id size" line per IVF frame, it is
+    // what ivfLayerFilter uses to thin the stream out per receiver.
+    FILE* layerfile = NULL;
+    if (ts_layers > 1) {
+        char layer_path[1024];
+        snprintf(layer_path, sizeof(layer_path), "%s.tl", out_path);
+        layerfile = fopen(layer_path, "w");
+        if (layerfile == NULL) {
+            printf("Error open file\n");
+            return -1;
+        }
+    }
+
     vpx_image_t raw;
     int width = 640;
     int height = 480;
@@ -95,7 +178,21 @@ int main()
     cfg.g_w = width;
     cfg.g_h = height;
 
-    write_ivf_file_header(outfile, &cfg, 0);
+    int layer_flags[MAX_TS_PERIODICITY] = { 0 };
+    if (ts_layers > 1) {
+        if (setup_temporal_layers(&cfg, ts_layers, layer_flags)) {
+            printf("Failed to setup temporal layers\n");
+            return -1;
+        }
+        fprintf(layerfile, "# ts_number_layers %u ts_periodicity %u\n", cfg.ts_number_layers, cfg.ts_periodicity);
+    }
+
+    ivf_file_header ivf_header = { IVF_FOURCC_VP8, (uint16_t)cfg.g_w, (uint16_t)cfg.g_h, (uint32_t)cfg.g_timebase.den, (uint32_t)cfg.g_timebase.num, 0 };
+    ivf_writer writer;
+    if (ivf_writer_open(&writer, outfile, &ivf_header, indexfile)) {
+        printf("Failed to write IVF header\n");
+        return -1;
+    }
 
     vpx_codec_ctx_t codec;
     // Initialize codec
@@ -110,6 +207,10 @@ int main()
     int y_size = cfg.g_w * cfg.g_h;
     int frame_cnt = 0;
     int flags = 0;
+    int last_key = 0;
+
+    int layer_frames[MAX_TS_LAYERS] = { 0 };
+    long long layer_bytes[MAX_TS_LAYERS] = { 0 };
 
     while (frame_avail || got_data) {
         vpx_codec_iter_t iter = NULL;
@@ -118,6 +219,16 @@ int main()
             frame_avail = 0;
         }
 
+        if (ts_layers > 1) {
+            int phase = frame_cnt % cfg.ts_periodicity;
+            flags = layer_flags[phase];
+            if (phase == 0 && frame_cnt - last_key >= (int)cfg.kf_max_dist) {
+                flags |= VPX_EFLAG_FORCE_KF;
+                last_key = frame_cnt;
+            }
+            vpx_codec_control(&codec, VP8E_SET_TEMPORAL_LAYER_ID, cfg.ts_layer_id[phase]);
+        }
+
         if (frame_avail) {
             ret = vpx_codec_encode(&codec, &raw, frame_cnt, 1, flags, VPX_DL_REALTIME);
         } else {
@@ -135,8 +246,17 @@ int main()
             got_data = 1;
             switch (pkt->kind) {
             case VPX_CODEC_CX_FRAME_PKT:
-                write_ivf_frame_header(outfile, pkt);
-                fwrite(pkt->data.frame.buf, 1, pkt->data.frame.sz, outfile);
+                if (ivf_writer_write_frame(&writer, pkt->data.frame.buf, pkt->data.frame.sz, pkt->data.frame.pts, pkt->data.frame.flags & VPX_FRAME_IS_KEY)) {
+                    printf("Failed to write frame\n");
+                    return -1;
+                }
+                if (layerfile) {
+                    // lag_in_frames is 0, so the pts is the input frame index
+                    int layer_id = cfg.ts_layer_id[pkt->data.frame.pts % cfg.ts_periodicity];
+                    fprintf(layerfile, "%lld %d %u\n", (long long)pkt->data.frame.pts, layer_id, (unsigned int)pkt->data.frame.sz);
+                    layer_frames[layer_id]++;
+                    layer_bytes[layer_id] += pkt->data.frame.sz;
+                }
                 break;
             default:
                 break;
@@ -150,8 +270,13 @@ int main()
     fclose(infile);
     vpx_codec_destroy(&codec);
 
-    if (!fseek(outfile, 0, SEEK_SET)) {
-        write_ivf_file_header(outfile, &cfg, frame_cnt - 1);
-    }
+    ivf_writer_close(&writer);
     fclose(outfile);
+    if (indexfile)
+        fclose(indexfile);
+
+    if (layerfile) {
+        fclose(layerfile);
+        print_layer_report(&cfg, layer_frames, layer_bytes, frame_cnt - 1);
+    }
 }
@@ -0,0 +1,174 @@
+#ifndef PACKET_QUEUE_H
+#define PACKET_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// Buffer health of one packet queue, sampled by the consumer on every pop
+struct packet_queue_stats {
+    int64_t pops;
+    int64_t empty_pops; // the decoder found nothing buffered and had to wait
+    double empty_wait; // seconds the decoder waited for the demuxer
+    int64_t full_pushes; // the read-ahead window was full
+    double full_wait; // seconds the demuxer waited for the decoder
+    double level_sum; // buffered seconds, summed over pops
+    double level_min;
+    int64_t bytes_max;
+};
+
+// Packets of one stream between the demuxer and its decoder, bounded by the
+// buffered bytes and duration instead of a packet count: the duration bound
+// is the read-ahead window, the byte bound caps high bitrate streams. One
+// packet is always accepted, so a huge packet cannot stall the demuxer.
+class PacketQueue {
+public:
+    PacketQueue(int64_t max_bytes, double max_duration, AVRational time_base)
+        : max_bytes_(max_bytes)
+        , max_duration_(max_duration)
+        , time_base_(av_q2d(time_base))
+    {
+        stats_ = packet_queue_stats();
+        stats_.level_min = -1;
+    }
+
+    // Blocks while the queue is full, false if the queue was closed
+    bool push(AVPacket* packet)
+    {
+        // packets without a duration are measured by their dts distance
+        int64_t duration = packet->duration;
+        if (duration <= 0 && packet->dts != AV_NOPTS_VALUE && last_dts_ != AV_NOPTS_VALUE && packet->dts > last_dts_)
+            duration = packet->dts - last_dts_;
+        if (packet->dts != AV_NOPTS_VALUE)
+            last_dts_ = packet->dts;
+        entry e = { packet, duration * time_base_ };
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (full() && !closed_) {
+            stats_.full_pushes++;
+            double start = now();
+            not_full_.wait(lock, [this] { return !full() || closed_; });
+            stats_.full_wait += now() - start;
+        }
+        if (closed_)
+            return false;
+        queue_.push_back(e);
+        bytes_ += packet->size;
+        duration_ += e.duration;
+        if (bytes_ > stats_.bytes_max)
+            stats_.bytes_max = bytes_;
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(AVPacket*& packet)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.empty() && !closed_) {
+            stats_.empty_pops++;
+            double start = now();
+            not_empty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+            stats_.empty_wait += now() - start;
+        }
+        if (queue_.empty())
+            return false;
+        stats_.pops++;
+        stats_.level_sum += duration_;
+        if (stats_.level_min < 0 || duration_ < stats_.level_min)
+            stats_.level_min = duration_;
+        take(packet);
+        return true;
+    }
+
+    // Non blocking pop for the cleanup, not counted in the stats
+    bool try_pop(AVPacket*& packet)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty())
+            return false;
+        take(packet);
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    // Buffered seconds and bytes right now
+    double duration()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return duration_;
+    }
+
+    int64_t bytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+
+    bool empty()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.empty() && !closed_;
+    }
+
+    packet_queue_stats stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    struct entry {
+        AVPacket* packet;
+        double duration;
+    };
+
+    static double now()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool full() const
+    {
+        return !queue_.empty() && (bytes_ >= max_bytes_ || duration_ >= max_duration_);
+    }
+
+    void take(AVPacket*& packet)
+    {
+        entry e = queue_.front();
+        queue_.pop_front();
+        bytes_ -= e.packet->size;
+        duration_ -= e.duration;
+        if (queue_.empty())
+            duration_ = 0; // no drift from the float sums
+        packet = e.packet;
+        not_full_.notify_one();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<entry> queue_;
+    int64_t max_bytes_;
+    double max_duration_;
+    double time_base_;
+    int64_t bytes_ = 0;
+    double duration_ = 0;
+    int64_t last_dts_ = AV_NOPTS_VALUE; // demuxer thread only
+    bool closed_ = false;
+    packet_queue_stats stats_;
+};
+
+#endif
@@ -1,4 +1,12 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #define __STDC_CONSTANT_MACROS
 
@@ -8,7 +16,9 @@ extern "C" {
 #include "SDL2/SDL.h"
 #include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
-#include "libavutil/imgutils.h"
+#include "libavutil/channel_layout.h"
+#include "libavutil/pixdesc.h"
+#include "libswresample/swresample.h"
 #include "libswscale/swscale.h"
 };
 #else
@@ -19,90 +29,595 @@ extern "C" {
 #include <SDL2/SDL.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
-#include <libavutil/imgutils.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/pixdesc.h>
+#include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 #ifdef __cplusplus
 };
 #endif
 #endif
 
+#include "bounded_queue.h"
+#include "packet_queue.h"
+#include "spsc_ring.h"
+
 // Output YUV420P data as a file
 #define OUTPUT_YUV420P 0
 
+// Decoded frames buffered between the decoder and the render thread
+#define FRAME_QUEUE_SIZE 8
+// Demuxer read-ahead per stream: seconds and MB buffered, AVIO buffer size
+#define READAHEAD_SECONDS 2.0
+#define READAHEAD_MB 16
+#define AVIO_BUFFER_KB 32
+// Decoded audio buffered ahead of the SDL callback
+#define AUDIO_RING_MS 500
+// Video is kept within this distance of the master clock, seconds
+#define AV_SYNC_THRESHOLD 0.040
+
+static double now_s()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Busy time of the pipeline stages for --benchmark, each field is written by
+// one thread only and read after it was joined
+struct stage_times {
+    double demux; // av_read_frame
+    int64_t packets;
+    double decode; // send/receive of the video stream
+    double present; // render clear/copy/present
+};
+
+struct player_stats {
+    int64_t presented;
+    int64_t dropped; // too late for the master clock
+    int64_t repeated; // early frames: the previous picture was shown again
+    int64_t out_of_sync; // presented further than AV_SYNC_THRESHOLD from the clock
+    double jitter_sum; // |presented - due|, seconds
+    double jitter_max;
+    // the render thread waited for a decoded frame while the video packet
+    // queue was empty (I/O bound) or had packets (decoder bound)
+    int64_t starved_io;
+    int64_t starved_cpu;
+    double starved_io_wait;
+    double starved_cpu_wait;
+};
+
+// Input read through our own AVIOContext: the buffer size is configurable and
+// the time spent in reads tells slow I/O from slow decoding
+struct io_reader {
+    AVIOContext* inner;
+    double read_time;
+    int64_t bytes;
+    int64_t reads;
+};
+
+static int io_read(void* opaque, uint8_t* buf, int size)
+{
+    io_reader* io = (io_reader*)opaque;
+    double start = now_s();
+    int ret = avio_read(io->inner, buf, size);
+    io->read_time += now_s() - start;
+    io->reads++;
+    if (ret > 0)
+        io->bytes += ret;
+    return ret == 0 ? AVERROR_EOF : ret;
+}
+
+static int64_t io_seek(void* opaque, int64_t offset, int whence)
+{
+    io_reader* io = (io_reader*)opaque;
+    if (whence == AVSEEK_SIZE)
+        return avio_size(io->inner);
+    return avio_seek(io->inner, offset, whence);
+}
+
+// Audio decoder -> SDL callback. Everything the callback touches is atomic
+// or owned by the lock free ring, the callback never blocks.
+struct audio_output {
+    SDL_AudioDeviceID device;
+    SpscRing* ring;
+    SwrContext* swr;
+    double time_base;
+    int rate;
+    int frame_bytes; // one sample for every channel, s16
+    double latency; // audio handed to SDL but not heard yet, seconds
+    double start_pts; // pts of the first queued sample, set before started
+    std::atomic<bool> started { false };
+    std::atomic<bool> finished { false };
+    std::atomic<bool> starved { true }; // until the first full callback
+    std::atomic<bool> stop { false };
+    std::atomic<int64_t> played_samples { 0 };
+    std::atomic<int64_t> callback_us { 0 };
+    std::atomic<int64_t> underruns { 0 };
+};
+
+static void audio_callback(void* userdata, Uint8* stream, int len)
+{
+    audio_output* audio = (audio_output*)userdata;
+    size_t got = audio->ring->read(stream, len);
+    if (got < (size_t)len) {
+        memset(stream + got, 0, len - got); // s16 silence
+        if (audio->started && !audio->finished)
+            audio->underruns++;
+        audio->starved = true;
+    } else {
+        audio->starved = false;
+    }
+    audio->played_samples += got / audio->frame_bytes;
+    audio->callback_us = (int64_t)(now_s() * 1000000);
+}
+
+// Media time being heard now: what the callbacks consumed minus what is still
+// in the device, advanced by the time since the last callback
+static double audio_clock(audio_output* audio)
+{
+    double since = now_s() - audio->callback_us / 1000000.0;
+    since = fmin(fmax(since, 0.0), audio->latency / 2);
+    return audio->start_pts + (double)audio->played_samples / audio->rate - audio->latency + since;
+}
+
+// Audio is the master while it is playing, otherwise (no audio stream, not
+// started yet, starved or finished) the wall clock continues from where the
+// last master time was
+struct master_clock {
+    audio_output* audio;
+    double wall_offset; // media time = now - wall_offset
+    int started;
+};
+
+static double master_time(master_clock* clock)
+{
+    audio_output* audio = clock->audio;
+    if (audio && audio->started && !audio->starved) {
+        double t = audio_clock(audio);
+        clock->wall_offset = now_s() - t;
+        return t;
+    }
+    return now_s() - clock->wall_offset;
+}
+
+// SDL_UpdateNVTexture arrived in SDL 2.0.16, older SDL converts NV12 with sws
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+#define HAVE_SDL_NV_TEXTURE 1
+#else
+#define HAVE_SDL_NV_TEXTURE 0
+#endif
+
+// How decoded frames reach the texture
+enum upload_path {
+    UPLOAD_YUV420P, // planes straight to an IYUV texture
+    UPLOAD_NV12, // Y + interleaved UV straight to an NV12 texture
+    UPLOAD_CONVERT, // sws_scale to YUV420P first
+};
+
+static const char* upload_path_names[] = { "yuv420p direct", "nv12 direct", "sws_scale to yuv420p" };
+
+// Texture state, rebuilt whenever the decoded format or size changes
+struct video_output {
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+    int format; // AVPixelFormat the texture was set up for
+    int width;
+    int height;
+    upload_path path;
+    struct SwsContext* sws;
+    AVFrame* converted; // UPLOAD_CONVERT destination
+    int64_t uploads;
+    double upload_sum; // seconds, conversion included
+    double upload_max;
+    double convert_sum; // sws_scale part of upload_sum
+};
+
+static int setup_output(video_output* out, const AVFrame* frame)
+{
+    if (out->texture)
+        SDL_DestroyTexture(out->texture);
+    av_frame_free(&out->converted);
+    sws_freeContext(out->sws);
+    out->sws = NULL;
+
+    Uint32 sdl_format = SDL_PIXELFORMAT_IYUV;
+    // the dump file is always yuv420p, so NV12 is converted when dumping
+    if (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P) {
+        out->path = UPLOAD_YUV420P;
+    } else if (frame->format == AV_PIX_FMT_NV12 && HAVE_SDL_NV_TEXTURE && !OUTPUT_YUV420P) {
+        out->path = UPLOAD_NV12;
+        sdl_format = SDL_PIXELFORMAT_NV12;
+    } else {
+        out->path = UPLOAD_CONVERT;
+        out->sws = sws_getContext(frame->width, frame->height, (AVPixelFormat)frame->format, frame->width, frame->height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, NULL, NULL, NULL);
+        out->converted = av_frame_alloc();
+        out->converted->format = AV_PIX_FMT_YUV420P;
+        out->converted->width = frame->width;
+        out->converted->height = frame->height;
+        if (!out->sws || av_frame_get_buffer(out->converted, 0) < 0) {
+            printf("Could not set up the conversion from %s.\n", av_get_pix_fmt_name((AVPixelFormat)frame->format));
+            return -1;
+        }
+    }
+
+    // IYUV: Y + U + V  (3 planes)
+    // NV12: Y + UV     (2 planes)
+    out->texture = SDL_CreateTexture(out->renderer, sdl_format, SDL_TEXTUREACCESS_STREAMING, frame->width, frame->height);
+    if (!out->texture) {
+        printf("SDL: could not create texture - %s\n", SDL_GetError());
+        return -1;
+    }
+    out->format = frame->format;
+    out->width = frame->width;
+    out->height = frame->height;
+    printf("video upload: %s, %dx%d %s\n", upload_path_names[out->path], frame->width, frame->height, av_get_pix_fmt_name((AVPixelFormat)frame->format));
+    return 0;
+}
+
+// Copy one decoded frame into the texture, returns the frame that was uploaded
+// (the decoded one or its yuv420p conversion)
+static const AVFrame* upload_frame(video_output* out, const AVFrame* frame)
+{
+    if (frame->format != out->format || frame->width != out->width || frame->height != out->height) {
+        if (setup_output(out, frame) < 0)
+            return NULL;
+    }
+
+    double start = now_s();
+    const AVFrame* src = frame;
+    switch (out->path) {
+    case UPLOAD_CONVERT:
+        sws_scale(out->sws, (const unsigned char* const*)frame->data, frame->linesize, 0, frame->height, out->converted->data, out->converted->linesize);
+        src = out->converted;
+        out->convert_sum += now_s() - start;
+        // fall through
+    case UPLOAD_YUV420P:
+        SDL_UpdateYUVTexture(out->texture, NULL, src->data[0], src->linesize[0], src->data[1], src->linesize[1], src->data[2], src->linesize[2]);
+        break;
+    case UPLOAD_NV12:
+#if HAVE_SDL_NV_TEXTURE
+        SDL_UpdateNVTexture(out->texture, NULL, src->data[0], src->linesize[0], src->data[1], src->linesize[1]);
+#endif
+        break;
+    }
+    double elapsed = now_s() - start;
+    out->upload_sum += elapsed;
+    out->upload_max = fmax(out->upload_max, elapsed);
+    out->uploads++;
+    return src;
+}
+
+#if OUTPUT_YUV420P
+static void write_yuv420p(FILE* fp, const AVFrame* frame)
+{
+    for (int plane = 0; plane < 3; ++plane) {
+        int w = plane ? (frame->width + 1) / 2 : frame->width;
+        int h = plane ? (frame->height + 1) / 2 : frame->height;
+        for (int y = 0; y < h; ++y)
+            fwrite(frame->data[plane] + y * frame->linesize[plane], 1, w, fp);
+    }
+}
+#endif
+
+// Send one packet (NULL flushes) and queue every frame it produces, the time
+// spent in the decoder (not waiting on the queue) is added to decode_time.
+// Returns a negative value on decode errors or when the queue was closed.
+static int decode_packet(AVCodecContext* pCodecCtx, const AVPacket* packet, BoundedQueue<AVFrame*>* frames, double* decode_time)
+{
+    double start = now_s();
+    int ret = avcodec_send_packet(pCodecCtx, packet);
+    *decode_time += now_s() - start;
+    if (ret < 0)
+        return ret;
+    for (;;) {
+        AVFrame* frame = av_frame_alloc();
+        start = now_s();
+        ret = avcodec_receive_frame(pCodecCtx, frame);
+        *decode_time += now_s() - start;
+        if (ret < 0) {
+            av_frame_free(&frame);
+            return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+        }
+        if (!frames->push(frame)) {
+            av_frame_free(&frame);
+            return -1;
+        }
+    }
+}
+
+// Route packets of the played streams to their decoder threads, the packet
+// queues bound how far (bytes and duration) the demuxer reads ahead
+static void demux_thread(AVFormatContext* pFormatCtx, int videoindex, PacketQueue* video_packets, int audioindex, PacketQueue* audio_packets, stage_times* times)
+{
+    AVPacket* packet = av_packet_alloc();
+    bool running = true;
+    while (running) {
+        double start = now_s();
+        int ret = av_read_frame(pFormatCtx, packet);
+        times->demux += now_s() - start;
+        if (ret < 0)
+            break;
+        times->packets++;
+        PacketQueue* queue = NULL;
+        if (packet->stream_index == videoindex)
+            queue = video_packets;
+        else if (packet->stream_index == audioindex)
+            queue = audio_packets;
+        if (queue) {
+            AVPacket* queued = av_packet_alloc();
+            av_packet_move_ref(queued, packet);
+            if (!queue->push(queued)) {
+                av_packet_free(&queued);
+                running = false;
+            }
+        }
+        av_packet_unref(packet);
+    }
+    video_packets->close();
+    audio_packets->close();
+    av_packet_free(&packet);
+}
+
+// Decode the video stream, the frame queue bounds how far the decoder runs
+// ahead of the presentation
+static void video_thread(AVCodecContext* pCodecCtx, PacketQueue* packets, BoundedQueue<AVFrame*>* frames, stage_times* times)
+{
+    AVPacket* packet;
+    int ret = 0;
+    while (ret >= 0 && packets->pop(packet)) {
+        ret = decode_packet(pCodecCtx, packet, frames, &times->decode);
+        if (ret < 0 && !frames->closed()) {
+            printf("Decode Error.\n");
+            ret = 0;
+        }
+        av_packet_free(&packet);
+    }
+    // flush decoder
+    if (ret >= 0)
+        decode_packet(pCodecCtx, NULL, frames, &times->decode);
+    frames->close();
+}
+
+// Convert one decoded frame to the device format and queue it for the
+// callback, waiting for room while the ring is full
+static int queue_audio(audio_output* audio, const AVFrame* frame, std::vector<uint8_t>& buffer)
+{
+    if (!audio->started) {
+        audio->start_pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp * audio->time_base : 0;
+        audio->started = true;
+    }
+
+    int max_samples = swr_get_out_samples(audio->swr, frame->nb_samples);
+    buffer.resize((size_t)max_samples * audio->frame_bytes);
+    uint8_t* out = buffer.data();
+    int samples = swr_convert(audio->swr, &out, max_samples, (const uint8_t**)frame->extended_data, frame->nb_samples);
+    if (samples < 0)
+        return samples;
+
+    size_t size = (size_t)samples * audio->frame_bytes;
+    size_t written = 0;
+    while (written < size) {
+        if (audio->stop)
+            return -1;
+        size_t n = audio->ring->write(out + written, size - written);
+        written += n;
+        if (!n)
+            std::this_thread::sleep_for(std::chrono::duration<double>(audio->latency / 4));
+    }
+    return 0;
+}
+
+static void audio_thread(AVCodecContext* pCodecCtx, PacketQueue* packets, audio_output* audio)
+{
+    AVFrame* frame = av_frame_alloc();
+    std::vector<uint8_t> buffer;
+    bool more = true;
+    while (more && !audio->stop) {
+        AVPacket* packet = NULL;
+        more = packets->pop(packet);
+        // a NULL packet flushes the decoder at the end of the stream
+        if (avcodec_send_packet(pCodecCtx, packet) < 0 && more) {
+            av_packet_free(&packet);
+            continue;
+        }
+        av_packet_free(&packet);
+        while (avcodec_receive_frame(pCodecCtx, frame) >= 0) {
+            if (queue_audio(audio, frame, buffer) < 0)
+                more = false;
+            av_frame_unref(frame);
+        }
+    }
+    audio->finished = true;
+    av_frame_free(&frame);
+}
+
+// Open the decoder and the SDL device of the first audio stream, audio is
+// played as s16 with at most two channels and SDL converts the rest
+static int open_audio(AVFormatContext* pFormatCtx, int audioindex, AVCodecContext** pAudioCtx, audio_output* audio)
+{
+    AVStream* st = pFormatCtx->streams[audioindex];
+    AVCodec* codec = avcodec_find_decoder(st->codecpar->codec_id);
+    if (!codec)
+        return -1;
+    AVCodecContext* ctx = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(ctx, st->codecpar);
+    if (avcodec_open2(ctx, codec, NULL) < 0) {
+        avcodec_free_context(&ctx);
+        return -1;
+    }
+
+    int channels = ctx->channels > 1 ? 2 : 1;
+    SDL_AudioSpec wanted, obtained;
+    memset(&wanted, 0, sizeof(wanted));
+    wanted.freq = ctx->sample_rate;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = channels;
+    // a callback every ~20 ms, rounded down to a power of two
+    wanted.samples = 256;
+    while (wanted.samples * 2 <= ctx->sample_rate / 50)
+        wanted.samples *= 2;
+    wanted.callback = audio_callback;
+    wanted.userdata = audio;
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, 0);
+    if (!audio->device) {
+        printf("SDL: could not open audio - %s\n", SDL_GetError());
+        avcodec_free_context(&ctx);
+        return -1;
+    }
+
+    int64_t in_layout = ctx->channel_layout ? (int64_t)ctx->channel_layout : av_get_default_channel_layout(ctx->channels);
+    int64_t out_layout = channels == 2 ? AV_CH_LAYOUT_STEREO : AV_CH_LAYOUT_MONO;
+    audio->swr = swr_alloc_set_opts(NULL, out_layout, AV_SAMPLE_FMT_S16, ctx->sample_rate, in_layout, ctx->sample_fmt, ctx->sample_rate, 0, NULL);
+    if (!audio->swr || swr_init(audio->swr) < 0) {
+        printf("Could not set up the audio conversion.\n");
+        SDL_CloseAudioDevice(audio->device);
+        avcodec_free_context(&ctx);
+        return -1;
+    }
+
+    audio->time_base = av_q2d(st->time_base);
+    audio->rate = ctx->sample_rate;
+    audio->frame_bytes = channels * 2;
+    // one buffer plays while the next one waits in SDL
+    audio->latency = 2.0 * obtained.samples / ctx->sample_rate;
+    audio->ring = new SpscRing((size_t)ctx->sample_rate * audio->frame_bytes * AUDIO_RING_MS / 1000);
+    *pAudioCtx = ctx;
+    printf("audio: %d Hz, %d channels, %d sample callback\n", ctx->sample_rate, channels, obtained.samples);
+    return 0;
+}
+
+static int poll_quit()
+{
+    SDL_Event event;
+    int quit = 0;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT)
+            quit = 1;
+    }
+    return quit;
+}
+
+// Draw the current texture
+static void render(SDL_Renderer* sdlRenderer, SDL_Texture* texture, const SDL_Rect* rect)
+{
+    SDL_RenderClear(sdlRenderer);
+    SDL_RenderCopy(sdlRenderer, texture, NULL, rect);
+    SDL_RenderPresent(sdlRenderer);
+}
+
 int main(int argc, char* argv[])
 {
     AVFormatContext* pFormatCtx;
-    int i, videoindex;
+    int videoindex, audioindex;
     AVCodecContext* pCodecCtx;
+    AVCodecContext* pAudioCtx = NULL;
+    audio_output audio;
     AVCodec* pCodec;
-    AVFrame *pFrame, *pFrameYUV;
-    unsigned char* out_buffer;
-    AVPacket* packet;
-    int y_size;
-    int ret, got_picture;
-    struct SwsContext* img_convert_ctx;
 
-    char filepath[] = "bigbuckbunny_480x272.h265";
+    const char* filepath = "bigbuckbunny_480x272.h265";
+    int benchmark = 0;
+    int health = 0;
+    double readahead = READAHEAD_SECONDS;
+    double readahead_mb = READAHEAD_MB;
+    int avio_buffer_kb = AVIO_BUFFER_KB;
+    io_reader io = { NULL, 0, 0, 0 };
+    AVIOContext* custom_pb = NULL;
     // SDL---------------------------
     int screen_w = 0, screen_h = 0;
     SDL_Window* screen;
     SDL_Renderer* sdlRenderer;
-    SDL_Texture* sdlTexture;
     SDL_Rect sdlRect;
 
+#if OUTPUT_YUV420P
     FILE* fp_yuv;
+#endif
+
+    for (int i = 1; i < argc; ++i) {
+        int has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--benchmark"))
+            benchmark = 1;
+        else if (!strcmp(argv[i], "--health"))
+            health = 1;
+        else if (!strcmp(argv[i], "--readahead") && has_value)
+            readahead = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--readahead-mb") && has_value)
+            readahead_mb = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--avio-buffer") && has_value)
+            avio_buffer_kb = atoi(argv[++i]);
+        else if (argv[i][0] == '-') {
+            readahead = 0;
+            break;
+        } else
+            filepath = argv[i];
+    }
+    if (readahead <= 0 || readahead_mb <= 0 || avio_buffer_kb <= 0) {
+        printf("usage: %s [--benchmark] [--health] [--readahead seconds] [--readahead-mb MB] [--avio-buffer KB] [file]\n", argv[0]);
+        return -1;
+    }
 
     av_register_all();
     avformat_network_init();
     pFormatCtx = avformat_alloc_context();
 
+    // inputs avio can open are read through our own AVIOContext, others
+    // (rtsp, devices, ...) keep the demuxer's own I/O
+    if (avio_open2(&io.inner, filepath, AVIO_FLAG_READ, NULL, NULL) >= 0) {
+        unsigned char* io_buffer = (unsigned char*)av_malloc(avio_buffer_kb * 1024);
+        custom_pb = avio_alloc_context(io_buffer, avio_buffer_kb * 1024, 0, &io, io_read, NULL, io_seek);
+        pFormatCtx->pb = custom_pb;
+    }
+
     if (avformat_open_input(&pFormatCtx, filepath, NULL, NULL) != 0) {
         printf("Couldn't open input stream.\n");
         return -1;
     }
+    // the report counts the playback reads only
+    io.read_time = 0;
+    io.bytes = 0;
+    io.reads = 0;
     if (avformat_find_stream_info(pFormatCtx, NULL) < 0) {
         printf("Couldn't find stream information.\n");
         return -1;
     }
-    videoindex = -1;
-    for (i = 0; i < pFormatCtx->nb_streams; i++)
-        if (pFormatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
-            videoindex = i;
-            break;
-        }
-    if (videoindex == -1) {
+    videoindex = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (videoindex < 0) {
         printf("Didn't find a video stream.\n");
         return -1;
     }
 
-    pCodecCtx = pFormatCtx->streams[videoindex]->codec;
-    pCodec = avcodec_find_decoder(pCodecCtx->codec_id);
+    AVStream* video_st = pFormatCtx->streams[videoindex];
+    pCodec = avcodec_find_decoder(video_st->codecpar->codec_id);
     if (pCodec == NULL) {
         printf("Codec not found.\n");
         return -1;
     }
+    pCodecCtx = avcodec_alloc_context3(pCodec);
+    avcodec_parameters_to_context(pCodecCtx, video_st->codecpar);
     if (avcodec_open2(pCodecCtx, pCodec, NULL) < 0) {
         printf("Could not open codec.\n");
         return -1;
     }
 
-    pFrame = av_frame_alloc();
-    pFrameYUV = av_frame_alloc();
-    out_buffer = (unsigned char*)av_malloc(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, pCodecCtx->width, pCodecCtx->height, 1));
-    av_image_fill_arrays(pFrameYUV->data, pFrameYUV->linesize, out_buffer, AV_PIX_FMT_YUV420P, pCodecCtx->width, pCodecCtx->height, 1);
+    // the benchmark measures the video path only
+    audioindex = benchmark ? -1 : av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_AUDIO, -1, videoindex, NULL, 0);
 
-    packet = (AVPacket*)av_malloc(sizeof(AVPacket));
     // Output Info-----------------------------
     printf("--------------- File Information ----------------\n");
     av_dump_format(pFormatCtx, 0, filepath, 0);
     printf("-------------------------------------------------\n");
-    img_convert_ctx = sws_getContext(pCodecCtx->width, pCodecCtx->height, pCodecCtx->pix_fmt, pCodecCtx->width, pCodecCtx->height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, NULL, NULL, NULL);
 
 #if OUTPUT_YUV420P
     fp_yuv = fopen("output.yuv", "wb+");
 #endif
 
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER)) {
+    // headless: render with the software renderer into a dummy window, and
+    // leave the audio subsystem alone, the benchmark plays no audio
+    Uint32 sdl_flags = SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER;
+    if (benchmark) {
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+        SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+        sdl_flags = SDL_INIT_VIDEO | SDL_INIT_TIMER;
+    }
+    if (SDL_Init(sdl_flags)) {
         printf("Could not initialize SDL - %s\n", SDL_GetError());
         return -1;
     }
@@ -110,7 +625,7 @@ int main(int argc, char* argv[])
     screen_w = pCodecCtx->width;
     screen_h = pCodecCtx->height;
     // SDL 2.0 Support for multiple windows
-    screen = SDL_CreateWindow("Simplest ffmpeg player's Window", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, screen_w, screen_h, SDL_WINDOW_OPENGL);
+    screen = SDL_CreateWindow("Simplest ffmpeg player's Window", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, screen_w, screen_h, benchmark ? 0 : SDL_WINDOW_OPENGL);
 
     if (!screen) {
         printf("SDL: could not create window - exiting:%s\n", SDL_GetError());
@@ -118,75 +633,214 @@ int main(int argc, char* argv[])
     }
 
     sdlRenderer = SDL_CreateRenderer(screen, -1, 0);
-    // IYUV: Y + U + V  (3 planes)
-    // YV12: Y + V + U  (3 planes)
-    sdlTexture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, pCodecCtx->width, pCodecCtx->height);
+    if (!sdlRenderer) {
+        printf("SDL: could not create renderer - exiting:%s\n", SDL_GetError());
+        return -1;
+    }
+    // the texture is created from the first decoded frame's format
+    video_output output = {};
+    output.renderer = sdlRenderer;
+    output.format = AV_PIX_FMT_NONE;
 
     sdlRect.x = 0;
     sdlRect.y = 0;
     sdlRect.w = screen_w;
     sdlRect.h = screen_h;
 
+    if (audioindex >= 0 && open_audio(pFormatCtx, audioindex, &pAudioCtx, &audio) < 0) {
+        printf("Couldn't open the audio stream, playing video only.\n");
+        audioindex = -1;
+    }
+
     // SDL End----------------------
-    while (av_read_frame(pFormatCtx, packet) >= 0) {
-        if (packet->stream_index == videoindex) {
-            ret = avcodec_decode_video2(pCodecCtx, pFrame, &got_picture, packet);
-            if (ret < 0) {
-                printf("Decode Error.\n");
-                return -1;
+
+    // Demuxing and decoding run on their own threads, this (main) thread owns
+    // SDL and presents every frame when the master clock reaches its PTS
+    int64_t readahead_bytes = (int64_t)(readahead_mb * 1024 * 1024);
+    PacketQueue video_packets(readahead_bytes, readahead, video_st->time_base);
+    PacketQueue audio_packets(readahead_bytes, readahead, audioindex >= 0 ? pFormatCtx->streams[audioindex]->time_base : video_st->time_base);
+    BoundedQueue<AVFrame*> frame_queue(FRAME_QUEUE_SIZE);
+    stage_times times = { 0, 0, 0, 0 };
+    double play_start = now_s();
+    std::thread demuxer(demux_thread, pFormatCtx, videoindex, &video_packets, audioindex, &audio_packets, &times);
+    std::thread video_decoder(video_thread, pCodecCtx, &video_packets, &frame_queue, &times);
+    std::thread audio_decoder;
+    if (pAudioCtx) {
+        audio_decoder = std::thread(audio_thread, pAudioCtx, &audio_packets, &audio);
+        SDL_PauseAudioDevice(audio.device, 0);
+    }
+
+    AVRational frame_rate = av_guess_frame_rate(pFormatCtx, video_st, NULL);
+    double frame_duration = frame_rate.num > 0 ? av_q2d(av_inv_q(frame_rate)) : 0.04;
+    double time_base = av_q2d(video_st->time_base);
+
+    player_stats stats = {};
+    master_clock clock = { pAudioCtx ? &audio : NULL, 0, 0 };
+    double last_pts = -frame_duration;
+    double next_health = play_start + 1;
+    int quit = 0;
+    AVFrame* frame;
+    while (!quit) {
+        // an empty frame queue is a stall, blame I/O when no packet was
+        // buffered for the decoder either
+        double wait_start = now_s();
+        int no_packets = video_packets.empty();
+        if (!frame_queue.pop(frame))
+            break;
+        double waited = now_s() - wait_start;
+        if (waited > 0.001 && stats.presented) {
+            if (no_packets) {
+                stats.starved_io++;
+                stats.starved_io_wait += waited;
+            } else {
+                stats.starved_cpu++;
+                stats.starved_cpu_wait += waited;
             }
-            if (got_picture) {
-                sws_scale(img_convert_ctx, (const unsigned char* const*)pFrame->data, pFrame->linesize, 0, pCodecCtx->height, pFrameYUV->data, pFrameYUV->linesize);
+        }
 
-#if OUTPUT_YUV420P
-                y_size = pCodecCtx->width * pCodecCtx->height;
-                fwrite(pFrameYUV->data[0], 1, y_size, fp_yuv);     // Y
-                fwrite(pFrameYUV->data[1], 1, y_size / 4, fp_yuv); // U
-                fwrite(pFrameYUV->data[2], 1, y_size / 4, fp_yuv); // V
-#endif
-                // SDL---------------------------
-#if 0
-				SDL_UpdateTexture( sdlTexture, NULL, pFrameYUV->data[0], pFrameYUV->linesize[0] );
-#else
-                SDL_UpdateYUVTexture(sdlTexture, &sdlRect, pFrameYUV->data[0], pFrameYUV->linesize[0], pFrameYUV->data[1], pFrameYUV->linesize[1], pFrameYUV->data[2], pFrameYUV->linesize[2]);
-#endif
+        quit = poll_quit();
+        if (health && wait_start >= next_health) {
+            printf("buffer: video %.2f s %.0f KB, audio %.2f s %.0f KB, %d frames decoded ahead\n", video_packets.duration(), video_packets.bytes() / 1024.0,
+                audio_packets.duration(), audio_packets.bytes() / 1024.0, (int)frame_queue.size());
+            next_health = wait_start + 1;
+        }
 
-                SDL_RenderClear(sdlRenderer);
-                SDL_RenderCopy(sdlRenderer, sdlTexture, NULL, &sdlRect);
-                SDL_RenderPresent(sdlRenderer);
-                // SDL End-----------------------
-                // Delay 40ms
-                SDL_Delay(40);
+        double pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp * time_base : last_pts + frame_duration;
+        last_pts = pts;
+        if (benchmark) {
+            // as fast as possible: no clock, no drops
+            const AVFrame* uploaded = upload_frame(&output, frame);
+            av_frame_free(&frame);
+            if (!uploaded)
+                break;
+            double start = now_s();
+            render(sdlRenderer, output.texture, &sdlRect);
+            times.present += now_s() - start;
+            stats.presented++;
+            continue;
+        }
+        if (!clock.started) {
+            clock.wall_offset = now_s() - pts;
+            clock.started = 1;
+        }
+
+        // behind the master clock: drop the frame. Ahead: wait, showing the
+        // previous picture again for every frame period the wait lasts
+        double diff = pts - master_time(&clock);
+        if (diff < -AV_SYNC_THRESHOLD) {
+            stats.dropped++;
+            av_frame_free(&frame);
+            continue;
+        }
+        while (!quit && diff > 0) {
+            if (diff < frame_duration) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(diff));
+                break;
             }
+            std::this_thread::sleep_for(std::chrono::duration<double>(frame_duration));
+            quit = poll_quit();
+            if (output.texture) {
+                render(sdlRenderer, output.texture, &sdlRect);
+                stats.repeated++;
+            }
+            diff = pts - master_time(&clock);
         }
-        av_free_packet(packet);
-    }
-    // flush decoder
-    // FIX: Flush Frames remained in Codec
-    while (1) {
-        ret = avcodec_decode_video2(pCodecCtx, pFrame, &got_picture, packet);
-        if (ret < 0)
-            break;
-        if (!got_picture)
+
+        // SDL---------------------------
+        const AVFrame* uploaded = upload_frame(&output, frame);
+        if (!uploaded) {
+            av_frame_free(&frame);
             break;
-        sws_scale(img_convert_ctx, (const unsigned char* const*)pFrame->data, pFrame->linesize, 0, pCodecCtx->height, pFrameYUV->data, pFrameYUV->linesize);
+        }
 #if OUTPUT_YUV420P
-        int y_size = pCodecCtx->width * pCodecCtx->height;
-        fwrite(pFrameYUV->data[0], 1, y_size, fp_yuv);     // Y
-        fwrite(pFrameYUV->data[1], 1, y_size / 4, fp_yuv); // U
-        fwrite(pFrameYUV->data[2], 1, y_size / 4, fp_yuv); // V
+        write_yuv420p(fp_yuv, uploaded);
 #endif
-        // SDL---------------------------
-        SDL_UpdateTexture(sdlTexture, &sdlRect, pFrameYUV->data[0], pFrameYUV->linesize[0]);
-        SDL_RenderClear(sdlRenderer);
-        SDL_RenderCopy(sdlRenderer, sdlTexture, NULL, &sdlRect);
-        SDL_RenderPresent(sdlRenderer);
+        render(sdlRenderer, output.texture, &sdlRect);
         // SDL End-----------------------
-        // Delay 40ms
-        SDL_Delay(40);
+
+        double jitter = fabs(pts - master_time(&clock));
+        stats.jitter_sum += jitter;
+        stats.jitter_max = fmax(stats.jitter_max, jitter);
+        if (jitter > AV_SYNC_THRESHOLD)
+            stats.out_of_sync++;
+        stats.presented++;
+        av_frame_free(&frame);
+    }
+
+    double play_time = now_s() - play_start;
+
+    // stop the threads if we quit early and release what they queued
+    if (quit)
+        audio.stop = true;
+    frame_queue.close();
+    video_packets.close();
+    audio_packets.close();
+    demuxer.join();
+    video_decoder.join();
+    if (audio_decoder.joinable()) {
+        audio_decoder.join();
+        // let the buffered audio play out
+        while (!quit && audio.ring->readable() > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        SDL_CloseAudioDevice(audio.device);
     }
+    while (frame_queue.try_pop(frame))
+        av_frame_free(&frame);
+    AVPacket* packet;
+    while (video_packets.try_pop(packet))
+        av_packet_free(&packet);
+    while (audio_packets.try_pop(packet))
+        av_packet_free(&packet);
 
-    sws_freeContext(img_convert_ctx);
+    if (benchmark) {
+        // the stages overlap on their threads, fps is end to end
+        int64_t n = stats.presented ? stats.presented : 1;
+        printf("--------------- Benchmark report ----------------\n");
+        printf("%lld frames in %.3f s: %.1f fps (%s)\n", (long long)stats.presented, play_time, stats.presented / play_time,
+            output.texture ? upload_path_names[output.path] : "none");
+        printf("%-10s %10s %12s %8s\n", "stage", "total ms", "ms/frame", "% wall");
+        const char* names[] = { "demux", "decode", "convert", "upload", "present" };
+        double totals[] = { times.demux, times.decode, output.convert_sum, output.upload_sum - output.convert_sum, times.present };
+        for (int i = 0; i < 5; ++i)
+            printf("%-10s %10.1f %12.3f %7.1f%%\n", names[i], totals[i] * 1000, totals[i] * 1000 / n, totals[i] / play_time * 100);
+        printf("(%lld packets demuxed)\n", (long long)times.packets);
+        printf("-------------------------------------------------\n");
+    } else {
+        printf("--------------- Playback report ----------------\n");
+        printf("frames presented: %lld, dropped: %lld, repeated: %lld\n", (long long)stats.presented, (long long)stats.dropped, (long long)stats.repeated);
+        printf("sync error vs %s clock: mean %.2f ms, max %.2f ms, %lld frames outside +-%.0f ms\n", pAudioCtx ? "audio" : "video",
+            stats.presented ? stats.jitter_sum / stats.presented * 1000 : 0.0, stats.jitter_max * 1000, (long long)stats.out_of_sync, AV_SYNC_THRESHOLD * 1000);
+        if (pAudioCtx)
+            printf("audio underruns: %lld\n", (long long)audio.underruns);
+        printf("texture upload (%s): mean %.3f ms, max %.3f ms over %lld frames\n", output.texture ? upload_path_names[output.path] : "none",
+            output.uploads ? output.upload_sum / output.uploads * 1000 : 0.0, output.upload_max * 1000, (long long)output.uploads);
+        printf("------------------------------------------------\n");
+    }
+
+    // buffer health: where playback waited
+    packet_queue_stats vs = video_packets.stats();
+    packet_queue_stats as = audio_packets.stats();
+    printf("--------------- Buffer health -------------------\n");
+    printf("read-ahead: %.1f s / %.0f MB per stream, avio buffer %d KB%s\n", readahead, readahead_mb, avio_buffer_kb, custom_pb ? "" : " (not used, demuxer I/O)");
+    if (custom_pb)
+        printf("demuxer I/O: %.1f ms in %lld reads, %.1f MB, %.1f MB/s while reading\n", io.read_time * 1000, (long long)io.reads, io.bytes / 1048576.0,
+            io.read_time > 0 ? io.bytes / 1048576.0 / io.read_time : 0.0);
+    for (int i = 0; i < 2; ++i) {
+        packet_queue_stats* q = i ? &as : &vs;
+        if (i && !pAudioCtx)
+            break;
+        printf("%s packets: level mean %.2f s, min %.2f s, peak %.0f KB; decoder waited %lld times (%.1f ms), demuxer blocked %lld times (%.1f ms)\n",
+            i ? "audio" : "video", q->pops ? q->level_sum / q->pops : 0.0, q->level_min > 0 ? q->level_min : 0.0, q->bytes_max / 1024.0,
+            (long long)q->empty_pops, q->empty_wait * 1000, (long long)q->full_pushes, q->full_wait * 1000);
+    }
+    printf("render stalls: %lld I/O starved (%.1f ms), %lld decoder starved (%.1f ms)\n", (long long)stats.starved_io, stats.starved_io_wait * 1000,
+        (long long)stats.starved_cpu, stats.starved_cpu_wait * 1000);
+    printf("-------------------------------------------------\n");
+
+    sws_freeContext(output.sws);
+    av_frame_free(&output.converted);
+    if (output.texture)
+        SDL_DestroyTexture(output.texture);
 
 #if OUTPUT_YUV420P
     fclose(fp_yuv);
@@ -194,10 +848,18 @@ int main(int argc, char* argv[])
 
     SDL_Quit();
 
-    av_frame_free(&pFrameYUV);
-    av_frame_free(&pFrame);
-    avcodec_close(pCodecCtx);
+    if (pAudioCtx) {
+        swr_free(&audio.swr);
+        delete audio.ring;
+        avcodec_free_context(&pAudioCtx);
+    }
+    avcodec_free_context(&pCodecCtx);
     avformat_close_input(&pFormatCtx);
+    if (custom_pb) {
+        av_freep(&custom_pb->buffer);
+        avio_context_free(&custom_pb);
+        avio_closep(&io.inner);
+    }
 
     return 0;
 }
@@ -0,0 +1,78 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// Lock free byte ring for exactly one producer and one consumer thread (the
+// audio decoder and the SDL audio callback). The producer only advances
+// write_pos_, the consumer only advances read_pos_, both count bytes forever
+// and are masked on access, so full and empty never look the same.
+class SpscRing {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        buffer_.resize(size);
+        mask_ = size - 1;
+    }
+
+    size_t capacity() const { return buffer_.size(); }
+
+    // Bytes the consumer can read now
+    size_t readable() const
+    {
+        return write_pos_.load(std::memory_order_acquire) - read_pos_.load(std::memory_order_acquire);
+    }
+
+    // Producer side: copies up to size bytes, returns how many fitted
+    size_t write(const uint8_t* data, size_t size)
+    {
+        size_t w = write_pos_.load(std::memory_order_relaxed);
+        size_t r = read_pos_.load(std::memory_order_acquire);
+        size = std::min(size, buffer_.size() - (w - r));
+        copy_in(w & mask_, data, size);
+        write_pos_.store(w + size, std::memory_order_release);
+        return size;
+    }
+
+    // Consumer side: copies up to size bytes, returns how many were available
+    size_t read(uint8_t* data, size_t size)
+    {
+        size_t r = read_pos_.load(std::memory_order_relaxed);
+        size_t w = write_pos_.load(std::memory_order_acquire);
+        size = std::min(size, w - r);
+        copy_out(r & mask_, data, size);
+        read_pos_.store(r + size, std::memory_order_release);
+        return size;
+    }
+
+private:
+    void copy_in(size_t offset, const uint8_t* data, size_t size)
+    {
+        size_t first = std::min(size, buffer_.size() - offset);
+        memcpy(&buffer_[offset], data, first);
+        memcpy(&buffer_[0], data + first, size - first);
+    }
+
+    void copy_out(size_t offset, uint8_t* data, size_t size)
+    {
+        size_t first = std::min(size, buffer_.size() - offset);
+        memcpy(data, &buffer_[offset], first);
+        memcpy(data + first, &buffer_[0], size - first);
+    }
+
+    std::vector<uint8_t> buffer_;
+    size_t mask_;
+    std::atomic<size_t> write_pos_ { 0 };
+    std::atomic<size_t> read_pos_ { 0 };
+};
+
+#endif
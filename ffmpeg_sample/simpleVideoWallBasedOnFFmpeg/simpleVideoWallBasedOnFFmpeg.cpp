@@ -0,0 +1,562 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define __STDC_CONSTANT_MACROS
+
+extern "C" {
+#include <SDL2/SDL.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+#include "bounded_queue.h"
+
+// Tile life cycle, the state hands the tile's pictures between a pool worker
+// and the render thread: only the owner of the current state touches them
+enum tile_state {
+    TILE_IDLE, // render thread: shown, the next picture can be decoded
+    TILE_DECODING, // a worker owns the decoder and the picture
+    TILE_READY, // render thread: picture waits for its due time
+    TILE_EOF,
+};
+
+struct tile {
+    const char* path;
+    AVFormatContext* fmt;
+    AVCodecContext* dec;
+    int stream;
+    double time_base;
+    double frame_duration;
+    SDL_Rect rect;
+
+    // worker side
+    AVPacket* packet;
+    AVFrame* decoded;
+    AVFrame* scaled; // tile size yuv420p
+    struct SwsContext* sws;
+    const AVFrame* picture; // decoded (zero copy) or scaled
+    double last_pts;
+    double clock_offset; // wall time of media time 0
+    int clock_started;
+    double due;
+    int64_t decoded_frames;
+    int64_t dropped;
+
+    // render side
+    int64_t shown;
+
+    std::atomic<int> state { TILE_IDLE };
+};
+
+struct wall_options {
+    int cols;
+    int width;
+    int height;
+    int refresh;
+    int threads;
+    double seconds;
+    int headless;
+    int single; // behave like one separate player: full size, full quality
+    int compare;
+    int reduce; // lowres / skip_loop_filter for small tiles
+};
+
+static double now_s()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int open_input(tile* t, const char* path)
+{
+    t->path = path;
+    if (avformat_open_input(&t->fmt, path, NULL, NULL) != 0) {
+        printf("Couldn't open input stream %s.\n", path);
+        return -1;
+    }
+    if (avformat_find_stream_info(t->fmt, NULL) < 0) {
+        printf("Couldn't find stream information in %s.\n", path);
+        return -1;
+    }
+    t->stream = av_find_best_stream(t->fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (t->stream < 0) {
+        printf("Didn't find a video stream in %s.\n", path);
+        return -1;
+    }
+    AVStream* st = t->fmt->streams[t->stream];
+    t->time_base = av_q2d(st->time_base);
+    AVRational frame_rate = av_guess_frame_rate(t->fmt, st, NULL);
+    t->frame_duration = frame_rate.num > 0 ? av_q2d(av_inv_q(frame_rate)) : 0.04;
+    t->last_pts = -t->frame_duration;
+    return 0;
+}
+
+// Open the decoder for a tile of rect size. Small tiles are decoded at a
+// reduced resolution when the codec supports lowres, and without the loop
+// filter once the picture is shown at half size or less.
+static int open_decoder(tile* t, int reduce)
+{
+    AVCodecParameters* par = t->fmt->streams[t->stream]->codecpar;
+    AVCodec* codec = avcodec_find_decoder(par->codec_id);
+    if (!codec) {
+        printf("Codec not found for %s.\n", t->path);
+        return -1;
+    }
+    t->dec = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(t->dec, par);
+    // the pool decodes many streams in parallel, one thread per decoder
+    t->dec->thread_count = 1;
+    if (reduce) {
+        int lowres = 0;
+        while (lowres < codec->max_lowres && (par->width >> (lowres + 1)) >= t->rect.w && (par->height >> (lowres + 1)) >= t->rect.h)
+            lowres++;
+        t->dec->lowres = lowres;
+        if (par->width >= 2 * t->rect.w && par->height >= 2 * t->rect.h)
+            t->dec->skip_loop_filter = AVDISCARD_ALL;
+    }
+    if (avcodec_open2(t->dec, codec, NULL) < 0) {
+        printf("Could not open codec for %s.\n", t->path);
+        return -1;
+    }
+
+    t->packet = av_packet_alloc();
+    t->decoded = av_frame_alloc();
+    t->scaled = av_frame_alloc();
+    t->scaled->format = AV_PIX_FMT_YUV420P;
+    t->scaled->width = t->rect.w;
+    t->scaled->height = t->rect.h;
+    if (av_frame_get_buffer(t->scaled, 0) < 0)
+        return -1;
+    printf("%s: %dx%d %s -> tile %dx%d at (%d,%d), lowres %d, loop filter %s\n", t->path, par->width, par->height, codec->name,
+        t->rect.w, t->rect.h, t->rect.x, t->rect.y, t->dec->lowres, t->dec->skip_loop_filter == AVDISCARD_ALL ? "off" : "on");
+    return 0;
+}
+
+// Make the tile picture from a decoded frame: the frame itself when it is
+// already yuv420p at tile size, otherwise a fast bilinear scale
+static void make_picture(tile* t)
+{
+    AVFrame* frame = t->decoded;
+    if ((frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P) && frame->width == t->rect.w && frame->height == t->rect.h) {
+        t->picture = frame;
+        return;
+    }
+    t->sws = sws_getCachedContext(t->sws, frame->width, frame->height, (AVPixelFormat)frame->format, t->rect.w, t->rect.h, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    sws_scale(t->sws, (const unsigned char* const*)frame->data, frame->linesize, 0, frame->height, t->scaled->data, t->scaled->linesize);
+    t->picture = t->scaled;
+}
+
+// Decode the next picture of a tile that is not already too late to show.
+// Runs on a pool worker, returns AVERROR_EOF at the end of the input.
+static int decode_next(tile* t)
+{
+    av_frame_unref(t->decoded);
+    for (;;) {
+        int ret = avcodec_receive_frame(t->dec, t->decoded);
+        if (ret >= 0) {
+            double pts = t->decoded->best_effort_timestamp != AV_NOPTS_VALUE ? t->decoded->best_effort_timestamp * t->time_base : t->last_pts + t->frame_duration;
+            t->last_pts = pts;
+            double now = now_s();
+            if (!t->clock_started) {
+                t->clock_offset = now - pts;
+                t->clock_started = 1;
+            }
+            t->due = t->clock_offset + pts;
+            t->decoded_frames++;
+            if (t->due < now - t->frame_duration) {
+                t->dropped++;
+                av_frame_unref(t->decoded);
+                continue;
+            }
+            make_picture(t);
+            return 0;
+        }
+        if (ret != AVERROR(EAGAIN))
+            return AVERROR_EOF;
+
+        // the decoder wants input: the next packet, or a flush at the end.
+        // Network and live inputs report a stall as EAGAIN, the tile then
+        // gives its worker back and is tried again on the next render tick.
+        ret = av_read_frame(t->fmt, t->packet);
+        if (ret == AVERROR(EAGAIN))
+            return ret;
+        if (ret < 0) {
+            if (ret != AVERROR_EOF) {
+                char err[AV_ERROR_MAX_STRING_SIZE];
+                av_strerror(ret, err, sizeof(err));
+                printf("%s: read error, tile ends: %s\n", t->path, err);
+            }
+            avcodec_send_packet(t->dec, NULL);
+            continue;
+        }
+        if (t->packet->stream_index == t->stream)
+            avcodec_send_packet(t->dec, t->packet);
+        av_packet_unref(t->packet);
+    }
+}
+
+static void worker_thread(std::vector<tile>* tiles, BoundedQueue<int>* jobs)
+{
+    int index;
+    while (jobs->pop(index)) {
+        tile* t = &(*tiles)[index];
+        int ret = decode_next(t);
+        int state = ret == AVERROR(EAGAIN) ? TILE_IDLE : ret < 0 ? TILE_EOF : TILE_READY;
+        t->state.store(state, std::memory_order_release);
+    }
+}
+
+static void close_tile(tile* t)
+{
+    sws_freeContext(t->sws);
+    av_frame_free(&t->scaled);
+    av_frame_free(&t->decoded);
+    av_packet_free(&t->packet);
+    avcodec_free_context(&t->dec);
+    avformat_close_input(&t->fmt);
+}
+
+static int poll_quit()
+{
+    SDL_Event event;
+    int quit = 0;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT)
+            quit = 1;
+    }
+    return quit;
+}
+
+static double cpu_seconds(const struct rusage* usage)
+{
+    return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6 + usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+}
+
+static int run_wall(const wall_options* opt, std::vector<const char*>& inputs)
+{
+    int n = (int)inputs.size();
+    std::vector<tile> tiles(n);
+    for (int i = 0; i < n; ++i) {
+        if (open_input(&tiles[i], inputs[i]) < 0)
+            return -1;
+    }
+
+    // layout: a grid of equal tiles, even sizes and offsets for 4:2:0
+    int width = opt->width, height = opt->height, cols = opt->cols;
+    if (opt->single) {
+        AVCodecParameters* par = tiles[0].fmt->streams[tiles[0].stream]->codecpar;
+        width = par->width;
+        height = par->height;
+        cols = 1;
+    }
+    if (cols <= 0)
+        cols = (int)ceil(sqrt((double)n));
+    int rows = (n + cols - 1) / cols;
+    int tile_w = (width / cols) & ~1;
+    int tile_h = (height / rows) & ~1;
+    for (int i = 0; i < n; ++i) {
+        tile* t = &tiles[i];
+        t->rect.x = (i % cols) * tile_w;
+        t->rect.y = (i / cols) * tile_h;
+        t->rect.w = tile_w;
+        t->rect.h = tile_h;
+        if (open_decoder(t, opt->reduce && !opt->single) < 0)
+            return -1;
+    }
+
+    if (opt->headless) {
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+        SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+    }
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER)) {
+        printf("Could not initialize SDL - %s\n", SDL_GetError());
+        return -1;
+    }
+    SDL_Window* screen = SDL_CreateWindow("Simplest ffmpeg video wall", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height, opt->headless ? 0 : SDL_WINDOW_OPENGL);
+    if (!screen) {
+        printf("SDL: could not create window - exiting:%s\n", SDL_GetError());
+        return -1;
+    }
+    SDL_Renderer* renderer = SDL_CreateRenderer(screen, -1, 0);
+    // one streaming texture for the whole wall, tiles update sub-rectangles
+    SDL_Texture* texture = renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, width, height) : NULL;
+    if (!texture) {
+        printf("SDL: could not create renderer - exiting:%s\n", SDL_GetError());
+        return -1;
+    }
+    uint8_t* black[4];
+    int black_linesize[4];
+    av_image_alloc(black, black_linesize, width, height, AV_PIX_FMT_YUV420P, 16);
+    memset(black[0], 16, black_linesize[0] * height);
+    memset(black[1], 128, black_linesize[1] * ((height + 1) / 2));
+    memset(black[2], 128, black_linesize[2] * ((height + 1) / 2));
+    SDL_UpdateYUVTexture(texture, NULL, black[0], black_linesize[0], black[1], black_linesize[1], black[2], black_linesize[2]);
+    av_freep(&black[0]);
+
+    // each tile is queued at most once, pushes never block
+    BoundedQueue<int> jobs(n);
+    int threads = opt->threads > 0 ? opt->threads : (int)std::thread::hardware_concurrency();
+    threads = threads > 0 ? std::min(threads, n) : 1;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i)
+        workers.push_back(std::thread(worker_thread, &tiles, &jobs));
+
+    // once per refresh: upload every due picture into its sub-rectangle,
+    // present once if anything changed and queue the next decodes
+    double start = now_s();
+    double next_tick = start;
+    double upload_time = 0;
+    int64_t presents = 0, ticks = 0;
+    int quit = 0;
+    while (!quit) {
+        quit = poll_quit();
+        double now = now_s();
+        int changed = 0, active = 0;
+        for (int i = 0; i < n; ++i) {
+            tile* t = &tiles[i];
+            int state = t->state.load(std::memory_order_acquire);
+            if (state == TILE_READY && t->due <= now) {
+                const AVFrame* p = t->picture;
+                double upload_start = now_s();
+                SDL_UpdateYUVTexture(texture, &t->rect, p->data[0], p->linesize[0], p->data[1], p->linesize[1], p->data[2], p->linesize[2]);
+                upload_time += now_s() - upload_start;
+                t->shown++;
+                changed = 1;
+                state = TILE_IDLE;
+            }
+            if (state == TILE_IDLE) {
+                t->state.store(TILE_DECODING, std::memory_order_relaxed);
+                jobs.push(i);
+            }
+            if (state != TILE_EOF)
+                active++;
+        }
+        if (changed) {
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+            SDL_RenderPresent(renderer);
+            presents++;
+        }
+        ticks++;
+        if (!active || (opt->seconds > 0 && now - start >= opt->seconds))
+            break;
+
+        next_tick += 1.0 / opt->refresh;
+        double wait = next_tick - now_s();
+        if (wait > 0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        else
+            next_tick = now_s();
+    }
+    double wall = now_s() - start;
+
+    jobs.close();
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    int64_t decoded = 0, shown = 0, dropped = 0;
+    for (int i = 0; i < n; ++i) {
+        decoded += tiles[i].decoded_frames;
+        shown += tiles[i].shown;
+        dropped += tiles[i].dropped;
+    }
+    printf("--------------- Video wall report ----------------\n");
+    printf("%d inputs, %dx%d tiles of %dx%d, %d decoder threads, %.1f s\n", n, cols, rows, tile_w, tile_h, threads, wall);
+    printf("frames decoded: %lld, shown: %lld, dropped late: %lld\n", (long long)decoded, (long long)shown, (long long)dropped);
+    printf("presents: %lld of %lld refreshes, upload %.3f ms per present\n", (long long)presents, (long long)ticks, presents ? upload_time / presents * 1000 : 0.0);
+    printf("cpu: %.2f s (%.0f%% of one core), max rss: %.1f MB\n", cpu_seconds(&usage), cpu_seconds(&usage) / wall * 100, usage.ru_maxrss / 1024.0);
+    printf("--------------------------------------------------\n");
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(screen);
+    SDL_Quit();
+    for (int i = 0; i < n; ++i)
+        close_tile(&tiles[i]);
+    return 0;
+}
+
+// Run command lines concurrently as child processes and sum their CPU time
+// and peak RSS
+static int run_processes(const std::vector<std::vector<std::string> >& commands, double* cpu, double* rss_mb, double* wall)
+{
+    double start = now_s();
+    std::vector<pid_t> pids;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            std::vector<char*> args;
+            for (size_t k = 0; k < commands[i].size(); ++k)
+                args.push_back((char*)commands[i][k].c_str());
+            args.push_back(NULL);
+            execv(args[0], &args[0]);
+            _exit(127);
+        }
+        if (pid < 0)
+            return -1;
+        pids.push_back(pid);
+    }
+    *cpu = 0;
+    *rss_mb = 0;
+    int failed = 0;
+    for (size_t i = 0; i < pids.size(); ++i) {
+        int status;
+        struct rusage usage;
+        if (wait4(pids[i], &status, 0, &usage) < 0) {
+            failed = 1;
+            continue; // status and usage were not filled in
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+        *cpu += cpu_seconds(&usage);
+        *rss_mb += usage.ru_maxrss / 1024.0;
+    }
+    *wall = now_s() - start;
+    return failed ? -1 : 0;
+}
+
+// N separate single stream players against one wall with the same inputs,
+// for the same duration. The players are this binary in --single mode, a
+// proxy for simpleVideoPlayerBasedOnFFmpeg: the same single threaded video
+// decoding and presentation, but no audio decoding or playback.
+static int compare(const char* self, const wall_options* opt, std::vector<const char*>& inputs)
+{
+    char seconds[32], refresh[32];
+    snprintf(seconds, sizeof(seconds), "%g", opt->seconds > 0 ? opt->seconds : 30.0);
+    snprintf(refresh, sizeof(refresh), "%d", opt->refresh);
+    std::vector<std::string> common;
+    common.push_back(self);
+    common.push_back("--seconds");
+    common.push_back(seconds);
+    common.push_back("--refresh");
+    common.push_back(refresh);
+    if (opt->headless)
+        common.push_back("--headless");
+
+    std::vector<std::vector<std::string> > players;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::vector<std::string> cmd = common;
+        cmd.push_back("--single");
+        cmd.push_back(inputs[i]);
+        players.push_back(cmd);
+    }
+
+    std::vector<std::string> cmd = common;
+    char value[64];
+    snprintf(value, sizeof(value), "%dx%d", opt->width, opt->height);
+    cmd.push_back("--size");
+    cmd.push_back(value);
+    if (opt->cols > 0) {
+        snprintf(value, sizeof(value), "%d", opt->cols);
+        cmd.push_back("--cols");
+        cmd.push_back(value);
+    }
+    if (opt->threads > 0) {
+        snprintf(value, sizeof(value), "%d", opt->threads);
+        cmd.push_back("--threads");
+        cmd.push_back(value);
+    }
+    if (!opt->reduce)
+        cmd.push_back("--no-reduce");
+    cmd.insert(cmd.end(), inputs.begin(), inputs.end());
+    std::vector<std::vector<std::string> > wall(1, cmd);
+
+    double cpu[2], rss[2], elapsed[2];
+    if (run_processes(players, &cpu[0], &rss[0], &elapsed[0]) < 0 || run_processes(wall, &cpu[1], &rss[1], &elapsed[1]) < 0) {
+        printf("a child process failed\n");
+        return -1;
+    }
+    printf("--------------- %d separate players vs one wall ----------------\n", (int)inputs.size());
+    printf("separate players: --single proxy, 1 decoder thread each, video only\n");
+    printf("%-20s %10s %12s %12s\n", "", "cpu s", "cpu cores", "rss MB");
+    const char* names[] = { "separate players", "video wall" };
+    for (int i = 0; i < 2; ++i)
+        printf("%-20s %10.2f %12.2f %12.1f\n", names[i], cpu[i], cpu[i] / elapsed[i], rss[i]);
+    printf("----------------------------------------------------------------\n");
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    printf("usage: %s [options] input1 [input2 ...]\n", name);
+    printf("  --cols N        tiles per row (default: square grid)\n");
+    printf("  --size WxH      wall size (default 1920x1080)\n");
+    printf("  --refresh HZ    present rate (default 60)\n");
+    printf("  --threads N     decoder pool size (default: cores)\n");
+    printf("  --seconds S     stop after S seconds (default: end of the inputs)\n");
+    printf("  --no-reduce     no lowres / skip_loop_filter for small tiles\n");
+    printf("  --headless      SDL dummy video driver and software renderer\n");
+    printf("  --single        one input shown at full size, like a separate player\n");
+    printf("  --compare       run the inputs as separate players, then as one wall\n");
+}
+
+int main(int argc, char* argv[])
+{
+    wall_options opt = { 0, 1920, 1080, 60, 0, 0, 0, 0, 0, 1 };
+    std::vector<const char*> inputs;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        int has_value = i + 1 < argc;
+        if (!strcmp(arg, "--cols") && has_value)
+            opt.cols = atoi(argv[++i]);
+        else if (!strcmp(arg, "--size") && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &opt.width, &opt.height) != 2) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(arg, "--refresh") && has_value)
+            opt.refresh = atoi(argv[++i]);
+        else if (!strcmp(arg, "--threads") && has_value)
+            opt.threads = atoi(argv[++i]);
+        else if (!strcmp(arg, "--seconds") && has_value)
+            opt.seconds = atof(argv[++i]);
+        else if (!strcmp(arg, "--no-reduce"))
+            opt.reduce = 0;
+        else if (!strcmp(arg, "--headless"))
+            opt.headless = 1;
+        else if (!strcmp(arg, "--single"))
+            opt.single = 1;
+        else if (!strcmp(arg, "--compare"))
+            opt.compare = 1;
+        else if (arg[0] == '-') {
+            usage(argv[0]);
+            return -1;
+        } else
+            inputs.push_back(arg);
+    }
+    if (inputs.empty() || (opt.single && inputs.size() != 1) || opt.refresh <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (opt.compare) {
+        // children are started through the path of this binary
+        char self[4096];
+        ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+        if (len <= 0) {
+            printf("Couldn't find the path of %s.\n", argv[0]);
+            return -1;
+        }
+        self[len] = 0;
+        return compare(self, &opt, inputs);
+    }
+
+    av_register_all();
+    avformat_network_init();
+    return run_wall(&opt, inputs);
+}
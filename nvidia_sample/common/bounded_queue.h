@@ -0,0 +1,59 @@
+#ifndef NVIDIA_SAMPLE_COMMON_BOUNDED_QUEUE_H
+#define NVIDIA_SAMPLE_COMMON_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Blocking FIFO between two pipeline threads. close() ends the stream: the
+// consumer drains what is left, a producer blocked on a full queue gives up.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+  // Blocks while the queue is full, false if the queue was closed
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock,
+                   [this] { return queue_.size() < capacity_ || closed_; });
+    if (closed_)
+      return false;
+    queue_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // Returns false once the queue is closed and drained
+  bool Pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+    if (queue_.empty())
+      return false;
+    item = std::move(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  size_t Size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<T> queue_;
+  size_t capacity_;
+  bool closed_ = false;
+};
+
+#endif
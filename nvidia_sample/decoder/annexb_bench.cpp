@@ -0,0 +1,303 @@
+// Checks AnnexBSplitter and DetectAnnexBCodec against synthetic H.264 and
+// HEVC streams whose access unit boundaries are known, fed in pieces of
+// different sizes, and measures the splitter's throughput against a plain
+// byte loop that only finds start codes. With -i it splits a real stream.
+// Needs no GPU.
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "annexb_splitter.h"
+
+struct TestStream {
+  std::vector<uint8_t> bytes;
+  std::vector<size_t> unit_starts;
+};
+
+// One NAL unit: start code, header, payload with emulation prevention and
+// the rbsp stop bit
+void AppendNal(std::vector<uint8_t> *out, bool fourByteStartCode,
+               std::initializer_list<uint8_t> header, size_t payload,
+               std::mt19937 *rng) {
+  if (fourByteStartCode) {
+    out->push_back(0);
+  }
+  out->insert(out->end(), {0, 0, 1});
+  out->insert(out->end(), header);
+  int zeros = 0;
+  for (size_t i = 0; i < payload; ++i) {
+    // Plenty of zeros, so emulation prevention kicks in
+    uint8_t byte = (*rng)() % 4 ? static_cast<uint8_t>((*rng)()) : 0;
+    if (zeros >= 2 && byte <= 3) {
+      out->push_back(3);
+      zeros = 0;
+    }
+    out->push_back(byte);
+    zeros = byte == 0 ? zeros + 1 : 0;
+  }
+  out->push_back(0x80);
+}
+
+// units access units of slices slices each, an IDR with parameter sets every
+// 30 units; every other unit starts with a delimiter, the others with their
+// first slice (or the parameter sets)
+TestStream MakeStream(AnnexBCodec codec, int units, int slices,
+                      size_t sliceBytes, std::mt19937 *rng) {
+  TestStream stream;
+  std::vector<uint8_t> &out = stream.bytes;
+  bool hevc = codec == AnnexBCodec::kHEVC;
+  for (int u = 0; u < units; ++u) {
+    stream.unit_starts.push_back(out.size());
+    bool idr = u % 30 == 0;
+    if (u % 2 == 0) {
+      if (hevc) {
+        AppendNal(&out, true, {0x46, 0x01}, 1, rng);
+      } else {
+        AppendNal(&out, true, {0x09}, 1, rng);
+      }
+    }
+    if (idr) {
+      if (hevc) {
+        AppendNal(&out, true, {0x40, 0x01}, 20, rng); // VPS
+        AppendNal(&out, true, {0x42, 0x01}, 40, rng); // SPS
+        AppendNal(&out, true, {0x44, 0x01}, 8, rng);  // PPS
+        AppendNal(&out, true, {0x4E, 0x01}, 30, rng); // prefix SEI
+      } else {
+        AppendNal(&out, true, {0x67, 0x64}, 20, rng); // SPS
+        AppendNal(&out, true, {0x68}, 4, rng);        // PPS
+        AppendNal(&out, true, {0x06}, 30, rng);       // SEI
+      }
+    }
+    for (int s = 0; s < slices; ++s) {
+      // First slice of the picture has the top bit set after the header
+      uint8_t first = s == 0 ? 0xAF : 0x2F;
+      if (hevc) {
+        AppendNal(&out, s == 0, {static_cast<uint8_t>(idr ? 0x26 : 0x02),
+                                 0x01, first},
+                  sliceBytes, rng);
+      } else {
+        AppendNal(&out, s == 0,
+                  {static_cast<uint8_t>(idr ? 0x65 : 0x41), first},
+                  sliceBytes, rng);
+      }
+    }
+    if (hevc && u % 3 == 0) {
+      AppendNal(&out, false, {0x50, 0x01}, 10, rng); // suffix SEI
+    }
+  }
+  return stream;
+}
+
+std::vector<size_t> Split(AnnexBCodec codec, const std::vector<uint8_t> &bytes,
+                          size_t chunk) {
+  std::vector<size_t> sizes;
+  AnnexBSplitter splitter(codec);
+  auto onUnit = [&sizes](const uint8_t *, size_t size) {
+    sizes.push_back(size);
+  };
+  for (size_t pos = 0; pos < bytes.size(); pos += chunk) {
+    splitter.Push(bytes.data() + pos, std::min(chunk, bytes.size() - pos),
+                  onUnit);
+  }
+  splitter.Finish(onUnit);
+  return sizes;
+}
+
+bool Check(AnnexBCodec codec, const TestStream &stream) {
+  bool ok = true;
+  AnnexBCodec detected = DetectAnnexBCodec(
+      stream.bytes.data(), std::min<size_t>(stream.bytes.size(), 65536));
+  if (detected != codec) {
+    std::cerr << AnnexBCodecName(codec) << ": FAILED, detected as "
+              << AnnexBCodecName(detected) << std::endl;
+    ok = false;
+  }
+  std::vector<size_t> expected;
+  for (size_t i = 0; i < stream.unit_starts.size(); ++i) {
+    size_t end = i + 1 < stream.unit_starts.size() ? stream.unit_starts[i + 1]
+                                                    : stream.bytes.size();
+    expected.push_back(end - stream.unit_starts[i]);
+  }
+  for (size_t chunk : {size_t(1) << 20, size_t(65536), size_t(4093),
+                       size_t(7), size_t(1)}) {
+    if (Split(codec, stream.bytes, chunk) != expected) {
+      std::cerr << AnnexBCodecName(codec) << ": FAILED, wrong access units"
+                << " when fed " << chunk << " bytes at a time" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// The old DetectCodec looked at the first NAL header only; mixed up and
+// garbage input must come out as unknown, while a broken NAL or a HEVC
+// enhancement layer must not hide the codec
+bool CheckDetectionEdges(std::mt19937 *rng) {
+  std::vector<uint8_t> garbage(65536);
+  for (uint8_t &byte : garbage) {
+    byte = static_cast<uint8_t>((*rng)());
+  }
+  std::vector<uint8_t> mixed;
+  AppendNal(&mixed, true, {0x67, 0x64}, 20, rng);
+  AppendNal(&mixed, true, {0x40, 0x01}, 20, rng);
+  bool ok = DetectAnnexBCodec(garbage.data(), garbage.size()) ==
+                AnnexBCodec::kUnknown &&
+            DetectAnnexBCodec(mixed.data(), mixed.size()) ==
+                AnnexBCodec::kUnknown &&
+            DetectAnnexBCodec(nullptr, 0) == AnnexBCodec::kUnknown;
+  if (!ok) {
+    std::cerr << "detection: FAILED on garbage or mixed input" << std::endl;
+  }
+
+  TestStream h264 = MakeStream(AnnexBCodec::kH264, 10, 3, 300, rng);
+  AppendNal(&h264.bytes, true, {0xFF, 0xFF}, 20, rng); // forbidden bit set
+  TestStream hevc = MakeStream(AnnexBCodec::kHEVC, 10, 3, 300, rng);
+  AppendNal(&hevc.bytes, true, {0x02, 0x09}, 300, rng); // layer 1 slice
+  AppendNal(&hevc.bytes, true, {0x80, 0x01}, 20, rng);
+  if (DetectAnnexBCodec(h264.bytes.data(), h264.bytes.size()) !=
+          AnnexBCodec::kH264 ||
+      DetectAnnexBCodec(hevc.bytes.data(), hevc.bytes.size()) !=
+          AnnexBCodec::kHEVC) {
+    std::cerr << "detection: FAILED with a broken or enhancement layer NAL"
+              << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+// Baseline: what a byte by byte search for start codes costs on its own
+size_t CountStartCodesBytewise(const uint8_t *data, size_t size) {
+  size_t count = 0;
+  for (size_t i = 0; i + 2 < size; ++i) {
+    if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+      count++;
+    }
+  }
+  return count;
+}
+
+template <typename F> double Seconds(F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+void Measure(const char *name, AnnexBCodec codec,
+             const std::vector<uint8_t> &bytes, int repeat) {
+  const size_t chunk = 1 << 20;
+  size_t units = 0;
+  double split = Seconds([&] {
+    for (int r = 0; r < repeat; ++r) {
+      units = Split(codec, bytes, chunk).size();
+    }
+  });
+  size_t codes = 0;
+  double bytewise = Seconds([&] {
+    for (int r = 0; r < repeat; ++r) {
+      codes += CountStartCodesBytewise(bytes.data(), bytes.size());
+    }
+  });
+  double mb = static_cast<double>(bytes.size()) * repeat / 1e6;
+  std::cout << name << ": " << units << " access units, splitter "
+            << mb / split << " MB/s, byte loop start code scan "
+            << mb / bytewise << " MB/s (" << codes / repeat << " start codes)"
+            << std::endl;
+}
+
+void PrintUsage() {
+  std::cout << "Usage: annexb_bench [options]\n"
+            << "Options:\n"
+            << "  -n, --units N          Access units per synthetic stream (600)\n"
+            << "  -s, --slice-bytes N    Bytes per slice (8000)\n"
+            << "  -r, --repeat N         Passes for the throughput numbers (5)\n"
+            << "  -i, --input FILE       Split and time this stream instead\n"
+            << "  --help                 Show this help message\n";
+}
+
+int main(int argc, char *argv[]) {
+  int units = 600;
+  size_t sliceBytes = 8000;
+  int repeat = 5;
+  std::string inputPath;
+
+  static struct option long_options[] = {
+      {"units", required_argument, nullptr, 'n'},
+      {"slice-bytes", required_argument, nullptr, 's'},
+      {"repeat", required_argument, nullptr, 'r'},
+      {"input", required_argument, nullptr, 'i'},
+      {"help", no_argument, nullptr, 0},
+      {nullptr, 0, nullptr, 0}};
+
+  int opt;
+  int option_index = 0;
+  while ((opt = getopt_long(argc, argv, "n:s:r:i:", long_options,
+                            &option_index)) != -1) {
+    switch (opt) {
+    case 'n':
+      units = std::stoi(optarg);
+      break;
+    case 's':
+      sliceBytes = std::stoul(optarg);
+      break;
+    case 'r':
+      repeat = std::stoi(optarg);
+      break;
+    case 'i':
+      inputPath = optarg;
+      break;
+    case 0:
+      PrintUsage();
+      return 0;
+    default:
+      PrintUsage();
+      return -1;
+    }
+  }
+  if (units < 1 || repeat < 1) {
+    std::cerr << "Error: Invalid options" << std::endl;
+    PrintUsage();
+    return -1;
+  }
+
+  if (!inputPath.empty()) {
+    std::ifstream input(inputPath, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(input)),
+                               std::istreambuf_iterator<char>());
+    if (!input.is_open() || bytes.empty()) {
+      std::cerr << "Error: Failed to read " << inputPath << std::endl;
+      return -1;
+    }
+    AnnexBCodec codec = DetectAnnexBCodec(
+        bytes.data(), std::min<size_t>(bytes.size(), 65536));
+    std::cout << inputPath << ": " << AnnexBCodecName(codec) << std::endl;
+    if (codec == AnnexBCodec::kUnknown) {
+      return 1;
+    }
+    Measure(AnnexBCodecName(codec), codec, bytes, repeat);
+    return 0;
+  }
+
+  std::mt19937 rng(42);
+  bool ok = CheckDetectionEdges(&rng);
+  for (AnnexBCodec codec : {AnnexBCodec::kH264, AnnexBCodec::kHEVC}) {
+    // Small stream for the checks, byte wise feeding is slow
+    ok = Check(codec, MakeStream(codec, 90, 3, 300, &rng)) && ok;
+    TestStream stream = MakeStream(codec, units, 4, sliceBytes, &rng);
+    if (Split(codec, stream.bytes, 1 << 20).size() !=
+        stream.unit_starts.size()) {
+      std::cerr << AnnexBCodecName(codec) << ": FAILED on the large stream"
+                << std::endl;
+      ok = false;
+    }
+    Measure(AnnexBCodecName(codec), codec, stream.bytes, repeat);
+  }
+  std::cout << (ok ? "all checks passed" : "CHECKS FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+#include "annexb_splitter.h"
+
+#include <cstring>
+
+namespace {
+
+// Bytes after a start code that decide whether a NAL unit starts an access
+// unit: the NAL header plus the byte holding first_mb_in_slice (H.264) or
+// first_slice_segment_in_pic_flag (HEVC)
+const size_t kHeaderBytes = 3;
+
+// forbidden_zero_bit clear and a NAL type the spec defines
+bool ValidH264Header(const uint8_t *header) {
+  int type = header[0] & 0x1F;
+  return !(header[0] & 0x80) && type >= 1 && type <= 21;
+}
+
+// forbidden_zero_bit clear, base layer, nuh_temporal_id_plus1 not 0 and a
+// NAL type the spec defines
+bool ValidHevcHeader(const uint8_t *header) {
+  int type = (header[0] >> 1) & 0x3F;
+  bool reserved = (type >= 10 && type <= 15) || (type >= 22 && type <= 31) ||
+                  (type >= 41 && type <= 47);
+  return !(header[0] & 0x80) && !(header[0] & 0x01) && !(header[1] & 0xF8) &&
+         (header[1] & 0x07) && !reserved;
+}
+
+} // namespace
+
+size_t FindStartCode(const uint8_t *data, size_t size, size_t from) {
+  // 0x01 is rare in coded data, so look for it with memchr and check the two
+  // zeros in front. The next candidate is at least three bytes further.
+  size_t pos = from + 2;
+  while (pos < size) {
+    const uint8_t *one =
+        static_cast<const uint8_t *>(memchr(data + pos, 0x01, size - pos));
+    if (!one) {
+      break;
+    }
+    size_t i = one - data;
+    if (data[i - 1] == 0 && data[i - 2] == 0) {
+      return i - 2;
+    }
+    pos = i + 3;
+  }
+  return size;
+}
+
+AnnexBCodec DetectAnnexBCodec(const uint8_t *data, size_t size) {
+  // The first parameter set names the codec: an H.264 SPS has an odd NAL
+  // type, which reads as a HEVC layer id of 32 or more, and HEVC VPS/SPS
+  // read as H.264 types 0 and 2, never 7. Most of the NAL headers must then
+  // be valid for that codec, which keeps garbage out but lets through a
+  // broken NAL or the enhancement layers of a multi-layer HEVC stream.
+  int nals = 0;
+  int h264Valid = 0;
+  int hevcValid = 0;
+  AnnexBCodec first = AnnexBCodec::kUnknown;
+  size_t code = FindStartCode(data, size, 0);
+  while (code + 3 + 2 <= size) {
+    const uint8_t *header = data + code + 3;
+    nals++;
+    if (ValidH264Header(header)) {
+      h264Valid++;
+      if (first == AnnexBCodec::kUnknown && (header[0] & 0x1F) == 7) {
+        first = AnnexBCodec::kH264;
+      }
+    }
+    if (ValidHevcHeader(header)) {
+      hevcValid++;
+      int type = (header[0] >> 1) & 0x3F;
+      if (first == AnnexBCodec::kUnknown && (type == 32 || type == 33)) {
+        first = AnnexBCodec::kHEVC;
+      }
+    }
+    code = FindStartCode(data, size, code + 3);
+  }
+  if (first == AnnexBCodec::kHEVC && hevcValid * 2 > nals) {
+    return AnnexBCodec::kHEVC;
+  }
+  if (first == AnnexBCodec::kH264 && h264Valid * 2 > nals) {
+    return AnnexBCodec::kH264;
+  }
+  return AnnexBCodec::kUnknown;
+}
+
+const char *AnnexBCodecName(AnnexBCodec codec) {
+  switch (codec) {
+  case AnnexBCodec::kH264:
+    return "H.264";
+  case AnnexBCodec::kHEVC:
+    return "HEVC";
+  default:
+    return "unknown";
+  }
+}
+
+void AnnexBSplitter::Push(const uint8_t *data, size_t size,
+                          const UnitCallback &onUnit) {
+  buffer_.insert(buffer_.end(), data, data + size);
+  const uint8_t *bytes = buffer_.data();
+  size_t end = buffer_.size();
+  while (true) {
+    size_t code = FindStartCode(bytes, end, scan_pos_);
+    if (code == end) {
+      // A start code may straddle this piece and the next
+      scan_pos_ = end > scan_pos_ + 2 ? end - 2 : scan_pos_;
+      break;
+    }
+    if (code + 3 + kHeaderBytes > end) {
+      scan_pos_ = code;
+      break;
+    }
+    // The zero in front of a four byte start code goes with the new unit
+    size_t nalStart = code > unit_start_ && bytes[code - 1] == 0 ? code - 1
+                                                                 : code;
+    if (StartsAccessUnit(bytes + code + 3) && nalStart > unit_start_) {
+      onUnit(bytes + unit_start_, nalStart - unit_start_);
+      unit_start_ = nalStart;
+    }
+    scan_pos_ = code + 3;
+  }
+
+  // Drop what has been handed out once it is most of the buffer, so the
+  // copying stays linear in the input
+  if (unit_start_ > buffer_.size() / 2) {
+    buffer_.erase(buffer_.begin(), buffer_.begin() + unit_start_);
+    scan_pos_ -= unit_start_;
+    unit_start_ = 0;
+  }
+}
+
+void AnnexBSplitter::Finish(const UnitCallback &onUnit) {
+  if (buffer_.size() > unit_start_) {
+    onUnit(buffer_.data() + unit_start_, buffer_.size() - unit_start_);
+  }
+  buffer_.clear();
+  unit_start_ = 0;
+  scan_pos_ = 0;
+  unit_has_picture_ = false;
+}
+
+bool AnnexBSplitter::StartsAccessUnit(const uint8_t *header) {
+  bool vcl;
+  bool firstSlice;
+  bool startsUnit; // NAL types that only come before the pictures of a unit
+  if (codec_ == AnnexBCodec::kHEVC) {
+    int type = (header[0] >> 1) & 0x3F;
+    vcl = type < 32;
+    firstSlice = header[2] & 0x80;
+    startsUnit = (type >= 32 && type <= 35) || type == 39 ||
+                 (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+  } else {
+    int type = header[0] & 0x1F;
+    vcl = type >= 1 && type <= 5;
+    // first_mb_in_slice is ue(v), 0 is the single bit 1
+    firstSlice = header[1] & 0x80;
+    startsUnit = (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+  }
+
+  if (vcl) {
+    bool boundary = unit_has_picture_ && firstSlice;
+    unit_has_picture_ = true;
+    return boundary;
+  }
+  if (startsUnit && unit_has_picture_) {
+    unit_has_picture_ = false;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,49 @@
+#ifndef ANNEXB_SPLITTER_H
+#define ANNEXB_SPLITTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+enum class AnnexBCodec { kUnknown, kH264, kHEVC };
+
+// Guesses the codec of an Annex-B elementary stream from its first bytes:
+// the first parameter set (H.264 SPS, HEVC VPS or SPS) names the codec, and
+// most of the NAL headers must be valid for it. A few KiB from the start of
+// the stream are enough.
+AnnexBCodec DetectAnnexBCodec(const uint8_t *data, size_t size);
+
+const char *AnnexBCodecName(AnnexBCodec codec);
+
+// Offset of the next 00 00 01 start code at or after from, size if none
+size_t FindStartCode(const uint8_t *data, size_t size, size_t from);
+
+// Cuts an H.264 or HEVC Annex-B byte stream, fed in pieces of any size,
+// into access units. A unit starts at an access unit delimiter, a parameter
+// set or prefix SEI following a picture, or at the first slice of a new
+// picture (first_mb_in_slice / first_slice_segment_in_pic_flag), and keeps
+// its leading start code. Units point into an internal buffer and are valid
+// until the next call.
+class AnnexBSplitter {
+public:
+  typedef std::function<void(const uint8_t *data, size_t size)> UnitCallback;
+
+  explicit AnnexBSplitter(AnnexBCodec codec) : codec_(codec) {}
+
+  // Calls onUnit for every access unit completed by data
+  void Push(const uint8_t *data, size_t size, const UnitCallback &onUnit);
+  // Calls onUnit for the last access unit, if there is one
+  void Finish(const UnitCallback &onUnit);
+
+private:
+  bool StartsAccessUnit(const uint8_t *header);
+
+  AnnexBCodec codec_;
+  std::vector<uint8_t> buffer_;
+  size_t unit_start_ = 0; // in buffer_
+  size_t scan_pos_ = 0;   // where the search for the next start code goes on
+  bool unit_has_picture_ = false;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef CUDA_CHECK_H
+#define CUDA_CHECK_H
+
+#include <cstdlib>
+#include <cuda.h>
+#include <iostream>
+
+// 检查 CUDA 函数返回值的宏
+#define CHECK_CU_RESULT(result)                                             \
+  if (result != CUDA_SUCCESS) {                                             \
+    const char *errStr;                                                     \
+    cuGetErrorName(result, &errStr);                                        \
+    std::cerr << "CUDA Error: " << errStr << " at " << __FILE__ << ":"      \
+              << __LINE__ << std::endl;                                     \
+    exit(-1);                                                               \
+  }
+
+// 检查 cuvid 函数返回值的宏
+#define CHECK_CUVID_RESULT(result)                                          \
+  if (result != CUDA_SUCCESS) {                                             \
+    const char *errStr;                                                     \
+    cuGetErrorName(result, &errStr);                                        \
+    std::cerr << "cuvid Error: " << errStr << " at " << __FILE__ << ":"     \
+              << __LINE__ << std::endl;                                     \
+    exit(-1);                                                               \
+  }
+
+#endif
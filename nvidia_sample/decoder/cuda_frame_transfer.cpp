@@ -0,0 +1,72 @@
+#include "cuda_frame_transfer.h"
+
+#include "cuda_check.h"
+
+CudaFrameTransfer::CudaFrameTransfer(CUvideodecoder *decoder, int slots)
+    : decoder_(decoder), events_(slots, nullptr) {
+  CHECK_CU_RESULT(cuStreamCreate(&stream_, CU_STREAM_NON_BLOCKING));
+  for (CUevent &event : events_) {
+    CHECK_CU_RESULT(cuEventCreate(&event, CU_EVENT_DISABLE_TIMING));
+  }
+}
+
+CudaFrameTransfer::~CudaFrameTransfer() {
+  for (CUevent event : events_) {
+    cuEventDestroy(event);
+  }
+  cuStreamDestroy(stream_);
+}
+
+uint8_t *CudaFrameTransfer::AllocHost(size_t bytes) {
+  void *buffer = nullptr;
+  CHECK_CU_RESULT(cuMemAllocHost(&buffer, bytes));
+  return static_cast<uint8_t *>(buffer);
+}
+
+void CudaFrameTransfer::FreeHost(uint8_t *buffer) {
+  CHECK_CU_RESULT(cuMemFreeHost(buffer));
+}
+
+MappedFrame CudaFrameTransfer::Map(int pictureIndex) {
+  CUdeviceptr devicePtr = 0;
+  unsigned int pitch = 0;
+  CUVIDPROCPARAMS videoProcessingParams = {};
+  videoProcessingParams.output_stream = stream_;
+  CHECK_CUVID_RESULT(cuvidMapVideoFrame(*decoder_, pictureIndex, &devicePtr,
+                                        &pitch, &videoProcessingParams));
+  MappedFrame frame;
+  frame.device_ptr = devicePtr;
+  frame.pitch = pitch;
+  return frame;
+}
+
+void CudaFrameTransfer::Unmap(const MappedFrame &frame) {
+  CHECK_CUVID_RESULT(cuvidUnmapVideoFrame(*decoder_, frame.device_ptr));
+}
+
+void CudaFrameTransfer::CopyAsync(const MappedFrame &frame,
+                                  const FrameLayout &layout, uint8_t *dst,
+                                  int slot) {
+  CUDA_MEMCPY2D copyParams = {};
+  copyParams.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+  copyParams.srcDevice = frame.device_ptr;
+  copyParams.srcPitch = frame.pitch;
+  copyParams.dstMemoryType = CU_MEMORYTYPE_HOST;
+  copyParams.dstHost = dst;
+  copyParams.dstPitch = layout.width;
+  copyParams.WidthInBytes = layout.width;
+  copyParams.Height = layout.height;
+  CHECK_CU_RESULT(cuMemcpy2DAsync(&copyParams, stream_));
+
+  copyParams.srcDevice = frame.device_ptr +
+                         static_cast<CUdeviceptr>(layout.surface_height) *
+                             frame.pitch;
+  copyParams.dstHost = dst + static_cast<size_t>(layout.width) * layout.height;
+  copyParams.Height = layout.height / 2;
+  CHECK_CU_RESULT(cuMemcpy2DAsync(&copyParams, stream_));
+  CHECK_CU_RESULT(cuEventRecord(events_[slot], stream_));
+}
+
+void CudaFrameTransfer::WaitCopy(int slot) {
+  CHECK_CU_RESULT(cuEventSynchronize(events_[slot]));
+}
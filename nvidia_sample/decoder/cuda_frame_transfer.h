@@ -0,0 +1,32 @@
+#ifndef CUDA_FRAME_TRANSFER_H
+#define CUDA_FRAME_TRANSFER_H
+
+#include <cuda.h>
+#include <nvcuvid.h>
+#include <vector>
+#include "frame_pipeline.h"
+
+// FrameTransfer on an NVDEC decoder: pinned buffers from cuMemAllocHost,
+// the copies are two cuMemcpy2DAsync on a private stream, one event per
+// slot marks when they have landed. The decoder handle is read on every
+// call because the owner recreates the decoder on sequence changes.
+class CudaFrameTransfer : public FrameTransfer {
+public:
+  CudaFrameTransfer(CUvideodecoder *decoder, int slots);
+  ~CudaFrameTransfer() override;
+
+  uint8_t *AllocHost(size_t bytes) override;
+  void FreeHost(uint8_t *buffer) override;
+  MappedFrame Map(int pictureIndex) override;
+  void Unmap(const MappedFrame &frame) override;
+  void CopyAsync(const MappedFrame &frame, const FrameLayout &layout,
+                 uint8_t *dst, int slot) override;
+  void WaitCopy(int slot) override;
+
+private:
+  CUvideodecoder *decoder_;
+  CUstream stream_ = nullptr;
+  std::vector<CUevent> events_;
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "fake_frame_transfer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+// Luma and chroma rows differ so that a chroma plane read from the wrong
+// offset does not match
+uint8_t FakePixel(int frameNumber, int x, int row) {
+  return static_cast<uint8_t>(frameNumber * 7 + x * 3 + row * 5);
+}
+
+const uint8_t kPadding = 0xEE;
+
+} // namespace
+
+FakeFrameTransfer::FakeFrameTransfer(const FakeFrameTransferConfig &config)
+    : config_(config), surfaces_(config.surfaces),
+      engine_free_(std::chrono::steady_clock::now()) {}
+
+void FakeFrameTransfer::Reset(const FrameLayout &layout) {
+  if (!mapped_.empty()) {
+    stats_.bad_calls++;
+  }
+  layout_ = layout;
+  pitch_ = (layout.width + config_.pitch_align - 1) / config_.pitch_align *
+           config_.pitch_align;
+  size_t size = static_cast<size_t>(pitch_) *
+                (layout.surface_height + layout.surface_height / 2);
+  for (std::vector<uint8_t> &surface : surfaces_) {
+    surface.assign(size, kPadding);
+  }
+}
+
+void FakeFrameTransfer::Decode(int pictureIndex, int frameNumber) {
+  std::vector<uint8_t> &surface = surfaces_[pictureIndex];
+  if (mapped_.count(reinterpret_cast<uintptr_t>(surface.data()))) {
+    stats_.bad_calls++;
+  }
+  int rows = layout_.height + layout_.height / 2;
+  for (int row = 0; row < rows; ++row) {
+    // Chroma starts at surface_height, not at the visible height
+    int surfaceRow = row;
+    if (row >= layout_.height) {
+      surfaceRow = layout_.surface_height + row - layout_.height;
+    }
+    uint8_t *line = surface.data() + static_cast<size_t>(surfaceRow) * pitch_;
+    for (int x = 0; x < layout_.width; ++x) {
+      line[x] = FakePixel(frameNumber, x, row);
+    }
+  }
+}
+
+uint8_t *FakeFrameTransfer::AllocHost(size_t bytes) {
+  return new uint8_t[bytes];
+}
+
+void FakeFrameTransfer::FreeHost(uint8_t *buffer) { delete[] buffer; }
+
+MappedFrame FakeFrameTransfer::Map(int pictureIndex) {
+  MappedFrame frame;
+  frame.device_ptr = reinterpret_cast<uintptr_t>(surfaces_[pictureIndex].data());
+  frame.pitch = pitch_;
+  if (mapped_.count(frame.device_ptr) ||
+      static_cast<int>(mapped_.size()) >= config_.max_mapped) {
+    stats_.bad_calls++;
+  }
+  mapped_[frame.device_ptr] = 0;
+  stats_.maps++;
+  stats_.max_mapped =
+      std::max(stats_.max_mapped, static_cast<int>(mapped_.size()));
+  return frame;
+}
+
+void FakeFrameTransfer::Unmap(const MappedFrame &frame) {
+  auto it = mapped_.find(frame.device_ptr);
+  if (it == mapped_.end() || it->second != 0) {
+    stats_.bad_calls++;
+  }
+  if (it != mapped_.end()) {
+    mapped_.erase(it);
+  }
+}
+
+void FakeFrameTransfer::CopyAsync(const MappedFrame &frame,
+                                  const FrameLayout &layout, uint8_t *dst,
+                                  int slot) {
+  auto it = mapped_.find(frame.device_ptr);
+  if (it == mapped_.end() || pending_.count(slot)) {
+    stats_.bad_calls++;
+    return;
+  }
+  it->second++;
+  auto now = std::chrono::steady_clock::now();
+  engine_free_ = std::max(engine_free_, now) +
+                 std::chrono::microseconds(config_.copy_us);
+  PendingCopy &copy = pending_[slot];
+  copy.frame = frame;
+  copy.layout = layout;
+  copy.dst = dst;
+  copy.done = engine_free_;
+}
+
+void FakeFrameTransfer::WaitCopy(int slot) {
+  auto pending = pending_.find(slot);
+  if (pending == pending_.end()) {
+    stats_.bad_calls++;
+    return;
+  }
+  const PendingCopy &copy = pending->second;
+  std::this_thread::sleep_until(copy.done);
+
+  const uint8_t *src = reinterpret_cast<const uint8_t *>(copy.frame.device_ptr);
+  const FrameLayout &layout = copy.layout;
+  uint8_t *dst = copy.dst;
+  for (int row = 0; row < layout.height; ++row) {
+    memcpy(dst, src + static_cast<size_t>(row) * copy.frame.pitch,
+           layout.width);
+    dst += layout.width;
+  }
+  src += static_cast<size_t>(layout.surface_height) * copy.frame.pitch;
+  for (int row = 0; row < layout.height / 2; ++row) {
+    memcpy(dst, src + static_cast<size_t>(row) * copy.frame.pitch,
+           layout.width);
+    dst += layout.width;
+  }
+
+  auto it = mapped_.find(copy.frame.device_ptr);
+  if (it != mapped_.end()) {
+    it->second--;
+  }
+  stats_.copies++;
+  pending_.erase(pending);
+}
+
+void FakeDecodedFrame(const FrameLayout &layout, int frameNumber,
+                      std::vector<uint8_t> *packed) {
+  packed->resize(layout.PackedSize());
+  uint8_t *dst = packed->data();
+  for (int row = 0; row < layout.height + layout.height / 2; ++row) {
+    for (int x = 0; x < layout.width; ++x) {
+      *dst++ = FakePixel(frameNumber, x, row);
+    }
+  }
+}
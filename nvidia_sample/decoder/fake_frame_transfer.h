@@ -0,0 +1,76 @@
+#ifndef FAKE_FRAME_TRANSFER_H
+#define FAKE_FRAME_TRANSFER_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "frame_pipeline.h"
+
+// CPU stand-in for the cuvid map and CUDA copy calls, for running and timing
+// FramePipeline without a GPU. Decoded surfaces live in host memory with a
+// padded pitch. A simulated copy engine finishes one copy every copy_us, in
+// order; the bytes only land in the host buffer when WaitCopy returns, so a
+// buffer read before that shows up as a wrong frame.
+struct FakeFrameTransferConfig {
+  int surfaces = 8;      // decode surfaces, picture indices 0..surfaces-1
+  int pitch_align = 512; // the surface pitch is the width rounded up to this
+  int copy_us = 500;     // per frame
+  int max_mapped = 1;    // ulNumOutputSurfaces - 1 of the real decoder
+};
+
+struct FakeFrameTransferStats {
+  int64_t maps = 0;
+  int64_t copies = 0;
+  int max_mapped = 0; // most frames mapped at once
+  // Calls the real API would reject or that would corrupt frames: mapping
+  // past the limit, unmapping before the copy landed, decoding into or
+  // resetting a mapped surface
+  int64_t bad_calls = 0;
+};
+
+class FakeFrameTransfer : public FrameTransfer {
+public:
+  explicit FakeFrameTransfer(const FakeFrameTransferConfig &config);
+
+  // New sequence: reallocates the surfaces for layout, like recreating the
+  // decoder. Nothing may be mapped.
+  void Reset(const FrameLayout &layout);
+  // Writes the picture of frame frameNumber into a surface, like
+  // cuvidDecodePicture
+  void Decode(int pictureIndex, int frameNumber);
+
+  uint8_t *AllocHost(size_t bytes) override;
+  void FreeHost(uint8_t *buffer) override;
+  MappedFrame Map(int pictureIndex) override;
+  void Unmap(const MappedFrame &frame) override;
+  void CopyAsync(const MappedFrame &frame, const FrameLayout &layout,
+                 uint8_t *dst, int slot) override;
+  void WaitCopy(int slot) override;
+
+  const FakeFrameTransferStats &Stats() const { return stats_; }
+
+private:
+  struct PendingCopy {
+    MappedFrame frame;
+    FrameLayout layout;
+    uint8_t *dst = nullptr;
+    std::chrono::steady_clock::time_point done;
+  };
+
+  FakeFrameTransferConfig config_;
+  FrameLayout layout_;
+  unsigned int pitch_ = 0;
+  std::vector<std::vector<uint8_t>> surfaces_;
+  std::map<uint64_t, int> mapped_; // device pointer -> copies not waited for
+  std::map<int, PendingCopy> pending_; // by slot
+  std::chrono::steady_clock::time_point engine_free_;
+  FakeFrameTransferStats stats_;
+};
+
+// The packed frame (luma then interleaved chroma, pitch == width) the fake
+// decodes for frameNumber
+void FakeDecodedFrame(const FrameLayout &layout, int frameNumber,
+                      std::vector<uint8_t> *packed);
+
+#endif
@@ -0,0 +1,137 @@
+#include "frame_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+FramePipeline::FramePipeline(FrameTransfer *transfer, std::ostream *output,
+                             int buffers)
+    : transfer_(transfer), output_(output), buffers_(buffers, nullptr),
+      frame_bytes_(buffers, 0), free_(buffers), to_write_(buffers) {
+  for (int i = 0; i < buffers; ++i) {
+    free_.Push(i);
+  }
+  writer_ = std::thread(&FramePipeline::WriterLoop, this);
+}
+
+FramePipeline::~FramePipeline() {
+  Finish();
+  for (uint8_t *buffer : buffers_) {
+    if (buffer) {
+      transfer_->FreeHost(buffer);
+    }
+  }
+}
+
+void FramePipeline::Configure(const FrameLayout &layout, int max_mapped) {
+  Drain();
+  layout_ = layout;
+  // At least one buffer has to be outside the mapped frames, or OnDisplay
+  // would wait for a buffer only it can free
+  max_mapped_ = std::max(
+      1, std::min(max_mapped, static_cast<int>(buffers_.size()) - 1));
+  size_t size = layout.PackedSize();
+  if (size > buffer_size_) {
+    for (uint8_t *&buffer : buffers_) {
+      if (buffer) {
+        transfer_->FreeHost(buffer);
+      }
+      buffer = transfer_->AllocHost(size);
+    }
+    buffer_size_ = size;
+  }
+}
+
+void FramePipeline::OnDisplay(int pictureIndex) {
+  auto start = std::chrono::steady_clock::now();
+  while (static_cast<int>(in_flight_.size()) >= max_mapped_) {
+    Retire();
+  }
+  auto waitStart = std::chrono::steady_clock::now();
+  int slot = 0;
+  free_.Pop(slot);
+  double waited = SecondsSince(waitStart);
+
+  InFlight entry;
+  entry.slot = slot;
+  entry.frame = transfer_->Map(pictureIndex);
+  frame_bytes_[slot] = layout_.PackedSize();
+  transfer_->CopyAsync(entry.frame, layout_, buffers_[slot], slot);
+  in_flight_.push_back(entry);
+
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stats_.frames++;
+  stats_.buffer_wait += waited;
+  stats_.display_time += SecondsSince(start);
+}
+
+bool FramePipeline::Finish() {
+  if (!finished_) {
+    finished_ = true;
+    while (!in_flight_.empty()) {
+      Retire();
+    }
+    to_write_.Close();
+    writer_.join();
+    output_->flush();
+  }
+  return !write_failed_ && output_->good();
+}
+
+FramePipelineStats FramePipeline::Stats() {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  return stats_;
+}
+
+// Oldest mapped frame: wait for its copy, unmap it, queue it for writing
+void FramePipeline::Retire() {
+  InFlight entry = in_flight_.front();
+  in_flight_.pop_front();
+  transfer_->WaitCopy(entry.slot);
+  transfer_->Unmap(entry.frame);
+  to_write_.Push(entry.slot);
+}
+
+// Everything mapped gets written and every buffer is back in the pool
+void FramePipeline::Drain() {
+  while (!in_flight_.empty()) {
+    Retire();
+  }
+  std::vector<int> slots(buffers_.size());
+  for (int &slot : slots) {
+    free_.Pop(slot);
+  }
+  for (int slot : slots) {
+    free_.Push(slot);
+  }
+}
+
+void FramePipeline::WriterLoop() {
+  int slot = 0;
+  while (to_write_.Pop(slot)) {
+    auto start = std::chrono::steady_clock::now();
+    if (!write_failed_) {
+      output_->write(reinterpret_cast<const char *>(buffers_[slot]),
+                     frame_bytes_[slot]);
+      if (!output_->good()) {
+        std::cerr << "Error: Failed to write to output file" << std::endl;
+        write_failed_ = true;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      stats_.write_time += SecondsSince(start);
+    }
+    free_.Push(slot);
+  }
+}
@@ -0,0 +1,116 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "../common/bounded_queue.h"
+
+// Visible part of a decoded NV12 frame. In the mapped surface the chroma
+// plane starts surface_height rows (of the surface pitch) after the luma.
+struct FrameLayout {
+  int width = 0;
+  int height = 0;
+  int surface_height = 0;
+
+  size_t PackedSize() const {
+    return static_cast<size_t>(width) * (height + height / 2);
+  }
+};
+
+// A frame mapped with cuvidMapVideoFrame: device pointer and pitch
+struct MappedFrame {
+  uint64_t device_ptr = 0;
+  unsigned int pitch = 0;
+};
+
+// The decoder calls FramePipeline needs. CudaFrameTransfer does them with
+// cuvid and the CUDA driver API, FakeFrameTransfer on the CPU.
+class FrameTransfer {
+public:
+  virtual ~FrameTransfer() {}
+
+  // Page-locked host memory, so the copies can run as DMA
+  virtual uint8_t *AllocHost(size_t bytes) = 0;
+  virtual void FreeHost(uint8_t *buffer) = 0;
+
+  virtual MappedFrame Map(int pictureIndex) = 0;
+  virtual void Unmap(const MappedFrame &frame) = 0;
+
+  // Starts copying the visible planes of a mapped frame into dst, packed
+  // (pitch == width, chroma right after the luma). slot identifies the
+  // copy for WaitCopy and is the index of the host buffer.
+  virtual void CopyAsync(const MappedFrame &frame, const FrameLayout &layout,
+                         uint8_t *dst, int slot) = 0;
+  // Blocks until the copy started on slot has landed in host memory
+  virtual void WaitCopy(int slot) = 0;
+};
+
+struct FramePipelineStats {
+  int64_t frames = 0;
+  double display_time = 0; // spent in OnDisplay, i.e. in the parser callback
+  double buffer_wait = 0;  // of that, waiting for the writer to free a buffer
+  double write_time = 0;   // writer thread
+};
+
+// Moves displayed frames from the decoder to an output stream without
+// holding up the parser. OnDisplay maps the picture, starts an async copy
+// into one of a fixed set of page-locked host buffers and returns, so the
+// copy runs while the parser goes on. A frame is unmapped once a later one
+// needs its place (more than max_mapped would be mapped) or at Finish, after
+// its copy has landed, and handed over a bounded queue to a writer thread.
+// The writer writes each frame with one call and puts the buffer back into
+// the pool. Frames are written in display order.
+//
+// OnDisplay, Configure and Finish are called from the parser thread.
+class FramePipeline {
+public:
+  FramePipeline(FrameTransfer *transfer, std::ostream *output, int buffers);
+  ~FramePipeline();
+
+  // Waits for every frame in flight to be written, then sizes the buffers
+  // for layout. max_mapped must stay below the decoder's output surfaces.
+  void Configure(const FrameLayout &layout, int max_mapped);
+
+  void OnDisplay(int pictureIndex);
+
+  // Writes the remaining frames and stops the writer. False if a write
+  // failed.
+  bool Finish();
+
+  FramePipelineStats Stats();
+
+private:
+  struct InFlight {
+    int slot;
+    MappedFrame frame;
+  };
+
+  void Retire();
+  void Drain();
+  void WriterLoop();
+
+  FrameTransfer *transfer_;
+  std::ostream *output_;
+  FrameLayout layout_;
+  int max_mapped_ = 1;
+
+  std::vector<uint8_t *> buffers_;
+  std::vector<size_t> frame_bytes_; // per buffer, what the writer writes
+  size_t buffer_size_ = 0;
+  std::deque<InFlight> in_flight_;
+  BoundedQueue<int> free_;
+  BoundedQueue<int> to_write_;
+  std::thread writer_;
+  bool finished_ = false;
+  bool write_failed_ = false;
+
+  std::mutex stats_mutex_;
+  FramePipelineStats stats_;
+};
+
+#endif
@@ -0,0 +1,277 @@
+// Runs the decoder's display path against the fake frame transfer, once the
+// old way (allocate, copy, write row by row and unmap inside the display
+// callback) and once through FramePipeline, and checks that every frame was
+// written once, in order and intact. Halfway through the stream the
+// resolution goes up, like a new sequence header. Needs no GPU.
+
+#include <chrono>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fake_frame_transfer.h"
+#include "frame_pipeline.h"
+
+// Frame layout of frame n: the first half of the stream at half size
+FrameLayout LayoutOf(int n, int frames, int width, int height) {
+  FrameLayout layout;
+  bool half = n < frames / 2;
+  layout.width = half ? width / 2 : width;
+  layout.height = half ? height / 2 : height;
+  // Coded height, e.g. 1088 for 1080p
+  layout.surface_height = (layout.height + 15) / 16 * 16;
+  return layout;
+}
+
+// Stream buffer that compares every frame written to it with the frame the
+// fake decoded and stands in for a slow sink: each frame takes write_us,
+// however many writes it arrives in
+class VerifyingSink : public std::streambuf {
+public:
+  VerifyingSink(int frames, int width, int height, int write_us)
+      : frames_(frames), width_(width), height_(height), write_us_(write_us) {
+    Expect();
+  }
+
+  int Frames() const { return frame_; }
+  int Mismatches() const { return mismatches_; }
+
+protected:
+  std::streamsize xsputn(const char *data, std::streamsize size) override {
+    std::streamsize left = size;
+    while (left > 0) {
+      if (frame_ >= frames_) {
+        mismatches_++;
+        return size;
+      }
+      size_t n = std::min<size_t>(left, expected_.size() - offset_);
+      if (memcmp(data, expected_.data() + offset_, n)) {
+        bad_frame_ = true;
+      }
+      data += n;
+      left -= n;
+      offset_ += n;
+      if (offset_ == expected_.size()) {
+        std::this_thread::sleep_for(std::chrono::microseconds(write_us_));
+        mismatches_ += bad_frame_;
+        frame_++;
+        Expect();
+      }
+    }
+    return size;
+  }
+  int_type overflow(int_type ch) override {
+    char c = static_cast<char>(ch);
+    xsputn(&c, 1);
+    return ch;
+  }
+
+private:
+  void Expect() {
+    FakeDecodedFrame(LayoutOf(frame_, frames_, width_, height_), frame_,
+                     &expected_);
+    offset_ = 0;
+    bad_frame_ = false;
+  }
+
+  int frames_;
+  int width_;
+  int height_;
+  int write_us_;
+  int frame_ = 0;
+  int mismatches_ = 0;
+  std::vector<uint8_t> expected_;
+  size_t offset_ = 0;
+  bool bad_frame_ = false;
+};
+
+struct BenchConfig {
+  int frames = 300;
+  int width = 1920;
+  int height = 1080;
+  int decode_us = 2000;
+  int write_us = 3000;
+  int buffers = 4;
+  FakeFrameTransferConfig transfer;
+};
+
+struct BenchResult {
+  double seconds = 0;
+  double display_time = 0;
+  int written = 0;
+  int mismatches = 0;
+  FakeFrameTransferStats fake;
+};
+
+// What HandlePictureDisplay did before: a fresh buffer per frame, the copy
+// waited for in the callback, one write per row
+void SerialDisplay(FakeFrameTransfer *transfer, const FrameLayout &layout,
+                   int pictureIndex, std::ostream &output) {
+  MappedFrame frame = transfer->Map(pictureIndex);
+  uint8_t *buffer = new uint8_t[layout.PackedSize()];
+  transfer->CopyAsync(frame, layout, buffer, 0);
+  transfer->WaitCopy(0);
+  for (int row = 0; row < layout.height + layout.height / 2; ++row) {
+    output.write(reinterpret_cast<const char *>(buffer) +
+                     static_cast<size_t>(row) * layout.width,
+                 layout.width);
+  }
+  transfer->Unmap(frame);
+  delete[] buffer;
+}
+
+BenchResult Run(const BenchConfig &config, bool pipelined) {
+  FakeFrameTransfer transfer(config.transfer);
+  VerifyingSink sink(config.frames, config.width, config.height,
+                     config.write_us);
+  std::ostream output(&sink);
+  std::unique_ptr<FramePipeline> pipeline;
+  if (pipelined) {
+    pipeline.reset(new FramePipeline(&transfer, &output, config.buffers));
+  }
+
+  BenchResult result;
+  FrameLayout layout;
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < config.frames; ++n) {
+    FrameLayout next = LayoutOf(n, config.frames, config.width, config.height);
+    if (next.width != layout.width) {
+      // Sequence callback: everything unmapped before the decoder goes
+      if (pipeline) {
+        pipeline->Configure(next, config.transfer.max_mapped);
+      }
+      transfer.Reset(next);
+      layout = next;
+    }
+    // The parser feeding and waiting for the decoder
+    std::this_thread::sleep_for(std::chrono::microseconds(config.decode_us));
+    int pictureIndex = n % config.transfer.surfaces;
+    transfer.Decode(pictureIndex, n);
+
+    auto displayStart = std::chrono::steady_clock::now();
+    if (pipeline) {
+      pipeline->OnDisplay(pictureIndex);
+    } else {
+      SerialDisplay(&transfer, layout, pictureIndex, output);
+      result.display_time += std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() -
+                                 displayStart)
+                                 .count();
+    }
+  }
+  if (pipeline) {
+    pipeline->Finish();
+    result.display_time = pipeline->Stats().display_time;
+  }
+  output.flush();
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result.written = sink.Frames();
+  result.mismatches = sink.Mismatches();
+  result.fake = transfer.Stats();
+  return result;
+}
+
+bool Report(const char *name, const BenchResult &result, int frames) {
+  std::cout << name << ": " << frames / result.seconds << " fps, "
+            << result.display_time * 1000 / frames
+            << " ms per display callback, " << result.fake.max_mapped
+            << " mapped at most" << std::endl;
+  bool ok = result.written == frames && result.mismatches == 0 &&
+            result.fake.maps == frames && result.fake.copies == frames &&
+            result.fake.bad_calls == 0;
+  if (!ok) {
+    std::cerr << name << ": FAILED, " << result.written << "/" << frames
+              << " frames written, " << result.mismatches << " wrong, "
+              << result.fake.bad_calls << " invalid calls" << std::endl;
+  }
+  return ok;
+}
+
+void PrintUsage() {
+  std::cout << "Usage: frame_pipeline_bench [options]\n"
+            << "Options:\n"
+            << "  -n, --frames N         Frames to decode (300)\n"
+            << "  -w, --width WIDTH      Width of the second half (1920)\n"
+            << "  -h, --height HEIGHT    Height of the second half (1080)\n"
+            << "  -d, --decode-us US     Simulated parse/decode time per frame (2000)\n"
+            << "  -c, --copy-us US       Simulated device to host copy time (500)\n"
+            << "  -s, --write-us US      Simulated time per frame written (3000)\n"
+            << "  -b, --buffers N        Host buffers in the pool (4)\n"
+            << "  -m, --max-mapped N     Frames mapped at once (1)\n"
+            << "  --help                 Show this help message\n";
+}
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+
+  static struct option long_options[] = {
+      {"frames", required_argument, nullptr, 'n'},
+      {"width", required_argument, nullptr, 'w'},
+      {"height", required_argument, nullptr, 'h'},
+      {"decode-us", required_argument, nullptr, 'd'},
+      {"copy-us", required_argument, nullptr, 'c'},
+      {"write-us", required_argument, nullptr, 's'},
+      {"buffers", required_argument, nullptr, 'b'},
+      {"max-mapped", required_argument, nullptr, 'm'},
+      {"help", no_argument, nullptr, 0},
+      {nullptr, 0, nullptr, 0}};
+
+  int opt;
+  int option_index = 0;
+  while ((opt = getopt_long(argc, argv, "n:w:h:d:c:s:b:m:", long_options,
+                            &option_index)) != -1) {
+    switch (opt) {
+    case 'n':
+      config.frames = std::stoi(optarg);
+      break;
+    case 'w':
+      config.width = std::stoi(optarg);
+      break;
+    case 'h':
+      config.height = std::stoi(optarg);
+      break;
+    case 'd':
+      config.decode_us = std::stoi(optarg);
+      break;
+    case 'c':
+      config.transfer.copy_us = std::stoi(optarg);
+      break;
+    case 's':
+      config.write_us = std::stoi(optarg);
+      break;
+    case 'b':
+      config.buffers = std::stoi(optarg);
+      break;
+    case 'm':
+      config.transfer.max_mapped = std::stoi(optarg);
+      break;
+    case 0:
+      PrintUsage();
+      return 0;
+    default:
+      PrintUsage();
+      return -1;
+    }
+  }
+  if (config.frames < 2 || config.width < 4 || config.height < 4 ||
+      config.buffers < 2 || config.transfer.max_mapped < 1 ||
+      config.transfer.max_mapped >= config.transfer.surfaces) {
+    std::cerr << "Error: Invalid options" << std::endl;
+    PrintUsage();
+    return -1;
+  }
+
+  BenchResult serial = Run(config, false);
+  BenchResult pipelined = Run(config, true);
+  bool ok = Report("serial", serial, config.frames);
+  ok = Report("pipelined", pipelined, config.frames) && ok;
+  std::cout << "speedup: " << serial.seconds / pipelined.seconds << "x"
+            << std::endl;
+  return ok ? 0 : 1;
+}
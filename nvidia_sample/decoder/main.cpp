@@ -2,33 +2,21 @@
 #include <cuda_runtime.h>
 #include <cuda_runtime_api.h>
 #include <fstream>
+#include <getopt.h>
 #include <iostream>
+#include <memory>
 #include <nvcuvid.h>
 #include <vector>
-
-// 检查 CUDA 函数返回值的宏
-#define CHECK_CU_RESULT(result)                                             \
-  if (result != CUDA_SUCCESS) {                                             \
-    const char *errStr;                                                     \
-    cuGetErrorName(result, &errStr);                                        \
-    std::cerr << "CUDA Error: " << errStr << " at " << __FILE__ << ":"      \
-              << __LINE__ << std::endl;                                     \
-    exit(-1);                                                               \
-  }
-
-// 检查 cuvid 函数返回值的宏
-#define CHECK_CUVID_RESULT(result)                                          \
-  if (result != CUDA_SUCCESS) {                                             \
-    const char *errStr;                                                     \
-    cuGetErrorName(result, &errStr);                                        \
-    std::cerr << "cuvid Error: " << errStr << " at " << __FILE__ << ":"     \
-              << __LINE__ << std::endl;                                     \
-    exit(-1);                                                               \
-  }
+#include "annexb_splitter.h"
+#include "cuda_check.h"
+#include "cuda_frame_transfer.h"
+#include "frame_pipeline.h"
+#include "surface_policy.h"
 
 class NvidiaDecoder {
 public:
-  NvidiaDecoder(const std::string &inputFile, const std::string &outputFile);
+  NvidiaDecoder(const std::string &inputFile, const std::string &outputFile,
+                const SurfacePolicyConfig &policyConfig);
   ~NvidiaDecoder();
   void Decode();
 
@@ -41,6 +29,7 @@ private:
                                           CUVIDPARSERDISPINFO *pDispInfo);
 
   cudaVideoCodec DetectCodec(const std::string &fileName);
+  void ParseAccessUnit(const uint8_t *data, size_t size, bool last);
 
   CUcontext cuContext;
   CUvideodecoder decoder;
@@ -49,53 +38,50 @@ private:
   std::string inputFile;
   std::string outputFile;
   std::ofstream yuvOutputFile;
+  std::unique_ptr<CudaFrameTransfer> transfer;
+  std::unique_ptr<FramePipeline> pipeline;
 
   int videoWidth;
   int videoHeight;
-};
 
-cudaVideoCodec NvidiaDecoder::DetectCodec(const std::string& fileName) {
-    std::ifstream file(fileName, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file: " << fileName << std::endl;
-        return cudaVideoCodec_NumCodecs;
-    }
+  AnnexBCodec streamCodec = AnnexBCodec::kUnknown;
+  int64_t accessUnits = 0;
 
-    uint8_t buffer[5] = {0};
-    file.read(reinterpret_cast<char*>(buffer), sizeof(buffer));
-
-    if (buffer[0] == 0x00 && buffer[1] == 0x00 && buffer[2] == 0x00 && buffer[3] == 0x01) {
-        uint8_t nal_unit_type = (buffer[4] >> 1) & 0x3F; 
-        if (nal_unit_type >= 32 && nal_unit_type <= 34) {
-            std::cout << "Detected HEVC stream" << std::endl;
-            file.clear();                 // 清除 EOF 或错误标志
-            file.seekg(0, std::ios::beg); // 返回文件开头
-            return cudaVideoCodec_HEVC;
-        }
-    }
+  SurfacePolicy policy;
+  DecodeQueueMonitor monitor;
+};
 
-    if (buffer[0] == 0x00 && buffer[1] == 0x00 && buffer[2] == 0x00 && buffer[3] == 0x01) {
-        uint8_t nal_unit_type = buffer[4] & 0x1F;
-        if (nal_unit_type == 7 || nal_unit_type == 5) {
-            std::cout << "Detected H.264 stream" << std::endl;
-            file.clear();                 // 清除 EOF 或错误标志
-            file.seekg(0, std::ios::beg); // 返回文件开头
-            return cudaVideoCodec_H264;
-        }
-    }
+cudaVideoCodec NvidiaDecoder::DetectCodec(const std::string &fileName) {
+  std::ifstream file(fileName, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open file: " << fileName << std::endl;
+    return cudaVideoCodec_NumCodecs;
+  }
 
-    // 未能检测到协议
-    file.clear();
-    file.seekg(0, std::ios::beg);
+  // Enough for the parameter sets and the first slices
+  std::vector<uint8_t> buffer(64 * 1024);
+  file.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
+  streamCodec = DetectAnnexBCodec(buffer.data(), file.gcount());
+  std::cout << "Detected " << AnnexBCodecName(streamCodec) << " stream"
+            << std::endl;
+
+  switch (streamCodec) {
+  case AnnexBCodec::kH264:
+    return cudaVideoCodec_H264;
+  case AnnexBCodec::kHEVC:
+    return cudaVideoCodec_HEVC;
+  default:
     std::cerr << "Unknown codec, defaulting to NumCodecs" << std::endl;
-
     return cudaVideoCodec_NumCodecs;
+  }
 }
 
 NvidiaDecoder::NvidiaDecoder(const std::string &inputFile,
-                             const std::string &outputFile)
+                             const std::string &outputFile,
+                             const SurfacePolicyConfig &policyConfig)
     : inputFile(inputFile), outputFile(outputFile), videoWidth(0),
-      videoHeight(0), decoder(nullptr), parser(nullptr) {
+      videoHeight(0), decoder(nullptr), parser(nullptr),
+      policy(policyConfig) {
 
   CHECK_CU_RESULT(cuInit(0));
 
@@ -104,11 +90,20 @@ NvidiaDecoder::NvidiaDecoder(const std::string &inputFile,
   CHECK_CU_RESULT(cuCtxCreate(&cuContext, 0, cuDevice));
 
   yuvOutputFile.open(outputFile, std::ios::binary);
+  // Pinned host frames between the display callback and the writer thread,
+  // two more than can be mapped at once
+  int hostBuffers = policyConfig.mapped_frames + 2;
+  transfer.reset(new CudaFrameTransfer(&decoder, hostBuffers));
+  pipeline.reset(
+      new FramePipeline(transfer.get(), &yuvOutputFile, hostBuffers));
   cudaVideoCodec codecType = DetectCodec(inputFile);
 
   CUVIDPARSERPARAMS parserParams = {};
   parserParams.CodecType = codecType;
+  // Only until the first sequence: HandleVideoSequence returns the count
+  // the parser cycles through from then on
   parserParams.ulMaxNumDecodeSurfaces = 1;
+  parserParams.ulMaxDisplayDelay = policy.DisplayDelay();
   parserParams.ulErrorThreshold = 0;
   parserParams.pUserData = this;
   parserParams.pfnSequenceCallback = HandleVideoSequence;
@@ -119,6 +114,9 @@ NvidiaDecoder::NvidiaDecoder(const std::string &inputFile,
 }
 
 NvidiaDecoder::~NvidiaDecoder() {
+  // Unmaps whatever is still mapped, so before the decoder goes
+  pipeline.reset();
+  transfer.reset();
   if (decoder) {
     CHECK_CUVID_RESULT(cuvidDestroyDecoder(decoder));
   }
@@ -131,12 +129,47 @@ NvidiaDecoder::~NvidiaDecoder() {
 
 int CUDAAPI NvidiaDecoder::HandleVideoSequence(void *pUserData,
                                                CUVIDEOFORMAT *pVideoFormat) {
-  std::cout << "HandleVideoSequence called" << std::endl;
   NvidiaDecoder *decoder = static_cast<NvidiaDecoder *>(pUserData);
 
+  SequenceFormat format;
+  format.codec = pVideoFormat->codec;
+  format.chroma_format = pVideoFormat->chroma_format;
+  format.bit_depth_minus8 = pVideoFormat->bit_depth_luma_minus8;
+  format.coded_width = pVideoFormat->coded_width;
+  format.coded_height = pVideoFormat->coded_height;
+  format.min_num_decode_surfaces = pVideoFormat->min_num_decode_surfaces;
+  SequenceAction action = decoder->policy.OnSequence(format);
+  const DecoderSurfaces &surfaces = decoder->policy.Surfaces();
+  std::cout << "Sequence " << format.coded_width << "x" << format.coded_height
+            << ": " << SequenceActionName(action) << ", "
+            << surfaces.decode_surfaces << " decode and "
+            << surfaces.output_surfaces << " output surfaces" << std::endl;
+  if (action == SequenceAction::kKeep) {
+    return surfaces.decode_surfaces;
+  }
+
   decoder->videoWidth = pVideoFormat->coded_width;
   decoder->videoHeight = pVideoFormat->coded_height;
 
+  // Frames of the old sequence are written and unmapped first
+  FrameLayout layout;
+  layout.width = decoder->videoWidth;
+  layout.height = decoder->videoHeight;
+  layout.surface_height = decoder->videoHeight;
+  decoder->pipeline->Configure(layout, surfaces.output_surfaces - 1);
+
+  if (action == SequenceAction::kReconfigure) {
+    CUVIDRECONFIGUREDECODERINFO reconfigureInfo = {};
+    reconfigureInfo.ulWidth = pVideoFormat->coded_width;
+    reconfigureInfo.ulHeight = pVideoFormat->coded_height;
+    reconfigureInfo.ulTargetWidth = pVideoFormat->coded_width;
+    reconfigureInfo.ulTargetHeight = pVideoFormat->coded_height;
+    reconfigureInfo.ulNumDecodeSurfaces = surfaces.decode_surfaces;
+    CHECK_CUVID_RESULT(
+        cuvidReconfigureDecoder(decoder->decoder, &reconfigureInfo));
+    return surfaces.decode_surfaces;
+  }
+
   if (decoder->decoder) {
     CHECK_CUVID_RESULT(cuvidDestroyDecoder(decoder->decoder));
   }
@@ -145,86 +178,55 @@ int CUDAAPI NvidiaDecoder::HandleVideoSequence(void *pUserData,
   decodeInfo.CodecType = pVideoFormat->codec;
   decodeInfo.ulWidth = pVideoFormat->coded_width;
   decodeInfo.ulHeight = pVideoFormat->coded_height;
-  decodeInfo.ulNumOutputSurfaces = 2;
-  decodeInfo.ulNumDecodeSurfaces = pVideoFormat->min_num_decode_surfaces;
-  decodeInfo.ulWidth = pVideoFormat->coded_width;
-  decodeInfo.ulHeight = pVideoFormat->coded_height;
-  decodeInfo.ulMaxWidth = pVideoFormat->coded_width;
-  decodeInfo.ulMaxHeight = pVideoFormat->coded_height;
+  decodeInfo.ulNumOutputSurfaces = surfaces.output_surfaces;
+  decodeInfo.ulNumDecodeSurfaces = surfaces.decode_surfaces;
+  decodeInfo.ulMaxWidth = surfaces.max_width;
+  decodeInfo.ulMaxHeight = surfaces.max_height;
   decodeInfo.ulTargetWidth = decodeInfo.ulWidth;
   decodeInfo.ulTargetHeight = decodeInfo.ulHeight;
   decodeInfo.ChromaFormat = pVideoFormat->chroma_format;
+  decodeInfo.bitDepthMinus8 = pVideoFormat->bit_depth_luma_minus8;
   decodeInfo.ulCreationFlags = cudaVideoCreate_PreferCUVID;
   decodeInfo.OutputFormat = cudaVideoSurfaceFormat_NV12;
   decodeInfo.DeinterlaceMode = cudaVideoDeinterlaceMode_Weave;
 
   CHECK_CUVID_RESULT(cuvidCreateDecoder(&decoder->decoder, &decodeInfo));
 
-  return pVideoFormat->min_num_decode_surfaces;
+  return surfaces.decode_surfaces;
 }
 
 int CUDAAPI NvidiaDecoder::HandlePictureDecode(void *pUserData,
                                                CUVIDPICPARAMS *pPicParams) {
-  std::cout << "HandlePictureDecode called" << std::endl;
   NvidiaDecoder *decoder = static_cast<NvidiaDecoder *>(pUserData);
+  decoder->monitor.OnDecode();
   CHECK_CUVID_RESULT(cuvidDecodePicture(decoder->decoder, pPicParams));
   return 1;
 }
 
 int CUDAAPI NvidiaDecoder::HandlePictureDisplay(
     void *pUserData, CUVIDPARSERDISPINFO *pDispInfo) {
-  std::cout << "HandlePictureDisplay called" << std::endl;
   NvidiaDecoder *decoder = static_cast<NvidiaDecoder *>(pUserData);
+  decoder->monitor.OnDisplay();
 
-  CUdeviceptr d_frame;
-  unsigned int pitch;
-  CUVIDPROCPARAMS videoProcessingParams = {};
-  CHECK_CUVID_RESULT(cuvidMapVideoFrame(decoder->decoder, pDispInfo->picture_index, &d_frame,
-                     &pitch, &videoProcessingParams));
-
-  unsigned char *pFrame =
-      new unsigned char[pitch * decoder->videoHeight * 3 /
-                        2];
-
-  CUDA_MEMCPY2D copyParams = {};
-  copyParams.srcMemoryType = CU_MEMORYTYPE_DEVICE;
-  copyParams.srcDevice = d_frame;
-  copyParams.srcPitch = pitch;
-  copyParams.dstMemoryType = CU_MEMORYTYPE_HOST;
-  copyParams.dstHost = pFrame;
-  copyParams.dstPitch = pitch;
-  copyParams.WidthInBytes = decoder->videoWidth;
-  copyParams.Height = decoder->videoHeight;
-
-  CHECK_CU_RESULT(cuMemcpy2D(&copyParams));
-
-  copyParams.srcDevice =
-      d_frame + decoder->videoHeight * pitch;
-  copyParams.dstHost = pFrame + decoder->videoHeight * pitch;
-  copyParams.Height = decoder->videoHeight / 2;
-
-  CHECK_CU_RESULT(cuMemcpy2D(&copyParams));
-
-  for (int i = 0; i < decoder->videoHeight; ++i) {
-    decoder->yuvOutputFile.write(
-        reinterpret_cast<const char *>(pFrame + i * pitch),
-        decoder->videoWidth);
-  }
+  // Only maps the frame and queues its copy into a pinned buffer, the
+  // pipeline unmaps it later and a writer thread writes it out
+  decoder->pipeline->OnDisplay(pDispInfo->picture_index);
+  return 1;
+}
 
-  for (int i = 0; i < decoder->videoHeight / 2; ++i) {
-    decoder->yuvOutputFile.write(
-        reinterpret_cast<const char *>(pFrame + (decoder->videoHeight * pitch) +
-                                       i * pitch),
-        decoder->videoWidth);
+// One access unit per packet, stamped with its index as PTS; the last one
+// also ends the stream so the parser displays the frames it still holds
+void NvidiaDecoder::ParseAccessUnit(const uint8_t *data, size_t size,
+                                    bool last) {
+  CUVIDSOURCEDATAPACKET packet = {};
+  packet.payload = data;
+  packet.payload_size = size;
+  packet.flags = CUVID_PKT_TIMESTAMP;
+  packet.timestamp = accessUnits++;
+  if (last) {
+    packet.flags |= CUVID_PKT_ENDOFSTREAM;
   }
-
-  std::cout << decoder->videoHeight << "x" << decoder->videoWidth
-            << ", pitch:" << pitch << std::endl;
-
-  CHECK_CUVID_RESULT(cuvidUnmapVideoFrame(decoder->decoder, d_frame));
-  delete[] pFrame;
-
-  return 1;
+  CHECK_CUVID_RESULT(cuvidParseVideoData(parser, &packet));
 }
 
 void NvidiaDecoder::Decode() {
@@ -235,28 +237,94 @@ void NvidiaDecoder::Decode() {
     return;
   }
 
+  AnnexBSplitter splitter(streamCodec);
+  auto parse = [this](const uint8_t *data, size_t size) {
+    ParseAccessUnit(data, size, false);
+  };
   std::vector<uint8_t> buffer(1024 * 1024);
   while (inputFileStream.read(reinterpret_cast<char *>(buffer.data()),
                               buffer.size()) ||
          inputFileStream.gcount()) {
-    CUVIDSOURCEDATAPACKET packet = {};
-    packet.payload_size = inputFileStream.gcount();
-    packet.payload = buffer.data();
-
-    std::cout << "Parsing packet with size: " << packet.payload_size << std::endl;
-    CHECK_CUVID_RESULT(cuvidParseVideoData(parser, &packet));
+    splitter.Push(buffer.data(), inputFileStream.gcount(), parse);
+  }
+  bool ended = false;
+  splitter.Finish([this, &ended](const uint8_t *data, size_t size) {
+    ParseAccessUnit(data, size, true);
+    ended = true;
+  });
+  if (!ended) {
+    ParseAccessUnit(nullptr, 0, true);
   }
+  std::cout << "Access units: " << accessUnits
+            << ", frames displayed: " << monitor.Displayed() << ", "
+            << monitor.Fps() << " fps, decode queue depth avg "
+            << monitor.AverageDepth() << " max " << monitor.MaxDepth()
+            << std::endl;
+
+  if (!pipeline->Finish()) {
+    std::cerr << "Failed to write the output file" << std::endl;
+  }
+  FramePipelineStats stats = pipeline->Stats();
+  std::cout << "Frames: " << stats.frames << ", display callbacks "
+            << stats.display_time << " s (waiting for a buffer "
+            << stats.buffer_wait << " s), writing " << stats.write_time
+            << " s" << std::endl;
+}
+
+void PrintUsage(const char *program) {
+  std::cout << "Usage: " << program << " [options] <input_file> <output_file>\n"
+            << "Options:\n"
+            << "  -d, --display-delay N  Pictures decoded ahead of display (2)\n"
+            << "  -m, --mapped N         Frames mapped at once (2)\n"
+            << "  -W, --max-width W      Largest width to reconfigure to (first sequence)\n"
+            << "  -H, --max-height H     Largest height to reconfigure to (first sequence)\n"
+            << "  --help                 Show this help message\n";
 }
 
 int main(int argc, char **argv) {
-  if (argc != 3) {
-    std::cerr << "Usage: " << argv[0] << " <input_file> <output_file>"
-              << std::endl;
+  SurfacePolicyConfig policyConfig;
+
+  static struct option long_options[] = {
+      {"display-delay", required_argument, nullptr, 'd'},
+      {"mapped", required_argument, nullptr, 'm'},
+      {"max-width", required_argument, nullptr, 'W'},
+      {"max-height", required_argument, nullptr, 'H'},
+      {"help", no_argument, nullptr, 0},
+      {nullptr, 0, nullptr, 0}};
+
+  int opt;
+  int option_index = 0;
+  while ((opt = getopt_long(argc, argv, "d:m:W:H:", long_options,
+                            &option_index)) != -1) {
+    switch (opt) {
+    case 'd':
+      policyConfig.display_delay = std::stoi(optarg);
+      break;
+    case 'm':
+      policyConfig.mapped_frames = std::stoi(optarg);
+      break;
+    case 'W':
+      policyConfig.max_width = std::stoi(optarg);
+      break;
+    case 'H':
+      policyConfig.max_height = std::stoi(optarg);
+      break;
+    case 0:
+      PrintUsage(argv[0]);
+      return 0;
+    default:
+      PrintUsage(argv[0]);
+      return -1;
+    }
+  }
+  if (argc - optind != 2 || policyConfig.display_delay < 0 ||
+      policyConfig.mapped_frames < 1) {
+    PrintUsage(argv[0]);
     return -1;
   }
 
-  NvidiaDecoder decoder(argv[1], argv[2]);
+  NvidiaDecoder decoder(argv[optind], argv[optind + 1], policyConfig);
   decoder.Decode();
 
   return 0;
-}
\ No newline at end of file
+}
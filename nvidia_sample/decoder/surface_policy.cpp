@@ -0,0 +1,60 @@
+#include "surface_policy.h"
+
+#include <algorithm>
+
+const char *SequenceActionName(SequenceAction action) {
+  switch (action) {
+  case SequenceAction::kCreate:
+    return "create";
+  case SequenceAction::kKeep:
+    return "keep";
+  case SequenceAction::kReconfigure:
+    return "reconfigure";
+  default:
+    return "recreate";
+  }
+}
+
+SurfacePolicy::SurfacePolicy(const SurfacePolicyConfig &config)
+    : config_(config) {
+  config_.display_delay = std::max(0, config_.display_delay);
+  config_.mapped_frames = std::max(1, config_.mapped_frames);
+}
+
+SequenceAction SurfacePolicy::OnSequence(const SequenceFormat &format) {
+  int decode = std::min(format.min_num_decode_surfaces + config_.display_delay,
+                        config_.max_decode_surfaces);
+  // Never below what the stream needs, even past the configured maximum
+  decode = std::max(decode, format.min_num_decode_surfaces);
+  int output =
+      std::min(config_.mapped_frames + 1, config_.max_output_surfaces);
+
+  bool sameKind = created_ && format.codec == format_.codec &&
+                  format.chroma_format == format_.chroma_format &&
+                  format.bit_depth_minus8 == format_.bit_depth_minus8;
+  bool fits = format.coded_width <= surfaces_.max_width &&
+              format.coded_height <= surfaces_.max_height;
+
+  SequenceAction action;
+  if (sameKind && fits && decode <= allocated_decode_surfaces_) {
+    if (format.coded_width == surfaces_.width &&
+        format.coded_height == surfaces_.height &&
+        decode == surfaces_.decode_surfaces) {
+      action = SequenceAction::kKeep;
+    } else {
+      action = SequenceAction::kReconfigure;
+    }
+  } else {
+    action = created_ ? SequenceAction::kRecreate : SequenceAction::kCreate;
+    surfaces_.max_width = std::max(format.coded_width, config_.max_width);
+    surfaces_.max_height = std::max(format.coded_height, config_.max_height);
+    surfaces_.output_surfaces = output;
+    allocated_decode_surfaces_ = decode;
+    created_ = true;
+  }
+  surfaces_.decode_surfaces = decode;
+  surfaces_.width = format.coded_width;
+  surfaces_.height = format.coded_height;
+  format_ = format;
+  return action;
+}
@@ -0,0 +1,120 @@
+#ifndef SURFACE_POLICY_H
+#define SURFACE_POLICY_H
+
+#include <chrono>
+#include <cstdint>
+
+struct SurfacePolicyConfig {
+  // Pictures the parser may hold back before display (ulMaxDisplayDelay).
+  // Each one is a picture the decoder can work on ahead of the display, so
+  // it costs a decode surface on top of min_num_decode_surfaces.
+  int display_delay = 2;
+  // Frames mapped at once by the display path; one output surface more is
+  // kept free for decoding
+  int mapped_frames = 2;
+  // 0: the size of the first sequence. Larger values let later sequences up
+  // to this size go through cuvidReconfigureDecoder.
+  int max_width = 0;
+  int max_height = 0;
+  int max_decode_surfaces = 32;
+  int max_output_surfaces = 64;
+};
+
+// What a sequence callback reports, codec independent
+struct SequenceFormat {
+  int codec = 0;
+  int chroma_format = 0;
+  int bit_depth_minus8 = 0;
+  int coded_width = 0;
+  int coded_height = 0;
+  int min_num_decode_surfaces = 0;
+};
+
+struct DecoderSurfaces {
+  int decode_surfaces = 0;
+  int output_surfaces = 0;
+  int width = 0;
+  int height = 0;
+  int max_width = 0; // ulMaxWidth/ulMaxHeight the decoder was created with
+  int max_height = 0;
+};
+
+enum class SequenceAction {
+  kCreate,      // first sequence
+  kKeep,        // same format again, nothing to do
+  kReconfigure, // cuvidReconfigureDecoder to the new size and surfaces
+  kRecreate,    // destroy and create the decoder
+};
+
+const char *SequenceActionName(SequenceAction action);
+
+// Decides the surface counts of the decoder and how it follows sequence
+// changes, without touching cuvid.
+//
+// decode surfaces = min_num_decode_surfaces + display_delay
+// output surfaces = mapped_frames + 1
+//
+// A new sequence reconfigures the decoder if codec, chroma format and bit
+// depth are the same, the coded size fits the maximum the decoder was
+// created with and it needs no more decode surfaces than were allocated;
+// anything else recreates it.
+class SurfacePolicy {
+public:
+  explicit SurfacePolicy(const SurfacePolicyConfig &config);
+
+  SequenceAction OnSequence(const SequenceFormat &format);
+
+  // After OnSequence: what the decoder has to look like
+  const DecoderSurfaces &Surfaces() const { return surfaces_; }
+  int DisplayDelay() const { return config_.display_delay; }
+
+private:
+  SurfacePolicyConfig config_;
+  bool created_ = false;
+  SequenceFormat format_;
+  DecoderSurfaces surfaces_;
+  int allocated_decode_surfaces_ = 0;
+};
+
+// Pictures handed to the decoder but not displayed yet, sampled at every
+// display, and the display rate
+class DecodeQueueMonitor {
+public:
+  void OnDecode() {
+    if (!started_) {
+      start_ = std::chrono::steady_clock::now();
+      started_ = true;
+    }
+    decoded_++;
+  }
+  void OnDisplay() {
+    displayed_++;
+    int64_t depth = decoded_ - displayed_;
+    depth_sum_ += depth;
+    if (depth > max_depth_) {
+      max_depth_ = depth;
+    }
+  }
+
+  int64_t Displayed() const { return displayed_; }
+  int64_t MaxDepth() const { return max_depth_; }
+  double AverageDepth() const {
+    return displayed_ ? static_cast<double>(depth_sum_) / displayed_ : 0;
+  }
+  double Fps() const {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start_)
+                         .count();
+    return started_ && seconds > 0 ? displayed_ / seconds : 0;
+  }
+
+private:
+  bool started_ = false;
+  std::chrono::steady_clock::time_point start_;
+  int64_t decoded_ = 0;
+  int64_t displayed_ = 0;
+  int64_t depth_sum_ = 0;
+  int64_t max_depth_ = 0;
+};
+
+#endif
@@ -0,0 +1,229 @@
+// Checks SurfacePolicy against a script of sequence changes, then simulates
+// the parser and a decode engine at several display delays to show what the
+// extra decode surfaces buy and what DecodeQueueMonitor reports. Needs no
+// GPU: decode, parse and copy times are simulated.
+
+#include <chrono>
+#include <condition_variable>
+#include <getopt.h>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "../common/bounded_queue.h"
+#include "surface_policy.h"
+
+struct Step {
+  const char *what;
+  SequenceFormat format;
+  SequenceAction action;
+  int decode_surfaces;
+  int max_width;
+};
+
+SequenceFormat Format(int width, int height, int minSurfaces, int codec = 4,
+                      int bitDepthMinus8 = 0) {
+  SequenceFormat format;
+  format.codec = codec;
+  format.chroma_format = 1;
+  format.bit_depth_minus8 = bitDepthMinus8;
+  format.coded_width = width;
+  format.coded_height = height;
+  format.min_num_decode_surfaces = minSurfaces;
+  return format;
+}
+
+bool CheckPolicy() {
+  SurfacePolicyConfig config;
+  config.display_delay = 2;
+  config.mapped_frames = 2;
+  config.max_width = 1920;
+  config.max_height = 1088;
+  const Step steps[] = {
+      {"first sequence", Format(1280, 720, 5), SequenceAction::kCreate, 7,
+       1920},
+      {"same again", Format(1280, 720, 5), SequenceAction::kKeep, 7, 1920},
+      {"up to the maximum", Format(1920, 1088, 5),
+       SequenceAction::kReconfigure, 7, 1920},
+      {"down, fewer surfaces", Format(640, 368, 4),
+       SequenceAction::kReconfigure, 6, 1920},
+      {"more surfaces than allocated", Format(640, 368, 8),
+       SequenceAction::kRecreate, 10, 1920},
+      {"past the maximum", Format(3840, 2160, 8), SequenceAction::kRecreate,
+       10, 3840},
+      {"back down", Format(1920, 1088, 6), SequenceAction::kReconfigure, 8,
+       3840},
+      // Recreating sizes for the configured maximum again
+      {"bit depth change", Format(1920, 1088, 6, 4, 2),
+       SequenceAction::kRecreate, 8, 1920},
+      {"codec change", Format(1920, 1088, 6, 8, 2), SequenceAction::kRecreate,
+       8, 1920},
+      {"clamped to the maximum count", Format(1920, 1088, 31, 8, 2),
+       SequenceAction::kRecreate, 32, 1920},
+      {"never below the stream minimum", Format(1920, 1088, 33, 8, 2),
+       SequenceAction::kRecreate, 33, 1920},
+  };
+
+  SurfacePolicy policy(config);
+  bool ok = true;
+  for (const Step &step : steps) {
+    SequenceAction action = policy.OnSequence(step.format);
+    const DecoderSurfaces &surfaces = policy.Surfaces();
+    if (action != step.action ||
+        surfaces.decode_surfaces != step.decode_surfaces ||
+        surfaces.max_width != step.max_width ||
+        surfaces.output_surfaces != 3 ||
+        surfaces.width != step.format.coded_width) {
+      std::cerr << "policy: FAILED at \"" << step.what << "\": "
+                << SequenceActionName(action) << " with "
+                << surfaces.decode_surfaces << " decode surfaces, max width "
+                << surfaces.max_width << std::endl;
+      ok = false;
+    }
+  }
+
+  // Without a configured maximum the first sequence sets it
+  SurfacePolicy unbounded(SurfacePolicyConfig{});
+  unbounded.OnSequence(Format(1280, 720, 5));
+  if (unbounded.OnSequence(Format(1920, 1080, 5)) !=
+      SequenceAction::kRecreate) {
+    std::cerr << "policy: FAILED, grew past the first sequence in place"
+              << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+struct SimConfig {
+  int frames = 300;
+  int parse_us = 1000;  // parser thread per picture
+  int decode_us = 3000; // decode engine per picture
+  int copy_us = 1000;   // display path per picture
+  int min_surfaces = 5;
+};
+
+// The parser submits a picture to a serial decode engine and, display_delay
+// pictures later, displays it: waits until it is decoded and copies it out.
+// Pictures submitted and not displayed hold decode surfaces beyond the
+// stream's reference pictures.
+bool Simulate(const SimConfig &sim, int displayDelay) {
+  SurfacePolicyConfig config;
+  config.display_delay = displayDelay;
+  SurfacePolicy policy(config);
+  policy.OnSequence(Format(1920, 1088, sim.min_surfaces));
+  int spareSurfaces =
+      policy.Surfaces().decode_surfaces - sim.min_surfaces + 1;
+
+  BoundedQueue<int> submitted(sim.frames);
+  std::mutex mutex;
+  std::condition_variable decodedCv;
+  int decoded = 0;
+  std::thread engine([&] {
+    int picture;
+    while (submitted.Pop(picture)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(sim.decode_us));
+      std::lock_guard<std::mutex> lock(mutex);
+      decoded++;
+      decodedCv.notify_all();
+    }
+  });
+
+  DecodeQueueMonitor monitor;
+  int displayed = 0;
+  auto display = [&] {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      decodedCv.wait(lock, [&] { return decoded > displayed; });
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(sim.copy_us));
+    monitor.OnDisplay();
+    displayed++;
+  };
+  for (int n = 0; n < sim.frames; ++n) {
+    std::this_thread::sleep_for(std::chrono::microseconds(sim.parse_us));
+    monitor.OnDecode();
+    submitted.Push(n);
+    while (n + 1 - displayed > policy.DisplayDelay()) {
+      display();
+    }
+  }
+  // End of stream: the parser flushes what it held back
+  while (displayed < sim.frames) {
+    display();
+  }
+  submitted.Close();
+  engine.join();
+
+  std::cout << "display delay " << displayDelay << ": "
+            << policy.Surfaces().decode_surfaces << " decode surfaces, "
+            << monitor.Fps() << " fps, decode queue depth avg "
+            << monitor.AverageDepth() << " max " << monitor.MaxDepth()
+            << std::endl;
+  if (monitor.Displayed() != sim.frames ||
+      monitor.MaxDepth() > spareSurfaces) {
+    std::cerr << "simulation: FAILED, more pictures in flight than spare "
+              << "decode surfaces (" << spareSurfaces << ")" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void PrintUsage() {
+  std::cout << "Usage: surface_policy_bench [options]\n"
+            << "Options:\n"
+            << "  -n, --frames N         Pictures to simulate (300)\n"
+            << "  -p, --parse-us US      Parser time per picture (1000)\n"
+            << "  -d, --decode-us US     Decode engine time per picture (3000)\n"
+            << "  -c, --copy-us US       Display path time per picture (1000)\n"
+            << "  --help                 Show this help message\n";
+}
+
+int main(int argc, char *argv[]) {
+  SimConfig sim;
+
+  static struct option long_options[] = {
+      {"frames", required_argument, nullptr, 'n'},
+      {"parse-us", required_argument, nullptr, 'p'},
+      {"decode-us", required_argument, nullptr, 'd'},
+      {"copy-us", required_argument, nullptr, 'c'},
+      {"help", no_argument, nullptr, 0},
+      {nullptr, 0, nullptr, 0}};
+
+  int opt;
+  int option_index = 0;
+  while ((opt = getopt_long(argc, argv, "n:p:d:c:", long_options,
+                            &option_index)) != -1) {
+    switch (opt) {
+    case 'n':
+      sim.frames = std::stoi(optarg);
+      break;
+    case 'p':
+      sim.parse_us = std::stoi(optarg);
+      break;
+    case 'd':
+      sim.decode_us = std::stoi(optarg);
+      break;
+    case 'c':
+      sim.copy_us = std::stoi(optarg);
+      break;
+    case 0:
+      PrintUsage();
+      return 0;
+    default:
+      PrintUsage();
+      return -1;
+    }
+  }
+  if (sim.frames < 1) {
+    std::cerr << "Error: Invalid options" << std::endl;
+    PrintUsage();
+    return -1;
+  }
+
+  bool ok = CheckPolicy();
+  for (int delay : {0, 1, 2, 4}) {
+    ok = Simulate(sim, delay) && ok;
+  }
+  std::cout << (ok ? "all checks passed" : "CHECKS FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
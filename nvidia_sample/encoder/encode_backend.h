@@ -0,0 +1,49 @@
+#ifndef ENCODE_BACKEND_H
+#define ENCODE_BACKEND_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+enum class EncodeCodec { kH264, kHEVC };
+enum class InputFormat { kNV12, kIYUV };
+
+// Rate control and GOP structure every backend is configured with, so a
+// stream has the same shape whether it was encoded on a GPU host or not:
+// VBR around bitrate_kbps with a one second VBV buffer at max_bitrate_kbps,
+// an IDR frame every gop_length frames and no scene cut keyframes.
+struct EncodeSettings {
+  int fps = 30;
+  int gop_length = 250;
+  int b_frames = 0;
+  int bitrate_kbps = 0;      // 0 picks one from the resolution
+  int max_bitrate_kbps = 0;  // 0 is twice the average
+
+  // Fills in the defaults that depend on the resolution
+  void Resolve(int width, int height) {
+    if (bitrate_kbps <= 0) {
+      // ~0.1 bit per pixel, 6 Mbit/s for 1080p30
+      bitrate_kbps = static_cast<int>(
+          static_cast<int64_t>(width) * height * fps / 10 / 1000);
+    }
+    if (max_bitrate_kbps <= 0) {
+      max_bitrate_kbps = bitrate_kbps * 2;
+    }
+  }
+};
+
+// One encoder implementation behind the CLI: frames go in packed (planes
+// back to back, no padding), Annex-B elementary stream comes out.
+class EncodeBackend {
+public:
+  virtual ~EncodeBackend() {}
+
+  // "nvenc", "libx264", ...
+  virtual std::string Name() const = 0;
+  virtual void EncodeFrame(const uint8_t *frameData,
+                           std::ofstream &outputFile) = 0;
+  virtual void Flush(std::ofstream &outputFile) = 0;
+  virtual int64_t EncodedBytes() const = 0;
+};
+
+#endif
@@ -0,0 +1,341 @@
+#include "fake_nvenc.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct FakeInput {
+  std::vector<uint8_t> data;
+  uint32_t pitch = 0;
+  bool locked = false;
+};
+
+struct FakeBitstream {
+  std::vector<uint8_t> data;
+  bool submitted = false;  // between nvEncEncodePicture and unlock
+  bool released = false;   // output no longer held back for reordering
+  bool locked = false;
+  Clock::time_point ready_at;
+  uint64_t seq = 0;
+  uint32_t frame_idx = 0;
+};
+
+struct FakeSession {
+  explicit FakeSession(FakeNvEncDevice *device) : device(device) {}
+
+  FakeNvEncDevice *device;
+  std::mutex mutex;
+  std::condition_variable done;
+  int width = 0;
+  int height = 0;
+  int frame_interval_p = 1;
+  NV_ENC_BUFFER_FORMAT format = NV_ENC_BUFFER_FORMAT_NV12;
+  std::vector<std::unique_ptr<FakeInput>> inputs;
+  std::vector<std::unique_ptr<FakeBitstream>> bitstreams;
+  std::vector<FakeBitstream *> held;
+  Clock::time_point engine_free;
+  uint64_t next_seq = 0;
+  uint64_t next_lock_seq = 0;
+};
+
+FakeSession *Session(void *encoder) {
+  return static_cast<FakeSession *>(encoder);
+}
+
+// Queues the held frames on the engine, which encodes them one at a time
+void ReleaseHeld(FakeSession *session) {
+  Clock::time_point now = Clock::now();
+  for (FakeBitstream *bitstream : session->held) {
+    session->engine_free = std::max(now, session->engine_free) +
+                           std::chrono::microseconds(
+                               session->device->config.encode_us);
+    bitstream->ready_at = session->engine_free;
+    bitstream->released = true;
+  }
+  session->held.clear();
+}
+
+template <typename T>
+bool Owns(const std::vector<std::unique_ptr<T>> &buffers, void *buffer) {
+  for (const auto &owned : buffers) {
+    if (owned.get() == buffer) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+NVENCSTATUS Destroy(std::vector<std::unique_ptr<T>> &buffers, void *buffer) {
+  for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+    if (it->get() == buffer) {
+      buffers.erase(it);
+      return NV_ENC_SUCCESS;
+    }
+  }
+  return NV_ENC_ERR_INVALID_PARAM;
+}
+
+NVENCSTATUS NVENCAPI
+FakeOpenEncodeSessionEx(NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS *params,
+                        void **encoder) {
+  if (!params || !params->device || !encoder) {
+    return NV_ENC_ERR_INVALID_PTR;
+  }
+  *encoder =
+      new FakeSession(static_cast<FakeNvEncDevice *>(params->device));
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI FakeGetEncodePresetConfigEx(
+    void *encoder, GUID encodeGUID, GUID presetGUID,
+    NV_ENC_TUNING_INFO tuningInfo, NV_ENC_PRESET_CONFIG *presetConfig) {
+  (void)encodeGUID;
+  (void)presetGUID;
+  (void)tuningInfo;
+  NV_ENC_CONFIG &config = presetConfig->presetCfg;
+  config.profileGUID = NV_ENC_CODEC_PROFILE_AUTOSELECT_GUID;
+  config.gopLength = 250;
+  config.frameIntervalP = Session(encoder)->device->config.frame_interval_p;
+  config.rcParams.rateControlMode = NV_ENC_PARAMS_RC_VBR;
+  config.rcParams.lookaheadDepth = 0;
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI FakeInitializeEncoder(void *encoder,
+                                           NV_ENC_INITIALIZE_PARAMS *params) {
+  FakeSession *session = Session(encoder);
+  if (params->encodeWidth == 0 || params->encodeHeight == 0) {
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+  session->width = params->encodeWidth;
+  session->height = params->encodeHeight;
+  session->frame_interval_p =
+      params->encodeConfig ? params->encodeConfig->frameIntervalP
+                           : session->device->config.frame_interval_p;
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI
+FakeCreateInputBuffer(void *encoder, NV_ENC_CREATE_INPUT_BUFFER *params) {
+  FakeSession *session = Session(encoder);
+  uint32_t align = std::max(1, session->device->config.pitch_align);
+  std::unique_ptr<FakeInput> input(new FakeInput);
+  input->pitch = (params->width + align - 1) / align * align;
+  input->data.resize(input->pitch * params->height * 3 / 2);
+  session->format = params->bufferFmt;
+  params->inputBuffer = input.get();
+  std::lock_guard<std::mutex> lock(session->mutex);
+  session->inputs.push_back(std::move(input));
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI FakeDestroyInputBuffer(void *encoder,
+                                            NV_ENC_INPUT_PTR buffer) {
+  FakeSession *session = Session(encoder);
+  std::lock_guard<std::mutex> lock(session->mutex);
+  return Destroy(session->inputs, buffer);
+}
+
+NVENCSTATUS NVENCAPI FakeCreateBitstreamBuffer(
+    void *encoder, NV_ENC_CREATE_BITSTREAM_BUFFER *params) {
+  FakeSession *session = Session(encoder);
+  std::unique_ptr<FakeBitstream> bitstream(new FakeBitstream);
+  bitstream->data.resize(
+      std::max(8, session->device->config.bytes_per_frame));
+  params->bitstreamBuffer = bitstream.get();
+  std::lock_guard<std::mutex> lock(session->mutex);
+  session->bitstreams.push_back(std::move(bitstream));
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI FakeDestroyBitstreamBuffer(void *encoder,
+                                                NV_ENC_OUTPUT_PTR buffer) {
+  FakeSession *session = Session(encoder);
+  std::lock_guard<std::mutex> lock(session->mutex);
+  return Destroy(session->bitstreams, buffer);
+}
+
+NVENCSTATUS NVENCAPI FakeLockInputBuffer(void *encoder,
+                                         NV_ENC_LOCK_INPUT_BUFFER *params) {
+  FakeSession *session = Session(encoder);
+  std::lock_guard<std::mutex> lock(session->mutex);
+  if (!Owns(session->inputs, params->inputBuffer)) {
+    session->device->stats.bad_calls++;
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+  FakeInput *input = static_cast<FakeInput *>(params->inputBuffer);
+  input->locked = true;
+  params->bufferDataPtr = input->data.data();
+  params->pitch = input->pitch;
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI FakeUnlockInputBuffer(void *encoder,
+                                           NV_ENC_INPUT_PTR buffer) {
+  FakeSession *session = Session(encoder);
+  std::lock_guard<std::mutex> lock(session->mutex);
+  if (!Owns(session->inputs, buffer)) {
+    session->device->stats.bad_calls++;
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+  static_cast<FakeInput *>(buffer)->locked = false;
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI FakeEncodePicture(void *encoder,
+                                       NV_ENC_PIC_PARAMS *params) {
+  FakeSession *session = Session(encoder);
+  std::lock_guard<std::mutex> lock(session->mutex);
+  if (params->encodePicFlags & NV_ENC_PIC_FLAG_EOS) {
+    ReleaseHeld(session);
+    session->done.notify_all();
+    return NV_ENC_SUCCESS;
+  }
+
+  FakeNvEncStats &stats = session->device->stats;
+  if (!Owns(session->inputs, params->inputBuffer) ||
+      !Owns(session->bitstreams, params->outputBitstream)) {
+    stats.bad_calls++;
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+  FakeInput *input = static_cast<FakeInput *>(params->inputBuffer);
+  FakeBitstream *bitstream =
+      static_cast<FakeBitstream *>(params->outputBitstream);
+  if (input->locked || bitstream->submitted) {
+    // the surface is still being written, or its last output not unlocked
+    stats.bad_calls++;
+    return NV_ENC_ERR_INVALID_CALL;
+  }
+
+  if (session->device->config.checksum) {
+    if (stats.checksums.size() <= params->frameIdx) {
+      stats.checksums.resize(params->frameIdx + 1);
+    }
+    stats.checksums[params->frameIdx] =
+        FakeNvEncChecksum(input->data.data(), input->pitch, session->width,
+                          session->height, params->bufferFmt);
+  }
+
+  bitstream->submitted = true;
+  bitstream->released = false;
+  bitstream->seq = session->next_seq++;
+  bitstream->frame_idx = params->frameIdx;
+  memcpy(bitstream->data.data(), &params->frameIdx, sizeof(uint32_t));
+  session->held.push_back(bitstream);
+  if (static_cast<int>(session->held.size()) < session->frame_interval_p) {
+    return NV_ENC_ERR_NEED_MORE_INPUT;
+  }
+  ReleaseHeld(session);
+  session->done.notify_all();
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI FakeLockBitstream(void *encoder,
+                                       NV_ENC_LOCK_BITSTREAM *params) {
+  FakeSession *session = Session(encoder);
+  std::unique_lock<std::mutex> lock(session->mutex);
+  FakeNvEncStats &stats = session->device->stats;
+  if (!Owns(session->bitstreams, params->outputBitstream)) {
+    stats.bad_calls++;
+    return NV_ENC_ERR_INVALID_PARAM;
+  }
+  FakeBitstream *bitstream =
+      static_cast<FakeBitstream *>(params->outputBitstream);
+  if (!bitstream->submitted || !bitstream->released || bitstream->locked) {
+    // the real call would hang on a frame the encoder still holds back
+    stats.bad_calls++;
+    return NV_ENC_ERR_INVALID_CALL;
+  }
+  if (bitstream->seq != session->next_lock_seq) {
+    stats.out_of_order_locks++;
+  }
+  session->next_lock_seq = bitstream->seq + 1;
+
+  while (Clock::now() < bitstream->ready_at) {
+    session->done.wait_until(lock, bitstream->ready_at);
+  }
+  bitstream->locked = true;
+  params->bitstreamBufferPtr = bitstream->data.data();
+  params->bitstreamSizeInBytes = bitstream->data.size();
+  params->frameIdx = bitstream->frame_idx;
+  params->outputTimeStamp = bitstream->frame_idx;
+  params->pictureType =
+      bitstream->seq == 0 ? NV_ENC_PIC_TYPE_IDR : NV_ENC_PIC_TYPE_P;
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI FakeUnlockBitstream(void *encoder,
+                                         NV_ENC_OUTPUT_PTR buffer) {
+  FakeSession *session = Session(encoder);
+  std::lock_guard<std::mutex> lock(session->mutex);
+  if (!Owns(session->bitstreams, buffer) ||
+      !static_cast<FakeBitstream *>(buffer)->locked) {
+    session->device->stats.bad_calls++;
+    return NV_ENC_ERR_INVALID_CALL;
+  }
+  FakeBitstream *bitstream = static_cast<FakeBitstream *>(buffer);
+  bitstream->locked = false;
+  bitstream->submitted = false;
+  session->device->stats.encoded++;
+  return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS NVENCAPI FakeDestroyEncoder(void *encoder) {
+  delete Session(encoder);
+  return NV_ENC_SUCCESS;
+}
+
+} // namespace
+
+void FillFakeNvEncodeApi(FakeNvEncDevice *device, NvEncodeApi *api) {
+  memset(&api->funcs, 0, sizeof(api->funcs));
+  api->funcs.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+  api->funcs.nvEncOpenEncodeSessionEx = FakeOpenEncodeSessionEx;
+  api->funcs.nvEncGetEncodePresetConfigEx = FakeGetEncodePresetConfigEx;
+  api->funcs.nvEncInitializeEncoder = FakeInitializeEncoder;
+  api->funcs.nvEncCreateInputBuffer = FakeCreateInputBuffer;
+  api->funcs.nvEncDestroyInputBuffer = FakeDestroyInputBuffer;
+  api->funcs.nvEncCreateBitstreamBuffer = FakeCreateBitstreamBuffer;
+  api->funcs.nvEncDestroyBitstreamBuffer = FakeDestroyBitstreamBuffer;
+  api->funcs.nvEncLockInputBuffer = FakeLockInputBuffer;
+  api->funcs.nvEncUnlockInputBuffer = FakeUnlockInputBuffer;
+  api->funcs.nvEncEncodePicture = FakeEncodePicture;
+  api->funcs.nvEncLockBitstream = FakeLockBitstream;
+  api->funcs.nvEncUnlockBitstream = FakeUnlockBitstream;
+  api->funcs.nvEncDestroyEncoder = FakeDestroyEncoder;
+  api->device = device;
+  api->deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+}
+
+uint32_t FakeNvEncChecksum(const uint8_t *data, uint32_t pitch, int width,
+                           int height, NV_ENC_BUFFER_FORMAT format) {
+  uint32_t sum = 0;
+  auto add_plane = [&sum](const uint8_t *plane, uint32_t plane_pitch,
+                          int row_bytes, int rows) {
+    for (int y = 0; y < rows; ++y) {
+      const uint8_t *row = plane + static_cast<size_t>(y) * plane_pitch;
+      for (int x = 0; x < row_bytes; ++x) {
+        sum = sum * 31 + row[x];
+      }
+    }
+  };
+  const uint8_t *chroma = data + static_cast<size_t>(pitch) * height;
+  add_plane(data, pitch, width, height);
+  if (format == NV_ENC_BUFFER_FORMAT_IYUV) {
+    uint32_t chroma_pitch = (pitch + 1) / 2;
+    add_plane(chroma, chroma_pitch, width / 2, height / 2);
+    add_plane(chroma + static_cast<size_t>(chroma_pitch) * (height / 2),
+              chroma_pitch, width / 2, height / 2);
+  } else {
+    add_plane(chroma, pitch, width, height / 2);
+  }
+  return sum;
+}
@@ -0,0 +1,46 @@
+#ifndef FAKE_NVENC_H
+#define FAKE_NVENC_H
+
+#include <cstdint>
+#include <vector>
+#include "nv_encoder.h"
+
+// CPU stand-in for the NVENC function table, for running and timing the
+// encoder pipeline on machines without a GPU. Input surfaces and bitstreams
+// live in host memory, nvEncEncodePicture queues the frame on a simulated
+// engine that encodes one frame every encode_us, and nvEncLockBitstream
+// sleeps until the frame is done, like the real call does in sync mode.
+struct FakeNvEncConfig {
+  int encode_us = 2000;
+  // Preset frameIntervalP. The one the encoder is initialized with counts:
+  // > 1 holds frames back with NV_ENC_ERR_NEED_MORE_INPUT like B-frames do
+  int frame_interval_p = 1;
+  // Pitch of the input surfaces is the width rounded up to this
+  int pitch_align = 1;
+  int bytes_per_frame = 50000;
+  // Checksum the visible pixels of every submitted frame (costs CPU time)
+  bool checksum = false;
+};
+
+struct FakeNvEncStats {
+  int64_t encoded = 0;
+  int64_t out_of_order_locks = 0;  // locked in another order than submitted
+  int64_t bad_calls = 0;           // locks/encodes the real API would reject
+  std::vector<uint32_t> checksums; // by frameIdx, when config.checksum is set
+};
+
+// Passed as the session's device: the fake reads its config and writes its
+// stats here. Must outlive the encoder.
+struct FakeNvEncDevice {
+  FakeNvEncConfig config;
+  FakeNvEncStats stats;
+};
+
+void FillFakeNvEncodeApi(FakeNvEncDevice *device, NvEncodeApi *api);
+
+// Checksum of the visible pixels of a frame in an NV12 or IYUV surface with
+// the given luma pitch, the same one the fake computes on submission
+uint32_t FakeNvEncChecksum(const uint8_t *data, uint32_t pitch, int width,
+                           int height, NV_ENC_BUFFER_FORMAT format);
+
+#endif
@@ -0,0 +1,53 @@
+#include "frame_upload.h"
+
+#include <cstring>
+
+namespace {
+
+void CopyPlane(const uint8_t *src, uint32_t src_pitch, uint8_t *dst,
+               uint32_t dst_pitch, int row_bytes, int rows) {
+  if (src_pitch == dst_pitch) {
+    memcpy(dst, src, static_cast<size_t>(src_pitch) * rows);
+    return;
+  }
+  for (int y = 0; y < rows; ++y) {
+    memcpy(dst, src, row_bytes);
+    src += src_pitch;
+    dst += dst_pitch;
+  }
+}
+
+} // namespace
+
+size_t FrameSize(int width, int height, NV_ENC_BUFFER_FORMAT format) {
+  (void)format; // both supported formats are 4:2:0, 12 bits per pixel
+  return static_cast<size_t>(width) * height * 3 / 2;
+}
+
+uint32_t ChromaPitch(uint32_t pitch, NV_ENC_BUFFER_FORMAT format) {
+  return format == NV_ENC_BUFFER_FORMAT_IYUV ? (pitch + 1) / 2 : pitch;
+}
+
+void CopyFrameToSurface(const uint8_t *src, int width, int height,
+                        NV_ENC_BUFFER_FORMAT format, uint8_t *dst,
+                        uint32_t pitch) {
+  if (pitch == static_cast<uint32_t>(width)) {
+    memcpy(dst, src, FrameSize(width, height, format));
+    return;
+  }
+
+  CopyPlane(src, width, dst, pitch, width, height);
+  src += static_cast<size_t>(width) * height;
+  dst += static_cast<size_t>(pitch) * height;
+  if (format == NV_ENC_BUFFER_FORMAT_IYUV) {
+    int chroma_width = width / 2;
+    uint32_t chroma_pitch = ChromaPitch(pitch, format);
+    size_t src_plane = static_cast<size_t>(chroma_width) * (height / 2);
+    size_t dst_plane = static_cast<size_t>(chroma_pitch) * (height / 2);
+    CopyPlane(src, chroma_width, dst, chroma_pitch, chroma_width, height / 2);
+    CopyPlane(src + src_plane, chroma_width, dst + dst_plane, chroma_pitch,
+              chroma_width, height / 2);
+  } else {
+    CopyPlane(src, width, dst, pitch, width, height / 2);
+  }
+}
@@ -0,0 +1,22 @@
+#ifndef FRAME_UPLOAD_H
+#define FRAME_UPLOAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <nvEncodeAPI.h>
+
+// Bytes of one packed frame: NV12 or IYUV planes back to back, no padding
+size_t FrameSize(int width, int height, NV_ENC_BUFFER_FORMAT format);
+
+// Pitch of the chroma planes of a surface with the given luma pitch. The
+// NV12 UV plane shares the luma pitch, IYUV U and V planes use half of it.
+uint32_t ChromaPitch(uint32_t pitch, NV_ENC_BUFFER_FORMAT format);
+
+// Copies a packed frame into a locked input surface. When the surface pitch
+// equals the width the layouts are identical and this is a single memcpy,
+// otherwise every row of every plane is copied to its padded position.
+void CopyFrameToSurface(const uint8_t *src, int width, int height,
+                        NV_ENC_BUFFER_FORMAT format, uint8_t *dst,
+                        uint32_t pitch);
+
+#endif
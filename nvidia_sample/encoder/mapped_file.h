@@ -0,0 +1,56 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only mapping of a whole raw YUV file, so frames are uploaded straight
+// from the page cache instead of being read into a staging buffer first
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (data_) {
+      munmap(data_, size_);
+    }
+  }
+
+  bool Open(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return false;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    // frames are read once, front to back
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    data_ = data;
+    size_ = st.st_size;
+    return true;
+  }
+
+  const uint8_t *Data() const { return static_cast<const uint8_t *>(data_); }
+  size_t Size() const { return size_; }
+
+private:
+  void *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+#endif
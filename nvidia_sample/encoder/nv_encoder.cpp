@@ -0,0 +1,379 @@
+#include "nv_encoder.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include "frame_upload.h"
+#include "utils.h"
+
+std::string GetNVEncErrorString(NVENCSTATUS status) {
+  switch (status) {
+  case NV_ENC_SUCCESS:
+    return "Success";
+  case NV_ENC_ERR_NO_ENCODE_DEVICE:
+    return "No encode device";
+  case NV_ENC_ERR_UNSUPPORTED_DEVICE:
+    return "Unsupported device";
+  case NV_ENC_ERR_INVALID_ENCODERDEVICE:
+    return "Invalid encoder device";
+  case NV_ENC_ERR_INVALID_DEVICE:
+    return "Invalid device";
+  case NV_ENC_ERR_DEVICE_NOT_EXIST:
+    return "Device does not exist";
+  case NV_ENC_ERR_INVALID_PTR:
+    return "Invalid pointer";
+  case NV_ENC_ERR_INVALID_EVENT:
+    return "Invalid event";
+  case NV_ENC_ERR_INVALID_PARAM:
+    return "Invalid parameter";
+  case NV_ENC_ERR_INVALID_CALL:
+    return "Invalid call";
+  case NV_ENC_ERR_OUT_OF_MEMORY:
+    return "Out of memory";
+  case NV_ENC_ERR_ENCODER_NOT_INITIALIZED:
+    return "Encoder not initialized";
+  case NV_ENC_ERR_UNSUPPORTED_PARAM:
+    return "Unsupported parameter";
+  case NV_ENC_ERR_LOCK_BUSY:
+    return "Lock busy";
+  case NV_ENC_ERR_NOT_ENOUGH_BUFFER:
+    return "Not enough buffer";
+  case NV_ENC_ERR_INVALID_VERSION:
+    return "Invalid version";
+  case NV_ENC_ERR_MAP_FAILED:
+    return "Map failed";
+  case NV_ENC_ERR_NEED_MORE_INPUT:
+    return "Need more input";
+  case NV_ENC_ERR_ENCODER_BUSY:
+    return "Encoder busy";
+  case NV_ENC_ERR_EVENT_NOT_REGISTERD:
+    return "Event not registered";
+  case NV_ENC_ERR_GENERIC:
+    return "Generic error";
+  case NV_ENC_ERR_INCOMPATIBLE_CLIENT_KEY:
+    return "Incompatible client key";
+  case NV_ENC_ERR_UNIMPLEMENTED:
+    return "Unimplemented";
+  case NV_ENC_ERR_RESOURCE_NOT_REGISTERED:
+    return "Resource not registered";
+  case NV_ENC_ERR_RESOURCE_NOT_MAPPED:
+    return "Resource not mapped";
+  default:
+    return "Unknown error code";
+  }
+}
+
+namespace {
+
+// Extra ring buffers in pipelined mode, so the submitter can run ahead of the
+// retrieval thread by more than the reorder/lookahead window
+const uint32_t kPipelineExtraBuffers = 2;
+
+typedef std::chrono::steady_clock Clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+void NvEncoder::Initialize() {
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS sessionParams = {};
+  sessionParams.version = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  sessionParams.device = device_;
+  sessionParams.deviceType = deviceType_;
+  sessionParams.apiVersion = NVENCAPI_VERSION;
+
+  NVENC_INIT_CALL(
+      nvencFuncs_.nvEncOpenEncodeSessionEx(&sessionParams, &nvencHandle_));
+
+  // Initialize encoder parameters
+  initializeParams_.version = NV_ENC_INITIALIZE_PARAMS_VER;
+  initializeParams_.encodeGUID = codec_;
+  initializeParams_.presetGUID = NV_ENC_PRESET_P3_GUID;
+  initializeParams_.encodeWidth = width_;
+  initializeParams_.encodeHeight = height_;
+  initializeParams_.darWidth = width_;
+  initializeParams_.darHeight = height_;
+  initializeParams_.frameRateNum = 30;
+  initializeParams_.frameRateDen = 1;
+  initializeParams_.enablePTD = 1;
+  initializeParams_.reportSliceOffsets = 0;
+  initializeParams_.enableSubFrameWrite = 0;
+  initializeParams_.maxEncodeWidth = width_;
+  initializeParams_.maxEncodeHeight = height_;
+  initializeParams_.tuningInfo = NV_ENC_TUNING_INFO_HIGH_QUALITY;
+
+  NV_ENC_PRESET_CONFIG presetConfig = {NV_ENC_PRESET_CONFIG_VER,
+                                       {NV_ENC_CONFIG_VER}};
+  NVENC_INIT_CALL(nvencFuncs_.nvEncGetEncodePresetConfigEx(
+      nvencHandle_, codec_, NV_ENC_PRESET_P3_GUID,
+      NV_ENC_TUNING_INFO_HIGH_QUALITY, &presetConfig));
+  encodeConfig_ = presetConfig.presetCfg;
+
+  // Rate control and GOP from the settings, the same ones the software
+  // backends get
+  EncodeSettings &settings = options_.settings;
+  settings.Resolve(width_, height_);
+  initializeParams_.frameRateNum = settings.fps;
+  encodeConfig_.gopLength = settings.gop_length;
+  encodeConfig_.frameIntervalP = settings.b_frames + 1;
+  encodeConfig_.rcParams.rateControlMode = NV_ENC_PARAMS_RC_VBR;
+  encodeConfig_.rcParams.averageBitRate = settings.bitrate_kbps * 1000;
+  encodeConfig_.rcParams.maxBitRate = settings.max_bitrate_kbps * 1000;
+  encodeConfig_.rcParams.vbvBufferSize = settings.max_bitrate_kbps * 1000;
+  encodeConfig_.rcParams.vbvInitialDelay =
+      encodeConfig_.rcParams.vbvBufferSize;
+
+  initializeParams_.encodeConfig = &encodeConfig_;
+  if (codec_ == NV_ENC_CODEC_H264_GUID) {
+    initializeParams_.encodeConfig->encodeCodecConfig.h264Config.idrPeriod =
+        initializeParams_.encodeConfig->gopLength;
+  } else if (codec_ == NV_ENC_CODEC_HEVC_GUID) {
+    initializeParams_.encodeConfig->encodeCodecConfig.hevcConfig.idrPeriod =
+        initializeParams_.encodeConfig->gopLength;
+  }
+
+  if (options_.verbose) {
+    PrintNVEncInitializeParams(initializeParams_);
+  }
+
+  NVENC_INIT_CALL(
+      nvencFuncs_.nvEncInitializeEncoder(nvencHandle_, &initializeParams_));
+
+  AllocateBuffers();
+}
+
+void NvEncoder::Cleanup() {
+  StopRetrieval();
+  for (auto &surface : inputSurfaces_) {
+    NVENC_API_CALL(nvencFuncs_.nvEncDestroyInputBuffer(nvencHandle_, surface))
+  }
+  for (auto &bitstream : outputBitstreams_) {
+    NVENC_API_CALL(
+        nvencFuncs_.nvEncDestroyBitstreamBuffer(nvencHandle_, bitstream))
+  }
+  if (nvencHandle_) {
+    NVENC_API_CALL(nvencFuncs_.nvEncDestroyEncoder(nvencHandle_));
+    nvencHandle_ = nullptr;
+  }
+}
+
+void NvEncoder::AllocateBuffers() {
+  num_buffers_ = encodeConfig_.frameIntervalP + encodeConfig_.rcParams.lookaheadDepth + 1;
+  output_delay_ = num_buffers_ - 1;
+  if (options_.pipelined) {
+    num_buffers_ += kPipelineExtraBuffers;
+  }
+  completed_.reset(new BoundedQueue<int>(num_buffers_));
+  if (options_.verbose) {
+    std::cout << "frameIntervalP: " << encodeConfig_.frameIntervalP << std::endl;
+    std::cout << "lookaheadDepth: " << encodeConfig_.rcParams.lookaheadDepth << std::endl;
+    std::cout << "num_buffers_: " << num_buffers_ << std::endl;
+  }
+
+  for (uint32_t i = 0; i < num_buffers_; ++i) {
+    NV_ENC_CREATE_INPUT_BUFFER createInputBuffer = {
+        NV_ENC_CREATE_INPUT_BUFFER_VER};
+    createInputBuffer.width = width_;
+    createInputBuffer.height = height_;
+    createInputBuffer.bufferFmt = format_;
+    NVENC_INIT_CALL(
+        nvencFuncs_.nvEncCreateInputBuffer(nvencHandle_, &createInputBuffer));
+    inputSurfaces_.push_back(createInputBuffer.inputBuffer);
+  }
+
+  for (uint32_t i = 0; i < num_buffers_; ++i) {
+    NV_ENC_CREATE_BITSTREAM_BUFFER createBitstreamBuffer = {
+        NV_ENC_CREATE_BITSTREAM_BUFFER_VER};
+    NVENC_INIT_CALL(nvencFuncs_.nvEncCreateBitstreamBuffer(
+        nvencHandle_, &createBitstreamBuffer));
+    outputBitstreams_.push_back(createBitstreamBuffer.bitstreamBuffer);
+  }
+}
+
+void NvEncoder::EncodeFrame(const uint8_t *frameData,
+                            std::ofstream &outputFile) {
+  if (options_.pipelined) {
+    StartRetrieval(outputFile);
+    WaitForFreeBuffer();
+  }
+  Clock::time_point start = Clock::now();
+  uint32_t index = num_to_send_ % num_buffers_;
+
+  // Copy frame data to input buffer
+  NV_ENC_LOCK_INPUT_BUFFER lockInputBuffer = {NV_ENC_LOCK_INPUT_BUFFER_VER};
+  lockInputBuffer.inputBuffer = inputSurfaces_[index];
+  NVENC_API_CALL(
+      nvencFuncs_.nvEncLockInputBuffer(nvencHandle_, &lockInputBuffer));
+  CopyFrameToSurface(frameData, width_, height_, format_,
+                     static_cast<uint8_t *>(lockInputBuffer.bufferDataPtr),
+                     lockInputBuffer.pitch);
+  NVENC_API_CALL(nvencFuncs_.nvEncUnlockInputBuffer(
+      nvencHandle_, lockInputBuffer.inputBuffer));
+
+  // Prepare parameters and encode frame
+  NV_ENC_PIC_PARAMS picParams = {};
+  picParams.version = NV_ENC_PIC_PARAMS_VER;
+  picParams.inputWidth = width_;
+  picParams.inputHeight = height_;
+  picParams.inputPitch = lockInputBuffer.pitch;
+  picParams.bufferFmt = format_;
+  picParams.inputBuffer = inputSurfaces_[index];
+  picParams.outputBitstream = outputBitstreams_[index];
+  picParams.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+  picParams.frameIdx = num_to_send_;
+  picParams.inputTimeStamp = num_to_send_;
+
+  if (options_.verbose) {
+    std::cout << "pitch: " << lockInputBuffer.pitch << std::endl;
+    std::cout << "Encoding frame with parameters:" << std::endl;
+    std::cout << "  Input Width: " << picParams.inputWidth << std::endl;
+    std::cout << "  Input Height: " << picParams.inputHeight << std::endl;
+    std::cout << "  Input Pitch: " << picParams.inputPitch << std::endl;
+    std::cout << "  Buffer Format: " << picParams.bufferFmt << std::endl;
+    std::cout << "  Picture Struct: " << picParams.pictureStruct << std::endl;
+  }
+
+  NVENCSTATUS status = nvencFuncs_.nvEncEncodePicture(nvencHandle_, &picParams);
+  stats_.submit_time += SecondsSince(start);
+  if (status == NV_ENC_SUCCESS || status == NV_ENC_ERR_NEED_MORE_INPUT ) {
+    num_to_send_++;
+    stats_.frames++;
+    if (options_.pipelined) {
+      // NEED_MORE_INPUT holds the frame back for B-frame reordering, its
+      // output is released together with a later frame's
+      if (status == NV_ENC_SUCCESS) {
+        QueueCompleted();
+      }
+    } else {
+      // Copy encoded data to output file
+      GetEncodedData(outputFile, true);
+    }
+  } else {
+    std::cerr << "Error: Failed to encode frame" << std::endl;
+    throw std::runtime_error("Failed to encode frame");
+  }
+}
+
+void NvEncoder::GetEncodedData(std::ofstream &outputFile, bool outputdelay) {
+  int32_t end = outputdelay ? num_to_send_ - output_delay_ : num_to_send_;
+  for (; num_to_get_ < end; num_to_get_++) {
+    WriteBitstream(num_to_get_ % num_buffers_, outputFile);
+  }
+}
+
+void NvEncoder::WriteBitstream(int index, std::ofstream &outputFile) {
+  Clock::time_point start = Clock::now();
+  NV_ENC_LOCK_BITSTREAM lockBitstreamData = {};
+  lockBitstreamData.version = NV_ENC_LOCK_BITSTREAM_VER;
+  lockBitstreamData.doNotWait = 0;
+  lockBitstreamData.outputBitstream = outputBitstreams_[index];
+  NVENC_API_CALL(
+      nvencFuncs_.nvEncLockBitstream(nvencHandle_, &lockBitstreamData));
+  stats_.lock_wait += SecondsSince(start);
+
+  if (lockBitstreamData.bitstreamBufferPtr == nullptr) {
+    std::cerr << "Error: Bitstream buffer pointer is null" << std::endl;
+    throw std::runtime_error("Bitstream buffer pointer is null");
+  }
+
+  if (lockBitstreamData.bitstreamSizeInBytes == 0) {
+    std::cerr << "Error: Bitstream size is zero" << std::endl;
+    throw std::runtime_error("Bitstream size is zero");
+  }
+  // num_to_send_ belongs to the submitter in pipelined mode
+  if (options_.verbose && !options_.pipelined) {
+    std::cout << "num_to_send_: " << num_to_send_
+              << " num_to_get_: " << num_to_get_
+              << " total_frames: " << num_to_get_ + 1 << std::endl;
+  }
+  start = Clock::now();
+  outputFile.write(
+      reinterpret_cast<char *>(lockBitstreamData.bitstreamBufferPtr),
+      lockBitstreamData.bitstreamSizeInBytes);
+
+  if (!outputFile.good()) {
+    std::cerr << "Error: Failed to write to output file" << std::endl;
+    throw std::runtime_error("Failed to write to output file");
+  }
+  stats_.write_time += SecondsSince(start);
+  stats_.bytes += lockBitstreamData.bitstreamSizeInBytes;
+
+  NVENC_API_CALL(nvencFuncs_.nvEncUnlockBitstream(
+      nvencHandle_, lockBitstreamData.outputBitstream));
+}
+
+void NvEncoder::FlushFrame(std::ofstream &outputFile) {
+  // send eos
+  NV_ENC_PIC_PARAMS picParams = {};
+  picParams.version = NV_ENC_PIC_PARAMS_VER;
+  picParams.encodePicFlags = NV_ENC_PIC_FLAG_EOS;
+  NVENC_API_CALL(nvencFuncs_.nvEncEncodePicture(nvencHandle_, &picParams))
+
+  if (options_.pipelined) {
+    QueueCompleted();
+    StopRetrieval();
+    if (retrieval_failed_) {
+      throw std::runtime_error("Failed to retrieve encoded data");
+    }
+  } else {
+    GetEncodedData(outputFile, false);
+  }
+}
+
+void NvEncoder::StartRetrieval(std::ofstream &outputFile) {
+  if (!retrieval_.joinable()) {
+    retrieval_ = std::thread(&NvEncoder::RetrievalLoop, this, &outputFile);
+  }
+}
+
+void NvEncoder::StopRetrieval() {
+  if (retrieval_.joinable()) {
+    completed_->Close();
+    retrieval_.join();
+  }
+}
+
+// Retrieval thread: waits for each released frame in submission order,
+// writes it and hands its input surface and bitstream back to the submitter.
+// It only touches num_to_get_ and the lock/write stats.
+void NvEncoder::RetrievalLoop(std::ofstream *outputFile) {
+  int index;
+  while (completed_->Pop(index)) {
+    try {
+      WriteBitstream(index, *outputFile);
+    } catch (const std::exception &) {
+      std::lock_guard<std::mutex> lock(buffer_mutex_);
+      retrieval_failed_ = true;
+      buffer_free_.notify_all();
+      completed_->Close();
+      return;
+    }
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    num_to_get_++;
+    buffer_free_.notify_one();
+  }
+}
+
+// Blocks until the ring slot the next frame goes to has been written out
+void NvEncoder::WaitForFreeBuffer() {
+  std::unique_lock<std::mutex> lock(buffer_mutex_);
+  Clock::time_point start = Clock::now();
+  buffer_free_.wait(lock, [this] {
+    return num_to_send_ - num_to_get_ < static_cast<int32_t>(num_buffers_) ||
+           retrieval_failed_;
+  });
+  stats_.slot_wait += SecondsSince(start);
+  if (retrieval_failed_) {
+    throw std::runtime_error("Failed to retrieve encoded data");
+  }
+}
+
+// Hands every frame nvEncEncodePicture has released so far to the retrieval
+// thread. The queue holds at most num_buffers_ entries, so this never blocks.
+void NvEncoder::QueueCompleted() {
+  for (; num_queued_ < num_to_send_; num_queued_++) {
+    completed_->Push(num_queued_ % num_buffers_);
+  }
+}
@@ -0,0 +1,141 @@
+#ifndef NV_ENCODER_H
+#define NV_ENCODER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <nvEncodeAPI.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../common/bounded_queue.h"
+#include "encode_backend.h"
+
+#define NVENC_API_CALL(func)                                                   \
+  {                                                                            \
+    NVENCSTATUS status = (func);                                               \
+    if (status != NV_ENC_SUCCESS) {                                            \
+      std::cerr << "NVENC API call failed at " << __FILE__ << ":" << __LINE__  \
+                << " with error code " << status << " ("                       \
+                << GetNVEncErrorString(status) << ")" << std::endl;            \
+      exit(EXIT_FAILURE);                                                      \
+    }                                                                          \
+  }
+
+// Same check for the session setup, which throws instead so a caller can
+// fall back to another encoder
+#define NVENC_INIT_CALL(func)                                                  \
+  {                                                                            \
+    NVENCSTATUS status = (func);                                               \
+    if (status != NV_ENC_SUCCESS) {                                            \
+      throw std::runtime_error(std::string("NVENC API call failed at ") +     \
+                               __FILE__ + ":" + std::to_string(__LINE__) +     \
+                               " with error code " + std::to_string(status) +  \
+                               " (" + GetNVEncErrorString(status) + ")");      \
+    }                                                                          \
+  }
+
+std::string GetNVEncErrorString(NVENCSTATUS status);
+
+// The NVENC entry points and the device the session is opened on. Filled by
+// NvEncodeAPICreateInstance with a CUDA context on a GPU machine, or by
+// FillFakeNvEncodeApi to run the encoder pipeline on the CPU.
+struct NvEncodeApi {
+  NV_ENCODE_API_FUNCTION_LIST funcs;
+  void *device;
+  NV_ENC_DEVICE_TYPE deviceType;
+};
+
+struct NvEncoderOptions {
+  // Submit frames on the caller's thread and lock/write the bitstreams on a
+  // retrieval thread, instead of blocking in nvEncLockBitstream after every
+  // submitted frame.
+  bool pipelined = false;
+  // Log every frame and the initialize params
+  bool verbose = true;
+  // Replace the preset's rate control and GOP
+  EncodeSettings settings;
+};
+
+struct NvEncoderStats {
+  int64_t frames = 0;
+  int64_t bytes = 0;
+  double submit_time = 0;  // seconds in lock input, copy and encode picture
+  double lock_wait = 0;    // seconds blocked in nvEncLockBitstream
+  double write_time = 0;   // seconds writing the bitstreams
+  double slot_wait = 0;    // seconds the submitter waited for a free buffer
+};
+
+class NvEncoder {
+public:
+  NvEncoder(int width, int height, NV_ENC_BUFFER_FORMAT format, GUID codec,
+            const NvEncodeApi &api,
+            const NvEncoderOptions &options = NvEncoderOptions())
+      : width_(width), height_(height), format_(format), codec_(codec),
+        nvencFuncs_(api.funcs), device_(api.device),
+        deviceType_(api.deviceType), options_(options) {
+    // Throws std::runtime_error when the session cannot be set up
+    try {
+      Initialize();
+    } catch (...) {
+      Cleanup();
+      throw;
+    }
+  }
+
+  ~NvEncoder() { Cleanup(); }
+
+  void EncodeFrame(const uint8_t *frameData, std::ofstream &outputFile);
+  void GetEncodedData(std::ofstream &outputFile, bool outputdelay);
+  void FlushFrame(std::ofstream &outputFile);
+
+  NvEncoderStats Stats() const { return stats_; }
+
+private:
+  void Initialize();
+  void Cleanup();
+  void AllocateBuffers();
+  void WriteBitstream(int index, std::ofstream &outputFile);
+
+  // Pipelined mode
+  void StartRetrieval(std::ofstream &outputFile);
+  void StopRetrieval();
+  void RetrievalLoop(std::ofstream *outputFile);
+  void WaitForFreeBuffer();
+  void QueueCompleted();
+
+  int width_;
+  int height_;
+  NV_ENC_BUFFER_FORMAT format_;
+  GUID codec_;
+  void *nvencHandle_ = nullptr;
+  NV_ENCODE_API_FUNCTION_LIST nvencFuncs_;
+  void *device_;
+  NV_ENC_DEVICE_TYPE deviceType_;
+  NvEncoderOptions options_;
+  NV_ENC_INITIALIZE_PARAMS initializeParams_ = {0};
+  NV_ENC_CONFIG encodeConfig_ = {0};
+  std::vector<void *> inputSurfaces_;
+  std::vector<void *> outputBitstreams_;
+  uint32_t num_buffers_ = 0;
+  int32_t output_delay_ = 0;
+  int32_t num_to_send_ = 0;
+  int32_t num_to_get_ = 0;
+  NvEncoderStats stats_;
+
+  // Ring indices of submitted frames whose output nvEncEncodePicture has
+  // released, in submission order. A buffer goes back to the submitter when
+  // the retrieval thread has unlocked its bitstream (num_to_get_).
+  std::unique_ptr<BoundedQueue<int>> completed_;
+  std::thread retrieval_;
+  std::mutex buffer_mutex_;
+  std::condition_variable buffer_free_;
+  int32_t num_queued_ = 0;
+  bool retrieval_failed_ = false;
+};
+
+#endif
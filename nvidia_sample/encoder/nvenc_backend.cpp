@@ -0,0 +1,174 @@
+#include "nvenc_backend.h"
+
+#include <cstring>
+#include <dlfcn.h>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// The few CUDA driver API types used here, so the encoder builds without
+// the CUDA toolkit and links without libcuda
+typedef int CUresult;
+typedef int CUdevice;
+typedef struct CUctx_st *CUcontext;
+const CUresult kCudaSuccess = 0;
+
+typedef CUresult (*PCUINIT)(unsigned int);
+typedef CUresult (*PCUDEVICEGETCOUNT)(int *);
+typedef CUresult (*PCUDEVICEGET)(CUdevice *, int);
+typedef CUresult (*PCUCTXCREATE)(CUcontext *, unsigned int, CUdevice);
+typedef CUresult (*PCUCTXDESTROY)(CUcontext);
+typedef NVENCSTATUS(NVENCAPI *PNVENCODEAPICREATEINSTANCE)(
+    NV_ENCODE_API_FUNCTION_LIST *);
+typedef NVENCSTATUS(NVENCAPI *PNVENCODEAPIGETMAXSUPPORTEDVERSION)(
+    uint32_t *);
+
+template <typename T> bool LoadSymbol(void *library, const char *name, T *fn) {
+  *fn = reinterpret_cast<T>(dlsym(library, name));
+  return *fn != nullptr;
+}
+
+} // namespace
+
+struct NvencBackend::Driver {
+  ~Driver() {
+    if (context) {
+      cuCtxDestroy(context);
+    }
+    if (nvenc) {
+      dlclose(nvenc);
+    }
+    if (cuda) {
+      dlclose(cuda);
+    }
+  }
+
+  void *cuda = nullptr;
+  void *nvenc = nullptr;
+  PCUCTXDESTROY cuCtxDestroy = nullptr;
+  CUcontext context = nullptr;
+  NvEncodeApi api;
+};
+
+std::unique_ptr<NvencBackend>
+NvencBackend::Create(int width, int height, EncodeCodec codec,
+                     InputFormat format, const NvEncoderOptions &options,
+                     std::string *reason) {
+  std::unique_ptr<Driver> driver(new Driver);
+
+  driver->cuda = dlopen("libcuda.so.1", RTLD_LAZY);
+  if (!driver->cuda) {
+    *reason = "libcuda.so.1 not found";
+    return nullptr;
+  }
+  PCUINIT cuInit;
+  PCUDEVICEGETCOUNT cuDeviceGetCount;
+  PCUDEVICEGET cuDeviceGet;
+  PCUCTXCREATE cuCtxCreate;
+  if (!LoadSymbol(driver->cuda, "cuInit", &cuInit) ||
+      !LoadSymbol(driver->cuda, "cuDeviceGetCount", &cuDeviceGetCount) ||
+      !LoadSymbol(driver->cuda, "cuDeviceGet", &cuDeviceGet) ||
+      !LoadSymbol(driver->cuda, "cuCtxCreate_v2", &cuCtxCreate) ||
+      !LoadSymbol(driver->cuda, "cuCtxDestroy_v2", &driver->cuCtxDestroy)) {
+    *reason = "libcuda.so.1 lacks the driver API";
+    return nullptr;
+  }
+  int devices = 0;
+  if (cuInit(0) != kCudaSuccess ||
+      cuDeviceGetCount(&devices) != kCudaSuccess || devices == 0) {
+    *reason = "cuInit failed or no CUDA device";
+    return nullptr;
+  }
+  CUdevice device;
+  if (cuDeviceGet(&device, 0) != kCudaSuccess ||
+      cuCtxCreate(&driver->context, 0, device) != kCudaSuccess) {
+    *reason = "failed to create a CUDA context";
+    return nullptr;
+  }
+
+  driver->nvenc = dlopen("libnvidia-encode.so.1", RTLD_LAZY);
+  if (!driver->nvenc) {
+    *reason = "libnvidia-encode.so.1 not found";
+    return nullptr;
+  }
+  PNVENCODEAPIGETMAXSUPPORTEDVERSION getMaxSupportedVersion;
+  PNVENCODEAPICREATEINSTANCE createInstance;
+  if (!LoadSymbol(driver->nvenc, "NvEncodeAPIGetMaxSupportedVersion",
+                  &getMaxSupportedVersion) ||
+      !LoadSymbol(driver->nvenc, "NvEncodeAPICreateInstance",
+                  &createInstance)) {
+    *reason = "libnvidia-encode.so.1 lacks the NVENC entry points";
+    return nullptr;
+  }
+  uint32_t supported = 0;
+  uint32_t required = (NVENCAPI_MAJOR_VERSION << 4) | NVENCAPI_MINOR_VERSION;
+  if (getMaxSupportedVersion(&supported) != NV_ENC_SUCCESS ||
+      supported < required) {
+    *reason = "the driver is too old for this NVENC API version";
+    return nullptr;
+  }
+
+  NvEncodeApi &api = driver->api;
+  memset(&api.funcs, 0, sizeof(api.funcs));
+  api.funcs.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+  if (createInstance(&api.funcs) != NV_ENC_SUCCESS) {
+    *reason = "NvEncodeAPICreateInstance failed";
+    return nullptr;
+  }
+  api.device = driver->context;
+  api.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+
+  // Open a session up front to see that the GPU has a free NVENC session and
+  // supports the codec, for a clearer reason than NvEncoder's setup error
+  GUID codecGuid = codec == EncodeCodec::kHEVC ? NV_ENC_CODEC_HEVC_GUID
+                                               : NV_ENC_CODEC_H264_GUID;
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS sessionParams = {};
+  sessionParams.version = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+  sessionParams.device = api.device;
+  sessionParams.deviceType = api.deviceType;
+  sessionParams.apiVersion = NVENCAPI_VERSION;
+  void *session = nullptr;
+  if (api.funcs.nvEncOpenEncodeSessionEx(&sessionParams, &session) !=
+      NV_ENC_SUCCESS) {
+    *reason = "failed to open an NVENC session";
+    return nullptr;
+  }
+  uint32_t count = 0;
+  bool supportsCodec = false;
+  if (api.funcs.nvEncGetEncodeGUIDCount(session, &count) == NV_ENC_SUCCESS) {
+    std::vector<GUID> guids(count);
+    if (api.funcs.nvEncGetEncodeGUIDs(session, guids.data(), count,
+                                      &count) == NV_ENC_SUCCESS) {
+      for (uint32_t i = 0; i < count; ++i) {
+        supportsCodec = supportsCodec ||
+                        !memcmp(&guids[i], &codecGuid, sizeof(GUID));
+      }
+    }
+  }
+  api.funcs.nvEncDestroyEncoder(session);
+  if (!supportsCodec) {
+    *reason = "the GPU cannot encode this codec";
+    return nullptr;
+  }
+
+  std::unique_ptr<NvencBackend> backend(new NvencBackend(std::move(driver)));
+  NV_ENC_BUFFER_FORMAT bufferFormat = format == InputFormat::kIYUV
+                                          ? NV_ENC_BUFFER_FORMAT_IYUV
+                                          : NV_ENC_BUFFER_FORMAT_NV12;
+  try {
+    backend->encoder_.reset(new NvEncoder(width, height, bufferFormat,
+                                          codecGuid, backend->driver_->api,
+                                          options));
+  } catch (const std::runtime_error &e) {
+    *reason = e.what();
+    return nullptr;
+  }
+  return backend;
+}
+
+NvencBackend::NvencBackend(std::unique_ptr<Driver> driver)
+    : driver_(std::move(driver)) {}
+
+// The encoder goes before the context it runs on
+NvencBackend::~NvencBackend() { encoder_.reset(); }
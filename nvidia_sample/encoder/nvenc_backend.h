@@ -0,0 +1,42 @@
+#ifndef NVENC_BACKEND_H
+#define NVENC_BACKEND_H
+
+#include <memory>
+#include <string>
+#include "encode_backend.h"
+#include "nv_encoder.h"
+
+// NVENC through NvEncoder. libcuda and libnvidia-encode are loaded at run
+// time, so the binary also starts on hosts without an NVIDIA driver and the
+// CLI can fall back to a software backend there.
+class NvencBackend : public EncodeBackend {
+public:
+  // nullptr and the reason when the driver libraries are missing, cuInit or
+  // the context creation fail, or no session for the codec can be opened
+  static std::unique_ptr<NvencBackend>
+  Create(int width, int height, EncodeCodec codec, InputFormat format,
+         const NvEncoderOptions &options, std::string *reason);
+
+  ~NvencBackend() override;
+
+  std::string Name() const override { return "nvenc"; }
+  void EncodeFrame(const uint8_t *frameData,
+                   std::ofstream &outputFile) override {
+    encoder_->EncodeFrame(frameData, outputFile);
+  }
+  void Flush(std::ofstream &outputFile) override {
+    encoder_->FlushFrame(outputFile);
+  }
+  int64_t EncodedBytes() const override { return encoder_->Stats().bytes; }
+  NvEncoderStats Stats() const { return encoder_->Stats(); }
+
+private:
+  struct Driver;
+
+  explicit NvencBackend(std::unique_ptr<Driver> driver);
+
+  std::unique_ptr<Driver> driver_;
+  std::unique_ptr<NvEncoder> encoder_;
+};
+
+#endif
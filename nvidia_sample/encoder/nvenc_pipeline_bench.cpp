@@ -0,0 +1,190 @@
+// Runs NvEncoder against the fake NVENC function table, once serialized and
+// once pipelined, and checks that every frame came out once and in order.
+// Needs no GPU: the fake simulates the encode latency on the CPU.
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fake_nvenc.h"
+#include "nv_encoder.h"
+
+// Stream buffer standing in for a slow sink (disk, network): every write of
+// a bitstream takes at least write_us
+class SlowSink : public std::streambuf {
+public:
+  SlowSink(std::streambuf *sink, int write_us)
+      : sink_(sink), write_us_(write_us) {}
+
+protected:
+  std::streamsize xsputn(const char *data, std::streamsize size) override {
+    std::this_thread::sleep_for(std::chrono::microseconds(write_us_));
+    return sink_->sputn(data, size);
+  }
+  int_type overflow(int_type ch) override { return sink_->sputc(ch); }
+
+private:
+  std::streambuf *sink_;
+  int write_us_;
+};
+
+struct BenchResult {
+  double seconds;
+  NvEncoderStats stats;
+  FakeNvEncStats fake;
+};
+
+BenchResult RunEncoder(const FakeNvEncConfig &config, bool pipelined,
+                       int width, int height, int frames,
+                       const std::vector<std::vector<uint8_t>> &source,
+                       const std::string &outputPath, int write_us) {
+  FakeNvEncDevice device;
+  device.config = config;
+  NvEncodeApi api;
+  FillFakeNvEncodeApi(&device, &api);
+  NvEncoderOptions options;
+  options.pipelined = pipelined;
+  options.verbose = false;
+  options.settings.b_frames = config.frame_interval_p - 1;
+
+  std::ofstream output(outputPath, std::ios::binary);
+  SlowSink sink(output.rdbuf(), write_us);
+  if (write_us > 0) {
+    static_cast<std::ostream &>(output).rdbuf(&sink);
+  }
+  BenchResult result;
+  auto start = std::chrono::steady_clock::now();
+  {
+    NvEncoder encoder(width, height, NV_ENC_BUFFER_FORMAT_NV12,
+                      NV_ENC_CODEC_H264_GUID, api, options);
+    for (int i = 0; i < frames; ++i) {
+      encoder.EncodeFrame(source[i % source.size()].data(), output);
+    }
+    encoder.FlushFrame(output);
+    result.stats = encoder.Stats();
+  }
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result.fake = device.stats;
+  return result;
+}
+
+bool Report(const char *name, const BenchResult &result, int frames) {
+  const NvEncoderStats &stats = result.stats;
+  std::cout << name << ": " << frames / result.seconds << " fps, submit "
+            << stats.submit_time << " s, nvEncLockBitstream "
+            << stats.lock_wait << " s, write " << stats.write_time
+            << " s, waiting for a buffer " << stats.slot_wait << " s"
+            << std::endl;
+  bool ok = stats.frames == frames && result.fake.encoded == frames &&
+            result.fake.out_of_order_locks == 0 && result.fake.bad_calls == 0;
+  if (!ok) {
+    std::cerr << name << ": FAILED, " << result.fake.encoded << "/" << frames
+              << " frames retrieved, " << result.fake.out_of_order_locks
+              << " out of order, " << result.fake.bad_calls
+              << " invalid calls" << std::endl;
+  }
+  return ok;
+}
+
+void PrintUsage() {
+  std::cout << "Usage: nvenc_pipeline_bench [options]\n"
+            << "Options:\n"
+            << "  -n, --frames N         Frames to encode (300)\n"
+            << "  -w, --width WIDTH      Width (1920)\n"
+            << "  -h, --height HEIGHT    Height (1080)\n"
+            << "  -e, --encode-us US     Simulated encode time per frame (2000)\n"
+            << "  -b, --interval-p N     Simulated frameIntervalP (1)\n"
+            << "  -s, --write-us US      Simulated time per bitstream write (2000)\n"
+            << "  -o, --output FILE      Bitstream output (/dev/null)\n"
+            << "  --help                 Show this help message\n";
+}
+
+int main(int argc, char *argv[]) {
+  int frames = 300;
+  int width = 1920;
+  int height = 1080;
+  std::string outputPath = "/dev/null";
+  int write_us = 2000;
+  FakeNvEncConfig config;
+
+  static struct option long_options[] = {
+      {"frames", required_argument, nullptr, 'n'},
+      {"width", required_argument, nullptr, 'w'},
+      {"height", required_argument, nullptr, 'h'},
+      {"encode-us", required_argument, nullptr, 'e'},
+      {"interval-p", required_argument, nullptr, 'b'},
+      {"write-us", required_argument, nullptr, 's'},
+      {"output", required_argument, nullptr, 'o'},
+      {"help", no_argument, nullptr, 0},
+      {nullptr, 0, nullptr, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:w:h:e:b:s:o:", long_options,
+                            nullptr)) != -1) {
+    switch (opt) {
+    case 'n':
+      frames = std::stoi(optarg);
+      break;
+    case 'w':
+      width = std::stoi(optarg);
+      break;
+    case 'h':
+      height = std::stoi(optarg);
+      break;
+    case 'e':
+      config.encode_us = std::stoi(optarg);
+      break;
+    case 'b':
+      config.frame_interval_p = std::stoi(optarg);
+      break;
+    case 's':
+      write_us = std::stoi(optarg);
+      break;
+    case 'o':
+      outputPath = optarg;
+      break;
+    case 0:
+      PrintUsage();
+      return EXIT_SUCCESS;
+    default:
+      PrintUsage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (frames <= 0 || width <= 0 || height <= 0 || config.frame_interval_p < 1) {
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+
+  // A few distinct frames, so the copies do not all hit the same cache lines
+  std::vector<std::vector<uint8_t>> source(4);
+  for (size_t i = 0; i < source.size(); ++i) {
+    source[i].resize(width * height * 3 / 2);
+    for (size_t j = 0; j < source[i].size(); ++j) {
+      source[i][j] = static_cast<uint8_t>(j * 7 + i * 13);
+    }
+  }
+
+  std::cout << frames << " frames " << width << "x" << height << ", "
+            << config.encode_us << " us encode, " << write_us
+            << " us write, frameIntervalP "
+            << config.frame_interval_p << std::endl;
+  BenchResult serialized =
+      RunEncoder(config, false, width, height, frames, source, outputPath,
+                 write_us);
+  BenchResult pipelined =
+      RunEncoder(config, true, width, height, frames, source, outputPath,
+                 write_us);
+  bool ok = Report("serialized", serialized, frames);
+  ok = Report("pipelined ", pipelined, frames) && ok;
+  std::cout << "speedup: " << serialized.seconds / pipelined.seconds << "x"
+            << std::endl;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,248 @@
+// Checks the pitch-aware input upload on the CPU and times it against the
+// old path (read into a staging vector, one memcpy ignoring the pitch).
+//  1. CopyFrameToSurface with synthetic pitches: the visible pixels must
+//     match the packed source and the row padding must stay untouched.
+//  2. NvEncoder against the fake NVENC with padded surfaces: every frame
+//     the fake sees must match its source frame.
+//  3. 1080p and 4K upload throughput from a raw file for both paths.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "fake_nvenc.h"
+#include "frame_upload.h"
+#include "mapped_file.h"
+#include "nv_encoder.h"
+
+namespace {
+
+const uint8_t kGuard = 0xAA;
+
+typedef std::chrono::steady_clock Clock;
+
+void FillFrame(std::vector<uint8_t> &frame, uint32_t seed) {
+  for (size_t i = 0; i < frame.size(); ++i) {
+    seed = seed * 1664525 + 1013904223;
+    frame[i] = static_cast<uint8_t>(seed >> 24);
+  }
+}
+
+// The padding after each row of a plane must not have been written
+bool PaddingUntouched(const uint8_t *plane, uint32_t pitch, int row_bytes,
+                      int rows) {
+  for (int y = 0; y < rows; ++y) {
+    const uint8_t *row = plane + static_cast<size_t>(y) * pitch;
+    for (uint32_t x = row_bytes; x < pitch; ++x) {
+      if (row[x] != kGuard) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool CheckPitch(int width, int height, NV_ENC_BUFFER_FORMAT format,
+                uint32_t pitch) {
+  std::vector<uint8_t> src(FrameSize(width, height, format));
+  FillFrame(src, width * 31 + pitch);
+  std::vector<uint8_t> surface(static_cast<size_t>(pitch) * height * 3 / 2,
+                               kGuard);
+  CopyFrameToSurface(src.data(), width, height, format, surface.data(),
+                     pitch);
+
+  bool ok = FakeNvEncChecksum(surface.data(), pitch, width, height, format) ==
+            FakeNvEncChecksum(src.data(), width, width, height, format);
+  const uint8_t *chroma = surface.data() + static_cast<size_t>(pitch) * height;
+  uint32_t chroma_pitch = ChromaPitch(pitch, format);
+  ok = ok && PaddingUntouched(surface.data(), pitch, width, height);
+  if (format == NV_ENC_BUFFER_FORMAT_IYUV) {
+    ok = ok && PaddingUntouched(chroma, chroma_pitch, width / 2, height);
+  } else {
+    ok = ok && PaddingUntouched(chroma, chroma_pitch, width, height / 2);
+  }
+  if (!ok) {
+    std::cerr << "FAILED: " << width << "x" << height
+              << (format == NV_ENC_BUFFER_FORMAT_IYUV ? " iyuv" : " nv12")
+              << " pitch " << pitch << std::endl;
+  }
+  return ok;
+}
+
+bool CheckPitches() {
+  const int sizes[][2] = {{64, 36}, {1280, 720}, {1920, 1080}, {720, 480}};
+  const NV_ENC_BUFFER_FORMAT formats[] = {NV_ENC_BUFFER_FORMAT_NV12,
+                                          NV_ENC_BUFFER_FORMAT_IYUV};
+  int cases = 0;
+  bool ok = true;
+  for (const auto &size : sizes) {
+    int width = size[0];
+    uint32_t pitches[] = {static_cast<uint32_t>(width),
+                          static_cast<uint32_t>(width + 2),
+                          static_cast<uint32_t>((width + 255) / 256 * 256),
+                          static_cast<uint32_t>(width * 2)};
+    for (NV_ENC_BUFFER_FORMAT format : formats) {
+      for (uint32_t pitch : pitches) {
+        ok = CheckPitch(width, size[1], format, pitch) && ok;
+        cases++;
+      }
+    }
+  }
+  std::cout << "synthetic pitches: " << cases << " cases "
+            << (ok ? "ok" : "FAILED") << std::endl;
+  return ok;
+}
+
+bool CheckEncoder(NV_ENC_BUFFER_FORMAT format, int pitch_align) {
+  const int width = 1280;
+  const int height = 720;
+  const int frames = 8;
+  std::vector<std::vector<uint8_t>> source(frames);
+  for (int i = 0; i < frames; ++i) {
+    source[i].resize(FrameSize(width, height, format));
+    FillFrame(source[i], i + 1);
+  }
+
+  FakeNvEncDevice device;
+  device.config.encode_us = 0;
+  device.config.pitch_align = pitch_align;
+  device.config.checksum = true;
+  NvEncodeApi api;
+  FillFakeNvEncodeApi(&device, &api);
+  NvEncoderOptions options;
+  options.verbose = false;
+  std::ofstream output("/dev/null", std::ios::binary);
+  {
+    NvEncoder encoder(width, height, format, NV_ENC_CODEC_H264_GUID, api,
+                      options);
+    for (int i = 0; i < frames; ++i) {
+      encoder.EncodeFrame(source[i].data(), output);
+    }
+    encoder.FlushFrame(output);
+  }
+
+  int bad = 0;
+  for (int i = 0; i < frames; ++i) {
+    uint32_t expected =
+        FakeNvEncChecksum(source[i].data(), width, width, height, format);
+    if (i >= static_cast<int>(device.stats.checksums.size()) ||
+        device.stats.checksums[i] != expected) {
+      bad++;
+    }
+  }
+  std::cout << "encoder upload, "
+            << (format == NV_ENC_BUFFER_FORMAT_IYUV ? "iyuv" : "nv12")
+            << " pitch aligned to " << pitch_align << ": "
+            << (bad ? "FAILED" : "ok") << " (" << frames - bad << "/"
+            << frames << " frames match)" << std::endl;
+  return bad == 0;
+}
+
+double Seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Upload throughput of one resolution. The file stays in the page cache, so
+// this measures the copies, not the disk.
+void BenchUpload(int width, int height, int frames, int passes) {
+  NV_ENC_BUFFER_FORMAT format = NV_ENC_BUFFER_FORMAT_NV12;
+  size_t frameSize = FrameSize(width, height, format);
+  char path[] = "/tmp/nvenc_upload_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    std::cerr << "Failed to create a temporary file" << std::endl;
+    return;
+  }
+  close(fd);
+  {
+    std::vector<uint8_t> frame(frameSize);
+    std::ofstream file(path, std::ios::binary);
+    for (int i = 0; i < frames; ++i) {
+      FillFrame(frame, i);
+      file.write(reinterpret_cast<const char *>(frame.data()), frame.size());
+    }
+  }
+
+  // next multiple of 256 above the width, so the rows never line up
+  uint32_t padded = (width / 256 + 1) * 256;
+  std::vector<uint8_t> surface(static_cast<size_t>(padded) * height * 3 / 2);
+  double staged = 0;
+  double mapped = 0;
+  double mappedPadded = 0;
+  for (int pass = 0; pass < passes; ++pass) {
+    // old path: read into a staging vector, one memcpy into the surface
+    Clock::time_point start = Clock::now();
+    {
+      std::ifstream file(path, std::ios::binary);
+      std::vector<uint8_t> frameData(frameSize);
+      while (file.read(reinterpret_cast<char *>(frameData.data()),
+                       frameData.size())) {
+        memcpy(surface.data(), frameData.data(), frameSize);
+      }
+    }
+    staged += Seconds(start);
+
+    // new path, surface pitch == width: one memcpy from the mapping
+    start = Clock::now();
+    {
+      MappedFile input;
+      input.Open(path);
+      for (size_t offset = 0; offset + frameSize <= input.Size();
+           offset += frameSize) {
+        CopyFrameToSurface(input.Data() + offset, width, height, format,
+                           surface.data(), width);
+      }
+    }
+    mapped += Seconds(start);
+
+    // new path, padded surface: row by row from the mapping
+    start = Clock::now();
+    {
+      MappedFile input;
+      input.Open(path);
+      for (size_t offset = 0; offset + frameSize <= input.Size();
+           offset += frameSize) {
+        CopyFrameToSurface(input.Data() + offset, width, height, format,
+                           surface.data(), padded);
+      }
+    }
+    mappedPadded += Seconds(start);
+  }
+  unlink(path);
+
+  int total = frames * passes;
+  double gb = static_cast<double>(frameSize) * total / 1e9;
+  std::cout << width << "x" << height << " nv12, " << total << " frames\n"
+            << "  read + memcpy (old):     " << staged * 1000 / total
+            << " ms/frame, " << gb / staged << " GB/s\n"
+            << "  mmap, pitch = width:     " << mapped * 1000 / total
+            << " ms/frame, " << gb / mapped << " GB/s\n"
+            << "  mmap, pitch " << padded << " rows: "
+            << mappedPadded * 1000 / total << " ms/frame, "
+            << gb / mappedPadded << " GB/s" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int passes = argc > 1 ? atoi(argv[1]) : 3;
+  if (passes <= 0) {
+    std::cout << "Usage: upload_bench [passes]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  bool ok = CheckPitches();
+  ok = CheckEncoder(NV_ENC_BUFFER_FORMAT_NV12, 1) && ok;
+  ok = CheckEncoder(NV_ENC_BUFFER_FORMAT_NV12, 256) && ok;
+  ok = CheckEncoder(NV_ENC_BUFFER_FORMAT_IYUV, 256) && ok;
+
+  BenchUpload(1920, 1080, 16, passes);
+  BenchUpload(3840, 2160, 8, passes);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
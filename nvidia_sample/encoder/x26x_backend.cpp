@@ -0,0 +1,171 @@
+#include "x26x_backend.h"
+
+#include <iostream>
+#include <stdexcept>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+}
+
+namespace {
+
+// Roughly NVENC P3 speed and quality on a few cores
+const char *kPreset = "fast";
+
+bool SupportsPixelFormat(const AVCodec *codec, AVPixelFormat format) {
+  if (!codec->pix_fmts) {
+    return false;
+  }
+  for (const AVPixelFormat *p = codec->pix_fmts; *p != AV_PIX_FMT_NONE; ++p) {
+    if (*p == format) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string ErrorString(int error) {
+  char buffer[AV_ERROR_MAX_STRING_SIZE] = {0};
+  av_strerror(error, buffer, sizeof(buffer));
+  return buffer;
+}
+
+} // namespace
+
+std::unique_ptr<X26xBackend>
+X26xBackend::Create(int width, int height, EncodeCodec codec,
+                    InputFormat format, EncodeSettings settings,
+                    std::string *reason) {
+  const char *name = codec == EncodeCodec::kHEVC ? "libx265" : "libx264";
+  const AVCodec *encoder = avcodec_find_encoder_by_name(name);
+  if (!encoder) {
+    *reason = std::string("libavcodec was built without ") + name;
+    return nullptr;
+  }
+  settings.Resolve(width, height);
+
+  std::unique_ptr<X26xBackend> backend(new X26xBackend);
+  backend->name_ = name;
+  backend->width_ = width;
+  backend->height_ = height;
+  backend->format_ = format;
+  AVCodecContext *context = avcodec_alloc_context3(encoder);
+  backend->context_ = context;
+  context->width = width;
+  context->height = height;
+  // NV12 input stays NV12 where the encoder takes it (libx264), otherwise
+  // the chroma is split into planes on the way in
+  context->pix_fmt =
+      format == InputFormat::kNV12 &&
+              SupportsPixelFormat(encoder, AV_PIX_FMT_NV12)
+          ? AV_PIX_FMT_NV12
+          : AV_PIX_FMT_YUV420P;
+  context->time_base = AVRational{1, settings.fps};
+  context->framerate = AVRational{settings.fps, 1};
+  context->gop_size = settings.gop_length;
+  context->keyint_min = settings.gop_length;
+  context->max_b_frames = settings.b_frames;
+  context->bit_rate = static_cast<int64_t>(settings.bitrate_kbps) * 1000;
+  context->rc_max_rate = static_cast<int64_t>(settings.max_bitrate_kbps) * 1000;
+  context->rc_buffer_size = settings.max_bitrate_kbps * 1000;
+  context->rc_initial_buffer_occupancy = context->rc_buffer_size;
+  context->thread_count = 0;
+
+  AVDictionary *param = nullptr;
+  av_dict_set(&param, "preset", kPreset, 0);
+  if (codec == EncodeCodec::kHEVC) {
+    av_dict_set(&param, "x265-params",
+                "scenecut=0:open-gop=0:log-level=error", 0);
+  } else {
+    av_dict_set(&param, "x264-params", "scenecut=0:open-gop=0", 0);
+  }
+  int ret = avcodec_open2(context, encoder, &param);
+  av_dict_free(&param);
+  if (ret < 0) {
+    *reason = std::string("failed to open ") + name + ": " + ErrorString(ret);
+    return nullptr;
+  }
+
+  backend->frame_ = av_frame_alloc();
+  backend->frame_->format = context->pix_fmt;
+  backend->frame_->width = width;
+  backend->frame_->height = height;
+  backend->packet_ = av_packet_alloc();
+  if (av_frame_get_buffer(backend->frame_, 0) < 0 || !backend->packet_) {
+    *reason = "failed to allocate the frame";
+    return nullptr;
+  }
+  return backend;
+}
+
+X26xBackend::~X26xBackend() {
+  av_packet_free(&packet_);
+  av_frame_free(&frame_);
+  avcodec_free_context(&context_);
+}
+
+void X26xBackend::EncodeFrame(const uint8_t *frameData,
+                              std::ofstream &outputFile) {
+  if (av_frame_make_writable(frame_) < 0) {
+    throw std::runtime_error("Failed to make the frame writable");
+  }
+  const uint8_t *chroma = frameData + static_cast<size_t>(width_) * height_;
+  int chromaWidth = width_ / 2;
+  int chromaHeight = height_ / 2;
+  av_image_copy_plane(frame_->data[0], frame_->linesize[0], frameData,
+                      width_, width_, height_);
+  if (frame_->format == AV_PIX_FMT_NV12) {
+    av_image_copy_plane(frame_->data[1], frame_->linesize[1], chroma, width_,
+                        width_, chromaHeight);
+  } else if (format_ == InputFormat::kIYUV) {
+    size_t planeSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+    av_image_copy_plane(frame_->data[1], frame_->linesize[1], chroma,
+                        chromaWidth, chromaWidth, chromaHeight);
+    av_image_copy_plane(frame_->data[2], frame_->linesize[2],
+                        chroma + planeSize, chromaWidth, chromaWidth,
+                        chromaHeight);
+  } else {
+    // NV12 into an encoder that only takes planar 4:2:0
+    for (int y = 0; y < chromaHeight; ++y) {
+      const uint8_t *uv = chroma + static_cast<size_t>(y) * width_;
+      uint8_t *u = frame_->data[1] + y * frame_->linesize[1];
+      uint8_t *v = frame_->data[2] + y * frame_->linesize[2];
+      for (int x = 0; x < chromaWidth; ++x) {
+        u[x] = uv[2 * x];
+        v[x] = uv[2 * x + 1];
+      }
+    }
+  }
+  frame_->pts = pts_++;
+  Send(frame_, outputFile);
+}
+
+void X26xBackend::Flush(std::ofstream &outputFile) {
+  Send(nullptr, outputFile);
+}
+
+void X26xBackend::Send(const AVFrame *frame, std::ofstream &outputFile) {
+  int ret = avcodec_send_frame(context_, frame);
+  if (ret < 0) {
+    std::cerr << "Error: Failed to encode frame: " << ErrorString(ret)
+              << std::endl;
+    throw std::runtime_error("Failed to encode frame");
+  }
+  while ((ret = avcodec_receive_packet(context_, packet_)) == 0) {
+    outputFile.write(reinterpret_cast<const char *>(packet_->data),
+                     packet_->size);
+    bytes_ += packet_->size;
+    av_packet_unref(packet_);
+    if (!outputFile.good()) {
+      std::cerr << "Error: Failed to write to output file" << std::endl;
+      throw std::runtime_error("Failed to write to output file");
+    }
+  }
+  if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+    std::cerr << "Error: Failed to receive packet: " << ErrorString(ret)
+              << std::endl;
+    throw std::runtime_error("Failed to receive packet");
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef X26X_BACKEND_H
+#define X26X_BACKEND_H
+
+#include <memory>
+#include <string>
+#include "encode_backend.h"
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+
+// Software fallback: libx264 for H.264, libx265 for HEVC, through
+// libavcodec. Configured from the same EncodeSettings as NVENC: VBR with the
+// same VBV, fixed closed GOP with IDR frames at gop_length, scene cut off.
+class X26xBackend : public EncodeBackend {
+public:
+  // nullptr and the reason when libavcodec lacks the encoder or rejects the
+  // settings
+  static std::unique_ptr<X26xBackend>
+  Create(int width, int height, EncodeCodec codec, InputFormat format,
+         EncodeSettings settings, std::string *reason);
+
+  ~X26xBackend() override;
+
+  std::string Name() const override { return name_; }
+  void EncodeFrame(const uint8_t *frameData,
+                   std::ofstream &outputFile) override;
+  void Flush(std::ofstream &outputFile) override;
+  int64_t EncodedBytes() const override { return bytes_; }
+
+private:
+  X26xBackend() = default;
+  void Send(const AVFrame *frame, std::ofstream &outputFile);
+
+  std::string name_;
+  int width_ = 0;
+  int height_ = 0;
+  InputFormat format_ = InputFormat::kNV12;
+  AVCodecContext *context_ = nullptr;
+  AVFrame *frame_ = nullptr;
+  AVPacket *packet_ = nullptr;
+  int64_t pts_ = 0;
+  int64_t bytes_ = 0;
+};
+
+#endif